@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// bandrender.cpp - Streams large frames to disk a band at a time
+
+#include <cerrno>
+#include <cstring>
+#include <pthread.h>
+#include "bandrender.h"
+#include "image.h"
+#include "timer.h"
+#include "trace.h"
+
+// the two band buffers, shared by the drawing and writer threads
+struct BandQueue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+
+	std::vector <unsigned char> buffers[2];
+	int rows[2];
+	bool full[2];
+	// no more bands will be drawn; the writer failed
+	bool done;
+	bool failed;
+
+	StripedImageWriter *writer;
+	double write_seconds;
+};
+
+// writes the bands in order as they fill up
+static void *
+band_writer_main(void *arg)
+{
+	BandQueue *queue = (BandQueue *)arg;
+
+	Trace::SetThreadName("band writer");
+
+	for(int next = 0; ; next ^= 1) {
+		pthread_mutex_lock(&queue->lock);
+		while(!queue->full[next] && !queue->done)
+			pthread_cond_wait(&queue->cond, &queue->lock);
+		bool have_band = queue->full[next];
+		pthread_mutex_unlock(&queue->lock);
+		if(!have_band)
+			break;
+
+		double start = timer_seconds();
+		bool ok = queue->writer->WriteRows(&queue->buffers[next][0], queue->rows[next]);
+		double seconds = timer_seconds() - start;
+
+		pthread_mutex_lock(&queue->lock);
+		queue->write_seconds += seconds;
+		queue->full[next] = false;
+		if(!ok)
+			queue->failed = true;
+		pthread_cond_broadcast(&queue->cond);
+		pthread_mutex_unlock(&queue->lock);
+
+		if(!ok)
+			break;
+	}
+
+	return NULL;
+}
+
+/*
+ * BandRenderer class
+ */
+BandRenderer::BandRenderer(RayTracer *raytracer_arg)
+{
+	raytracer = raytracer_arg;
+	band_rows = 0;
+	buffer_bytes = DEFAULT_BUFFER_BYTES;
+	memset(&stats, 0, sizeof(stats));
+}
+
+// bands are whole rows of tiles where the budget allows
+int
+BandRenderer::PickBandRows(int width, int height) const
+{
+	int rows = band_rows;
+	if(rows <= 0) {
+		size_t fit = buffer_bytes / ((size_t)width * 4 * 2);
+		rows = (fit < (size_t)height) ? (int)fit : height;
+
+		int tile_size = raytracer->GetTileSize();
+		if(rows > tile_size)
+			rows -= rows % tile_size;
+	}
+
+	if(rows > height)
+		rows = height;
+
+	return (rows > 0) ? rows : 1;
+}
+
+bool
+BandRenderer::Render(const char *filename, int virtual_width, int virtual_height, const RayTracer::TileRect &region,
+                     std::string *error)
+{
+	double start = timer_seconds();
+	memset(&stats, 0, sizeof(stats));
+
+	int width = region.x1 - region.x0;
+	int height = region.y1 - region.y0;
+	if(region.x0 < 0 || region.y0 < 0 || region.x1 > virtual_width || region.y1 > virtual_height ||
+	   width <= 0 || height <= 0) {
+		if(error)
+			*error = "region outside the frame";
+		return false;
+	}
+
+	StripedImageWriter writer;
+	if(!writer.Open(filename, width, height)) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	int rows = PickBandRows(width, height);
+	stats.band_rows = rows;
+
+	BandQueue queue;
+	pthread_mutex_init(&queue.lock, NULL);
+	pthread_cond_init(&queue.cond, NULL);
+	for(int i = 0; i < 2; i++) {
+		queue.buffers[i].resize((size_t)width * rows * 4);
+		queue.rows[i] = 0;
+		queue.full[i] = false;
+	}
+	queue.done = false;
+	queue.failed = false;
+	queue.writer = &writer;
+	queue.write_seconds = 0.0;
+	stats.buffer_bytes = queue.buffers[0].size() * 2;
+
+	pthread_t thread;
+	bool threaded = pthread_create(&thread, NULL, band_writer_main, &queue) == 0;
+
+	RayTracer::FrameWindow window;
+	window.virtual_width = virtual_width;
+	window.virtual_height = virtual_height;
+	window.x0 = region.x0;
+
+	bool failed = false;
+	for(int y = region.y0, band = 0; y < region.y1; y += rows, band ^= 1) {
+		int count = (y + rows < region.y1) ? rows : region.y1 - y;
+
+		double wait = timer_seconds();
+		{
+			TRACE_SCOPE(trace, "wait for writer", "output");
+			pthread_mutex_lock(&queue.lock);
+			while(threaded && queue.full[band] && !queue.failed)
+				pthread_cond_wait(&queue.cond, &queue.lock);
+			failed = queue.failed;
+			pthread_mutex_unlock(&queue.lock);
+		}
+		stats.stall_seconds += timer_seconds() - wait;
+		if(failed)
+			break;
+
+		window.y0 = y;
+		raytracer->DrawWindow(&queue.buffers[band][0], width, count, window);
+		stats.draw_seconds += raytracer->GetFrameStats().draw_seconds;
+		stats.rays += raytracer->GetFrameStats().rays;
+		stats.bands++;
+
+		if(!threaded) {
+			double write_start = timer_seconds();
+			failed = !writer.WriteRows(&queue.buffers[band][0], count);
+			queue.write_seconds += timer_seconds() - write_start;
+			if(failed)
+				break;
+			continue;
+		}
+
+		pthread_mutex_lock(&queue.lock);
+		queue.rows[band] = count;
+		queue.full[band] = true;
+		pthread_cond_broadcast(&queue.cond);
+		pthread_mutex_unlock(&queue.lock);
+	}
+
+	if(threaded) {
+		pthread_mutex_lock(&queue.lock);
+		queue.done = true;
+		pthread_cond_broadcast(&queue.cond);
+		pthread_mutex_unlock(&queue.lock);
+		pthread_join(thread, NULL);
+		failed = failed || queue.failed;
+	}
+
+	pthread_cond_destroy(&queue.cond);
+	pthread_mutex_destroy(&queue.lock);
+
+	stats.write_seconds = queue.write_seconds;
+	if(!writer.Close() || failed) {
+		if(error)
+			*error = "error writing the image";
+		failed = true;
+	}
+	stats.total_seconds = timer_seconds() - start;
+
+	return !failed;
+}
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BANDRENDER_H__
+#define __BANDRENDER_H__
+
+#include <cstddef>
+#include <string>
+#include "raytracer.h"
+
+/*
+ * Renders frames too large to hold in memory straight to an image file,
+ * one band of rows at a time. Two band buffers are kept: while one is
+ * being drawn, a writer thread encodes and writes the other, so disk
+ * output overlaps rendering. Any rectangle of the frame can be rendered
+ * on its own, as a crop, with exactly the pixels it has in the full
+ * frame.
+ */
+class BandRenderer {
+	public:
+		struct Stats {
+			int bands;
+			int band_rows;
+			// the two band buffers; encoding and antialiasing use a
+			// few more band-sized buffers
+			size_t buffer_bytes;
+			unsigned long rays;
+			double draw_seconds;
+			// time the writer thread spent encoding and writing, and
+			// time drawing waited on it for a free buffer
+			double write_seconds;
+			double stall_seconds;
+			double total_seconds;
+		};
+
+		enum { DEFAULT_BUFFER_BYTES = 128 << 20 };
+
+	protected:
+		RayTracer *raytracer;
+		int band_rows;
+		size_t buffer_bytes;
+		Stats stats;
+
+		int PickBandRows(int width, int height) const;
+
+	public:
+		// draws with raytracer and its settings
+		BandRenderer(RayTracer *raytracer_arg);
+
+		// rows per band; 0, the default, fits both band buffers in
+		// the buffer budget
+		inline void SetBandRows(int band_rows_arg) { band_rows = band_rows_arg; }
+		inline void SetBufferBudget(size_t bytes) { buffer_bytes = bytes; }
+
+		// writes the region of a virtual_width x virtual_height frame
+		// to filename, in the format picked by its extension (.png, or
+		// else PPM); the image has the region's size
+		bool Render(const char *filename, int virtual_width, int virtual_height, const RayTracer::TileRect &region,
+		            std::string *error);
+
+		// statistics from the most recent call to Render()
+		inline const Stats &GetStats() const { return stats; }
+
+	private:
+		BandRenderer(const BandRenderer &);
+		BandRenderer &operator = (const BandRenderer &);
+};
+
+#endif /* __BANDRENDER_H__ */
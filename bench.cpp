@@ -0,0 +1,682 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// bench.cpp - Reproducible renderer benchmark with JSON output
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "raytracer.h"
+#include "scalarmath.h"
+#include "scenegen.h"
+#include "spherestore.h"
+#include "timer.h"
+
+struct BenchOptions {
+	std::vector <int> scenes;
+	std::vector <unsigned int> counts;
+	std::vector <int> widths;
+	std::vector <int> heights;
+	unsigned int threads;
+	int packet_size;
+	bool wavefront;
+	int aa_rate;
+	bool shadows;
+	Scene::Termination termination;
+	bool specialized;
+	int repeats;
+	unsigned int seed;
+	int kernel_iterations;
+	int incremental_frames;
+	const char *output;
+};
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [options]\n", progname);
+	fprintf(stderr, "  -s LIST   scene types (default grid,cloud,reflective)\n");
+	fprintf(stderr, "  -n LIST   sphere counts (default 10,100,1000,10000,100000,1000000)\n");
+	fprintf(stderr, "  -r LIST   resolutions (default 320x240,640x480)\n");
+	fprintf(stderr, "  -t N      render threads (default: one per CPU)\n");
+	fprintf(stderr, "  -p N      primary ray packet size (default 1)\n");
+	fprintf(stderr, "  -m MODE   reflection shading: recursive or wavefront (default recursive)\n");
+	fprintf(stderr, "  -a RATE   adaptive antialiasing rate: 1 (off), 4, 16 or 64 (default 1)\n");
+	fprintf(stderr, "  -S on|off trace shadow rays (default off)\n");
+	fprintf(stderr, "  -T POLICY reflection termination: depth, throughput or roulette (default depth);\n");
+	fprintf(stderr, "            with a policy, each frame is drawn with the depth cutoff too, to\n");
+	fprintf(stderr, "            report the reflection rays saved and the pixels that differ\n");
+	fprintf(stderr, "  -K KIND   tile kernels: specialized or generic (default specialized)\n");
+	fprintf(stderr, "  -k N      renders per configuration; the median is reported (default 3)\n");
+	fprintf(stderr, "  -e N      scene seed (default 1)\n");
+	fprintf(stderr, "  -d N      also time N incremental frames, moving one sphere per frame\n");
+	fprintf(stderr, "  -u N      run the kernel microbenchmarks N times instead of rendering, timing\n");
+	fprintf(stderr, "            the scalar reference versions alongside\n");
+	fprintf(stderr, "  -o FILE   write JSON to FILE instead of stdout\n");
+}
+
+// splits a comma-separated list in place
+static std::vector <char *>
+split_list(char *list)
+{
+	std::vector <char *> items;
+
+	for(char *item = strtok(list, ","); item; item = strtok(NULL, ","))
+		items.push_back(item);
+
+	return items;
+}
+
+static bool
+parse_options(int argc, char *argv[], BenchOptions *options)
+{
+	char default_scenes[] = "grid,cloud,reflective";
+	char default_counts[] = "10,100,1000,10000,100000,1000000";
+	char default_resolutions[] = "320x240,640x480";
+	char *scenes = default_scenes;
+	char *counts = default_counts;
+	char *resolutions = default_resolutions;
+
+	options->threads = 0;
+	options->packet_size = 1;
+	options->wavefront = false;
+	options->aa_rate = 1;
+	options->shadows = false;
+	options->termination = Scene::TERMINATE_DEPTH;
+	options->specialized = true;
+	options->repeats = 3;
+	options->seed = 1;
+	options->kernel_iterations = 0;
+	options->incremental_frames = 0;
+	options->output = NULL;
+
+	for(int i = 1; i < argc; i++) {
+		if(argv[i][0] != '-' || strlen(argv[i]) != 2 || i + 1 >= argc)
+			return false;
+
+		char *arg = argv[++i];
+		switch(argv[i - 1][1]) {
+			default:
+				return false;
+			case 's':
+				scenes = arg;
+				break;
+			case 'n':
+				counts = arg;
+				break;
+			case 'r':
+				resolutions = arg;
+				break;
+			case 't':
+				options->threads = (unsigned int)atoi(arg);
+				break;
+			case 'p':
+				options->packet_size = atoi(arg);
+				break;
+			case 'm':
+				if(strcmp(arg, "wavefront") == 0)
+					options->wavefront = true;
+				else if(strcmp(arg, "recursive") == 0)
+					options->wavefront = false;
+				else
+					return false;
+				break;
+			case 'a':
+				options->aa_rate = atoi(arg);
+				break;
+			case 'S':
+				if(strcmp(arg, "on") == 0)
+					options->shadows = true;
+				else if(strcmp(arg, "off") == 0)
+					options->shadows = false;
+				else
+					return false;
+				break;
+			case 'T':
+				if(!Scene::ParseTermination(arg, options->termination))
+					return false;
+				break;
+			case 'K':
+				if(strcmp(arg, "specialized") == 0)
+					options->specialized = true;
+				else if(strcmp(arg, "generic") == 0)
+					options->specialized = false;
+				else
+					return false;
+				break;
+			case 'k':
+				options->repeats = atoi(arg);
+				break;
+			case 'e':
+				options->seed = (unsigned int)atoi(arg);
+				break;
+			case 'd':
+				options->incremental_frames = atoi(arg);
+				break;
+			case 'u':
+				options->kernel_iterations = atoi(arg);
+				break;
+			case 'o':
+				options->output = arg;
+				break;
+		}
+	}
+
+	std::vector <char *> items = split_list(scenes);
+	for(unsigned int i = 0; i < items.size(); i++) {
+		int type = scene_type_from_name(items[i]);
+		if(type < 0) {
+			fprintf(stderr, "unknown scene type '%s'\n", items[i]);
+			return false;
+		}
+		options->scenes.push_back(type);
+	}
+
+	items = split_list(counts);
+	for(unsigned int i = 0; i < items.size(); i++)
+		options->counts.push_back((unsigned int)atoi(items[i]));
+
+	items = split_list(resolutions);
+	for(unsigned int i = 0; i < items.size(); i++) {
+		int w, h;
+		if(sscanf(items[i], "%dx%d", &w, &h) != 2 || w <= 0 || h <= 0) {
+			fprintf(stderr, "bad resolution '%s'\n", items[i]);
+			return false;
+		}
+		options->widths.push_back(w);
+		options->heights.push_back(h);
+	}
+
+	if(options->repeats < 1)
+		options->repeats = 1;
+
+	return !options->scenes.empty() && !options->counts.empty() && !options->widths.empty();
+}
+
+static double
+per_second(double count, double seconds)
+{
+	return (seconds > 0.0) ? count / seconds : 0.0;
+}
+
+static double
+per_ray(unsigned long count, unsigned long rays)
+{
+	return (rays > 0) ? (double)count / (double)rays : 0.0;
+}
+
+/*
+ * Moves one sphere per frame by half its radius and redraws with
+ * DrawIncremental(), starting from a full incremental frame. The spheres
+ * are put back and the scene rebuilt afterwards.
+ */
+static void
+time_incremental(Scene &scene, RayTracer &raytracer, unsigned char *framebuf, int width, int height,
+                 int frames, double &frame_seconds, double &reused_fraction)
+{
+	raytracer.DrawIncremental(framebuf, width, height);
+
+	const std::vector <Object *> &objects = scene.GetObjects();
+	std::vector <Vector> origins;
+	for(unsigned int i = 0; i < objects.size(); i++)
+		origins.push_back(objects[i]->GetOrigin());
+
+	double seconds = 0.0;
+	unsigned long reused = 0, pixels = 0;
+	for(int k = 0; k < frames; k++) {
+		Sphere *sphere = dynamic_cast <Sphere *> (objects[((unsigned int)k * 7919u) % objects.size()]);
+		if(sphere) {
+			Vector origin = sphere->GetOrigin();
+			origin.vec[0] += sphere->GetRadius() * 0.5f;
+			sphere->SetOrigin(origin);
+		}
+
+		raytracer.DrawIncremental(framebuf, width, height);
+		const RayTracer::FrameStats &stats = raytracer.GetFrameStats();
+		seconds += stats.draw_seconds;
+		reused += stats.reused_pixels;
+		pixels += stats.reused_pixels + stats.primary_rays;
+	}
+
+	for(unsigned int i = 0; i < objects.size(); i++)
+		objects[i]->SetOrigin(origins[i]);
+	scene.Build();
+
+	frame_seconds = seconds / frames;
+	reused_fraction = (double)reused / (double)pixels;
+}
+
+/*
+ * Draws the frame again with the fixed depth cutoff, to weigh the rays a
+ * termination policy saves against how far its pixels drift. The frame
+ * drawn with the policy is in policy. The scene's policy is put back.
+ */
+static void
+compare_termination(Scene &scene, RayTracer &raytracer, const unsigned char *policy, int width, int height,
+                    unsigned long &depth_secondary, unsigned long &differ, int &max_step)
+{
+	Scene::Termination termination = scene.GetTermination();
+	std::vector <unsigned char> fixed((size_t)width * height * 4);
+
+	scene.SetTermination(Scene::TERMINATE_DEPTH);
+	raytracer.Draw(&fixed[0], width, height);
+	const RayTracer::FrameStats &stats = raytracer.GetFrameStats();
+	depth_secondary = stats.rays - stats.primary_rays - stats.aa_rays;
+	scene.SetTermination(termination);
+
+	differ = 0;
+	max_step = 0;
+	for(size_t i = 0; i < fixed.size(); i += 4) {
+		bool pixel_differs = false;
+		for(int c = 0; c < 3; c++) {
+			int d = abs((int)fixed[i + c] - (int)policy[i + c]);
+			if(d > max_step)
+				max_step = d;
+			pixel_differs = pixel_differs || d > 0;
+		}
+		differ += pixel_differs;
+	}
+}
+
+/*
+ * Kernel microbenchmarks: the Vector heavy code paths timed in isolation
+ * on fixed inputs, reported in nanoseconds per call. Where the kernel has
+ * a ScalarVector version, that is timed on the same inputs as the
+ * baseline; its checksum should match.
+ */
+const unsigned int KERNEL_INPUTS = 4096;
+
+static float
+bench_random(unsigned int &state)
+{
+	state = state * 1664525u + 1013904223u;
+
+	return (float)(state >> 8) / 16777216.0f;
+}
+
+static void
+print_kernel(FILE *out, bool first, const char *name, double seconds, double calls, float checksum)
+{
+	fprintf(out, "%s\n    {\"kernel\": \"%s\", \"ns_per_call\": %.3f, \"checksum\": %g}",
+	        first ? "" : ",", name, seconds * 1.0e9 / calls, checksum);
+}
+
+static void
+print_kernel(FILE *out, bool first, const char *name, double seconds, double calls, float checksum,
+             double baseline_seconds, float baseline_checksum)
+{
+	fprintf(out, "%s\n    {\"kernel\": \"%s\", \"ns_per_call\": %.3f, \"checksum\": %g, "
+	        "\"scalar_ns_per_call\": %.3f, \"scalar_checksum\": %g}",
+	        first ? "" : ",", name, seconds * 1.0e9 / calls, checksum,
+	        baseline_seconds * 1.0e9 / calls, baseline_checksum);
+}
+
+static ScalarVector
+to_scalar(const Vector &v)
+{
+	return ScalarVector(v.vec[0], v.vec[1], v.vec[2]);
+}
+
+/*
+ * The benchmarked kernels as the renderer computed them with the old
+ * vector math: Sphere::Intersection(), Sphere::NormalAtSurfacePoint()
+ * and Camera::GetRay(). They live in a different file from the
+ * ScalarVector operators, so they call them out of line as before.
+ */
+#define SQUARE(x) ((x)*(x))
+
+static bool
+scalar_sphere_intersection(const ScalarVector &origin, float radius, const ScalarVector &ro,
+                           const ScalarVector &rd, float *t_arg)
+{
+	ScalarVector tmp;
+
+	tmp = ro;
+	tmp.Subtract(&origin);
+
+	float a = SQUARE(rd.vec[0]) + SQUARE(rd.vec[1]) + SQUARE(rd.vec[2]);
+	float b = scalar_dot_product(rd.vec, tmp.vec) * 2.0f;
+	float c = SQUARE(ro.vec[0] - origin.vec[0]) +
+	          SQUARE(ro.vec[1] - origin.vec[1]) +
+	          SQUARE(ro.vec[2] - origin.vec[2]) - SQUARE(radius);
+
+	float disc = SQUARE(b) - (4.0f*a*c);
+
+	if(disc < 0.0f)
+		return false;
+
+	float t1 = (-b + sqrtf(disc)) / (2.0f*a);
+	float t2 = (-b - sqrtf(disc)) / (2.0f*a);
+	float t = (t1 < t2) ? t1 : t2;
+
+	if(t < 0.0f)
+		return false;
+
+	if(t_arg)
+		*t_arg = t;
+
+	return true;
+}
+
+static ScalarVector
+scalar_sphere_normal(const ScalarVector &origin, const ScalarVector &p)
+{
+	ScalarVector tmp;
+
+	tmp = p - origin;
+	tmp.Normalize();
+
+	return tmp;
+}
+
+// the normalized ray direction
+static ScalarVector
+scalar_camera_ray(const ScalarVector &forward, const ScalarVector &right, const ScalarVector &down,
+                  float plane_distance, float sx, float sy)
+{
+	ScalarVector dir = forward * plane_distance + right * sx + down * sy;
+	dir.Normalize();
+
+	return dir;
+}
+
+static void
+run_kernel_benchmarks(FILE *out, int iterations, unsigned int seed)
+{
+	Scene scene;
+	generate_scene(scene, SCENE_GRID, 1000, seed);
+	scene.Build();
+
+	unsigned int state = seed;
+	std::vector <Ray> rays(KERNEL_INPUTS);
+	std::vector <Hit> hits(KERNEL_INPUTS);
+	for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+		rays[i] = scene.GetCamera().GetRay(bench_random(state) * 8.0f - 4.0f, bench_random(state) * 6.0f - 3.0f);
+		scene.Intersect(rays[i], &hits[i]);
+	}
+
+	const std::vector <Object *> &objects = scene.GetObjects();
+	float checksum, baseline_checksum;
+	double start, seconds, baseline_seconds;
+
+	// the same inputs for the scalar baselines
+	ScalarVector zero(0.0f, 0.0f, 0.0f);
+	std::vector <ScalarVector> scalar_origins(KERNEL_INPUTS, zero), scalar_directions(KERNEL_INPUTS, zero);
+	for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+		scalar_origins[i] = to_scalar(rays[i].GetOrigin());
+		scalar_directions[i] = to_scalar(rays[i].GetDirection());
+	}
+	std::vector <ScalarVector> centers(objects.size(), zero);
+	std::vector <float> radii(objects.size());
+	for(unsigned int i = 0; i < objects.size(); i++) {
+		const Sphere *sphere = dynamic_cast <const Sphere *> (objects[i]);
+		centers[i] = to_scalar(objects[i]->GetOrigin());
+		radii[i] = sphere ? sphere->GetRadius() : 0.0f;
+	}
+	const Camera &camera = scene.GetCamera();
+	ScalarVector forward = to_scalar(camera.GetForward());
+	ScalarVector right = to_scalar(camera.GetRight());
+	ScalarVector down = to_scalar(camera.GetDown());
+
+	fprintf(out, "{\n  \"config\": {\"iterations\": %d, \"inputs\": %u, \"kernel_width\": %u, \"vector\": \"%s\"},\n",
+	        iterations, KERNEL_INPUTS, SphereStore::GetKernelWidth(), VECTOR_SSE ? "sse" : "scalar");
+	fprintf(out, "  \"kernels\": [");
+
+	// every ray against a handful of spheres through the Object interface
+	checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			for(unsigned int j = 0; j < 8; j++) {
+				float t;
+				if(objects[(i + j) % objects.size()]->Intersection(rays[i], &t))
+					checksum += t;
+			}
+		}
+	}
+	seconds = timer_seconds() - start;
+
+	baseline_checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			for(unsigned int j = 0; j < 8; j++) {
+				unsigned int o = (i + j) % objects.size();
+				float t;
+				if(scalar_sphere_intersection(centers[o], radii[o], scalar_origins[i], scalar_directions[i], &t))
+					baseline_checksum += t;
+			}
+		}
+	}
+	baseline_seconds = timer_seconds() - start;
+	print_kernel(out, true, "sphere_intersection", seconds, (double)iterations * KERNEL_INPUTS * 8, checksum,
+	             baseline_seconds, baseline_checksum);
+
+	checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			Vector n = objects[i % objects.size()]->NormalAtSurfacePoint(rays[i].GetDirection());
+			checksum += n.vec[0];
+		}
+	}
+	seconds = timer_seconds() - start;
+
+	baseline_checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			ScalarVector n = scalar_sphere_normal(centers[i % objects.size()], scalar_directions[i]);
+			baseline_checksum += n.vec[0];
+		}
+	}
+	baseline_seconds = timer_seconds() - start;
+	print_kernel(out, false, "sphere_normal", seconds, (double)iterations * KERNEL_INPUTS, checksum,
+	             baseline_seconds, baseline_checksum);
+
+	// direct lighting at the primary hits, without tracing reflections
+	checksum = 0.0f;
+	unsigned long calls = 0;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			if(hits[i].primitive == NO_HIT)
+				continue;
+
+			float color[4], reflectance;
+			Ray reflection;
+			scene.ShadeSurface(rays[i], hits[i], 0, 1.0f, color, &reflection, &reflectance);
+			checksum += color[0];
+			calls++;
+		}
+	}
+	seconds = timer_seconds() - start;
+	print_kernel(out, false, "shade_surface", seconds, (double)calls, checksum);
+
+	checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			Ray ray = scene.GetCamera().GetRay(rays[i].GetDirection().vec[0], rays[i].GetDirection().vec[1]);
+			checksum += ray.GetDirection().vec[2];
+		}
+	}
+	seconds = timer_seconds() - start;
+
+	baseline_checksum = 0.0f;
+	start = timer_seconds();
+	for(int k = 0; k < iterations; k++) {
+		for(unsigned int i = 0; i < KERNEL_INPUTS; i++) {
+			ScalarVector dir = scalar_camera_ray(forward, right, down, Camera::PLANE_DISTANCE,
+			                                     scalar_directions[i].vec[0], scalar_directions[i].vec[1]);
+			baseline_checksum += dir.vec[2];
+		}
+	}
+	baseline_seconds = timer_seconds() - start;
+	print_kernel(out, false, "camera_ray", seconds, (double)iterations * KERNEL_INPUTS, checksum,
+	             baseline_seconds, baseline_checksum);
+
+	fprintf(out, "\n  ]\n}\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+	BenchOptions options;
+
+	if(!parse_options(argc, argv, &options)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	FILE *out = stdout;
+	if(options.output) {
+		out = fopen(options.output, "w");
+		if(!out) {
+			perror(options.output);
+			return 1;
+		}
+	}
+
+	if(options.kernel_iterations > 0) {
+		run_kernel_benchmarks(out, options.kernel_iterations, options.seed);
+		if(out != stdout)
+			fclose(out);
+		return 0;
+	}
+
+	fprintf(out, "{\n");
+	fprintf(out, "  \"config\": {\"threads\": %u, \"packet_size\": %d, \"shading\": \"%s\", \"aa_rate\": %d, \"shadows\": %s, \"termination\": \"%s\", \"tile_kernels\": \"%s\", \"kernel_width\": %u, \"repeats\": %d, \"seed\": %u},\n",
+	        options.threads ? options.threads : ThreadPool::GetDefaultThreadCount(), options.packet_size,
+	        options.wavefront ? "wavefront" : "recursive", options.aa_rate,
+	        options.shadows ? "true" : "false", Scene::GetTerminationName(options.termination),
+	        options.specialized ? "specialized" : "generic", SphereStore::GetKernelWidth(), options.repeats, options.seed);
+	fprintf(out, "  \"results\": [");
+
+	bool first_result = true;
+	for(unsigned int s = 0; s < options.scenes.size(); s++) {
+		SceneType type = (SceneType)options.scenes[s];
+
+		for(unsigned int c = 0; c < options.counts.size(); c++) {
+			unsigned int count = options.counts[c];
+
+			double start = timer_seconds();
+			Scene scene;
+			generate_scene(scene, type, count, options.seed);
+			double generate_seconds = timer_seconds() - start;
+			scene.SetShadows(options.shadows);
+			scene.SetTermination(options.termination);
+
+			scene.Build();
+			BVH::BuildStats build_stats = scene.GetBuildStats();
+
+			RayTracer raytracer(&scene);
+			raytracer.SetThreadCount(options.threads);
+			raytracer.SetPacketSize(options.packet_size);
+			raytracer.SetWavefront(options.wavefront);
+			raytracer.SetAntialiasing(options.aa_rate);
+			raytracer.SetSpecializedKernels(options.specialized);
+
+			for(unsigned int r = 0; r < options.widths.size(); r++) {
+				int width = options.widths[r];
+				int height = options.heights[r];
+				std::vector <unsigned char> framebuf((size_t)width * height * 4);
+
+				fprintf(stderr, "%s, %u spheres, %dx%d...\n", scene_type_name(type), count, width, height);
+
+				std::vector <double> times;
+				RayTracer::FrameStats stats = raytracer.GetFrameStats();
+				for(int k = 0; k < options.repeats; k++) {
+					raytracer.Draw(&framebuf[0], width, height);
+					stats = raytracer.GetFrameStats();
+					times.push_back(stats.draw_seconds);
+				}
+				std::sort(times.begin(), times.end());
+				double wall = times[times.size() / 2];
+
+				unsigned long depth_secondary = 0, differ = 0;
+				int max_step = 0;
+				if(options.termination != Scene::TERMINATE_DEPTH) {
+					compare_termination(scene, raytracer, &framebuf[0], width, height,
+					                    depth_secondary, differ, max_step);
+				}
+
+				double incremental_seconds = 0.0, reused_fraction = 0.0;
+				if(options.incremental_frames > 0 && !scene.GetObjects().empty()) {
+					time_incremental(scene, raytracer, &framebuf[0], width, height,
+					                 options.incremental_frames, incremental_seconds, reused_fraction);
+				}
+
+				// antialiasing samples are primary rays, reported on their own
+				unsigned long secondary = stats.rays - stats.primary_rays - stats.aa_rays;
+
+				fprintf(out, "%s\n    {\"scene\": \"%s\", \"spheres\": %u, \"width\": %d, \"height\": %d, ",
+				        first_result ? "" : ",", scene_type_name(type), scene.GetPrimitiveCount(), width, height);
+				fprintf(out, "\"generate_ms\": %.3f, \"build_ms\": %.3f, \"bvh_nodes\": %u, \"bvh_depth\": %u, ",
+				        generate_seconds * 1000.0, build_stats.build_seconds * 1000.0,
+				        build_stats.node_count, build_stats.max_depth);
+				fprintf(out, "\"wall_ms\": %.3f, \"wall_ms_min\": %.3f, ", wall * 1000.0, times[0] * 1000.0);
+				fprintf(out, "\"primary_rays\": %lu, \"secondary_rays\": %lu, \"reflections_per_camera_ray\": %.3f, ",
+				        stats.primary_rays, secondary, per_ray(secondary, stats.primary_rays + stats.aa_rays));
+				fprintf(out, "\"aa_pixels\": %lu, \"aa_rays\": %lu, ", stats.aa_pixels, stats.aa_rays);
+				fprintf(out, "\"primary_mrays_per_s\": %.3f, \"secondary_mrays_per_s\": %.3f, \"total_mrays_per_s\": %.3f, ",
+				        per_second((double)stats.primary_rays, wall) * 1.0e-6,
+				        per_second((double)secondary, wall) * 1.0e-6,
+				        per_second((double)stats.rays, wall) * 1.0e-6);
+				fprintf(out, "\"shadow_rays\": %lu, \"shadow_hits\": %lu, \"occluder_cache_hit_rate\": %.3f, \"shadow_mrays_per_s\": %.3f, ",
+				        stats.shadow_rays, stats.shadow_hits, per_ray(stats.occluder_cache_hits, stats.shadow_hits),
+				        per_second((double)stats.shadow_rays, wall) * 1.0e-6);
+
+				if(options.termination != Scene::TERMINATE_DEPTH) {
+					fprintf(out, "\"depth_cutoff_secondary_rays\": %lu, \"reflection_rays_saved\": %.3f, ",
+					        depth_secondary, depth_secondary ? 1.0 - (double)secondary / (double)depth_secondary : 0.0);
+					fprintf(out, "\"termination_differing_pixels\": %lu, \"termination_max_step\": %d, ",
+					        differ, max_step);
+				}
+
+				if(options.incremental_frames > 0) {
+					fprintf(out, "\"incremental_frames\": %d, \"incremental_ms\": %.3f, \"reused_fraction\": %.3f, ",
+					        options.incremental_frames, incremental_seconds * 1000.0, reused_fraction);
+				}
+
+				// the traversal counters cover shadow rays too
+				unsigned long traced = stats.rays + stats.shadow_rays;
+				fprintf(out, "\"intersections_per_ray\": %.3f, \"nodes_per_ray\": %.3f}",
+				        per_ray(stats.primitive_tests, traced), per_ray(stats.nodes_visited, traced));
+				fflush(out);
+				first_result = false;
+			}
+		}
+	}
+
+	fprintf(out, "\n  ]\n}\n");
+
+	if(out != stdout)
+		fclose(out);
+
+	return 0;
+}
@@ -0,0 +1,356 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// bvh.cpp - Surface area heuristic bounding volume hierarchy
+
+#include <algorithm>
+#include "bvh.h"
+#include "timer.h"
+#include "trace.h"
+
+const unsigned int SAH_BINS = 16;
+const float TRAVERSAL_COST = 1.0f;
+const float INTERSECTION_COST = 2.0f;
+
+static __thread BVH::TraversalStats thread_stats;
+
+static void
+bounds_clear(float min[3], float max[3])
+{
+	for(int i = 0; i < 3; i++) {
+		min[i] = 9999999.0f;
+		max[i] = -9999999.0f;
+	}
+}
+
+static void
+bounds_grow(float min[3], float max[3], const float pmin[3], const float pmax[3])
+{
+	for(int i = 0; i < 3; i++) {
+		if(pmin[i] < min[i])
+			min[i] = pmin[i];
+		if(pmax[i] > max[i])
+			max[i] = pmax[i];
+	}
+}
+
+static float
+bounds_area(const float min[3], const float max[3])
+{
+	float dx = max[0] - min[0];
+	float dy = max[1] - min[1];
+	float dz = max[2] - min[2];
+
+	if(dx < 0.0f || dy < 0.0f || dz < 0.0f)
+		return 0.0f;
+
+	return 2.0f * (dx*dy + dy*dz + dz*dx);
+}
+
+struct BinPredicate {
+	unsigned int axis;
+	unsigned int split;
+	float cmin;
+	float scale;
+
+	bool operator () (const BVH::BuildPrimitive &p) const;
+};
+
+static unsigned int
+bin_index(float centroid, float cmin, float scale)
+{
+	int b = (int)((centroid - cmin) * scale);
+
+	if(b < 0)
+		b = 0;
+	if(b >= (int)SAH_BINS)
+		b = SAH_BINS - 1;
+
+	return (unsigned int)b;
+}
+
+bool
+BinPredicate::operator () (const BVH::BuildPrimitive &p) const
+{
+	return bin_index(p.centroid[axis], cmin, scale) < split;
+}
+
+struct CentroidLess {
+	unsigned int axis;
+
+	bool operator () (const BVH::BuildPrimitive &a, const BVH::BuildPrimitive &b) const
+	{
+		return a.centroid[axis] < b.centroid[axis];
+	}
+};
+
+/*
+ * BVH class
+ */
+BVH::BVH()
+{
+	leaf_width = 1;
+	Clear();
+}
+
+// number of intersection tests needed for a leaf of n primitives
+inline float
+BVH::LeafBatches(unsigned int n) const
+{
+	return (float)((n + leaf_width - 1) / leaf_width);
+}
+
+void
+BVH::Clear()
+{
+	nodes.clear();
+	node_data = NULL;
+	node_count = 0;
+
+	build_stats.build_seconds = 0.0;
+	build_stats.primitive_count = 0;
+	build_stats.node_count = 0;
+	build_stats.leaf_count = 0;
+	build_stats.max_depth = 0;
+	build_stats.max_leaf_size = 0;
+	build_stats.sah_cost = 0.0f;
+}
+
+void
+BVH::Attach(const Node *node_array, unsigned int count, const BuildStats &stats)
+{
+	Clear();
+
+	node_data = node_array;
+	node_count = count;
+	build_stats = stats;
+}
+
+void
+BVH::MakeBuildPrimitive(BuildPrimitive &p, const Vector &min, const Vector &max, unsigned int index)
+{
+	for(int j = 0; j < 3; j++) {
+		// pad slightly so hits right on the surface aren't culled
+		// by rounding in the slab test
+		float pad = (max.vec[j] - min.vec[j]) * 1.0e-4f + 1.0e-5f;
+		p.min[j] = min.vec[j] - pad;
+		p.max[j] = max.vec[j] + pad;
+		p.centroid[j] = (min.vec[j] + max.vec[j]) * 0.5f;
+	}
+	p.index = index;
+}
+
+void
+BVH::Build(std::vector <BuildPrimitive> &build_prims, unsigned int leaf_width_arg)
+{
+	TRACE_SCOPE(trace, "bvh build", "scene");
+	TRACE_ARG(trace, "primitives", (int)build_prims.size());
+
+	leaf_width = (leaf_width_arg > 0) ? leaf_width_arg : 1;
+
+	double start = timer_seconds();
+
+	Clear();
+	if(build_prims.empty())
+		return;
+
+	nodes.reserve(build_prims.size() * 2);
+	BuildRecursive(build_prims, 0, (unsigned int)build_prims.size(), 0);
+	std::vector <Node>(nodes).swap(nodes);
+	node_data = &nodes[0];
+	node_count = (unsigned int)nodes.size();
+
+	// expected cost of a random ray through the root, relative to
+	// the root's surface area
+	float root_area = bounds_area(nodes[0].min, nodes[0].max);
+	float cost = 0.0f;
+	for(unsigned int i = 0; i < nodes.size(); i++) {
+		float a = (root_area > 0.0f) ? bounds_area(nodes[i].min, nodes[i].max) / root_area : 1.0f;
+		if(nodes[i].count > 0)
+			cost += a * INTERSECTION_COST * LeafBatches(nodes[i].count);
+		else
+			cost += a * TRAVERSAL_COST;
+	}
+
+	build_stats.primitive_count = (unsigned int)build_prims.size();
+	build_stats.node_count = (unsigned int)nodes.size();
+	build_stats.sah_cost = cost;
+	build_stats.build_seconds = timer_seconds() - start;
+}
+
+unsigned int
+BVH::MakeLeaf(std::vector <BuildPrimitive> &build_prims, unsigned int first, unsigned int count,
+              unsigned int depth, const float min[3], const float max[3])
+{
+	Node node;
+
+	for(int i = 0; i < 3; i++) {
+		node.min[i] = min[i];
+		node.max[i] = max[i];
+	}
+	node.offset = first;
+	node.count = (unsigned short)count;
+	node.axis = 0;
+
+	nodes.push_back(node);
+
+	build_stats.leaf_count++;
+	if(count > build_stats.max_leaf_size)
+		build_stats.max_leaf_size = count;
+	if(depth > build_stats.max_depth)
+		build_stats.max_depth = depth;
+
+	return (unsigned int)nodes.size() - 1;
+}
+
+unsigned int
+BVH::BuildRecursive(std::vector <BuildPrimitive> &build_prims, unsigned int first,
+                    unsigned int count, unsigned int depth)
+{
+	float min[3], max[3], cmin[3], cmax[3];
+
+	bounds_clear(min, max);
+	bounds_clear(cmin, cmax);
+	for(unsigned int i = first; i < first + count; i++) {
+		bounds_grow(min, max, build_prims[i].min, build_prims[i].max);
+		bounds_grow(cmin, cmax, build_prims[i].centroid, build_prims[i].centroid);
+	}
+
+	// a leaf forced by the depth limit still has to fit its count
+	bool forced = depth >= MAX_DEPTH;
+	if(count <= 2 || (forced && count <= MAX_LEAF_COUNT))
+		return MakeLeaf(build_prims, first, count, depth, min, max);
+
+	// find the cheapest binned split over all three axes
+	float parent_area = bounds_area(min, max);
+	float best_cost = INTERSECTION_COST * LeafBatches(count);
+	int best_axis = -1;
+	unsigned int best_split = 0;
+
+	for(unsigned int axis = 0; axis < 3 && !forced; axis++) {
+		float extent = cmax[axis] - cmin[axis];
+		if(extent <= 0.0f)
+			continue;
+
+		float scale = (float)SAH_BINS / extent;
+		unsigned int bin_count[SAH_BINS];
+		float bin_min[SAH_BINS][3], bin_max[SAH_BINS][3];
+
+		for(unsigned int b = 0; b < SAH_BINS; b++) {
+			bin_count[b] = 0;
+			bounds_clear(bin_min[b], bin_max[b]);
+		}
+		for(unsigned int i = first; i < first + count; i++) {
+			unsigned int b = bin_index(build_prims[i].centroid[axis], cmin[axis], scale);
+			bin_count[b]++;
+			bounds_grow(bin_min[b], bin_max[b], build_prims[i].min, build_prims[i].max);
+		}
+
+		// sweep from the right to get the area/count of every right side
+		float right_area[SAH_BINS];
+		unsigned int right_count[SAH_BINS];
+		float rmin[3], rmax[3];
+		unsigned int rcount = 0;
+		bounds_clear(rmin, rmax);
+		for(unsigned int b = SAH_BINS - 1; b > 0; b--) {
+			bounds_grow(rmin, rmax, bin_min[b], bin_max[b]);
+			rcount += bin_count[b];
+			right_area[b] = bounds_area(rmin, rmax);
+			right_count[b] = rcount;
+		}
+
+		float lmin[3], lmax[3];
+		unsigned int lcount = 0;
+		bounds_clear(lmin, lmax);
+		for(unsigned int split = 1; split < SAH_BINS; split++) {
+			bounds_grow(lmin, lmax, bin_min[split - 1], bin_max[split - 1]);
+			lcount += bin_count[split - 1];
+			if(lcount == 0 || right_count[split] == 0)
+				continue;
+
+			float cost = TRAVERSAL_COST + INTERSECTION_COST *
+			             (bounds_area(lmin, lmax) * LeafBatches(lcount) +
+			              right_area[split] * LeafBatches(right_count[split])) / parent_area;
+			if(cost < best_cost) {
+				best_cost = cost;
+				best_axis = (int)axis;
+				best_split = split;
+			}
+		}
+	}
+
+	unsigned int mid;
+	if(best_axis >= 0) {
+		BinPredicate pred;
+		pred.axis = (unsigned int)best_axis;
+		pred.split = best_split;
+		pred.cmin = cmin[best_axis];
+		pred.scale = (float)SAH_BINS / (cmax[best_axis] - cmin[best_axis]);
+
+		mid = (unsigned int)(std::partition(build_prims.begin() + first,
+		                                    build_prims.begin() + first + count, pred) - build_prims.begin());
+	} else if(count <= MAX_LEAF_SIZE) {
+		return MakeLeaf(build_prims, first, count, depth, min, max);
+	} else {
+		// splitting doesn't pay off by SAH (or is past the depth
+		// limit), but the leaf would be too big; fall back to a median
+		// split along the widest axis
+		unsigned int axis = 0;
+		for(unsigned int i = 1; i < 3; i++) {
+			if(cmax[i] - cmin[i] > cmax[axis] - cmin[axis])
+				axis = i;
+		}
+
+		CentroidLess less;
+		less.axis = axis;
+		mid = first + count / 2;
+		std::nth_element(build_prims.begin() + first, build_prims.begin() + mid,
+		                 build_prims.begin() + first + count, less);
+		best_axis = (int)axis;
+	}
+
+	Node node;
+	for(int i = 0; i < 3; i++) {
+		node.min[i] = min[i];
+		node.max[i] = max[i];
+	}
+	node.offset = 0;
+	node.count = 0;
+	node.axis = (unsigned short)best_axis;
+
+	unsigned int index = (unsigned int)nodes.size();
+	nodes.push_back(node);
+
+	BuildRecursive(build_prims, first, mid - first, depth + 1);
+	nodes[index].offset = BuildRecursive(build_prims, mid, first + count - mid, depth + 1);
+
+	return index;
+}
+
+BVH::TraversalStats &
+BVH::GetThreadStats()
+{
+	return thread_stats;
+}
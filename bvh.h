@@ -0,0 +1,377 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __BVH_H__
+#define __BVH_H__
+
+#include <vector>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#include "my_math.h"
+#include "ray.h"
+#include "packet.h"
+
+/*
+ * Bounding volume hierarchy over primitive bounds, built with the surface
+ * area heuristic. Nodes are stored flattened in depth-first order: the
+ * left child of an interior node directly follows it and the right child
+ * is at node.offset. For leaves, node.offset is the index of the first
+ * primitive and node.count the number of primitives.
+ *
+ * Build() reorders the primitives so every leaf covers a contiguous
+ * range; the owner keeps its primitive data in that order and supplies
+ * the leaf intersection test to Traverse()/TraversePacket().
+ *
+ * Instead of building, a hierarchy can be attached to nodes stored
+ * elsewhere, such as a memory mapped scene cache.
+ */
+class BVH {
+	public:
+		struct Node {
+			float min[3];
+			float max[3];
+			unsigned int offset;
+			unsigned short count;
+			unsigned short axis;
+		};
+
+		// per-primitive record used while building
+		struct BuildPrimitive {
+			float min[3];
+			float max[3];
+			float centroid[3];
+			unsigned int index;
+		};
+
+		struct BuildStats {
+			double build_seconds;
+			unsigned int primitive_count;
+			unsigned int node_count;
+			unsigned int leaf_count;
+			unsigned int max_depth;
+			unsigned int max_leaf_size;
+			float sah_cost;
+		};
+
+		struct TraversalStats {
+			unsigned long rays;
+			unsigned long nodes_visited;
+			unsigned long primitive_tests;
+			// occlusion queries, how many found a blocker and how many
+			// of those were answered by the last-occluder cache
+			unsigned long shadow_rays;
+			unsigned long shadow_hits;
+			unsigned long occluder_cache_hits;
+		};
+
+		/*
+		 * Past MAX_DEPTH, nodes are only split while they hold more
+		 * primitives than a leaf's count can, which adds at most
+		 * another 17 levels; traversal stacks are sized for both.
+		 */
+		enum {
+			MAX_LEAF_SIZE = 8,
+			MAX_DEPTH = 60,
+			MAX_LEAF_COUNT = 0xffff,
+			STACK_SIZE = MAX_DEPTH + 17 + 4
+		};
+
+		BVH();
+
+		// on return build_prims is in leaf order: build_prims[i].index
+		// is the original index of the i'th primitive. leaf_width is the
+		// number of primitives the leaf test handles at once (its SIMD
+		// width), which the SAH uses to favour fuller leaves.
+		void Build(std::vector <BuildPrimitive> &build_prims, unsigned int leaf_width_arg = 1);
+		void Clear();
+
+		// uses count nodes at node_array in place; the caller keeps them
+		// alive for as long as the hierarchy is used
+		void Attach(const Node *node_array, unsigned int count, const BuildStats &stats);
+
+		static void MakeBuildPrimitive(BuildPrimitive &p, const Vector &min, const Vector &max, unsigned int index);
+
+		inline bool IsEmpty() const { return node_count == 0; }
+		inline const Node *GetNodes() const { return node_data; }
+		inline unsigned int GetNodeCount() const { return node_count; }
+		// bytes of node storage owned by the hierarchy
+		inline unsigned long GetMemoryUsage() const { return nodes.capacity() * sizeof(Node); }
+		inline const BuildStats &GetBuildStats() const { return build_stats; }
+
+		/*
+		 * Walks the nodes the ray reaches in front-to-back order.
+		 * For every leaf, leaf(first, count, closest_t) is called and
+		 * must lower closest_t if it finds a closer hit.
+		 */
+		template <class Leaf>
+		void Traverse(const Ray &ray, float &closest_t, Leaf &leaf) const;
+
+		/*
+		 * Any-hit query: walks the nodes the ray reaches before max_t
+		 * and calls leaf(first, count, max_t) for every leaf until it
+		 * returns true. Returns true if any leaf did.
+		 */
+		template <class Leaf>
+		bool TraverseAny(const Ray &ray, float max_t, Leaf &leaf) const;
+
+		// as Traverse(), but for every ray of a packet at once; nodes
+		// outside the packet frustum are culled before any per-ray work
+		template <class Leaf>
+		void TraversePacket(RayPacket &packet, Leaf &leaf) const;
+
+		// counters for the calling thread; each thread only ever
+		// touches its own, so they can be read without locking
+		static TraversalStats &GetThreadStats();
+
+	protected:
+		std::vector <Node> nodes;
+		// what traversal reads: either nodes or attached storage
+		const Node *node_data;
+		unsigned int node_count;
+		BuildStats build_stats;
+		unsigned int leaf_width;
+
+		float LeafBatches(unsigned int n) const;
+
+		unsigned int BuildRecursive(std::vector <BuildPrimitive> &build_prims,
+		                            unsigned int first, unsigned int count, unsigned int depth);
+		unsigned int MakeLeaf(std::vector <BuildPrimitive> &build_prims,
+		                      unsigned int first, unsigned int count, unsigned int depth,
+		                      const float min[3], const float max[3]);
+
+		static inline bool IntersectBox(const Node &node, const float origin[3], const float inv_dir[3], float max_t);
+		static inline bool IntersectBoxPacket(const Node &node, const RayPacket &packet);
+
+	private:
+		BVH(const BVH &);
+		BVH &operator = (const BVH &);
+};
+
+inline bool
+BVH::IntersectBox(const Node &node, const float origin[3], const float inv_dir[3], float max_t)
+{
+	float tmin = 0.0f;
+	float tmax = max_t;
+
+	for(int i = 0; i < 3; i++) {
+		float t0 = (node.min[i] - origin[i]) * inv_dir[i];
+		float t1 = (node.max[i] - origin[i]) * inv_dir[i];
+		if(t0 > t1) {
+			float tmp = t0;
+			t0 = t1;
+			t1 = tmp;
+		}
+		if(t0 > tmin)
+			tmin = t0;
+		if(t1 < tmax)
+			tmax = t1;
+	}
+
+	return tmin <= tmax;
+}
+
+// returns true if any ray in the packet hits the box before its closest hit
+inline bool
+BVH::IntersectBoxPacket(const Node &node, const RayPacket &packet)
+{
+#ifdef __SSE__
+	for(int i = 0; i < packet.size; i += 4) {
+		__m128 tmin = _mm_setzero_ps();
+		__m128 tmax = _mm_loadu_ps(&packet.t[i]);
+
+		for(int j = 0; j < 3; j++) {
+			__m128 o = _mm_set1_ps(packet.origin[j]);
+			__m128 inv = _mm_loadu_ps(&packet.inv_dir[j][i]);
+			__m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[j]), o), inv);
+			__m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[j]), o), inv);
+			tmin = _mm_max_ps(tmin, _mm_min_ps(t0, t1));
+			tmax = _mm_min_ps(tmax, _mm_max_ps(t0, t1));
+		}
+
+		if(_mm_movemask_ps(_mm_cmple_ps(tmin, tmax)))
+			return true;
+	}
+
+	return false;
+#else
+	for(int i = 0; i < packet.size; i++) {
+		float inv_dir[3] = { packet.inv_dir[0][i], packet.inv_dir[1][i], packet.inv_dir[2][i] };
+		if(IntersectBox(node, packet.origin, inv_dir, packet.t[i]))
+			return true;
+	}
+
+	return false;
+#endif
+}
+
+template <class Leaf>
+void
+BVH::Traverse(const Ray &ray, float &closest_t, Leaf &leaf) const
+{
+	if(node_count == 0)
+		return;
+
+	TraversalStats &stats = GetThreadStats();
+
+	const float *origin = ray.GetOrigin().vec;
+	const float *dir = ray.GetDirection().vec;
+	float inv_dir[3];
+	int dir_neg[3];
+	for(int i = 0; i < 3; i++) {
+		inv_dir[i] = 1.0f / dir[i];
+		dir_neg[i] = dir[i] < 0.0f;
+	}
+
+	unsigned int stack[STACK_SIZE];
+	unsigned int stack_size = 0;
+	unsigned int index = 0;
+
+	for(;;) {
+		const Node &node = node_data[index];
+		stats.nodes_visited++;
+
+		if(IntersectBox(node, origin, inv_dir, closest_t)) {
+			if(node.count > 0) {
+				stats.primitive_tests += node.count;
+				leaf(node.offset, node.count, closest_t);
+			} else {
+				// visit the near child first so closest_t shrinks early
+				if(dir_neg[node.axis]) {
+					stack[stack_size++] = index + 1;
+					index = node.offset;
+				} else {
+					stack[stack_size++] = node.offset;
+					index = index + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stack_size == 0)
+			break;
+		index = stack[--stack_size];
+	}
+}
+
+template <class Leaf>
+bool
+BVH::TraverseAny(const Ray &ray, float max_t, Leaf &leaf) const
+{
+	if(node_count == 0)
+		return false;
+
+	TraversalStats &stats = GetThreadStats();
+
+	const float *origin = ray.GetOrigin().vec;
+	const float *dir = ray.GetDirection().vec;
+	float inv_dir[3];
+	int dir_neg[3];
+	for(int i = 0; i < 3; i++) {
+		inv_dir[i] = 1.0f / dir[i];
+		dir_neg[i] = dir[i] < 0.0f;
+	}
+
+	unsigned int stack[STACK_SIZE];
+	unsigned int stack_size = 0;
+	unsigned int index = 0;
+
+	for(;;) {
+		const Node &node = node_data[index];
+		stats.nodes_visited++;
+
+		if(IntersectBox(node, origin, inv_dir, max_t)) {
+			if(node.count > 0) {
+				stats.primitive_tests += node.count;
+				if(leaf(node.offset, node.count, max_t))
+					return true;
+			} else {
+				// any blocker will do, but blockers near the origin
+				// are the likeliest, so the near child still goes first
+				if(dir_neg[node.axis]) {
+					stack[stack_size++] = index + 1;
+					index = node.offset;
+				} else {
+					stack[stack_size++] = node.offset;
+					index = index + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stack_size == 0)
+			break;
+		index = stack[--stack_size];
+	}
+
+	return false;
+}
+
+template <class Leaf>
+void
+BVH::TraversePacket(RayPacket &packet, Leaf &leaf) const
+{
+	if(node_count == 0)
+		return;
+
+	TraversalStats &stats = GetThreadStats();
+
+	// order children by the first ray; all rays in a coherent packet
+	// almost always agree
+	int dir_neg[3];
+	for(int i = 0; i < 3; i++)
+		dir_neg[i] = packet.dir[i][0] < 0.0f;
+
+	unsigned int stack[STACK_SIZE];
+	unsigned int stack_size = 0;
+	unsigned int index = 0;
+
+	for(;;) {
+		const Node &node = node_data[index];
+		stats.nodes_visited++;
+
+		if(!packet.BoxOutsideFrustum(node.min, node.max) && IntersectBoxPacket(node, packet)) {
+			if(node.count > 0) {
+				stats.primitive_tests += node.count * packet.size;
+				leaf(node.offset, node.count, packet);
+			} else {
+				if(dir_neg[node.axis]) {
+					stack[stack_size++] = index + 1;
+					index = node.offset;
+				} else {
+					stack[stack_size++] = node.offset;
+					index = index + 1;
+				}
+				continue;
+			}
+		}
+
+		if(stack_size == 0)
+			break;
+		index = stack[--stack_size];
+	}
+}
+
+#endif /* __BVH_H__ */
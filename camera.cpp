@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// camera.cpp - Pinhole camera
+
+#include <cmath>
+#include "camera.h"
+
+const float Camera::PLANE_DISTANCE = 2.0f;
+
+/*
+ * Camera class
+ */
+Camera::Camera()
+{
+	position = Vector(0.0f, 0.0f, 0.0f);
+	forward = Vector(0.0f, 0.0f, 1.0f);
+	right = Vector(1.0f, 0.0f, 0.0f);
+	down = Vector(0.0f, 1.0f, 0.0f);
+	half_width = 4.0f;
+	half_height = 3.0f;
+}
+
+void
+Camera::LookAt(const Vector &position_arg, const Vector &target, const Vector &up)
+{
+	position = position_arg;
+
+	forward = target - position;
+	forward.Normalize();
+
+	cross_product(forward.vec, up.vec, right.vec);
+	right.Normalize();
+
+	cross_product(forward.vec, right.vec, down.vec);
+	down.Normalize();
+}
+
+void
+Camera::SetFov(double fov, double aspect)
+{
+	half_width = (float)(tan(fov * M_PI / 360.0) * PLANE_DISTANCE);
+	half_height = (float)((double)half_width / aspect);
+}
+
+double
+Camera::GetFov() const
+{
+	return atan((double)half_width / PLANE_DISTANCE) * 360.0 / M_PI;
+}
+
+void
+Camera::Set(const Vector &position_arg, const Vector &forward_arg, const Vector &right_arg,
+            const Vector &down_arg, float half_width_arg, float half_height_arg)
+{
+	position = position_arg;
+	forward = forward_arg;
+	right = right_arg;
+	down = down_arg;
+	half_width = half_width_arg;
+	half_height = half_height_arg;
+}
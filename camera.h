@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CAMERA_H__
+#define __CAMERA_H__
+
+#include "my_math.h"
+#include "ray.h"
+
+/*
+ * Pinhole camera. Primary rays start at the camera position and pass
+ * through a screen plane PLANE_DISTANCE units along the forward axis.
+ * Screen coordinates run from -half_width..half_width to the right and
+ * -half_height..half_height downwards, so the top row of the frame has
+ * the lowest y.
+ */
+class Camera {
+	protected:
+		Vector position;
+		Vector forward;
+		Vector right;
+		Vector down;
+		float half_width;
+		float half_height;
+
+	public:
+		static const float PLANE_DISTANCE;
+
+		// the original fixed view: at the origin looking down +z,
+		// with an 8x6 screen plane
+		Camera();
+
+		// up is the world direction that should appear at the top of
+		// the frame
+		void LookAt(const Vector &position_arg, const Vector &target, const Vector &up);
+
+		// horizontal field of view in degrees; aspect is width / height
+		void SetFov(double fov, double aspect);
+		double GetFov() const;
+		inline double GetAspect() const { return (double)half_width / (double)half_height; }
+
+		// sets the full camera frame directly, e.g. from a scene cache
+		void Set(const Vector &position_arg, const Vector &forward_arg, const Vector &right_arg,
+		         const Vector &down_arg, float half_width_arg, float half_height_arg);
+
+		inline const Vector &GetPosition() const { return position; }
+		inline const Vector &GetForward() const { return forward; }
+		inline const Vector &GetRight() const { return right; }
+		inline const Vector &GetDown() const { return down; }
+		inline float GetHalfWidth() const { return half_width; }
+		inline float GetHalfHeight() const { return half_height; }
+
+		// ray through screen plane point (sx, sy)
+		inline Ray GetRay(float sx, float sy) const
+		{
+			Vector dir = forward * PLANE_DISTANCE + right * sx + down * sy;
+
+			Ray ray;
+			ray.SetOrigin(position);
+			ray.SetDirection(dir);
+
+			return ray;
+		}
+};
+
+#endif /* __CAMERA_H__ */
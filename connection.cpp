@@ -0,0 +1,372 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// connection.cpp - Message framing over Unix domain and TCP sockets
+
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "connection.h"
+
+static bool
+fail(std::string *error, const std::string &message)
+{
+	if(error)
+		*error = message;
+	return false;
+}
+
+// splits "HOST:PORT" at the last colon; HOST may be empty
+static bool
+split_host_port(const char *address, std::string &host, std::string &port)
+{
+	const char *colon = strrchr(address, ':');
+	if(!colon || colon[1] == '\0')
+		return false;
+
+	host.assign(address, colon - address);
+	port = colon + 1;
+	return true;
+}
+
+static bool
+make_unix_address(const char *path, struct sockaddr_un &addr, std::string *error)
+{
+	if(strlen(path) >= sizeof(addr.sun_path))
+		return fail(error, "socket path too long");
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	return true;
+}
+
+/*
+ * Connection class
+ */
+Connection::Connection()
+{
+	fd = -1;
+	bytes_sent = 0;
+	bytes_received = 0;
+}
+
+Connection::~Connection()
+{
+	Close();
+}
+
+bool
+Connection::Connect(const char *address, std::string *error)
+{
+	Close();
+
+	if(strncmp(address, "unix:", 5) == 0) {
+		struct sockaddr_un addr;
+		if(!make_unix_address(address + 5, addr, error))
+			return false;
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0)
+			return fail(error, strerror(errno));
+		if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+			int connect_errno = errno;
+			Close();
+			return fail(error, strerror(connect_errno));
+		}
+
+		return true;
+	}
+
+	std::string host, port;
+	if(!split_host_port(address, host, port))
+		return fail(error, "expected unix:PATH or HOST:PORT");
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	int status = getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &res);
+	if(status != 0)
+		return fail(error, gai_strerror(status));
+
+	std::string last_error = "no usable address";
+	for(struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd < 0) {
+			last_error = strerror(errno);
+			continue;
+		}
+		if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0)
+			break;
+
+		last_error = strerror(errno);
+		Close();
+	}
+	freeaddrinfo(res);
+
+	if(fd < 0)
+		return fail(error, last_error);
+
+	// tile requests are small and latency bound
+	int one = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	return true;
+}
+
+bool
+Connection::Listen(const char *address, std::string *error)
+{
+	Close();
+
+	if(strncmp(address, "unix:", 5) == 0) {
+		struct sockaddr_un addr;
+		if(!make_unix_address(address + 5, addr, error))
+			return false;
+
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if(fd < 0)
+			return fail(error, strerror(errno));
+
+		// a socket left behind by a previous run would make bind() fail
+		unlink(addr.sun_path);
+		if(bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+			int bind_errno = errno;
+			Close();
+			return fail(error, strerror(bind_errno));
+		}
+
+		unix_path = addr.sun_path;
+		return true;
+	}
+
+	std::string host, port;
+	if(!split_host_port(address, host, port))
+		return fail(error, "expected unix:PATH or HOST:PORT");
+
+	struct addrinfo hints, *res;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_PASSIVE;
+	int status = getaddrinfo(host.empty() ? NULL : host.c_str(), port.c_str(), &hints, &res);
+	if(status != 0)
+		return fail(error, gai_strerror(status));
+
+	std::string last_error = "no usable address";
+	for(struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if(fd < 0) {
+			last_error = strerror(errno);
+			continue;
+		}
+
+		int one = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		if(bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 16) == 0)
+			break;
+
+		last_error = strerror(errno);
+		Close();
+	}
+	freeaddrinfo(res);
+
+	if(fd < 0)
+		return fail(error, last_error);
+
+	return true;
+}
+
+Connection *
+Connection::Accept(std::string *error)
+{
+	int client;
+	do {
+		client = accept(fd, NULL, NULL);
+	} while(client < 0 && errno == EINTR);
+
+	if(client < 0) {
+		fail(error, strerror(errno));
+		return NULL;
+	}
+
+	// harmless on Unix domain sockets, where it just fails
+	int one = 1;
+	setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+	Connection *connection = new Connection;
+	connection->fd = client;
+	return connection;
+}
+
+void
+Connection::Close()
+{
+	if(fd >= 0)
+		close(fd);
+	fd = -1;
+
+	if(!unix_path.empty())
+		unlink(unix_path.c_str());
+	unix_path.clear();
+}
+
+bool
+Connection::WriteAll(const void *data, size_t size)
+{
+	const char *p = (const char *)data;
+	while(size > 0) {
+		// MSG_NOSIGNAL: a peer that has gone away is an error to
+		// report, not a reason to die of SIGPIPE
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+		bytes_sent += n;
+	}
+
+	return true;
+}
+
+bool
+Connection::ReadAll(void *data, size_t size)
+{
+	char *p = (char *)data;
+	while(size > 0) {
+		ssize_t n = recv(fd, p, size, 0);
+		if(n < 0 && errno == EINTR)
+			continue;
+		if(n <= 0)
+			return false;
+
+		p += n;
+		size -= n;
+		bytes_received += n;
+	}
+
+	return true;
+}
+
+bool
+Connection::Send(unsigned int type, const void *head, size_t head_size, const void *data, size_t size)
+{
+	if(fd < 0 || head_size + size > MAX_MESSAGE_SIZE)
+		return false;
+
+	std::vector <unsigned char> header;
+	PutUint32(header, type);
+	PutUint32(header, (unsigned int)(head_size + size));
+
+	return WriteAll(&header[0], header.size()) &&
+	       (head_size == 0 || WriteAll(head, head_size)) &&
+	       (size == 0 || WriteAll(data, size));
+}
+
+bool
+Connection::SetSendTimeout(int timeout_ms)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	return fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+bool
+Connection::SetReceiveTimeout(int timeout_ms)
+{
+	struct timeval tv;
+	tv.tv_sec = timeout_ms / 1000;
+	tv.tv_usec = (timeout_ms % 1000) * 1000;
+
+	return fd >= 0 && setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) == 0;
+}
+
+bool
+Connection::Receive(unsigned int &type, std::vector <unsigned char> &payload)
+{
+	unsigned char header[8];
+	if(fd < 0 || !ReadAll(header, sizeof(header)))
+		return false;
+
+	type = GetUint32(header);
+	unsigned int size = GetUint32(header + 4);
+	if(size > MAX_MESSAGE_SIZE)
+		return false;
+
+	payload.resize(size);
+	return size == 0 || ReadAll(&payload[0], size);
+}
+
+bool
+Connection::Poll(int timeout_ms) const
+{
+	struct pollfd p;
+	p.fd = fd;
+	p.events = POLLIN;
+	p.revents = 0;
+
+	int n;
+	do {
+		n = poll(&p, 1, timeout_ms);
+	} while(n < 0 && errno == EINTR);
+
+	return n > 0;
+}
+
+void
+Connection::ResetCounters()
+{
+	bytes_sent = 0;
+	bytes_received = 0;
+}
+
+void
+Connection::PutUint32(std::vector <unsigned char> &buffer, unsigned int value)
+{
+	buffer.push_back((unsigned char)(value >> 24));
+	buffer.push_back((unsigned char)(value >> 16));
+	buffer.push_back((unsigned char)(value >> 8));
+	buffer.push_back((unsigned char)value);
+}
+
+unsigned int
+Connection::GetUint32(const unsigned char *p)
+{
+	return ((unsigned int)p[0] << 24) | ((unsigned int)p[1] << 16) | ((unsigned int)p[2] << 8) | p[3];
+}
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __CONNECTION_H__
+#define __CONNECTION_H__
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/*
+ * Stream socket carrying messages: a type and a length followed by the
+ * payload. Addresses are "unix:PATH" for a Unix domain socket or
+ * "HOST:PORT" for TCP, where a listening address may leave HOST empty to
+ * accept connections on every interface.
+ *
+ * Integers inside payloads are written in network byte order with
+ * PutUint32() and read back with GetUint32().
+ */
+class Connection {
+	protected:
+		int fd;
+		// a listening Unix domain socket removes its path on Close()
+		std::string unix_path;
+		unsigned long bytes_sent;
+		unsigned long bytes_received;
+
+		bool WriteAll(const void *data, size_t size);
+		bool ReadAll(void *data, size_t size);
+
+	public:
+		enum { MAX_MESSAGE_SIZE = 1 << 30 };
+
+		Connection();
+		~Connection();
+
+		bool Connect(const char *address, std::string *error);
+		bool Listen(const char *address, std::string *error);
+
+		// waits for a connection to a listening socket; returns NULL
+		// on failure
+		Connection *Accept(std::string *error);
+
+		void Close();
+		inline bool IsOpen() const { return fd >= 0; }
+		inline int GetDescriptor() const { return fd; }
+
+		// the payload is head followed by data, so that bulk data
+		// needs no copy; both fail once the peer has gone away
+		bool Send(unsigned int type, const void *head, size_t head_size, const void *data = NULL, size_t size = 0);
+		bool Receive(unsigned int &type, std::vector <unsigned char> &payload);
+
+		// makes Send() fail once the peer has taken no data for the
+		// given time; 0, the default, waits indefinitely
+		bool SetSendTimeout(int timeout_ms);
+
+		// likewise makes Receive() fail once the peer has sent no data
+		// for the given time, such as partway through a message
+		bool SetReceiveTimeout(int timeout_ms);
+
+		// true if Receive() would not block, or the peer has gone away;
+		// a negative timeout waits indefinitely
+		bool Poll(int timeout_ms) const;
+
+		inline unsigned long GetBytesSent() const { return bytes_sent; }
+		inline unsigned long GetBytesReceived() const { return bytes_received; }
+		void ResetCounters();
+
+		static void PutUint32(std::vector <unsigned char> &buffer, unsigned int value);
+		static unsigned int GetUint32(const unsigned char *p);
+
+	private:
+		Connection(const Connection &);
+		Connection &operator = (const Connection &);
+};
+
+#endif /* __CONNECTION_H__ */
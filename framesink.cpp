@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// framesink.cpp - Destinations for finished tiles
+
+#include "framesink.h"
+
+const PixelLayout RGBA_LAYOUT = { 0, 1, 2, 3 };
+
+PixelLayout
+pixel_layout_from_shifts(int red_shift, int green_shift, int blue_shift)
+{
+	// the byte holding the lowest bits comes first on little endian
+	// machines and last on big endian ones
+	const unsigned int one = 1;
+	bool little = *(const unsigned char *)&one == 1;
+
+	PixelLayout layout;
+	layout.red = little ? red_shift / 8 : 3 - red_shift / 8;
+	layout.green = little ? green_shift / 8 : 3 - green_shift / 8;
+	layout.blue = little ? blue_shift / 8 : 3 - blue_shift / 8;
+	layout.alpha = 6 - layout.red - layout.green - layout.blue;
+
+	return layout;
+}
+
+void
+convert_pixels(const unsigned char *src, unsigned char *dst, size_t count, const PixelLayout &layout)
+{
+	for(size_t i = 0; i < count; i++, src += 4, dst += 4) {
+		dst[layout.red] = src[0];
+		dst[layout.green] = src[1];
+		dst[layout.blue] = src[2];
+		dst[layout.alpha] = 0xff;
+	}
+}
+
+/*
+ * PixelSink class
+ */
+PixelSink::PixelSink()
+{
+	pthread_mutex_init(&lock, NULL);
+}
+
+PixelSink::~PixelSink()
+{
+	pthread_mutex_destroy(&lock);
+}
+
+void
+PixelSink::TileDone(const unsigned char *, int, int x0, int y0, int x1, int y1)
+{
+	Region r = { x0, y0, x1, y1 };
+	pthread_mutex_lock(&lock);
+	finished.push_back(r);
+	pthread_mutex_unlock(&lock);
+}
+
+void
+PixelSink::TakeFinished(std::vector <Region> &regions)
+{
+	regions.clear();
+
+	pthread_mutex_lock(&lock);
+	regions.swap(finished);
+	pthread_mutex_unlock(&lock);
+}
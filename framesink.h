@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __FRAMESINK_H__
+#define __FRAMESINK_H__
+
+#include <vector>
+#include <pthread.h>
+
+/*
+ * Where the colour channels of a 32-bit pixel sit, as byte offsets;
+ * the remaining byte, alpha, is always 0xff. Frames are RGBA unless
+ * the raytracer is given another layout, such as a window surface's.
+ */
+struct PixelLayout {
+	int red, green, blue, alpha;
+};
+
+extern const PixelLayout RGBA_LAYOUT;
+
+// the layout of pixels whose channels sit at the given bit shifts of a
+// 32-bit word in native byte order, as window systems describe them
+PixelLayout pixel_layout_from_shifts(int red_shift, int green_shift, int blue_shift);
+
+// rewrites count RGBA pixels from src into dst in the given layout
+void convert_pixels(const unsigned char *src, unsigned char *dst, size_t count, const PixelLayout &layout);
+
+/*
+ * Receives the pixels of a frame as they are finished. The raytracer
+ * calls TileDone() from its render threads once each tile of the last
+ * pass is complete, with the tile's pixels in the framebuffer being
+ * drawn into, in the raytracer's pixel layout; tiles never overlap, but
+ * several may be handed over at once.
+ */
+class FrameSink {
+	public:
+		virtual ~FrameSink() { }
+
+		virtual void TileDone(const unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1) = 0;
+};
+
+/*
+ * Queues the regions of a frame finished so far, so that another thread
+ * can present them while rendering goes on. The frame is drawn straight
+ * into what is presented, such as a window surface in its own pixel
+ * layout, so nothing is copied.
+ */
+class PixelSink : public FrameSink {
+	public:
+		// pixels [x0, x1) x [y0, y1)
+		struct Region {
+			int x0, y0;
+			int x1, y1;
+		};
+
+	protected:
+		pthread_mutex_t lock;
+		std::vector <Region> finished;
+
+	public:
+		PixelSink();
+		virtual ~PixelSink();
+
+		virtual void TileDone(const unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1);
+
+		// moves the regions finished since the last call into regions,
+		// replacing its contents
+		void TakeFinished(std::vector <Region> &regions);
+
+	private:
+		PixelSink(const PixelSink &);
+		PixelSink &operator = (const PixelSink &);
+};
+
+#endif /* __FRAMESINK_H__ */
@@ -0,0 +1,375 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// image.cpp - PPM and PNG image output
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "image.h"
+#include "trace.h"
+
+static bool
+write_file(const char *filename, const std::vector <unsigned char> &data)
+{
+	TRACE_SCOPE(trace, "write file", "output");
+
+	FILE *fp = fopen(filename, "wb");
+	if(!fp)
+		return false;
+
+	if(!data.empty())
+		fwrite(&data[0], 1, data.size(), fp);
+
+	bool ok = !ferror(fp);
+	if(fclose(fp) != 0)
+		ok = false;
+
+	return ok;
+}
+
+void
+encode_ppm(const unsigned char *framebuf, int width, int height, std::vector <unsigned char> &out)
+{
+	TRACE_SCOPE(trace, "encode ppm", "output");
+
+	char header[64];
+	int header_len = sprintf(header, "P6\n%d %d\n255\n", width, height);
+
+	out.resize((size_t)header_len + (size_t)width * height * 3);
+	memcpy(&out[0], header, header_len);
+
+	unsigned char *dst = &out[header_len];
+	for(size_t i = 0; i < (size_t)width * height; i++) {
+		dst[i * 3 + 0] = framebuf[i * 4 + 0];
+		dst[i * 3 + 1] = framebuf[i * 4 + 1];
+		dst[i * 3 + 2] = framebuf[i * 4 + 2];
+	}
+}
+
+bool
+write_ppm(const char *filename, const unsigned char *framebuf, int width, int height)
+{
+	std::vector <unsigned char> data;
+	encode_ppm(framebuf, width, height, data);
+
+	return write_file(filename, data);
+}
+
+/*
+ * PNG output. The image data is stored with uncompressed deflate blocks,
+ * which needs no zlib and costs nothing to encode.
+ */
+// built before main(), so threads encoding at once only ever read it
+struct CrcTable {
+	unsigned int entries[256];
+
+	CrcTable()
+	{
+		for(unsigned int n = 0; n < 256; n++) {
+			unsigned int c = n;
+			for(int k = 0; k < 8; k++)
+				c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+			entries[n] = c;
+		}
+	}
+};
+
+static const CrcTable crc_table;
+
+static unsigned int
+update_crc(unsigned int crc, const unsigned char *buf, size_t len)
+{
+	for(size_t i = 0; i < len; i++)
+		crc = crc_table.entries[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+static void
+put_u32(unsigned char *p, unsigned int v)
+{
+	p[0] = (unsigned char)(v >> 24);
+	p[1] = (unsigned char)(v >> 16);
+	p[2] = (unsigned char)(v >> 8);
+	p[3] = (unsigned char)v;
+}
+
+static void
+put_png_chunk(std::vector <unsigned char> &out, const char *type, const unsigned char *data, size_t len)
+{
+	unsigned char buf[4];
+
+	put_u32(buf, (unsigned int)len);
+	out.insert(out.end(), buf, buf + 4);
+	out.insert(out.end(), type, type + 4);
+	if(len > 0)
+		out.insert(out.end(), data, data + len);
+
+	unsigned int crc = update_crc(0xffffffffu, (const unsigned char *)type, 4);
+	crc = update_crc(crc, data, len);
+	put_u32(buf, crc ^ 0xffffffffu);
+	out.insert(out.end(), buf, buf + 4);
+}
+
+// the signature and IHDR chunk
+static void
+put_png_header(std::vector <unsigned char> &out, int width, int height)
+{
+	static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+	out.insert(out.end(), signature, signature + 8);
+
+	unsigned char ihdr[13];
+	put_u32(ihdr + 0, (unsigned int)width);
+	put_u32(ihdr + 4, (unsigned int)height);
+	ihdr[8] = 8;  // bit depth
+	ihdr[9] = 2;  // truecolour
+	ihdr[10] = 0; // deflate
+	ihdr[11] = 0; // adaptive filtering
+	ihdr[12] = 0; // no interlace
+	put_png_chunk(out, "IHDR", ihdr, sizeof(ihdr));
+}
+
+// appends raw scanlines, each prefixed with filter type 0
+static void
+put_png_rows(std::vector <unsigned char> &raw, const unsigned char *rows, int width, int count)
+{
+	size_t row_len = (size_t)width * 3 + 1;
+	size_t first = raw.size();
+	raw.resize(first + row_len * count);
+
+	for(int y = 0; y < count; y++) {
+		unsigned char *dst = &raw[first + row_len * y];
+		const unsigned char *src = rows + (size_t)y * width * 4;
+		dst[0] = 0;
+		for(int x = 0; x < width; x++) {
+			dst[1 + x * 3 + 0] = src[x * 4 + 0];
+			dst[1 + x * 3 + 1] = src[x * 4 + 1];
+			dst[1 + x * 3 + 2] = src[x * 4 + 2];
+		}
+	}
+}
+
+// appends raw to a zlib stream as stored blocks of at most 65535 bytes,
+// updating the stream's Adler-32 sums; last marks the final block
+static void
+put_stored_blocks(std::vector <unsigned char> &z, const std::vector <unsigned char> &raw, bool last,
+                  unsigned int &s1, unsigned int &s2)
+{
+	const size_t max_block = 65535;
+	size_t num_blocks = (raw.size() + max_block - 1) / max_block;
+	z.reserve(z.size() + raw.size() + num_blocks * 5 + 6);
+
+	for(size_t i = 0; i < raw.size(); i++) {
+		s1 = (s1 + raw[i]) % 65521;
+		s2 = (s2 + s1) % 65521;
+	}
+
+	for(size_t pos = 0; pos < raw.size(); pos += max_block) {
+		size_t len = raw.size() - pos;
+		if(len > max_block)
+			len = max_block;
+
+		z.push_back((last && pos + len == raw.size()) ? 1 : 0);
+		z.push_back((unsigned char)len);
+		z.push_back((unsigned char)(len >> 8));
+		z.push_back((unsigned char)~len);
+		z.push_back((unsigned char)(~len >> 8));
+		z.insert(z.end(), raw.begin() + pos, raw.begin() + pos + len);
+	}
+}
+
+void
+encode_png(const unsigned char *framebuf, int width, int height, std::vector <unsigned char> &out)
+{
+	TRACE_SCOPE(trace, "encode png", "output");
+
+	out.clear();
+	put_png_header(out, width, height);
+
+	std::vector <unsigned char> raw;
+	put_png_rows(raw, framebuf, width, height);
+
+	std::vector <unsigned char> z;
+	z.push_back(0x78);
+	z.push_back(0x01);
+
+	unsigned int s1 = 1, s2 = 0;
+	put_stored_blocks(z, raw, true, s1, s2);
+
+	unsigned char adler[4];
+	put_u32(adler, (s2 << 16) | s1);
+	z.insert(z.end(), adler, adler + 4);
+
+	out.reserve(out.size() + z.size() + 24);
+	put_png_chunk(out, "IDAT", &z[0], z.size());
+	put_png_chunk(out, "IEND", NULL, 0);
+}
+
+bool
+write_png(const char *filename, const unsigned char *framebuf, int width, int height)
+{
+	std::vector <unsigned char> data;
+	encode_png(framebuf, width, height, data);
+
+	return write_file(filename, data);
+}
+
+bool
+write_image(const char *filename, const unsigned char *framebuf, int width, int height)
+{
+	size_t len = strlen(filename);
+
+	if(len >= 4 && (strcmp(filename + len - 4, ".png") == 0 || strcmp(filename + len - 4, ".PNG") == 0))
+		return write_png(filename, framebuf, width, height);
+
+	return write_ppm(filename, framebuf, width, height);
+}
+
+/*
+ * StripedImageWriter class
+ */
+StripedImageWriter::StripedImageWriter()
+{
+	fp = NULL;
+	width = 0;
+	height = 0;
+	rows_written = 0;
+	png = false;
+	adler_s1 = 1;
+	adler_s2 = 0;
+	failed = false;
+}
+
+StripedImageWriter::~StripedImageWriter()
+{
+	if(fp)
+		fclose(fp);
+}
+
+bool
+StripedImageWriter::Open(const char *filename, int width_arg, int height_arg)
+{
+	if(fp)
+		fclose(fp);
+
+	fp = fopen(filename, "wb");
+	if(!fp)
+		return false;
+
+	width = width_arg;
+	height = height_arg;
+	rows_written = 0;
+	adler_s1 = 1;
+	adler_s2 = 0;
+	failed = false;
+
+	size_t len = strlen(filename);
+	png = len >= 4 && (strcmp(filename + len - 4, ".png") == 0 || strcmp(filename + len - 4, ".PNG") == 0);
+
+	buffer.clear();
+	if(png) {
+		put_png_header(buffer, width, height);
+	} else {
+		char header[64];
+		int header_len = sprintf(header, "P6\n%d %d\n255\n", width, height);
+		buffer.assign(header, header + header_len);
+	}
+
+	return Flush();
+}
+
+bool
+StripedImageWriter::Flush()
+{
+	if(!buffer.empty() && fwrite(&buffer[0], 1, buffer.size(), fp) != buffer.size())
+		failed = true;
+	buffer.clear();
+
+	return !failed;
+}
+
+bool
+StripedImageWriter::WriteRows(const unsigned char *rows, int count)
+{
+	if(!fp || failed || count <= 0 || rows_written + count > height)
+		return false;
+
+	TRACE_SCOPE(trace, "write band", "output");
+	TRACE_ARG(trace, "rows", count);
+
+	if(png) {
+		// one IDAT chunk per band; the zlib stream runs across them
+		raw.clear();
+		put_png_rows(raw, rows, width, count);
+
+		zdata.clear();
+		if(rows_written == 0) {
+			zdata.push_back(0x78);
+			zdata.push_back(0x01);
+		}
+
+		bool last = rows_written + count == height;
+		put_stored_blocks(zdata, raw, last, adler_s1, adler_s2);
+		if(last) {
+			unsigned char adler[4];
+			put_u32(adler, (adler_s2 << 16) | adler_s1);
+			zdata.insert(zdata.end(), adler, adler + 4);
+		}
+
+		put_png_chunk(buffer, "IDAT", &zdata[0], zdata.size());
+	} else {
+		buffer.resize((size_t)width * count * 3);
+		for(size_t i = 0; i < (size_t)width * count; i++) {
+			buffer[i * 3 + 0] = rows[i * 4 + 0];
+			buffer[i * 3 + 1] = rows[i * 4 + 1];
+			buffer[i * 3 + 2] = rows[i * 4 + 2];
+		}
+	}
+	rows_written += count;
+
+	return Flush();
+}
+
+bool
+StripedImageWriter::Close()
+{
+	if(!fp)
+		return false;
+
+	bool ok = !failed && rows_written == height;
+	if(ok && png) {
+		put_png_chunk(buffer, "IEND", NULL, 0);
+		ok = Flush();
+	}
+
+	if(ferror(fp))
+		ok = false;
+	if(fclose(fp) != 0)
+		ok = false;
+	fp = NULL;
+
+	return ok;
+}
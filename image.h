@@ -0,0 +1,85 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __IMAGE_H__
+#define __IMAGE_H__
+
+#include <cstdio>
+#include <vector>
+
+/*
+ * Writers for RGBA framebuffers as filled by RayTracer::Draw(). The alpha
+ * channel is dropped. All return false if the file can't be written.
+ */
+bool write_ppm(const char *filename, const unsigned char *framebuf, int width, int height);
+bool write_png(const char *filename, const unsigned char *framebuf, int width, int height);
+
+// the same formats encoded into memory, replacing the contents of out
+void encode_ppm(const unsigned char *framebuf, int width, int height, std::vector <unsigned char> &out);
+void encode_png(const unsigned char *framebuf, int width, int height, std::vector <unsigned char> &out);
+
+// picks the format from the file name's extension (.png, otherwise PPM)
+bool write_image(const char *filename, const unsigned char *framebuf, int width, int height);
+
+/*
+ * Writes an image a band of rows at a time, for images too large to
+ * hold in memory: as PPM, or as PNG with an IDAT chunk per band. Only
+ * one band is buffered. The format is picked from the file name as by
+ * write_image().
+ */
+class StripedImageWriter {
+	protected:
+		FILE *fp;
+		int width;
+		int height;
+		int rows_written;
+		bool png;
+		unsigned int adler_s1;
+		unsigned int adler_s2;
+		bool failed;
+		std::vector <unsigned char> buffer;
+		std::vector <unsigned char> raw;
+		std::vector <unsigned char> zdata;
+
+		bool Flush();
+
+	public:
+		StripedImageWriter();
+		~StripedImageWriter();
+
+		bool Open(const char *filename, int width_arg, int height_arg);
+
+		// appends count rows of RGBA pixels, top to bottom
+		bool WriteRows(const unsigned char *rows, int count);
+
+		// finishes the file; fails if a write failed or rows are missing
+		bool Close();
+
+	private:
+		StripedImageWriter(const StripedImageWriter &);
+		StripedImageWriter &operator = (const StripedImageWriter &);
+};
+
+#endif /* __IMAGE_H__ */
@@ -25,89 +25,1004 @@
 
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#ifndef HEADLESS
+#include <pthread.h>
 #include <SDL/SDL.h>
+#endif
+#include "bandrender.h"
 #include "objects.h"
 #include "raytracer.h"
+#include "renderfarm.h"
+#include "renderserver.h"
+#include "image.h"
+#include "scenecache.h"
+#include "scenefile.h"
+#include "scenegen.h"
+#include "timer.h"
+#include "trace.h"
+#include "viewer.h"
 
-#define WINWIDTH 640
-#define WINHEIGHT 480
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
 #define FULLSCREEN 0
+// how often finished tiles are pushed to the window while drawing
+#define DISPLAY_INTERVAL_MS 16
+// frame rate the window scales its resolution to hold while moving
+#define DEFAULT_FPS 30.0f
+// window controls: units moved and radians turned per second a key is
+// held, radians turned per pixel dragged, and the field of view scale
+// per wheel step
+#define MOVE_SPEED 4.0f
+#define TURN_SPEED 1.5f
+#define MOUSE_TURN 0.005f
+#define ZOOM_STEP 0.9
+// longest time step applied to held keys, so a stall doesn't jump
+#define MAX_STEP_SECONDS 0.1f
+// where the frame time overlay goes in the window, and its magnification
+#define OVERLAY_X 4
+#define OVERLAY_Y 4
+#define OVERLAY_SIZE 2
+
+struct Options {
+	int width;
+	int height;
+	const char *output;
+	unsigned int threads;
+	int tile_size;
+	int packet_size;
+	bool wavefront;
+	int aa_rate;
+	float aa_threshold;
+	int shadows;
+	int termination;
+	const char *scene_file;
+	const char *export_file;
+	const char *cache_file;
+	const char *worker_address;
+	const char *workers;
+	const char *server_address;
+	const char *server;
+	unsigned int cache_scenes;
+	float fps;
+	const char *heatmap;
+	PixelStats::Metric heatmap_metric;
+	float budget;
+	int band_rows;
+	bool crop;
+	RayTracer::TileRect region;
+	const char *trace_file;
+};
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "usage: %s [options]\n", progname);
+	fprintf(stderr, "  -w WIDTH    frame width (default %d)\n", DEFAULT_WIDTH);
+	fprintf(stderr, "  -h HEIGHT   frame height (default %d)\n", DEFAULT_HEIGHT);
+#ifdef HEADLESS
+	fprintf(stderr, "  -o FILE     write the frame to FILE (.png or .ppm, default render.ppm)\n");
+#else
+	fprintf(stderr, "  -o FILE     render headless and write the frame to FILE (.png or .ppm)\n");
+#endif
+	fprintf(stderr, "              PNGs are written uncompressed, about the size of a PPM\n");
+	fprintf(stderr, "  -t THREADS  render threads (default: one per CPU)\n");
+	fprintf(stderr, "  -s SIZE     tile size in pixels (default 32)\n");
+	fprintf(stderr, "  -p SIZE     primary ray packet size: 1, 4, 8 or 16 (default 1)\n");
+	fprintf(stderr, "  -m MODE     reflection shading: recursive or wavefront (default recursive)\n");
+	fprintf(stderr, "  -a RATE     adaptive antialiasing, up to RATE samples per edge pixel: 4, 16 or 64\n");
+	fprintf(stderr, "  -A LEVEL    colour difference (0-255) that marks an edge (default %d)\n", RayTracer::DEFAULT_AA_THRESHOLD);
+	fprintf(stderr, "  -S on|off   trace shadow rays (default: as set by the scene)\n");
+	fprintf(stderr, "  -T POLICY   reflection termination: depth, throughput or roulette (default: as\n");
+	fprintf(stderr, "              set by the scene)\n");
+	fprintf(stderr, "  -i FILE     load the scene from FILE instead of the built-in scene\n");
+	fprintf(stderr, "  -x FILE     write the scene to FILE in the text scene format\n");
+	fprintf(stderr, "  -c FILE     use FILE as a compiled scene cache, rebuilding it when stale\n");
+	fprintf(stderr, "  -D ADDRS    spread the frame over the render workers at the comma-separated\n");
+	fprintf(stderr, "              addresses (HOST:PORT or unix:PATH)\n");
+	fprintf(stderr, "  -W ADDRESS  run as a render worker listening on ADDRESS (HOST:PORT, :PORT\n");
+	fprintf(stderr, "              or unix:PATH)\n");
+	fprintf(stderr, "  -B ROWS     render in bands of ROWS rows (0 picks a size) written straight to\n");
+	fprintf(stderr, "              the output file, never holding the whole frame in memory\n");
+	fprintf(stderr, "  -r X,Y,W,H  write only the W x H region at (X, Y) of the frame; implies -B 0\n");
+	fprintf(stderr, "              unless given\n");
+	fprintf(stderr, "  -R ADDRESS  run as a render server listening on ADDRESS, keeping scenes\n");
+	fprintf(stderr, "              built between requests\n");
+	fprintf(stderr, "  -C SCENES   number of scenes the render server keeps built (default %d)\n",
+	        RenderServer::DEFAULT_CACHE_SCENES);
+	fprintf(stderr, "  -Q ADDRESS  have the render server at ADDRESS draw the frame, naming the\n");
+	fprintf(stderr, "              scene by its -i path, and print the server's statistics\n");
+	fprintf(stderr, "  -H FILE     write a heatmap of each pixel's render cost to FILE; not with -D\n");
+	fprintf(stderr, "  -M METRIC   heatmap cost: rays, tests, depth or time (default time)\n");
+	fprintf(stderr, "  -b MS       draw the frame coarse to fine, stopping after MS milliseconds;\n");
+	fprintf(stderr, "              without antialiasing, and not with -D or -H\n");
+	fprintf(stderr, "  -j FILE     write a timeline of each thread's work to FILE in the Chrome\n");
+	fprintf(stderr, "              trace format, for Perfetto; not with -W, -R or -Q\n");
+#ifndef HEADLESS
+	fprintf(stderr, "  -f FPS      frame rate to hold while moving the view, lowering the\n");
+	fprintf(stderr, "              resolution as needed (default %g)\n", DEFAULT_FPS);
+#endif
+}
+
+static bool
+parse_options(int argc, char *argv[], Options *options)
+{
+	options->width = DEFAULT_WIDTH;
+	options->height = DEFAULT_HEIGHT;
+#ifdef HEADLESS
+	options->output = "render.ppm";
+#else
+	options->output = NULL;
+#endif
+	options->threads = 0;
+	options->tile_size = 32;
+	options->packet_size = 1;
+	options->wavefront = false;
+	options->aa_rate = 1;
+	options->aa_threshold = RayTracer::DEFAULT_AA_THRESHOLD;
+	options->shadows = -1;
+	options->termination = -1;
+	options->scene_file = NULL;
+	options->export_file = NULL;
+	options->cache_file = NULL;
+	options->worker_address = NULL;
+	options->workers = NULL;
+	options->server_address = NULL;
+	options->server = NULL;
+	options->cache_scenes = RenderServer::DEFAULT_CACHE_SCENES;
+	options->fps = DEFAULT_FPS;
+	options->heatmap = NULL;
+	options->heatmap_metric = PixelStats::METRIC_TIME;
+	options->budget = 0.0f;
+	options->band_rows = -1;
+	options->crop = false;
+	options->trace_file = NULL;
+
+	for(int i = 1; i < argc; i++) {
+		if(argv[i][0] != '-' || strlen(argv[i]) != 2 || i + 1 >= argc)
+			return false;
+
+		const char *arg = argv[++i];
+		switch(argv[i - 1][1]) {
+			default:
+				return false;
+			case 'w':
+				options->width = atoi(arg);
+				break;
+			case 'h':
+				options->height = atoi(arg);
+				break;
+			case 'o':
+				options->output = arg;
+				break;
+			case 't':
+				options->threads = (unsigned int)atoi(arg);
+				break;
+			case 's':
+				options->tile_size = atoi(arg);
+				break;
+			case 'p':
+				options->packet_size = atoi(arg);
+				break;
+			case 'm':
+				if(strcmp(arg, "wavefront") == 0)
+					options->wavefront = true;
+				else if(strcmp(arg, "recursive") == 0)
+					options->wavefront = false;
+				else
+					return false;
+				break;
+			case 'a':
+				options->aa_rate = atoi(arg);
+				break;
+			case 'A':
+				options->aa_threshold = (float)atof(arg);
+				break;
+			case 'S':
+				if(strcmp(arg, "on") == 0)
+					options->shadows = 1;
+				else if(strcmp(arg, "off") == 0)
+					options->shadows = 0;
+				else
+					return false;
+				break;
+			case 'T': {
+				Scene::Termination termination;
+				if(!Scene::ParseTermination(arg, termination))
+					return false;
+				options->termination = termination;
+				break;
+			}
+			case 'i':
+				options->scene_file = arg;
+				break;
+			case 'x':
+				options->export_file = arg;
+				break;
+			case 'c':
+				options->cache_file = arg;
+				break;
+			case 'D':
+				options->workers = arg;
+				break;
+			case 'W':
+				options->worker_address = arg;
+				break;
+			case 'B':
+				options->band_rows = atoi(arg);
+				break;
+			case 'r': {
+				int x, y, w, h;
+				if(sscanf(arg, "%d,%d,%d,%d", &x, &y, &w, &h) != 4)
+					return false;
+				options->crop = true;
+				options->region.x0 = x;
+				options->region.y0 = y;
+				options->region.x1 = x + w;
+				options->region.y1 = y + h;
+				break;
+			}
+			case 'R':
+				options->server_address = arg;
+				break;
+			case 'C':
+				options->cache_scenes = (unsigned int)atoi(arg);
+				break;
+			case 'Q':
+				options->server = arg;
+				break;
+			case 'H':
+				options->heatmap = arg;
+				break;
+			case 'M':
+				if(!PixelStats::ParseMetric(arg, options->heatmap_metric))
+					return false;
+				break;
+			case 'b':
+				options->budget = (float)atof(arg);
+				break;
+			case 'j':
+				options->trace_file = arg;
+				break;
+#ifndef HEADLESS
+			case 'f':
+				options->fps = (float)atof(arg);
+				break;
+#endif
+		}
+	}
+
+	return options->width > 0 && options->height > 0 && options->fps > 0.0f && options->budget >= 0.0f;
+}
 
 static void
-handle_key_event(SDL_Event *event)
+print_stats(const RayTracer &raytracer)
+{
+	const BVH::BuildStats bstats = raytracer.GetScene().GetBuildStats();
+	const RayTracer::FrameStats &fstats = raytracer.GetFrameStats();
+
+	printf("BVH: %u objects, %u nodes, %u leaves, depth %u, SAH cost %.2f, built in %.3f ms\n",
+	       bstats.primitive_count, bstats.node_count, bstats.leaf_count,
+	       bstats.max_depth, bstats.sah_cost, bstats.build_seconds * 1000.0);
+	if(fstats.rays > 0) {
+		// the traversal counters cover shadow rays too
+		double traced = (double)(fstats.rays + fstats.shadow_rays);
+		printf("Frame: %.3f ms, %lu rays, %.2f nodes/ray, %.2f tests/ray\n",
+		       fstats.draw_seconds * 1000.0, fstats.rays,
+		       (double)fstats.nodes_visited / traced,
+		       (double)fstats.primitive_tests / traced);
+	}
+	if(fstats.shadow_rays > 0) {
+		printf("Shadows: %lu occlusion queries, %lu blocked (%.1f%%), %lu occluder cache hits (%.1f%% of blocked)\n",
+		       fstats.shadow_rays, fstats.shadow_hits,
+		       100.0 * (double)fstats.shadow_hits / (double)fstats.shadow_rays,
+		       fstats.occluder_cache_hits,
+		       fstats.shadow_hits ? 100.0 * (double)fstats.occluder_cache_hits / (double)fstats.shadow_hits : 0.0);
+	}
+	if(raytracer.GetAntialiasRate() > 1) {
+		printf("Antialiasing: %lu pixels refined (%.1f%%), %lu extra rays (+%.1f%%)\n",
+		       fstats.aa_pixels, 100.0 * (double)fstats.aa_pixels / (double)fstats.primary_rays,
+		       fstats.aa_rays, 100.0 * (double)fstats.aa_rays / (double)fstats.primary_rays);
+	}
+}
+
+static void
+print_pixel_stats(const PixelStats &pixel_stats)
+{
+	PixelStats::Totals totals;
+	pixel_stats.GetTotals(totals);
+	if(totals.pixels == 0)
+		return;
+
+	double pixels = (double)totals.pixels;
+	printf("Pixels: %.2f rays (max %u), %.1f tests (max %u), reflection depth up to %u, "
+	       "%.0f ns (max %u); costliest 10%% took %.1f%% of the time\n",
+	       (double)totals.rays / pixels, totals.max_rays, (double)totals.tests / pixels, totals.max_tests,
+	       totals.max_depth, totals.seconds * 1.0e9 / pixels, totals.max_nanoseconds,
+	       100.0 * totals.top_decile_share);
+}
+
+static void
+print_farm_stats(const RenderCoordinator &coordinator)
+{
+	const RenderCoordinator::FrameStats &fstats = coordinator.GetFrameStats();
+
+	for(unsigned int i = 0; i < coordinator.GetWorkerCount(); i++) {
+		const RenderCoordinator::WorkerStats &wstats = coordinator.GetWorkerStats(i);
+		printf("Worker %s: %u threads, %u tiles, %.2f Mpixels/s, %lu rays, %lu bytes out, %lu bytes in%s\n",
+		       wstats.address.c_str(), wstats.threads, wstats.tiles,
+		       wstats.render_seconds > 0.0 ? (double)wstats.pixels / wstats.render_seconds * 1.0e-6 : 0.0,
+		       wstats.rays, wstats.bytes_sent, wstats.bytes_received, wstats.failed ? " (failed)" : "");
+	}
+	printf("Farm: %.3f ms, %u tiles, %u reissued (%u timed out), %u rendered locally, %lu bytes out, %lu bytes in\n",
+	       fstats.draw_seconds * 1000.0, fstats.tiles, fstats.reissued_tiles, fstats.expired_tiles, fstats.local_tiles,
+	       fstats.bytes_sent, fstats.bytes_received);
+}
+
+// renders locally, or across the workers when a coordinator is given
+static void
+draw_frame(RayTracer &raytracer, RenderCoordinator *coordinator, unsigned char *framebuf, const Options &options)
+{
+	printf("Drawing scene...\n");
+	if(coordinator) {
+		coordinator->Draw(framebuf, options.width, options.height);
+		printf("Done.\n");
+		print_farm_stats(*coordinator);
+	} else if(options.budget > 0.0f) {
+		float partial;
+		int size = raytracer.DrawProgressive(framebuf, options.width, options.height, options.budget / 1000.0, &partial);
+		if(size > 1)
+			printf("Stopped at %dx%d blocks, %.1f%% of the next level refined.\n", size, size, partial * 100.0f);
+		else
+			printf("Done.\n");
+		print_stats(raytracer);
+	} else {
+		raytracer.Draw(framebuf, options.width, options.height);
+		printf("Done.\n");
+		print_stats(raytracer);
+	}
+}
+
+static int
+render_headless(RayTracer &raytracer, RenderCoordinator *coordinator, const Options &options)
+{
+	unsigned char *framebuf = new unsigned char[(size_t)options.width * options.height * 4];
+
+	draw_frame(raytracer, coordinator, framebuf, options);
+
+	bool ok = write_image(options.output, framebuf, options.width, options.height);
+	if(ok)
+		printf("Wrote %s\n", options.output);
+	else
+		perror(options.output);
+
+	const PixelStats *pixel_stats = raytracer.GetPixelStats();
+	if(ok && pixel_stats) {
+		print_pixel_stats(*pixel_stats);
+
+		pixel_stats->DrawHeatmap(options.heatmap_metric, framebuf);
+		ok = write_image(options.heatmap, framebuf, options.width, options.height);
+		if(ok)
+			printf("Wrote %s\n", options.heatmap);
+		else
+			perror(options.heatmap);
+	}
+
+	delete [] framebuf;
+
+	return ok ? 0 : 1;
+}
+
+static bool
+load_text_scene(Scene &scene, const Options &options)
+{
+	if(!options.scene_file) {
+		generate_scene(scene, SCENE_DEFAULT, 0, 0);
+		return true;
+	}
+
+	SceneLoadStats stats;
+	std::string error;
+	if(!load_scene(options.scene_file, scene, &stats, &error)) {
+		fprintf(stderr, "%s: %s\n", options.scene_file, error.c_str());
+		return false;
+	}
+	printf("Loaded %s: %u objects, %u lines, %lu bytes in %.3f ms\n", options.scene_file,
+	       stats.objects, stats.lines, stats.bytes, stats.parse_seconds * 1000.0);
+	if(stats.triangles > 0)
+		printf("Meshes: %lu triangles\n", stats.triangles);
+
+	return true;
+}
+
+// uses the cache when it is up to date, otherwise loads the scene and
+// compiles a fresh cache for the next run
+static bool
+setup_scene(Scene &scene, const Options &options)
+{
+	if(!options.cache_file)
+		return load_text_scene(scene, options);
+
+	SceneCacheStats stats;
+	std::string error;
+	if(load_scene_cache(options.cache_file, scene, options.scene_file, &stats, &error)) {
+		printf("Mapped %s: %u spheres, %u nodes, %lu bytes in %.3f ms\n", options.cache_file,
+		       stats.spheres, stats.nodes, stats.bytes, stats.load_seconds * 1000.0);
+		return true;
+	}
+	printf("%s: %s; rebuilding\n", options.cache_file, error.c_str());
+
+	if(!load_text_scene(scene, options))
+		return false;
+
+	scene.Build();
+	if(!save_scene_cache(options.cache_file, scene, options.scene_file, &error))
+		fprintf(stderr, "%s: %s\n", options.cache_file, error.c_str());
+	else
+		printf("Wrote %s\n", options.cache_file);
+
+	return true;
+}
+
+#ifndef HEADLESS
+// returns false when the window should close
+static bool
+handle_key_event(const SDL_Event *event, float &speed)
 {
 	switch(event->key.keysym.sym) {
 		default:
 			break;
 		case SDLK_ESCAPE:
-			SDL_Quit();
-			exit(0);
+			return false;
+		case SDLK_EQUALS:
+			speed *= 2.0f;
+			break;
+		case SDLK_MINUS:
+			speed *= 0.5f;
 			break;
 	}
+
+	return true;
 }
 
-static void
-handle_event(SDL_Event *event)
+// returns false when the window should close; moved is set if the
+// view changed
+static bool
+handle_event(const SDL_Event *event, CameraControl &control, float &speed, bool &moved)
 {
 	switch(event->type) {
 		default:
 			break;
+		case SDL_QUIT:
+			return false;
 		case SDL_KEYDOWN:
-			handle_key_event(event);
+			return handle_key_event(event, speed);
+		case SDL_MOUSEMOTION:
+			if(event->motion.state & SDL_BUTTON(SDL_BUTTON_LEFT)) {
+				control.Turn(event->motion.xrel * MOUSE_TURN, -event->motion.yrel * MOUSE_TURN);
+				moved = true;
+			}
+			break;
+		case SDL_MOUSEBUTTONDOWN:
+			if(event->button.button == SDL_BUTTON_WHEELUP) {
+				control.Zoom(ZOOM_STEP);
+				moved = true;
+			} else if(event->button.button == SDL_BUTTON_WHEELDOWN) {
+				control.Zoom(1.0 / ZOOM_STEP);
+				moved = true;
+			}
 			break;
 	}
+
+	return true;
 }
 
-int
-main(int argc, char *argv[])
+// moves the view for the keys held down over the last dt seconds;
+// returns true if any were
+static bool
+apply_held_keys(CameraControl &control, float speed, float dt)
+{
+	const Uint8 *keys = SDL_GetKeyState(NULL);
+	float ahead = (float)(keys[SDLK_w] != 0) - (float)(keys[SDLK_s] != 0);
+	float across = (float)(keys[SDLK_d] != 0) - (float)(keys[SDLK_a] != 0);
+	float rise = (float)(keys[SDLK_e] != 0) - (float)(keys[SDLK_q] != 0);
+	float yaw = (float)(keys[SDLK_RIGHT] != 0) - (float)(keys[SDLK_LEFT] != 0);
+	float pitch = (float)(keys[SDLK_UP] != 0) - (float)(keys[SDLK_DOWN] != 0);
+
+	if(ahead == 0.0f && across == 0.0f && rise == 0.0f && yaw == 0.0f && pitch == 0.0f)
+		return false;
+
+	control.Move(ahead * speed * dt, across * speed * dt, rise * speed * dt);
+	control.Turn(yaw * TURN_SPEED * dt, pitch * TURN_SPEED * dt);
+
+	return true;
+}
+
+// what the window front end shares with its draw thread
+struct WindowDraw {
+	RayTracer *raytracer;
+	Scene *scene;
+	RenderCoordinator *coordinator;
+	PixelSink *sink;
+	// the window surface, in the raytracer's pixel layout
+	unsigned char *pixels;
+	const Options *options;
+
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	// the view the main thread wants drawn next
+	Camera camera;
+	bool camera_changed;
+	bool quit;
+};
+
+/*
+ * Draws frames until told to quit. While the view moves, frames are
+ * sized to hold the target frame rate and upscaled for the window; once
+ * it stops, the view is drawn once more at full size, straight into the
+ * window surface with tiles shown as they finish, and the thread waits
+ * for the next move.
+ */
+static void *
+window_draw_main(void *arg)
+{
+	WindowDraw *draw = (WindowDraw *)arg;
+	const Options &options = *draw->options;
+
+	Trace::SetThreadName("draw");
+	int width = options.width;
+	int height = options.height;
+
+	// smaller frames are drawn here before being scaled up into the
+	// surface
+	std::vector <unsigned char> small;
+	ResolutionScaler scaler(width, height, 1.0 / options.fps);
+
+	bool full = false;
+	for(;;) {
+		pthread_mutex_lock(&draw->lock);
+		while(!draw->quit && !draw->camera_changed && full)
+			pthread_cond_wait(&draw->wake, &draw->lock);
+		bool quit = draw->quit;
+		bool moving = draw->camera_changed;
+		if(moving)
+			draw->scene->GetCamera() = draw->camera;
+		draw->camera_changed = false;
+		pthread_mutex_unlock(&draw->lock);
+
+		if(quit)
+			break;
+
+		int w = width;
+		int h = height;
+		if(moving)
+			scaler.GetFrameSize(w, h);
+		full = (w == width && h == height);
+
+		if(!full)
+			small.resize((size_t)w * h * 4);
+		unsigned char *framebuf = full ? draw->pixels : &small[0];
+
+		// the render farm fills the frame without going through the sink
+		draw->raytracer->SetFrameSink(full ? draw->sink : NULL);
+		double start = timer_seconds();
+		if(draw->coordinator)
+			draw->coordinator->Draw(framebuf, w, h);
+		else
+			draw->raytracer->Draw(framebuf, w, h);
+		double seconds = timer_seconds() - start;
+		scaler.FrameDone(seconds, w, h);
+
+		if(!full)
+			upscale_frame(framebuf, w, h, draw->pixels, width, height);
+
+		char text[64];
+		sprintf(text, "%.1f MS %dX%d %d%%", seconds * 1000.0, w, h, (int)(100.0f * w / width + 0.5f));
+		draw_text(draw->pixels, width, height, OVERLAY_X, OVERLAY_Y, text, OVERLAY_SIZE);
+
+		// the sink was handed every tile of a full frame drawn here, so
+		// only the overlay is new; farm and scaled frames reach the
+		// surface without it
+		if(full && !draw->coordinator) {
+			int text_width, text_height;
+			get_text_size(text, OVERLAY_SIZE, text_width, text_height);
+			int x1 = (OVERLAY_X + text_width < width) ? OVERLAY_X + text_width : width;
+			int y1 = (OVERLAY_Y + text_height < height) ? OVERLAY_Y + text_height : height;
+			draw->sink->TileDone(draw->pixels, width, OVERLAY_X, OVERLAY_Y, x1, y1);
+		} else {
+			draw->sink->TileDone(draw->pixels, width, 0, 0, width, height);
+		}
+
+		if(!moving) {
+			if(draw->coordinator)
+				print_farm_stats(*draw->coordinator);
+			else
+				print_stats(*draw->raytracer);
+		}
+	}
+
+	draw->raytracer->SetFrameSink(NULL);
+
+	return NULL;
+}
+
+static void
+present_regions(SDL_Surface *screen, PixelSink &sink, std::vector <PixelSink::Region> &regions,
+                std::vector <SDL_Rect> &rects)
+{
+	sink.TakeFinished(regions);
+	if(regions.empty())
+		return;
+
+	rects.resize(regions.size());
+	for(unsigned int i = 0; i < regions.size(); i++) {
+		rects[i].x = (Sint16)regions[i].x0;
+		rects[i].y = (Sint16)regions[i].y0;
+		rects[i].w = (Uint16)(regions[i].x1 - regions[i].x0);
+		rects[i].h = (Uint16)(regions[i].y1 - regions[i].y0);
+	}
+	SDL_UpdateRects(screen, (int)rects.size(), &rects[0]);
+}
+
+static int
+render_window(RayTracer &raytracer, Scene &scene, RenderCoordinator *coordinator, const Options &options)
 {
 	if(SDL_Init(SDL_INIT_VIDEO) != 0)
 		return 1;
 
-	SDL_Surface *screen = SDL_SetVideoMode(WINWIDTH, WINHEIGHT, 32, SDL_HWSURFACE | (FULLSCREEN ? SDL_FULLSCREEN : 0));
-	if(!screen) {
+	// the render threads draw straight into the surface, so it has to
+	// be one that needs no locking, with rows a frame apart
+	SDL_Surface *screen = SDL_SetVideoMode(options.width, options.height, 32, SDL_SWSURFACE | (FULLSCREEN ? SDL_FULLSCREEN : 0));
+	if(!screen || SDL_MUSTLOCK(screen) || screen->pitch != options.width * 4) {
 		SDL_Quit();
 		return 1;
 	}
 
-	// create framebuf for RayTracer
-	unsigned char *framebuf = new unsigned char[WINWIDTH * WINHEIGHT * 4];
-	for(unsigned int i = 0; i < WINWIDTH*WINHEIGHT*4; i++)
-		framebuf[i] = 0xff;
+	const SDL_PixelFormat *format = screen->format;
+	raytracer.SetPixelLayout(pixel_layout_from_shifts(format->Rshift, format->Gshift, format->Bshift));
+	PixelSink sink;
 
-	RayTracer raytracer;
+	WindowDraw draw;
+	draw.raytracer = &raytracer;
+	draw.scene = &scene;
+	draw.coordinator = coordinator;
+	draw.sink = &sink;
+	draw.pixels = (unsigned char *)screen->pixels;
+	draw.options = &options;
+	draw.camera = scene.GetCamera();
+	draw.camera_changed = false;
+	draw.quit = false;
+	pthread_mutex_init(&draw.lock, NULL);
+	pthread_cond_init(&draw.wake, NULL);
 
-	printf("Drawing scene...\n");
-	raytracer.Draw(framebuf, WINWIDTH, WINHEIGHT);
-	printf("Done.\n");
-
-	SDL_LockSurface(screen);
-	const unsigned int *buf = (unsigned int *)framebuf;
-	unsigned int max = WINWIDTH * WINHEIGHT;
-	unsigned int *pixels = (unsigned int *)screen->pixels;
-	for(unsigned int i = 0; i < max; i++) {
-		unsigned int p;
-
-		p = (buf[i] >> 24) & 0xff;
-		p <<= 8;
-		p |= (buf[i] >> 0) & 0xff;
-		p <<= 8;
-		p |= (buf[i] >> 8) & 0xff;
-		p <<= 8;
-		p |= (buf[i] >> 16) & 0xff;
-
-		pixels[i] = p;
-	}
-	SDL_UnlockSurface(screen);
-	SDL_UpdateRect(screen, 0, 0, 0, 0);
-	delete [] framebuf;
+	CameraControl control(draw.camera);
+	float speed = MOVE_SPEED;
 
-	for(;;) {
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, window_draw_main, &draw) != 0) {
+		SDL_Quit();
+		return 1;
+	}
+	printf("W/A/S/D/Q/E move, arrows or dragging turn, the wheel zooms, -/= change speed, Esc quits\n");
+
+	std::vector <PixelSink::Region> regions;
+	std::vector <SDL_Rect> rects;
+	Uint32 last = SDL_GetTicks();
+	for(bool running = true; running; ) {
+		SDL_Delay(DISPLAY_INTERVAL_MS);
+		present_regions(screen, sink, regions, rects);
+
+		Uint32 now = SDL_GetTicks();
+		float dt = (float)(now - last) * 0.001f;
+		if(dt > MAX_STEP_SECONDS)
+			dt = MAX_STEP_SECONDS;
+		last = now;
+
+		bool moved = false;
 		SDL_Event event;
+		while(SDL_PollEvent(&event)) {
+			if(!handle_event(&event, control, speed, moved))
+				running = false;
+		}
+		if(apply_held_keys(control, speed, dt))
+			moved = true;
 
-		while(SDL_PollEvent(&event))
-			handle_event(&event);
+		if(moved) {
+			pthread_mutex_lock(&draw.lock);
+			control.Apply(draw.camera);
+			draw.camera_changed = true;
+			pthread_cond_signal(&draw.wake);
+			pthread_mutex_unlock(&draw.lock);
+		}
 	}
 
+	pthread_mutex_lock(&draw.lock);
+	draw.quit = true;
+	pthread_cond_signal(&draw.wake);
+	pthread_mutex_unlock(&draw.lock);
+
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&draw.wake);
+	pthread_mutex_destroy(&draw.lock);
+	SDL_Quit();
+
 	return 0;
 }
+#endif
+
+static int
+run_worker(const Options &options)
+{
+	RenderWorker worker(options.threads);
+	std::string error;
+	if(!worker.Listen(options.worker_address, &error)) {
+		fprintf(stderr, "%s: %s\n", options.worker_address, error.c_str());
+		return 1;
+	}
+	printf("Listening on %s\n", options.worker_address);
+	fflush(stdout);
+
+	worker.Run();
+
+	return 1;
+}
+
+static int
+run_server(const Options &options)
+{
+	RenderServer server(options.threads, options.cache_scenes);
+	std::string error;
+	if(!server.Listen(options.server_address, &error)) {
+		fprintf(stderr, "%s: %s\n", options.server_address, error.c_str());
+		return 1;
+	}
+	printf("Listening on %s\n", options.server_address);
+	fflush(stdout);
+
+	server.Run();
+
+	return 1;
+}
+
+// draws the frame on a render server and writes the image it returns
+static int
+render_remote(const Options &options)
+{
+	if(!options.output) {
+		fprintf(stderr, "-Q needs -o\n");
+		return 1;
+	}
+
+	RenderClient client;
+	std::string error;
+	if(!client.Connect(options.server, &error)) {
+		fprintf(stderr, "%s: %s\n", options.server, error.c_str());
+		return 1;
+	}
+
+	RenderServer::Request request;
+	if(options.scene_file)
+		request.scene = options.scene_file;
+	request.width = options.width;
+	request.height = options.height;
+	size_t len = strlen(options.output);
+	bool png = len >= 4 && (strcmp(options.output + len - 4, ".png") == 0 || strcmp(options.output + len - 4, ".PNG") == 0);
+	request.format = png ? RenderServer::FORMAT_PNG : RenderServer::FORMAT_PPM;
+	request.aa_rate = options.aa_rate;
+	if(options.shadows >= 0)
+		request.shadows = options.shadows ? RenderServer::SHADOWS_ON : RenderServer::SHADOWS_OFF;
+	request.budget_seconds = options.budget / 1000.0;
+
+	std::vector <unsigned char> image;
+	RenderServer::Reply reply;
+	std::string stats;
+	if(!client.Render(request, image, &reply, &error) || !client.GetStats(stats, &error)) {
+		fprintf(stderr, "%s: %s\n", options.server, error.c_str());
+		return 1;
+	}
+	printf("Rendered %s on %s: queued %.3f ms, drawn and encoded in %.3f ms\n", request.scene.c_str(),
+	       options.server, reply.queued_seconds * 1000.0, reply.render_seconds * 1000.0);
+
+	FILE *fp = fopen(options.output, "wb");
+	bool ok = fp && fwrite(&image[0], 1, image.size(), fp) == image.size();
+	if(fp && fclose(fp) != 0)
+		ok = false;
+	if(!ok) {
+		perror(options.output);
+		return 1;
+	}
+	printf("Wrote %s\n", options.output);
+
+	printf("Server statistics:\n%s", stats.c_str());
+
+	return 0;
+}
+
+// renders the frame, or the -r region of it, band by band straight to
+// the output file
+static int
+render_banded(RayTracer &raytracer, const Options &options)
+{
+	RayTracer::TileRect region = { 0, 0, options.width, options.height };
+	if(options.crop)
+		region = options.region;
+
+	BandRenderer renderer(&raytracer);
+	renderer.SetBandRows(options.band_rows > 0 ? options.band_rows : 0);
+
+	printf("Drawing scene in bands...\n");
+	std::string error;
+	if(!renderer.Render(options.output, options.width, options.height, region, &error)) {
+		fprintf(stderr, "%s: %s\n", options.output, error.c_str());
+		return 1;
+	}
+
+	const BandRenderer::Stats &stats = renderer.GetStats();
+	printf("Wrote %s: %dx%d at (%d, %d) of %dx%d\n", options.output, region.x1 - region.x0,
+	       region.y1 - region.y0, region.x0, region.y0, options.width, options.height);
+	printf("Bands: %d of %d rows, %.1f MB of band buffers, %lu rays\n", stats.bands, stats.band_rows,
+	       (double)stats.buffer_bytes / (1024.0 * 1024.0), stats.rays);
+	printf("Time: %.3f ms total, %.3f ms drawing, %.3f ms writing alongside, %.3f ms waiting on writes\n",
+	       stats.total_seconds * 1000.0, stats.draw_seconds * 1000.0, stats.write_seconds * 1000.0,
+	       stats.stall_seconds * 1000.0);
+
+	return 0;
+}
+
+// draws the frame in the way the options ask for
+static int
+render(RayTracer &raytracer, Scene &scene, RenderCoordinator *coordinator, const Options &options)
+{
+#ifndef HEADLESS
+	if(!options.output)
+		return render_window(raytracer, scene, coordinator, options);
+#endif
+
+	if(options.band_rows >= 0 || options.crop)
+		return render_banded(raytracer, options);
+
+	return render_headless(raytracer, coordinator, options);
+}
+
+static bool
+write_trace(const char *filename)
+{
+	Trace::Stop();
+
+	std::string error;
+	if(!Trace::Write(filename, &error)) {
+		fprintf(stderr, "%s: %s\n", filename, error.c_str());
+		return false;
+	}
+
+	printf("Wrote %s\n", filename);
+	unsigned long dropped = Trace::GetDroppedEvents();
+	if(dropped > 0)
+		printf("Trace: the oldest %lu events were overwritten\n", dropped);
+
+	return true;
+}
+
+// connects to each worker in the comma-separated list; workers that
+// can't be reached are left out
+static void
+add_workers(RenderCoordinator &coordinator, const char *workers)
+{
+	std::string list = workers;
+	size_t start = 0;
+	while(start <= list.size()) {
+		size_t end = list.find(',', start);
+		if(end == std::string::npos)
+			end = list.size();
+
+		std::string address = list.substr(start, end - start);
+		std::string error;
+		if(!address.empty() && !coordinator.AddWorker(address.c_str(), &error))
+			fprintf(stderr, "%s: %s\n", address.c_str(), error.c_str());
+
+		start = end + 1;
+	}
+
+	printf("Connected to %u of the render workers\n", coordinator.GetWorkerCount());
+}
+
+int
+main(int argc, char *argv[])
+{
+	Options options;
+
+	if(!parse_options(argc, argv, &options)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+	if(options.trace_file && (options.worker_address || options.server_address || options.server)) {
+		fprintf(stderr, "-j can't be used with -W, -R or -Q\n");
+		return 1;
+	}
+
+	if(options.worker_address)
+		return run_worker(options);
+	if(options.server_address)
+		return run_server(options);
+	if(options.server)
+		return render_remote(options);
+
+	if(options.trace_file) {
+		if(!TRACE_ENABLED) {
+			fprintf(stderr, "tracing was compiled out (NO_TRACE)\n");
+			return 1;
+		}
+		Trace::SetThreadName("main");
+		Trace::Start();
+	}
+
+	Scene scene;
+	if(!setup_scene(scene, options))
+		return 1;
+
+	if(options.shadows >= 0)
+		scene.SetShadows(options.shadows != 0);
+	if(options.termination >= 0)
+		scene.SetTermination((Scene::Termination)options.termination);
+
+	if(options.export_file) {
+		unsigned int skipped;
+		if(!save_scene(options.export_file, scene, &skipped)) {
+			perror(options.export_file);
+			return 1;
+		}
+		printf("Wrote %s\n", options.export_file);
+		if(skipped > 0)
+			fprintf(stderr, "%s: left out %u objects the text scene format can't describe\n",
+			        options.export_file, skipped);
+	}
+
+	RayTracer raytracer(&scene);
+	raytracer.SetThreadCount(options.threads);
+	raytracer.SetTileSize(options.tile_size);
+	raytracer.SetPacketSize(options.packet_size);
+	raytracer.SetWavefront(options.wavefront);
+	raytracer.SetAntialiasing(options.aa_rate, options.aa_threshold);
+
+	bool banded = options.band_rows >= 0 || options.crop;
+	if(banded && (options.workers || options.heatmap || options.budget > 0.0f || !options.output)) {
+		fprintf(stderr, "%s\n", !options.output ? "-B and -r need -o" :
+		        "-B and -r can't be used with -D, -H or -b");
+		return 1;
+	}
+
+	if(options.budget > 0.0f && (options.workers || options.heatmap)) {
+		fprintf(stderr, "-b can't be used with %s\n", options.workers ? "-D" : "-H");
+		return 1;
+	}
+
+	// the counters are kept by the threads that trace each pixel, so
+	// there are none for pixels rendered by workers
+	PixelStats pixel_stats;
+	if(options.heatmap) {
+		if(!PIXEL_STATS_ENABLED || options.workers) {
+			fprintf(stderr, "%s\n", options.workers ? "-H can't be used with -D" :
+			        "per-pixel statistics were compiled out (NO_PIXEL_STATS)");
+			return 1;
+		}
+		raytracer.SetPixelStats(&pixel_stats);
+	}
+
+	RenderCoordinator *coordinator = NULL;
+	if(options.workers) {
+		coordinator = new RenderCoordinator(&raytracer);
+		add_workers(*coordinator, options.workers);
+	}
+
+	int status = render(raytracer, scene, coordinator, options);
+
+	delete coordinator;
+
+	if(options.trace_file && !write_trace(options.trace_file))
+		status = 1;
+
+	return status;
+}
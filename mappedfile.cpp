@@ -0,0 +1,100 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// mappedfile.cpp - Read-only file mappings
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mappedfile.h"
+
+/*
+ * MappedFile class
+ */
+MappedFile::MappedFile()
+{
+	data = NULL;
+	size = 0;
+}
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool
+MappedFile::Open(const char *filename, std::string *error)
+{
+	Close();
+
+	int fd = open(filename, O_RDONLY);
+	if(fd < 0) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	struct stat st;
+	if(fstat(fd, &st) != 0) {
+		if(error)
+			*error = strerror(errno);
+		close(fd);
+		return false;
+	}
+	if(st.st_size == 0) {
+		// mmap() refuses empty mappings
+		if(error)
+			*error = "empty file";
+		close(fd);
+		return false;
+	}
+
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	int mmap_errno = errno;
+	close(fd);
+	if(p == MAP_FAILED) {
+		if(error)
+			*error = strerror(mmap_errno);
+		return false;
+	}
+
+	data = p;
+	size = (size_t)st.st_size;
+
+	return true;
+}
+
+void
+MappedFile::Close()
+{
+	if(data)
+		munmap(data, size);
+
+	data = NULL;
+	size = 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// mathtest.cpp - Checks the Vector operators against the scalar reference
+
+#include <cstdio>
+#include <cstring>
+#include "my_math.h"
+#include "scalarmath.h"
+
+#define TEST_INPUTS 1000
+
+static int failures = 0;
+static int checks = 0;
+
+static float
+test_random(unsigned int &state)
+{
+	state = state * 1664525u + 1013904223u;
+
+	// spread over a few orders of magnitude, either sign
+	float f = (float)(state >> 8) / 16777216.0f;
+	float scale = (float)(1 << ((state >> 4) % 8)) / 16.0f;
+	return (state & 1) ? f * scale : -f * scale;
+}
+
+// the lanes must match bit for bit, since Vector is meant to do exactly
+// the scalar arithmetic
+static void
+check(const char *op, unsigned int input, const float *got, const float *want, int n)
+{
+	checks++;
+	if(memcmp(got, want, sizeof(float) * n) == 0)
+		return;
+
+	failures++;
+	if(failures <= 10) {
+		fprintf(stderr, "%s, input %u: got", op, input);
+		for(int i = 0; i < n; i++)
+			fprintf(stderr, " %.9g", got[i]);
+		fprintf(stderr, ", want");
+		for(int i = 0; i < n; i++)
+			fprintf(stderr, " %.9g", want[i]);
+		fprintf(stderr, "\n");
+	}
+}
+
+static void
+check_vector(const char *op, unsigned int input, const Vector &got, const ScalarVector &want)
+{
+	check(op, input, got.vec, want.vec, 3);
+}
+
+static void
+check_float(const char *op, unsigned int input, float got, float want)
+{
+	check(op, input, &got, &want, 1);
+}
+
+// garbage in the padding lane mustn't reach the other three
+static Vector
+make_vector(float x, float y, float z)
+{
+	Vector v(x, y, z);
+	v.vec[3] = 1.0e30f;
+
+	return v;
+}
+
+static void
+test_layout()
+{
+	Vector array[3];
+
+	checks++;
+	if(sizeof(Vector) != 16 || __alignof__(Vector) != 16 || ((size_t)&array[1] & 15) != 0) {
+		fprintf(stderr, "layout: Vector is %u bytes, aligned to %u\n", (unsigned int)sizeof(Vector),
+		        (unsigned int)__alignof__(Vector));
+		failures++;
+	}
+}
+
+static void
+test_ops(unsigned int input, const float a[3], const float b[3], float f)
+{
+	Vector va = make_vector(a[0], a[1], a[2]), vb = make_vector(b[0], b[1], b[2]);
+	ScalarVector sa(a[0], a[1], a[2]), sb(b[0], b[1], b[2]);
+
+	check_vector("+ float", input, va + f, sa + f);
+	check_vector("+ Vector", input, va + vb, sa + sb);
+	check_vector("- float", input, va - f, sa - f);
+	check_vector("- Vector", input, va - vb, sa - sb);
+	check_vector("* float", input, va * f, sa * f);
+	check_vector("* Vector", input, va * vb, sa * sb);
+	check_vector("/ float", input, va / f, sa / f);
+	check_vector("/ Vector", input, va / vb, sa / sb);
+
+	Vector v;
+	ScalarVector s;
+	v = va; v += f; s = sa; s += f; check_vector("+= float", input, v, s);
+	v = va; v += vb; s = sa; s += sb; check_vector("+= Vector", input, v, s);
+	v = va; v -= f; s = sa; s -= f; check_vector("-= float", input, v, s);
+	v = va; v -= vb; s = sa; s -= sb; check_vector("-= Vector", input, v, s);
+	v = va; v *= f; s = sa; s *= f; check_vector("*= float", input, v, s);
+	v = va; v *= vb; s = sa; s *= sb; check_vector("*= Vector", input, v, s);
+	v = va; v /= f; s = sa; s /= f; check_vector("/= float", input, v, s);
+	v = va; v /= vb; s = sa; s /= sb; check_vector("/= Vector", input, v, s);
+
+	v = va; v.Scale(f); s = sa; s.Scale(f); check_vector("Scale", input, v, s);
+	v = va; v.Normalize(); s = sa; s.Normalize(); check_vector("Normalize", input, v, s);
+	v = va; v.Add(&vb); s = sa; s.Add(&sb); check_vector("Add", input, v, s);
+	v = va; v.Subtract(&vb); s = sa; s.Subtract(&sb); check_vector("Subtract", input, v, s);
+	v = va; v.Clear(); s = sa; s.Clear(); check_vector("Clear", input, v, s);
+	v = va; v.Set(b); s = sa; s.Set(b); check_vector("Set", input, v, s);
+
+	check_float("dot_product", input, dot_product(va.vec, vb.vec), scalar_dot_product(sa.vec, sb.vec));
+
+	float got[3], want[3];
+	cross_product(va.vec, vb.vec, got);
+	scalar_cross_product(sa.vec, sb.vec, want);
+	check("cross_product", input, got, want, 3);
+
+	for(int i = 0; i < 3; i++)
+		got[i] = want[i] = a[i];
+	normalize(got);
+	scalar_normalize(want);
+	check("normalize", input, got, want, 3);
+}
+
+int
+main()
+{
+	unsigned int state = 1;
+
+	test_layout();
+
+	for(unsigned int i = 0; i < TEST_INPUTS; i++) {
+		float a[3], b[3];
+		for(int j = 0; j < 3; j++) {
+			a[j] = test_random(state);
+			b[j] = test_random(state);
+		}
+
+		// no divisions by zero; the reference and Vector agree on
+		// those too, but the results aren't worth comparing
+		for(int j = 0; j < 3; j++) {
+			if(b[j] == 0.0f)
+				b[j] = 1.0f;
+		}
+		float f = test_random(state);
+		if(f == 0.0f)
+			f = 1.0f;
+
+		test_ops(i, a, b, f);
+	}
+
+	printf("%s: %d of %d checks failed (%s Vector)\n", failures ? "FAIL" : "ok", failures, checks,
+	       VECTOR_SSE ? "SSE" : "scalar");
+
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,424 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// mesh.cpp - Triangle mesh object
+
+#include <cmath>
+#include "mesh.h"
+
+// hits closer than this are taken to be the surface the ray leaves from
+const float MIN_HIT_T = 1.0e-4f;
+
+const float NO_HIT_T = 9999999.0f;
+
+/*
+ * The watertight test of Woop, Benthin and Wald: the triangle is moved
+ * into a space where the ray runs along +z from the origin, so whether
+ * the ray passes an edge comes down to the sign of a 2D cross product
+ * that every triangle sharing the edge computes identically.
+ */
+struct ShearedRay {
+	float origin[3];
+	int kx, ky, kz;
+	float sx, sy, sz;
+};
+
+static void
+shear_ray(const Ray &ray, ShearedRay &r)
+{
+	const float *o = ray.GetOrigin().vec;
+	const float *d = ray.GetDirection().vec;
+
+	r.kz = 0;
+	for(int i = 1; i < 3; i++) {
+		if(fabsf(d[i]) > fabsf(d[r.kz]))
+			r.kz = i;
+	}
+	r.kx = (r.kz + 1) % 3;
+	r.ky = (r.kx + 1) % 3;
+	// keep the winding of the triangles as seen along the ray
+	if(d[r.kz] < 0.0f) {
+		int tmp = r.kx;
+		r.kx = r.ky;
+		r.ky = tmp;
+	}
+
+	r.sx = d[r.kx] / d[r.kz];
+	r.sy = d[r.ky] / d[r.kz];
+	r.sz = 1.0f / d[r.kz];
+	for(int i = 0; i < 3; i++)
+		r.origin[i] = o[i];
+}
+
+// lowers closest_t and returns true if the ray hits the triangle closer
+// than closest_t
+static inline bool
+intersect_triangle(const ShearedRay &r, const float *a, const float *b, const float *c, float &closest_t)
+{
+	float az = a[r.kz] - r.origin[r.kz];
+	float bz = b[r.kz] - r.origin[r.kz];
+	float cz = c[r.kz] - r.origin[r.kz];
+	float ax = a[r.kx] - r.origin[r.kx] - r.sx * az;
+	float ay = a[r.ky] - r.origin[r.ky] - r.sy * az;
+	float bx = b[r.kx] - r.origin[r.kx] - r.sx * bz;
+	float by = b[r.ky] - r.origin[r.ky] - r.sy * bz;
+	float cx = c[r.kx] - r.origin[r.kx] - r.sx * cz;
+	float cy = c[r.ky] - r.origin[r.ky] - r.sy * cz;
+
+	float u = cx * by - cy * bx;
+	float v = ax * cy - ay * cx;
+	float w = bx * ay - by * ax;
+
+	// a ray right on an edge is decided in double precision, where
+	// the products are exact
+	if(u == 0.0f || v == 0.0f || w == 0.0f) {
+		u = (float)((double)cx * by - (double)cy * bx);
+		v = (float)((double)ax * cy - (double)ay * cx);
+		w = (float)((double)bx * ay - (double)by * ax);
+	}
+
+	if((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f))
+		return false;
+
+	float det = u + v + w;
+	if(det == 0.0f)
+		return false;
+
+	// t scaled by det, so the range tests need no division
+	float t = (u * az + v * bz + w * cz) * r.sz;
+	if(det < 0.0f) {
+		det = -det;
+		t = -t;
+	}
+	if(t <= MIN_HIT_T * det || t >= closest_t * det)
+		return false;
+
+	closest_t = t / det;
+
+	return true;
+}
+
+static inline Vector
+to_vector(const float *f)
+{
+	return Vector(f[0], f[1], f[2]);
+}
+
+struct TriangleLeaf {
+	const ShearedRay *ray;
+	const float *positions;
+	const unsigned int *triangles;
+	bool hit;
+
+	inline void operator () (unsigned int first, unsigned int n, float &closest_t)
+	{
+		for(const unsigned int *t = triangles + first * 3; n > 0; n--, t += 3) {
+			if(intersect_triangle(*ray, positions + t[0] * 3, positions + t[1] * 3, positions + t[2] * 3, closest_t))
+				hit = true;
+		}
+	}
+};
+
+/*
+ * Mesh class
+ */
+Mesh::Mesh()
+{
+	bounds_min.Clear();
+	bounds_max.Clear();
+}
+
+unsigned int
+Mesh::AddVertex(const Vector &position)
+{
+	positions.push_back(position.vec[0]);
+	positions.push_back(position.vec[1]);
+	positions.push_back(position.vec[2]);
+
+	return GetVertexCount() - 1;
+}
+
+unsigned int
+Mesh::AddNormal(const Vector &normal)
+{
+	normals.push_back(normal.vec[0]);
+	normals.push_back(normal.vec[1]);
+	normals.push_back(normal.vec[2]);
+
+	return GetNormalCount() - 1;
+}
+
+void
+Mesh::AddTriangle(unsigned int a, unsigned int b, unsigned int c)
+{
+	triangles.push_back(a);
+	triangles.push_back(b);
+	triangles.push_back(c);
+
+	if(!triangle_normals.empty())
+		triangle_normals.resize(triangles.size(), NO_NORMAL);
+}
+
+void
+Mesh::AddTriangle(unsigned int a, unsigned int b, unsigned int c,
+                  unsigned int na, unsigned int nb, unsigned int nc)
+{
+	// the normal indices are only stored once some triangle has them
+	triangle_normals.resize(triangles.size(), NO_NORMAL);
+	triangle_normals.push_back(na);
+	triangle_normals.push_back(nb);
+	triangle_normals.push_back(nc);
+
+	triangles.push_back(a);
+	triangles.push_back(b);
+	triangles.push_back(c);
+}
+
+void
+Mesh::Reserve(unsigned int vertex_count, unsigned int triangle_count)
+{
+	positions.reserve((size_t)vertex_count * 3);
+	triangles.reserve((size_t)triangle_count * 3);
+}
+
+void
+Mesh::Build()
+{
+	unsigned int count = GetTriangleCount();
+	if(count == 0) {
+		bvh.Clear();
+		bounds_min.Clear();
+		bounds_max.Clear();
+		return;
+	}
+
+	std::vector <BVH::BuildPrimitive> build_prims(count);
+	for(unsigned int i = 0; i < count; i++) {
+		const float *p = GetPosition(triangles[i * 3]);
+		Vector min = to_vector(p);
+		Vector max = to_vector(p);
+		for(int j = 1; j < 3; j++) {
+			p = GetPosition(triangles[i * 3 + j]);
+			for(int k = 0; k < 3; k++) {
+				if(p[k] < min.vec[k])
+					min.vec[k] = p[k];
+				if(p[k] > max.vec[k])
+					max.vec[k] = p[k];
+			}
+		}
+		BVH::MakeBuildPrimitive(build_prims[i], min, max, i);
+	}
+
+	bvh.Build(build_prims);
+
+	// the root box covers every triangle
+	const BVH::Node &root = bvh.GetNodes()[0];
+	bounds_min = Vector(root.min[0], root.min[1], root.min[2]);
+	bounds_max = Vector(root.max[0], root.max[1], root.max[2]);
+
+	// put the triangles in leaf order
+	std::vector <unsigned int> sorted((size_t)count * 3);
+	for(unsigned int i = 0; i < count; i++) {
+		const unsigned int *src = &triangles[build_prims[i].index * 3];
+		sorted[i * 3] = src[0];
+		sorted[i * 3 + 1] = src[1];
+		sorted[i * 3 + 2] = src[2];
+	}
+	triangles.swap(sorted);
+
+	if(!triangle_normals.empty()) {
+		std::vector <unsigned int> sorted_normals((size_t)count * 3);
+		for(unsigned int i = 0; i < count; i++) {
+			const unsigned int *src = &triangle_normals[build_prims[i].index * 3];
+			sorted_normals[i * 3] = src[0];
+			sorted_normals[i * 3 + 1] = src[1];
+			sorted_normals[i * 3 + 2] = src[2];
+		}
+		triangle_normals.swap(sorted_normals);
+	}
+
+	// loaders grow the vertex arrays as they go; drop the slack
+	std::vector <float>(positions).swap(positions);
+	std::vector <float>(normals).swap(normals);
+}
+
+unsigned long
+Mesh::GetMemoryUsage() const
+{
+	return (positions.capacity() + normals.capacity()) * sizeof(float) +
+	       (triangles.capacity() + triangle_normals.capacity()) * sizeof(unsigned int) +
+	       bvh.GetMemoryUsage();
+}
+
+bool
+Mesh::Intersection(const Ray &ray, float *t_arg) const
+{
+	// the hierarchy is in object space
+	Ray local;
+	const Ray *r = &ray;
+	if(origin.vec[0] != 0.0f || origin.vec[1] != 0.0f || origin.vec[2] != 0.0f) {
+		local.SetOrigin(ray.GetOrigin() - origin);
+		local.SetDirection(ray.GetDirection());
+		r = &local;
+	}
+
+	ShearedRay sheared;
+	shear_ray(*r, sheared);
+
+	TriangleLeaf leaf;
+	leaf.ray = &sheared;
+	leaf.positions = positions.empty() ? NULL : &positions[0];
+	leaf.triangles = triangles.empty() ? NULL : &triangles[0];
+	leaf.hit = false;
+
+	float closest_t = NO_HIT_T;
+	bvh.Traverse(*r, closest_t, leaf);
+	if(!leaf.hit)
+		return false;
+
+	if(t_arg)
+		*t_arg = closest_t;
+
+	return true;
+}
+
+/*
+ * Finds the triangle a hit point lies on by walking the nodes whose boxes
+ * hold the point. Of the triangles the point is inside of, allowing for
+ * rounding, the one whose plane it is nearest wins. u and v receive the
+ * point's barycentric coordinates along the triangle's second and third
+ * corners.
+ */
+unsigned int
+Mesh::FindTriangle(const Vector &p, float *u, float *v) const
+{
+	if(bvh.IsEmpty())
+		return NO_HIT;
+
+	float extent = 1.0f;
+	for(int i = 0; i < 3; i++) {
+		extent = fmaxf(extent, fabsf(bounds_min.vec[i]));
+		extent = fmaxf(extent, fabsf(bounds_max.vec[i]));
+	}
+	float tolerance = extent * 1.0e-4f;
+
+	const BVH::Node *nodes = bvh.GetNodes();
+	unsigned int stack[BVH::STACK_SIZE];
+	unsigned int stack_size = 0;
+	unsigned int index = 0;
+
+	unsigned int best = NO_HIT;
+	float best_distance = NO_HIT_T;
+	bool best_inside = false;
+
+	for(;;) {
+		const BVH::Node &node = nodes[index];
+		bool contains = true;
+		for(int i = 0; i < 3; i++) {
+			if(p.vec[i] < node.min[i] - tolerance || p.vec[i] > node.max[i] + tolerance)
+				contains = false;
+		}
+
+		if(contains && node.count == 0) {
+			stack[stack_size++] = node.offset;
+			index = index + 1;
+			continue;
+		}
+
+		for(unsigned int i = node.offset; contains && i < node.offset + node.count; i++) {
+			const unsigned int *t = &triangles[i * 3];
+			Vector a = to_vector(GetPosition(t[0]));
+			Vector e1 = to_vector(GetPosition(t[1])) - a;
+			Vector e2 = to_vector(GetPosition(t[2])) - a;
+			Vector d = p - a;
+			Vector n;
+			cross_product(e1.vec, e2.vec, n.vec);
+
+			float area2 = dot_product(n.vec, n.vec);
+			if(area2 <= 0.0f)
+				continue;
+			float distance = fabsf(dot_product(n.vec, d.vec)) / sqrtf(area2);
+
+			float d00 = dot_product(e1.vec, e1.vec);
+			float d01 = dot_product(e1.vec, e2.vec);
+			float d11 = dot_product(e2.vec, e2.vec);
+			float d20 = dot_product(d.vec, e1.vec);
+			float d21 = dot_product(d.vec, e2.vec);
+			float denom = d00 * d11 - d01 * d01;
+			float bu = (d11 * d20 - d01 * d21) / denom;
+			float bv = (d00 * d21 - d01 * d20) / denom;
+			bool inside = bu >= -1.0e-3f && bv >= -1.0e-3f && bu + bv <= 1.001f;
+
+			// a triangle the point is inside of beats any it is outside of
+			if((inside && !best_inside) || (inside == best_inside && distance < best_distance)) {
+				best = i;
+				best_distance = distance;
+				best_inside = inside;
+				*u = bu;
+				*v = bv;
+			}
+		}
+
+		if(stack_size == 0)
+			break;
+		index = stack[--stack_size];
+	}
+
+	return best;
+}
+
+Vector
+Mesh::NormalAtSurfacePoint(const Vector &p) const
+{
+	float u = 0.0f, v = 0.0f;
+	unsigned int triangle = FindTriangle(p - origin, &u, &v);
+	if(triangle == NO_HIT)
+		return Vector(0.0f, 0.0f, -1.0f);
+
+	Vector normal;
+	const unsigned int *t = &triangles[triangle * 3];
+	const unsigned int *tn = triangle_normals.empty() ? NULL : &triangle_normals[triangle * 3];
+	if(tn && tn[0] != NO_NORMAL && tn[1] != NO_NORMAL && tn[2] != NO_NORMAL) {
+		normal = to_vector(&normals[tn[0] * 3]) * (1.0f - u - v) +
+		         to_vector(&normals[tn[1] * 3]) * u +
+		         to_vector(&normals[tn[2] * 3]) * v;
+	} else {
+		Vector a = to_vector(GetPosition(t[0]));
+		Vector e1 = to_vector(GetPosition(t[1])) - a;
+		Vector e2 = to_vector(GetPosition(t[2])) - a;
+		normal.Clear();
+		cross_product(e1.vec, e2.vec, normal.vec);
+	}
+	normal.Normalize();
+
+	return normal;
+}
+
+void
+Mesh::GetBounds(Vector &min, Vector &max) const
+{
+	min = bounds_min + origin;
+	max = bounds_max + origin;
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __MESH_H__
+#define __MESH_H__
+
+#include <string>
+#include <vector>
+#include "objects.h"
+#include "bvh.h"
+
+/*
+ * Triangle mesh. To the scene a mesh is a single Object; its triangles
+ * sit behind their own BVH, so a mesh costs one entry in the scene's
+ * object hierarchy however many triangles it has. Vertices are in
+ * object space and the object's origin translates the whole mesh.
+ *
+ * Triangles are added by vertex index, and Build() must be called once
+ * they are all in, before the mesh is added to a scene. A triangle may
+ * carry a normal index per corner, for smooth shading; otherwise its
+ * face normal is used, facing the side from which the corners run
+ * counterclockwise.
+ *
+ * Rays are tested with the watertight ray/triangle test, so a ray can't
+ * slip through the shared edge of two triangles. A mesh can shadow
+ * itself; the scene starts shadow rays just off the surface so a ray
+ * doesn't hit the triangle it leaves.
+ */
+class Mesh : public Object {
+	protected:
+		enum { NO_NORMAL = 0xffffffff };
+
+		std::vector <float> positions;
+		std::vector <float> normals;
+		// three vertex indices per triangle, in leaf order once built
+		std::vector <unsigned int> triangles;
+		// three normal indices per triangle, or empty when no triangle
+		// has normals
+		std::vector <unsigned int> triangle_normals;
+
+		BVH bvh;
+		Vector bounds_min;
+		Vector bounds_max;
+		std::string source;
+
+		inline const float *GetPosition(unsigned int vertex) const { return &positions[vertex * 3]; }
+		unsigned int FindTriangle(const Vector &p, float *u, float *v) const;
+
+	public:
+		Mesh();
+
+		unsigned int AddVertex(const Vector &position);
+		unsigned int AddNormal(const Vector &normal);
+		void AddTriangle(unsigned int a, unsigned int b, unsigned int c);
+		void AddTriangle(unsigned int a, unsigned int b, unsigned int c,
+		                 unsigned int na, unsigned int nb, unsigned int nc);
+		void Reserve(unsigned int vertex_count, unsigned int triangle_count);
+
+		// builds the triangle hierarchy
+		void Build();
+
+		inline unsigned int GetVertexCount() const { return (unsigned int)(positions.size() / 3); }
+		inline unsigned int GetNormalCount() const { return (unsigned int)(normals.size() / 3); }
+		inline unsigned int GetTriangleCount() const { return (unsigned int)(triangles.size() / 3); }
+		inline const BVH &GetBVH() const { return bvh; }
+		unsigned long GetMemoryUsage() const;
+
+		// the file the mesh was loaded from, if any, for writing the
+		// scene back out
+		inline void SetSource(const std::string &source_arg) { source = source_arg; }
+		inline const std::string &GetSource() const { return source; }
+
+		// p must be a point found by Intersection(); the normal is that
+		// of the triangle it lies on
+		virtual Vector NormalAtSurfacePoint(const Vector &p) const;
+		virtual bool Intersection(const Ray &ray, float *t_arg) const;
+		virtual void GetBounds(Vector &min, Vector &max) const;
+
+	private:
+		Mesh(const Mesh &);
+		Mesh &operator = (const Mesh &);
+};
+
+#endif /* __MESH_H__ */
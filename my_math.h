@@ -28,6 +28,15 @@
 
 #include <cmath>
 
+// building with -DNO_SSE_VECTOR uses the scalar Vector operators even
+// where SSE is available
+#if defined(__SSE__) && !defined(NO_SSE_VECTOR)
+#define VECTOR_SSE 1
+#include <xmmintrin.h>
+#else
+#define VECTOR_SSE 0
+#endif
+
 #define PI_DIVBY_180 0.017453
 #define DEG2RAD(a) ((float)(a) * PI_DIVBY_180)
 #define RAD2DEG(a) (((float)(a) / M_PI) * 180.0f)
@@ -39,41 +48,93 @@ enum {
 	W = 3
 };
 
-class Vector;
+/*
+ * Everything here is inline so the hot math in the intersection and
+ * shading code can be inlined without link-time optimization.
+ */
+inline float
+dot_product(const float v1[3], const float v2[3])
+{
+	return (v1[0]*v2[0] + v1[1]*v2[1] + v1[2]*v2[2]);
+}
+
+inline void
+cross_product(const float v1[3], const float v2[3], float out[3])
+{
+	out[0] = v1[1] * v2[2] - v1[2] * v2[1];
+	out[1] = v1[2] * v2[0] - v1[0] * v2[2];
+	out[2] = v1[0] * v2[1] - v1[1] * v2[0];
+}
+
+inline void
+normalize(float v[3])
+{
+	float f;
 
-float dot_product(const float v1[3], const float v2[3]);
-void cross_product(const float v1[3], const float v2[3], float out[3]);
-void normalize(float v[3]);
+	f = 1.0f / sqrtf(dot_product(v, v));
+	v[0] *= f;
+	v[1] *= f;
+	v[2] *= f;
+}
 
+/*
+ * Three component vector stored in a 16 byte aligned float4. With SSE
+ * the component-wise operators work on the whole register at once; the
+ * fourth lane is padding, and its value is meaningless. Each lane does
+ * exactly the arithmetic of the scalar code, so results are the same
+ * either way.
+ */
 class Vector {
 	public:
-		float vec[3];
+#if VECTOR_SSE
+		union {
+			float vec[4];
+			__m128 m;
+		};
+#else
+		// aligned like the SSE layout, so Vector has the same size and
+		// alignment either way
+		float vec[4] __attribute__ ((aligned (16)));
+#endif
 
 		Vector() { }
-		Vector(float f1, float f2, float f3) { vec[0] = f1; vec[1] = f2; vec[2] = f3; }
-		void Clear();
-		void Set(const float v[3]);
-		void Scale(float f);
-		void Normalize();
-		void Add(const Vector *v);
-		void Subtract(const Vector *v);
+		Vector(float f1, float f2, float f3) { vec[0] = f1; vec[1] = f2; vec[2] = f3; vec[3] = 0.0f; }
+
+		inline void Clear() { vec[0] = 0.0f; vec[1] = 0.0f; vec[2] = 0.0f; vec[3] = 0.0f; }
+		inline void Set(const float v[3]) { vec[0] = v[0]; vec[1] = v[1]; vec[2] = v[2]; }
+		inline void Scale(float f) { *this *= f; }
+		inline void Normalize() { *this *= 1.0f / sqrtf(dot_product(vec, vec)); }
+		inline void Add(const Vector *v) { *this += *v; }
+		inline void Subtract(const Vector *v) { *this -= *v; }
+
+		inline Vector operator + (float f) const { Vector tmp = *this; return tmp += f; }
+		inline Vector operator + (const Vector &v) const { Vector tmp = *this; return tmp += v; }
+		inline Vector operator - (float f) const { Vector tmp = *this; return tmp -= f; }
+		inline Vector operator - (const Vector &v) const { Vector tmp = *this; return tmp -= v; }
+		inline Vector operator * (float f) const { Vector tmp = *this; return tmp *= f; }
+		inline Vector operator * (const Vector &v) const { Vector tmp = *this; return tmp *= v; }
+		inline Vector operator / (float f) const { Vector tmp = *this; return tmp /= f; }
+		inline Vector operator / (const Vector &v) const { Vector tmp = *this; return tmp /= v; }
 
-		Vector operator + (float f) const;
-		Vector operator + (Vector v) const;
-		Vector operator - (float f) const;
-		Vector operator - (Vector v) const;
-		Vector operator * (float f) const;
-		Vector operator * (Vector v) const;
-		Vector operator / (float f) const;
-		Vector operator / (Vector v) const;
-		Vector operator += (float f);
-		Vector operator += (Vector v);
-		Vector operator -= (float f);
-		Vector operator -= (Vector v);
-		Vector operator *= (float f);
-		Vector operator *= (Vector v);
-		Vector operator /= (float f);
-		Vector operator /= (Vector v);
+#if VECTOR_SSE
+		inline Vector &operator += (float f) { m = _mm_add_ps(m, _mm_set1_ps(f)); return *this; }
+		inline Vector &operator += (const Vector &v) { m = _mm_add_ps(m, v.m); return *this; }
+		inline Vector &operator -= (float f) { m = _mm_sub_ps(m, _mm_set1_ps(f)); return *this; }
+		inline Vector &operator -= (const Vector &v) { m = _mm_sub_ps(m, v.m); return *this; }
+		inline Vector &operator *= (float f) { m = _mm_mul_ps(m, _mm_set1_ps(f)); return *this; }
+		inline Vector &operator *= (const Vector &v) { m = _mm_mul_ps(m, v.m); return *this; }
+		inline Vector &operator /= (float f) { m = _mm_div_ps(m, _mm_set1_ps(f)); return *this; }
+		inline Vector &operator /= (const Vector &v) { m = _mm_div_ps(m, v.m); return *this; }
+#else
+		inline Vector &operator += (float f) { vec[0] += f; vec[1] += f; vec[2] += f; return *this; }
+		inline Vector &operator += (const Vector &v) { vec[0] += v.vec[0]; vec[1] += v.vec[1]; vec[2] += v.vec[2]; return *this; }
+		inline Vector &operator -= (float f) { vec[0] -= f; vec[1] -= f; vec[2] -= f; return *this; }
+		inline Vector &operator -= (const Vector &v) { vec[0] -= v.vec[0]; vec[1] -= v.vec[1]; vec[2] -= v.vec[2]; return *this; }
+		inline Vector &operator *= (float f) { vec[0] *= f; vec[1] *= f; vec[2] *= f; return *this; }
+		inline Vector &operator *= (const Vector &v) { vec[0] *= v.vec[0]; vec[1] *= v.vec[1]; vec[2] *= v.vec[2]; return *this; }
+		inline Vector &operator /= (float f) { vec[0] /= f; vec[1] /= f; vec[2] /= f; return *this; }
+		inline Vector &operator /= (const Vector &v) { vec[0] /= v.vec[0]; vec[1] /= v.vec[1]; vec[2] /= v.vec[2]; return *this; }
+#endif
 };
 
 #endif /* __DROME_MATH_H__ */
@@ -25,91 +25,30 @@
 
 #include <cstdio>
 #include "objects.h"
+#include "packet.h"
 
 #define SQUARE(x) ((x)*(x))
 
-const int MAX_REFLECTION_RECURSION = 8;
-const float AMBIENT = 0.2f;
-
-const Vector light_pos(-2.0f, -10.0f, 12.0f);
-
 /*
  * Object class
  */
 void
-Object::Sample(std::vector <Object *> &objects, const Ray &ray, float t_arg, float color_arg[4], int level)
+Object::IntersectPacket(RayPacket &packet, unsigned int id) const
 {
-	// calculate point on object
-	Vector p = ray.GetOrigin() + ray.GetDirection() * t_arg;
-
-	// calculate normal of point on object
-	Vector normal = NormalAtSurfacePoint(p);
-
-	// calculate light to point vector
-	Vector l = light_pos - p;
-	l.Normalize();
-
-	// calculate diffuse lighting
-	float diffuse = dot_product(normal.vec, l.vec);
-	diffuse += 1.0f;
-	diffuse /= 2.0f;
-	if(diffuse < AMBIENT)
-		diffuse = AMBIENT;
-
-	// calculate specular lighting
-	float specular = 0.0f;
-	Vector sv = l - normal * dot_product(l.vec, normal.vec) * 2.0f;
-	float dot = dot_product(sv.vec, ray.GetDirection().vec);
-	if(dot > 0.0f)
-		specular = SQUARE(SQUARE(SQUARE(dot)));
-
-	// write to color array
-	for(int i = 0; i < 4; i++)
-		color_arg[i] = (color[i] * diffuse * (1.0f - reflectance)) + specular;
-
-#if 1
-	if(level <= MAX_REFLECTION_RECURSION && reflectance > 0.0f) {
-		// create reflection vector
-		Vector rv = ray.GetDirection() - normal * dot_product(ray.GetDirection().vec, normal.vec) * 2.0f;
-
-		// create ray from intersection point in direction of reflection vector
-		Ray r;
-		r.SetOrigin(p);
-		r.SetDirection(rv);
-
-		Object *closest_object = NULL;
-		float closest_t = 9999999.0f;
-		for(unsigned int i = 0; i < objects.size(); i++) {
-			float t;
-			if(objects[i]->Intersection(r, &t)) {
-				if(t < closest_t) {
-					closest_object = objects[i];
-					closest_t = t;
-				}
-			}
-		}
-		if(closest_object) {
-			float fcolor[4];
-			closest_object->Sample(objects, r, closest_t, fcolor, level+1);
-			color_arg[0] += fcolor[0] * reflectance;
-			color_arg[1] += fcolor[1] * reflectance;
-			color_arg[2] += fcolor[2] * reflectance;
-			color_arg[3] += fcolor[3] * reflectance;
+	for(int i = 0; i < packet.size; i++) {
+		float t;
+		if(Intersection(packet.rays[i], &t) && t < packet.t[i]) {
+			packet.t[i] = t;
+			packet.primitive[i] = id;
 		}
 	}
-#endif
-
-	for(int i = 0; i < 4; i++) {
-		if(color_arg[i] > 1.0f)
-			color_arg[i] = 1.0f;
-	}
 }
 
 /*
  * Sphere class
  */
 Vector
-Sphere::NormalAtSurfacePoint(const Vector &p)
+Sphere::NormalAtSurfacePoint(const Vector &p) const
 {
 	Vector tmp;
 
@@ -120,7 +59,7 @@ Sphere::NormalAtSurfacePoint(const Vector &p)
 }
 
 bool
-Sphere::Intersection(const Ray &ray, float *t_arg)
+Sphere::Intersection(const Ray &ray, float *t_arg) const
 {
 	Vector ro, rd, tmp;
 
@@ -152,3 +91,110 @@ Sphere::Intersection(const Ray &ray, float *t_arg)
 
 	return true;
 }
+
+void
+Sphere::GetBounds(Vector &min, Vector &max) const
+{
+	min = origin - radius;
+	max = origin + radius;
+}
+
+/*
+ * Instance class
+ */
+static inline Vector
+transform(const float m[9], const Vector &v)
+{
+	return Vector(m[0] * v.vec[0] + m[1] * v.vec[1] + m[2] * v.vec[2],
+	              m[3] * v.vec[0] + m[4] * v.vec[1] + m[5] * v.vec[2],
+	              m[6] * v.vec[0] + m[7] * v.vec[1] + m[8] * v.vec[2]);
+}
+
+Instance::Instance(const Object *geometry_arg)
+{
+	geometry = geometry_arg;
+	for(int i = 0; i < 9; i++)
+		linear[i] = inverse[i] = (i % 4 == 0) ? 1.0f : 0.0f;
+}
+
+bool
+Instance::SetLinear(const float m[9])
+{
+	// inverse by cofactors, in double so it holds up for large scales
+	double c[9];
+	c[0] = (double)m[4] * m[8] - (double)m[5] * m[7];
+	c[1] = (double)m[2] * m[7] - (double)m[1] * m[8];
+	c[2] = (double)m[1] * m[5] - (double)m[2] * m[4];
+	c[3] = (double)m[5] * m[6] - (double)m[3] * m[8];
+	c[4] = (double)m[0] * m[8] - (double)m[2] * m[6];
+	c[5] = (double)m[2] * m[3] - (double)m[0] * m[5];
+	c[6] = (double)m[3] * m[7] - (double)m[4] * m[6];
+	c[7] = (double)m[1] * m[6] - (double)m[0] * m[7];
+	c[8] = (double)m[0] * m[4] - (double)m[1] * m[3];
+
+	double det = m[0] * c[0] + m[1] * c[3] + m[2] * c[6];
+	if(det == 0.0)
+		return false;
+
+	for(int i = 0; i < 9; i++) {
+		linear[i] = m[i];
+		inverse[i] = (float)(c[i] / det);
+	}
+
+	return true;
+}
+
+Vector
+Instance::NormalAtSurfacePoint(const Vector &p) const
+{
+	Vector n = geometry->NormalAtSurfacePoint(transform(inverse, p - origin));
+
+	// normals go back through the inverse transpose
+	Vector tmp(inverse[0] * n.vec[0] + inverse[3] * n.vec[1] + inverse[6] * n.vec[2],
+	           inverse[1] * n.vec[0] + inverse[4] * n.vec[1] + inverse[7] * n.vec[2],
+	           inverse[2] * n.vec[0] + inverse[5] * n.vec[1] + inverse[8] * n.vec[2]);
+	tmp.Normalize();
+
+	return tmp;
+}
+
+bool
+Instance::Intersection(const Ray &ray, float *t_arg) const
+{
+	Vector d = transform(inverse, ray.GetDirection());
+	float length = sqrtf(dot_product(d.vec, d.vec));
+
+	Ray local;
+	local.SetOrigin(transform(inverse, ray.GetOrigin() - origin));
+	local.SetDirection(d);
+
+	// the local ray is normalized too, so t shrinks by the length the
+	// direction had in object space
+	float t;
+	if(!geometry->Intersection(local, &t))
+		return false;
+
+	if(t_arg)
+		*t_arg = t / length;
+
+	return true;
+}
+
+void
+Instance::GetBounds(Vector &min, Vector &max) const
+{
+	Vector gmin, gmax;
+	geometry->GetBounds(gmin, gmax);
+
+	// each output extent is the sum of the extremes of its terms
+	min = origin;
+	max = origin;
+	for(int i = 0; i < 3; i++) {
+		for(int j = 0; j < 3; j++) {
+			float a = linear[i * 3 + j] * gmin.vec[j];
+			float b = linear[i * 3 + j] * gmax.vec[j];
+			min.vec[i] += (a < b) ? a : b;
+			max.vec[i] += (a < b) ? b : a;
+		}
+	}
+}
@@ -26,31 +26,51 @@
 #ifndef __OBJECTS_H__
 #define __OBJECTS_H__
 
-#include <vector>
 #include "my_math.h"
 #include "ray.h"
 
+struct RayPacket;
+
+struct Material {
+	float color[4];
+	float reflectance;
+};
+
 class Object {
 	protected:
 		Vector origin;
-		float color[4];
-		float reflectance;
+		Material material;
 
 	public:
-		Object() { origin.Clear(); color[0] = color[1] = color[2] = color[3] = 1.0f; reflectance = 0.0f; }
+		Object() { origin.Clear(); SetColor(1.0f, 1.0f, 1.0f, 1.0f); material.reflectance = 0.0f; }
 		virtual ~Object() { }
-		virtual Vector NormalAtSurfacePoint(const Vector &p) = 0;
-		virtual bool Intersection(const Ray &ray, float *t_arg) = 0;
-		virtual void Sample(std::vector <Object *> &objects, const Ray &ray, float t_arg, float color_arg[4], int level = 0);
+
+		// these only read object state, so they may be called from
+		// several render threads at once
+		virtual Vector NormalAtSurfacePoint(const Vector &p) const = 0;
+		virtual bool Intersection(const Ray &ray, float *t_arg) const = 0;
+		virtual void GetBounds(Vector &min, Vector &max) const = 0;
+
+		// records a hit as primitive id for every ray in the packet
+		// that hits this object closer than its current hit
+		virtual void IntersectPacket(RayPacket &packet, unsigned int id) const;
+
+		// true if no part of the surface can hide another part of it
+		// from a light, so shadow rays needn't be tested against the
+		// object they leave
+		virtual bool IsConvex() const { return false; }
 
 		inline void SetOrigin(const Vector &v) { origin = v; }
 		inline const Vector &GetOrigin() const { return origin; }
 
-		inline void SetColor(const float color_arg[4]) { for(int i = 0; i < 4; i++) color[i] = color_arg[i]; }
-		inline void SetColor(float r, float g, float b, float a = 1.0f) { color[0] = r; color[1] = g; color[2] = b; color[3] = a; }
-		inline const float *GetColor() const { return color; }
+		inline void SetColor(const float color_arg[4]) { for(int i = 0; i < 4; i++) material.color[i] = color_arg[i]; }
+		inline void SetColor(float r, float g, float b, float a = 1.0f) { material.color[0] = r; material.color[1] = g; material.color[2] = b; material.color[3] = a; }
+		inline const float *GetColor() const { return material.color; }
+
+		inline void SetReflectance(float reflectance_arg) { material.reflectance = reflectance_arg; }
+		inline float GetReflectance() const { return material.reflectance; }
 
-		inline void SetReflectance(float reflectance_arg) { reflectance = reflectance_arg; }
+		inline const Material &GetMaterial() const { return material; }
 };
 
 class Sphere : public Object {
@@ -60,11 +80,44 @@ class Sphere : public Object {
 	public:
 		Sphere(float radius_arg) { radius = radius_arg; }
 
-		virtual Vector NormalAtSurfacePoint(const Vector &p);
-		virtual bool Intersection(const Ray &ray, float *t_arg);
+		virtual Vector NormalAtSurfacePoint(const Vector &p) const;
+		virtual bool Intersection(const Ray &ray, float *t_arg) const;
+		virtual void GetBounds(Vector &min, Vector &max) const;
+		virtual bool IsConvex() const { return true; }
 
 		inline void SetRadius(float radius_arg) { radius = radius_arg; }
 		inline float GetRadius() const { return radius; }
 };
 
+/*
+ * A placed copy of shared geometry: the geometry's surface under an
+ * affine transform, drawn in the instance's own material. Rays are
+ * taken into the geometry's space to be intersected, so the geometry is
+ * stored once however many instances place it. The instance's origin
+ * is the translation of the transform. The geometry isn't owned and
+ * must outlive the instance.
+ */
+class Instance : public Object {
+	protected:
+		const Object *geometry;
+		// the linear part of the transform and its inverse, row major
+		float linear[9];
+		float inverse[9];
+
+	public:
+		Instance(const Object *geometry_arg);
+
+		virtual Vector NormalAtSurfacePoint(const Vector &p) const;
+		virtual bool Intersection(const Ray &ray, float *t_arg) const;
+		virtual void GetBounds(Vector &min, Vector &max) const;
+		// an affine transform keeps a convex shape convex
+		virtual bool IsConvex() const { return geometry->IsConvex(); }
+
+		inline const Object *GetGeometry() const { return geometry; }
+
+		// returns false, leaving the transform alone, if m is singular
+		bool SetLinear(const float m[9]);
+		inline const float *GetLinear() const { return linear; }
+};
+
 #endif /* __OBJECTS_H__ */
@@ -0,0 +1,189 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// objfile.cpp - Wavefront OBJ mesh loader
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include "objfile.h"
+#include "textparse.h"
+#include "timer.h"
+
+// enough for the polygons real files contain
+const unsigned int MAX_CORNERS = 64;
+
+/*
+ * ObjParser class
+ */
+class ObjParser : public LineParser {
+	protected:
+		Mesh &mesh;
+
+		virtual bool ParseLine(char *line);
+		bool ParseIndex(const char *&p, unsigned int count, unsigned int *index);
+		bool ParseCorner(const char *token, unsigned int *vertex, unsigned int *normal);
+
+	public:
+		ObjParser(Mesh &mesh_arg, std::string *error_arg)
+			: LineParser(error_arg), mesh(mesh_arg) { }
+};
+
+// parses a 1-based or negative relative index into a 0-based one
+bool
+ObjParser::ParseIndex(const char *&p, unsigned int count, unsigned int *index)
+{
+	bool negative = (*p == '-');
+	if(negative)
+		p++;
+	if(*p < '0' || *p > '9')
+		return false;
+
+	unsigned long n = 0;
+	while(*p >= '0' && *p <= '9') {
+		n = n * 10 + (unsigned long)(*p++ - '0');
+		if(n > count)
+			return false;
+	}
+	if(n == 0)
+		return false;
+
+	*index = negative ? (unsigned int)(count - n) : (unsigned int)(n - 1);
+
+	return true;
+}
+
+// a face corner is v, v/vt, v//vn or v/vt/vn; normal is NO_HIT when
+// the corner has none
+bool
+ObjParser::ParseCorner(const char *token, unsigned int *vertex, unsigned int *normal)
+{
+	const char *p = token;
+
+	*normal = NO_HIT;
+	if(!ParseIndex(p, mesh.GetVertexCount(), vertex))
+		return false;
+	if(*p == '\0')
+		return true;
+	if(*p++ != '/')
+		return false;
+
+	// texture coordinates aren't used
+	while(*p != '/' && *p != '\0')
+		p++;
+	if(*p == '\0')
+		return true;
+	p++;
+
+	return ParseIndex(p, mesh.GetNormalCount(), normal) && *p == '\0';
+}
+
+bool
+ObjParser::ParseLine(char *line)
+{
+	while(*line != '\0' && is_space(*line))
+		line++;
+
+	// the statements used all start with v or f; skip the rest early
+	if(line[0] != 'v' && line[0] != 'f')
+		return true;
+
+	char *tokens[MAX_CORNERS + 1];
+	unsigned int count;
+	if(!Tokenize(line, tokens, MAX_CORNERS + 1, count))
+		return false;
+
+	const char *keyword = tokens[0];
+	float f[3];
+
+	if(strcmp(keyword, "v") == 0) {
+		// an optional w is ignored
+		if(count < 4 || count > 5 || !parse_floats(tokens + 1, 3, f))
+			return Fail("expected: v X Y Z");
+
+		mesh.AddVertex(Vector(f[0], f[1], f[2]));
+	} else if(strcmp(keyword, "vn") == 0) {
+		if(count != 4 || !parse_floats(tokens + 1, 3, f))
+			return Fail("expected: vn X Y Z");
+
+		mesh.AddNormal(Vector(f[0], f[1], f[2]));
+	} else if(strcmp(keyword, "f") == 0) {
+		if(count < 4)
+			return Fail("a face needs at least three corners");
+
+		unsigned int vertices[MAX_CORNERS], normals[MAX_CORNERS];
+		bool smooth = true;
+		for(unsigned int i = 0; i < count - 1; i++) {
+			if(!ParseCorner(tokens[i + 1], &vertices[i], &normals[i]))
+				return Fail("bad or out of range face index");
+			if(normals[i] == NO_HIT)
+				smooth = false;
+		}
+
+		for(unsigned int i = 2; i < count - 1; i++) {
+			if(smooth)
+				mesh.AddTriangle(vertices[0], vertices[i - 1], vertices[i], normals[0], normals[i - 1], normals[i]);
+			else
+				mesh.AddTriangle(vertices[0], vertices[i - 1], vertices[i]);
+		}
+	}
+
+	return true;
+}
+
+bool
+load_obj(const char *filename, Mesh &mesh, ObjLoadStats *stats_arg, std::string *error)
+{
+	ObjLoadStats local_stats;
+	ObjLoadStats &stats = stats_arg ? *stats_arg : local_stats;
+
+	FILE *fp = fopen(filename, "rb");
+	if(!fp) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	double start = timer_seconds();
+
+	ObjParser parser(mesh, error);
+	bool ok = parser.Load(fp);
+	fclose(fp);
+
+	stats.bytes = parser.GetBytes();
+	stats.lines = parser.GetLines();
+	stats.vertices = mesh.GetVertexCount();
+	stats.triangles = mesh.GetTriangleCount();
+	stats.parse_seconds = timer_seconds() - start;
+	stats.build_seconds = 0.0;
+	if(!ok)
+		return false;
+
+	start = timer_seconds();
+	mesh.Build();
+	stats.build_seconds = timer_seconds() - start;
+
+	return true;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __OBJFILE_H__
+#define __OBJFILE_H__
+
+#include <string>
+#include "mesh.h"
+
+/*
+ * Wavefront OBJ loading. The file is streamed; only the v, vn and f
+ * statements are used, with polygons split into triangle fans, and
+ * everything else (texture coordinates, groups, materials, lines) is
+ * skipped. Negative indices count back from the latest vertex.
+ */
+struct ObjLoadStats {
+	unsigned long bytes;
+	unsigned int lines;
+	unsigned int vertices;
+	unsigned int triangles;
+	double parse_seconds;
+	double build_seconds;
+};
+
+// adds the file's triangles to mesh and builds it; on failure error
+// describes the problem
+bool load_obj(const char *filename, Mesh &mesh, ObjLoadStats *stats, std::string *error);
+
+#endif /* __OBJFILE_H__ */
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// packet.cpp - Coherent ray packets and frustum culling
+
+#include "packet.h"
+
+/*
+ * RayPacket struct
+ */
+void
+RayPacket::Init(const Ray *rays_arg, int count)
+{
+	size = (count + 3) & ~3;
+	if(size > MAX_PACKET_SIZE)
+		size = MAX_PACKET_SIZE;
+
+	for(int i = 0; i < size; i++) {
+		rays[i] = rays_arg[(i < count) ? i : count - 1];
+
+		const float *d = rays[i].GetDirection().vec;
+		for(int j = 0; j < 3; j++) {
+			dir[j][i] = d[j];
+			inv_dir[j][i] = 1.0f / d[j];
+		}
+
+		t[i] = 9999999.0f;
+		primitive[i] = NO_HIT;
+	}
+
+	origin[0] = rays[0].GetOrigin().vec[0];
+	origin[1] = rays[0].GetOrigin().vec[1];
+	origin[2] = rays[0].GetOrigin().vec[2];
+}
+
+void
+RayPacket::BuildFrustum(const Vector corners[4])
+{
+	Vector center = corners[0] + corners[1] + corners[2] + corners[3];
+
+	for(int i = 0; i < 4; i++) {
+		Vector n;
+		cross_product(corners[i].vec, corners[(i + 1) & 3].vec, n.vec);
+		n.Normalize();
+		if(dot_product(n.vec, center.vec) < 0.0f)
+			n.Scale(-1.0f);
+
+		planes[i][0] = n.vec[0];
+		planes[i][1] = n.vec[1];
+		planes[i][2] = n.vec[2];
+		planes[i][3] = -dot_product(n.vec, origin);
+	}
+}
+
+bool
+RayPacket::BoxOutsideFrustum(const float min[3], const float max[3]) const
+{
+	for(int i = 0; i < 4; i++) {
+		// the box corner furthest along the plane normal
+		float p[3];
+		for(int j = 0; j < 3; j++)
+			p[j] = (planes[i][j] >= 0.0f) ? max[j] : min[j];
+
+		if(dot_product(planes[i], p) + planes[i][3] < -1.0e-4f)
+			return true;
+	}
+
+	return false;
+}
+
+bool
+RayPacket::SphereOutsideFrustum(const Vector &center, float radius) const
+{
+	for(int i = 0; i < 4; i++) {
+		if(dot_product(planes[i], center.vec) + planes[i][3] < -radius - 1.0e-4f)
+			return true;
+	}
+
+	return false;
+}
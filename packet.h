@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PACKET_H__
+#define __PACKET_H__
+
+#include "objects.h"
+
+const int MAX_PACKET_SIZE = 16;
+
+/*
+ * A group of coherent primary rays that share an origin, traced together.
+ * Directions are also kept in structure-of-arrays form so intersection
+ * kernels can test four rays per SIMD instruction. The frustum planes
+ * bound every ray in the packet and are used to cull whole nodes and
+ * objects before doing any per-ray work.
+ */
+struct RayPacket {
+	int size; // always a multiple of 4
+
+	Ray rays[MAX_PACKET_SIZE];
+	float origin[3];
+	float dir[3][MAX_PACKET_SIZE];
+	float inv_dir[3][MAX_PACKET_SIZE];
+
+	float t[MAX_PACKET_SIZE];
+	unsigned int primitive[MAX_PACKET_SIZE];
+
+	// plane normals point inwards: a point p is inside when
+	// dot(n, p) + d >= 0 for all four planes
+	float planes[4][4];
+
+	// size is rounded up to a multiple of 4 by repeating the last ray
+	void Init(const Ray *rays_arg, int count);
+
+	// corners must be the directions of the packet's four outermost
+	// rays, in order around the boundary
+	void BuildFrustum(const Vector corners[4]);
+
+	bool BoxOutsideFrustum(const float min[3], const float max[3]) const;
+	bool SphereOutsideFrustum(const Vector &center, float radius) const;
+};
+
+#endif /* __PACKET_H__ */
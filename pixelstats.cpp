@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// pixelstats.cpp - Per-pixel render cost
+
+#include <algorithm>
+#include <cstring>
+#include "pixelstats.h"
+
+/*
+ * PixelStats class
+ */
+PixelStats::PixelStats()
+{
+	width = 0;
+	height = 0;
+}
+
+void
+PixelStats::Reset(int width_arg, int height_arg)
+{
+	width = width_arg;
+	height = height_arg;
+
+	PixelCost zero = { 0, 0, 0, 0 };
+	pixels.assign((size_t)width * height, zero);
+}
+
+void
+PixelStats::GetTotals(Totals &totals) const
+{
+	memset(&totals, 0, sizeof(totals));
+	totals.pixels = pixels.size();
+
+	std::vector <unsigned int> times(pixels.size());
+	unsigned long nanoseconds = 0;
+	for(size_t i = 0; i < pixels.size(); i++) {
+		const PixelCost &cost = pixels[i];
+		totals.rays += cost.rays;
+		totals.tests += cost.tests;
+		nanoseconds += cost.nanoseconds;
+		totals.max_rays = std::max(totals.max_rays, cost.rays);
+		totals.max_tests = std::max(totals.max_tests, cost.tests);
+		totals.max_depth = std::max(totals.max_depth, cost.depth);
+		totals.max_nanoseconds = std::max(totals.max_nanoseconds, cost.nanoseconds);
+		times[i] = cost.nanoseconds;
+	}
+	totals.seconds = (double)nanoseconds * 1.0e-9;
+
+	size_t top = times.size() / 10;
+	if(top > 0 && nanoseconds > 0) {
+		std::nth_element(times.begin(), times.begin() + top, times.end(), std::greater <unsigned int> ());
+		double top_nanoseconds = 0.0;
+		for(size_t i = 0; i < top; i++)
+			top_nanoseconds += times[i];
+		totals.top_decile_share = top_nanoseconds / (double)nanoseconds;
+	}
+}
+
+static unsigned int
+metric_value(const PixelCost &cost, PixelStats::Metric metric)
+{
+	switch(metric) {
+		case PixelStats::METRIC_RAYS:
+			return cost.rays;
+		case PixelStats::METRIC_TESTS:
+			return cost.tests;
+		case PixelStats::METRIC_DEPTH:
+			return cost.depth;
+		case PixelStats::METRIC_TIME:
+		default:
+			return cost.nanoseconds;
+	}
+}
+
+// the heatmap's colour stops, from cheapest to costliest
+static const unsigned char heat_colors[][3] = {
+	{ 0, 0, 64 },
+	{ 0, 64, 255 },
+	{ 0, 224, 128 },
+	{ 255, 224, 0 },
+	{ 255, 0, 0 }
+};
+
+void
+PixelStats::DrawHeatmap(Metric metric, unsigned char *framebuf) const
+{
+	if(pixels.empty())
+		return;
+
+	std::vector <unsigned int> values(pixels.size());
+	for(size_t i = 0; i < pixels.size(); i++)
+		values[i] = metric_value(pixels[i], metric);
+
+	std::vector <unsigned int> sorted(values);
+	size_t rank = sorted.size() * 99 / 100;
+	std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+	float scale = (sorted[rank] > 0) ? 1.0f / (float)sorted[rank] : 0.0f;
+
+	const int stops = sizeof(heat_colors) / sizeof(heat_colors[0]);
+	for(size_t i = 0; i < values.size(); i++) {
+		float f = (float)values[i] * scale;
+		if(f > 1.0f)
+			f = 1.0f;
+
+		float position = f * (stops - 1);
+		int stop = (int)position;
+		if(stop >= stops - 1)
+			stop = stops - 2;
+		float blend = position - (float)stop;
+
+		unsigned char *p = framebuf + i * 4;
+		for(int c = 0; c < 3; c++)
+			p[c] = (unsigned char)(heat_colors[stop][c] + (heat_colors[stop + 1][c] - heat_colors[stop][c]) * blend + 0.5f);
+		p[3] = 0xff;
+	}
+}
+
+bool
+PixelStats::ParseMetric(const char *name, Metric &metric)
+{
+	static const struct {
+		const char *name;
+		Metric metric;
+	} names[] = {
+		{ "rays", METRIC_RAYS },
+		{ "tests", METRIC_TESTS },
+		{ "depth", METRIC_DEPTH },
+		{ "time", METRIC_TIME }
+	};
+
+	for(unsigned int i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if(strcmp(name, names[i].name) == 0) {
+			metric = names[i].metric;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+#if PIXEL_STATS_ENABLED
+/*
+ * PixelMeter class
+ */
+void
+PixelMeter::ChargeBlock(int x0, int y0, int x1, int y1)
+{
+	if(!stats)
+		return;
+
+	double now = timer_seconds();
+	unsigned int count = (unsigned int)((x1 - x0) * (y1 - y0));
+	unsigned int block_rays = (unsigned int)(counters->rays + counters->shadow_rays - rays);
+	unsigned int block_tests = (unsigned int)(counters->primitive_tests - tests);
+	unsigned int block_nanoseconds = (unsigned int)((now - start) * 1.0e9);
+
+	// the remainders go to the first pixels
+	unsigned int i = 0;
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++, i++) {
+			PixelCost &cost = stats->At(x, y);
+			cost.rays += block_rays / count + (i < block_rays % count);
+			cost.tests += block_tests / count + (i < block_tests % count);
+			cost.nanoseconds += block_nanoseconds / count + (i < block_nanoseconds % count);
+		}
+	}
+
+	Mark(now);
+}
+#endif
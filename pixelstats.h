@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __PIXELSTATS_H__
+#define __PIXELSTATS_H__
+
+#include <vector>
+#include "bvh.h"
+#include "scene.h"
+#include "timer.h"
+
+// building with -DNO_PIXEL_STATS compiles the per-pixel counting out of
+// the render loops
+#ifdef NO_PIXEL_STATS
+#define PIXEL_STATS_ENABLED 0
+#else
+#define PIXEL_STATS_ENABLED 1
+#endif
+
+// the work spent on one pixel in a frame
+struct PixelCost {
+	// primary, reflection and shadow rays, including antialiasing
+	// samples
+	unsigned int rays;
+	// primitive intersection tests
+	unsigned int tests;
+	// deepest reflection level shaded
+	unsigned int depth;
+	unsigned int nanoseconds;
+};
+
+/*
+ * Per-pixel cost of the last frame drawn with the map set on a
+ * RayTracer. Every pixel is only charged by the thread drawing its
+ * tile, so the render threads fill the map without locking; totals are
+ * summed from it afterwards.
+ */
+class PixelStats {
+	public:
+		enum Metric { METRIC_RAYS, METRIC_TESTS, METRIC_DEPTH, METRIC_TIME };
+
+		struct Totals {
+			unsigned long pixels;
+			unsigned long rays;
+			unsigned long tests;
+			double seconds;
+			unsigned int max_rays;
+			unsigned int max_tests;
+			unsigned int max_depth;
+			unsigned int max_nanoseconds;
+			// share of the frame's time spent on its costliest tenth
+			// of pixels
+			double top_decile_share;
+		};
+
+	protected:
+		int width;
+		int height;
+		std::vector <PixelCost> pixels;
+
+	public:
+		PixelStats();
+
+		// clears the map to a frame of the given size
+		void Reset(int width_arg, int height_arg);
+
+		inline int GetWidth() const { return width; }
+		inline int GetHeight() const { return height; }
+		inline PixelCost &At(int x, int y) { return pixels[(size_t)y * width + x]; }
+		inline const PixelCost &At(int x, int y) const { return pixels[(size_t)y * width + x]; }
+
+		void GetTotals(Totals &totals) const;
+
+		/*
+		 * Fills an RGBA frame of the map's size with a false colour
+		 * image of the metric, from dark blue for the cheapest pixels
+		 * through green and yellow to red. The scale tops out at the
+		 * 99th percentile, so a few outliers don't wash out the rest.
+		 */
+		void DrawHeatmap(Metric metric, unsigned char *framebuf) const;
+
+		// "rays", "tests", "depth" or "time"; returns false otherwise
+		static bool ParseMetric(const char *name, Metric &metric);
+};
+
+/*
+ * Charges the work done on the calling thread to pixels: Start() marks
+ * the thread's counters and the clock, and each Charge() adds what was
+ * spent since to a pixel and starts over. Does nothing if the map is
+ * NULL or the counting is compiled out.
+ */
+class PixelMeter {
+#if PIXEL_STATS_ENABLED
+	protected:
+		PixelStats *stats;
+		const BVH::TraversalStats *counters;
+		unsigned long rays;
+		unsigned long tests;
+		double start;
+
+		inline void Mark(double now)
+		{
+			rays = counters->rays + counters->shadow_rays;
+			tests = counters->primitive_tests;
+			start = now;
+		}
+
+	public:
+		inline PixelMeter(PixelStats *stats_arg)
+		{
+			stats = stats_arg;
+			counters = &BVH::GetThreadStats();
+			rays = 0;
+			tests = 0;
+			start = 0.0;
+			Start();
+		}
+
+		inline void Start()
+		{
+			if(!stats)
+				return;
+
+			Scene::TakeThreadDepth();
+			Mark(timer_seconds());
+		}
+
+		inline void Charge(int x, int y)
+		{
+			if(!stats)
+				return;
+
+			double now = timer_seconds();
+			PixelCost &cost = stats->At(x, y);
+			cost.rays += (unsigned int)(counters->rays + counters->shadow_rays - rays);
+			cost.tests += (unsigned int)(counters->primitive_tests - tests);
+			cost.nanoseconds += (unsigned int)((now - start) * 1.0e9);
+
+			unsigned int depth = Scene::TakeThreadDepth();
+			if(depth > cost.depth)
+				cost.depth = depth;
+
+			Mark(now);
+		}
+
+		// splits the work since Start() evenly over the pixels
+		// [x0, x1) x [y0, y1), as for a packet of primary rays
+		void ChargeBlock(int x0, int y0, int x1, int y1);
+#else
+	public:
+		inline PixelMeter(PixelStats *) { }
+		inline void Start() { }
+		inline void Charge(int, int) { }
+		inline void ChargeBlock(int, int, int, int) { }
+#endif
+};
+
+#endif /* __PIXELSTATS_H__ */
@@ -43,4 +43,12 @@ class Ray {
 		inline const Vector &GetDirection() const { return direction; }
 };
 
+const unsigned int NO_HIT = 0xffffffff;
+
+// closest hit along a ray; primitive is a scene primitive id or NO_HIT
+struct Hit {
+	float t;
+	unsigned int primitive;
+};
+
 #endif /* __RAY_H__ */
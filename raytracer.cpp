@@ -23,11 +23,13 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <cstdio>
+#include <cstring>
 #include "raytracer.h"
-
-const Vector screen_min(-4.0f, -3.0f, 0.0f);
-const Vector screen_max(4.0f, 3.0f, 0.0f);
+#include "scenegen.h"
+#include "timer.h"
+#include "trace.h"
 
 static void
 color_floats_to_bytes(float f[4], unsigned char b[4])
@@ -38,102 +40,1622 @@ color_floats_to_bytes(float f[4], unsigned char b[4])
 	b[3] = (unsigned char)(f[3] * 255.0f);
 }
 
+static unsigned int
+color_to_pixel(float f[4])
+{
+	unsigned char b[4];
+	color_floats_to_bytes(f, b);
+
+	return (b[0] << 24) | (b[1] << 16) | (b[2] << 8) | b[3];
+}
+
+// spreads the low 9 bits of x so there are two zero bits between each
+static unsigned int
+spread_bits(unsigned int x)
+{
+	x &= 0x1ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+
+	return x;
+}
+
+struct QueuedRayLess {
+	bool operator () (const RayTracer::QueuedRay &a, const RayTracer::QueuedRay &b) const
+	{
+		return a.key < b.key;
+	}
+};
+
+// orders the queue by direction octant, then by the Morton code of the
+// ray origin within the queue's bounds
+void
+RayTracer::SortRayQueue(std::vector <QueuedRay> &queue)
+{
+	float min[3], max[3];
+	for(int j = 0; j < 3; j++) {
+		min[j] = queue[0].ray.GetOrigin().vec[j];
+		max[j] = min[j];
+	}
+	for(unsigned int i = 1; i < queue.size(); i++) {
+		const float *o = queue[i].ray.GetOrigin().vec;
+		for(int j = 0; j < 3; j++) {
+			if(o[j] < min[j])
+				min[j] = o[j];
+			if(o[j] > max[j])
+				max[j] = o[j];
+		}
+	}
+
+	float scale[3];
+	for(int j = 0; j < 3; j++)
+		scale[j] = (max[j] > min[j]) ? 511.0f / (max[j] - min[j]) : 0.0f;
+
+	for(unsigned int i = 0; i < queue.size(); i++) {
+		const float *o = queue[i].ray.GetOrigin().vec;
+		const float *d = queue[i].ray.GetDirection().vec;
+
+		unsigned int octant = (d[0] < 0.0f) | ((d[1] < 0.0f) << 1) | ((d[2] < 0.0f) << 2);
+		unsigned int morton = 0;
+		for(int j = 0; j < 3; j++) {
+			unsigned int q = (unsigned int)((o[j] - min[j]) * scale[j]);
+			morton |= spread_bits((q < 511) ? q : 511) << j;
+		}
+
+		queue[i].key = (octant << 27) | morton;
+	}
+
+	std::sort(queue.begin(), queue.end(), QueuedRayLess());
+}
+
+/*
+ * FrameTask class
+ *
+ * A piece of a frame run on the thread pool; collects the ray counters
+ * of the thread that runs it for RunTasks() to add up.
+ */
+class FrameTask : public ThreadPool::Task {
+	protected:
+		virtual void Work(unsigned int thread_index) = 0;
+
+	public:
+		BVH::TraversalStats stats;
+		unsigned long aa_pixels;
+		unsigned long aa_rays;
+
+		FrameTask()
+		{
+			aa_pixels = 0;
+			aa_rays = 0;
+		}
+
+		virtual void Run(unsigned int thread_index)
+		{
+			BVH::TraversalStats &thread_stats = BVH::GetThreadStats();
+			BVH::TraversalStats before = thread_stats;
+
+			Work(thread_index);
+
+			stats.rays = thread_stats.rays - before.rays;
+			stats.nodes_visited = thread_stats.nodes_visited - before.nodes_visited;
+			stats.primitive_tests = thread_stats.primitive_tests - before.primitive_tests;
+			stats.shadow_rays = thread_stats.shadow_rays - before.shadow_rays;
+			stats.shadow_hits = thread_stats.shadow_hits - before.shadow_hits;
+			stats.occluder_cache_hits = thread_stats.occluder_cache_hits - before.occluder_cache_hits;
+		}
+};
+
+/*
+ * DrawTileTask class
+ */
+class DrawTileTask : public FrameTask {
+	protected:
+		const RayTracer *raytracer;
+		RayTracer::TileKernel kernel;
+		RayTracer::TilePass pass;
+		RayTracer::WavefrontScratch *scratch;
+		unsigned char *framebuf;
+		int framewidth;
+		int x0, y0, x1, y1;
+		std::vector <unsigned int> *objects;
+
+	public:
+		// scratch_arg is indexed by thread; if objects_arg is given,
+		// the ids of the objects the tile's rays hit are merged into it
+		DrawTileTask(const RayTracer *raytracer_arg, RayTracer::TileKernel kernel_arg, RayTracer::TilePass pass_arg,
+		             RayTracer::WavefrontScratch *scratch_arg, unsigned char *framebuf_arg, int framewidth_arg,
+		             int x0_arg, int y0_arg, int x1_arg, int y1_arg, std::vector <unsigned int> *objects_arg)
+		{
+			raytracer = raytracer_arg;
+			kernel = kernel_arg;
+			pass = pass_arg;
+			scratch = scratch_arg;
+			framebuf = framebuf_arg;
+			framewidth = framewidth_arg;
+			x0 = x0_arg; y0 = y0_arg;
+			x1 = x1_arg; y1 = y1_arg;
+			objects = objects_arg;
+		}
+
+	protected:
+		virtual void Work(unsigned int thread_index)
+		{
+			TRACE_SCOPE(trace, pass == RayTracer::PASS_ANTIALIAS ? "antialias tile" : "tile", "render");
+			TRACE_ARG(trace, "x", x0);
+			TRACE_ARG(trace, "y", y0);
+
+			size_t logged = 0;
+			if(objects) {
+				logged = objects->size();
+				Scene::SetThreadHitLog(objects);
+			}
+
+			(raytracer->*kernel)(pass, framebuf, framewidth, x0, y0, x1, y1,
+			                     scratch ? &scratch[thread_index] : NULL, aa_pixels, aa_rays);
+
+			// with antialiasing, a tile is only finished after its
+			// second pass
+			if(raytracer->sink && (pass == RayTracer::PASS_ANTIALIAS || raytracer->aa_rate <= 1))
+				raytracer->sink->TileDone(framebuf, framewidth, x0, y0, x1, y1);
+
+			if(objects) {
+				Scene::SetThreadHitLog(NULL);
+
+				const Scene &scene = raytracer->GetScene();
+				for(size_t i = logged; i < objects->size(); i++)
+					(*objects)[i] = scene.GetPrimitiveObject((*objects)[i]);
+				std::sort(objects->begin(), objects->end());
+				objects->erase(std::unique(objects->begin(), objects->end()), objects->end());
+			}
+		}
+};
+
+/*
+ * RefineTask class
+ *
+ * Refines every stride-th block of a progressive frame level, in order,
+ * adding the blocks refined and pixels traced to the given counters.
+ */
+class RefineTask : public FrameTask {
+	protected:
+		const RayTracer *raytracer;
+		RayTracer::RefineKernel kernel;
+		const std::vector <RayTracer::RefineBlock> *blocks;
+		unsigned int first;
+		unsigned int stride;
+		int size;
+		bool keep_corner;
+		unsigned char *framebuf;
+		int framewidth;
+		double deadline;
+		unsigned int *refined;
+		unsigned long *pixels;
+
+	public:
+		RefineTask(const RayTracer *raytracer_arg, RayTracer::RefineKernel kernel_arg,
+		           const std::vector <RayTracer::RefineBlock> *blocks_arg, unsigned int first_arg,
+		           unsigned int stride_arg, int size_arg, bool keep_corner_arg,
+		           unsigned char *framebuf_arg, int framewidth_arg, double deadline_arg,
+		           unsigned int *refined_arg, unsigned long *pixels_arg)
+		{
+			raytracer = raytracer_arg;
+			kernel = kernel_arg;
+			blocks = blocks_arg;
+			first = first_arg;
+			stride = stride_arg;
+			size = size_arg;
+			keep_corner = keep_corner_arg;
+			framebuf = framebuf_arg;
+			framewidth = framewidth_arg;
+			deadline = deadline_arg;
+			refined = refined_arg;
+			pixels = pixels_arg;
+		}
+
+	protected:
+		virtual void Work(unsigned int thread_index)
+		{
+			TRACE_SCOPE(trace, "refine", "render");
+			TRACE_ARG(trace, "size", size);
+
+			(raytracer->*kernel)(*blocks, first, stride, size, keep_corner, framebuf, framewidth, deadline,
+			                     *refined, *pixels);
+		}
+};
+
 /*
  * RayTracer class
  */
 RayTracer::RayTracer()
 {
-	const int spheresPerDimension = 3;
+	Init();
 
-	// create objects
-	for(int x = 0; x < spheresPerDimension; ++x) {
-		for(int y = 0; y < spheresPerDimension; ++y) {
-			for(int z = 0; z < spheresPerDimension; ++z) {
-				if(((x+y+z) % 3) == 0)
-					continue;
+	scene = new Scene;
+	owns_scene = true;
+	generate_scene(*scene, SCENE_DEFAULT, 0, 0);
+}
+
+RayTracer::RayTracer(Scene *scene_arg)
+{
+	Init();
+
+	scene = scene_arg;
+	owns_scene = false;
+}
+
+void
+RayTracer::Init()
+{
+	pool = NULL;
+	owns_pool = true;
+	thread_count = 0;
+	tile_size = 32;
+	packet_size = 1;
+	wavefront = false;
+	specialized = true;
+	aa_rate = 1;
+	aa_threshold = DEFAULT_AA_THRESHOLD;
+	sink = NULL;
+	pixel_stats = NULL;
+	layout = RGBA_LAYOUT;
+	frame_ids = NULL;
+	base_borders = false;
+	incremental_valid = false;
+	tiles_x = 0;
+	tiles_y = 0;
+
+	frame_stats.draw_seconds = 0.0;
+	frame_stats.primary_rays = 0;
+	frame_stats.rays = 0;
+	frame_stats.nodes_visited = 0;
+	frame_stats.primitive_tests = 0;
+	frame_stats.aa_pixels = 0;
+	frame_stats.aa_rays = 0;
+	frame_stats.shadow_rays = 0;
+	frame_stats.shadow_hits = 0;
+	frame_stats.occluder_cache_hits = 0;
+	frame_stats.reused_pixels = 0;
+}
+
+RayTracer::~RayTracer()
+{
+	if(owns_pool)
+		delete pool;
+	if(owns_scene)
+		delete scene;
+}
+
+template <unsigned int FEATURES>
+void
+RayTracer::RunTileKernel(TilePass pass, unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+                         WavefrontScratch *scratch, unsigned long &aa_pixels, unsigned long &aa_rays) const
+{
+	switch(pass) {
+		case PASS_RECURSIVE:
+			DrawTile <FEATURES> (framebuf, framewidth, x0, y0, x1, y1);
+			break;
+		case PASS_WAVEFRONT:
+			DrawTileWavefront <FEATURES> (framebuf, framewidth, x0, y0, x1, y1, *scratch);
+			break;
+		case PASS_ANTIALIAS:
+			AntialiasTile <FEATURES> (framebuf, framewidth, x0, y0, x1, y1, aa_pixels, aa_rays);
+			break;
+	}
+}
+
+// the features the next pass needs; frame_ids must be set up first
+unsigned int
+RayTracer::GetKernelFeatures() const
+{
+	if(!specialized)
+		return KERNEL_ALL;
+
+	unsigned int features = scene->GetShadeFeatures();
+	if(pixel_stats && PIXEL_STATS_ENABLED)
+		features |= Scene::FEATURE_STATS;
+	if(frame_ids)
+		features |= FEATURE_OBJECT_IDS;
+
+	return features;
+}
+
+RayTracer::TileKernel
+RayTracer::GetTileKernel() const
+{
+	static const TileKernel kernels[KERNEL_COUNT] = {
+		&RayTracer::RunTileKernel <0>, &RayTracer::RunTileKernel <1>,
+		&RayTracer::RunTileKernel <2>, &RayTracer::RunTileKernel <3>,
+		&RayTracer::RunTileKernel <4>, &RayTracer::RunTileKernel <5>,
+		&RayTracer::RunTileKernel <6>, &RayTracer::RunTileKernel <7>,
+		&RayTracer::RunTileKernel <8>, &RayTracer::RunTileKernel <9>,
+		&RayTracer::RunTileKernel <10>, &RayTracer::RunTileKernel <11>,
+		&RayTracer::RunTileKernel <12>, &RayTracer::RunTileKernel <13>,
+		&RayTracer::RunTileKernel <14>, &RayTracer::RunTileKernel <15>
+	};
+
+	return kernels[GetKernelFeatures()];
+}
+
+template <unsigned int FEATURES>
+unsigned int
+RayTracer::TestPixelRay(int x, int y, const Ray &ray) const
+{
+	Hit hit;
+	scene->Intersect(ray, &hit);
+	RecordHit <FEATURES> (x, y, hit.primitive);
+
+	return ShadePixel <FEATURES> (ray, hit);
+}
+
+template <unsigned int FEATURES>
+unsigned int
+RayTracer::ShadePixel(const Ray &ray, const Hit &hit) const
+{
+	if(hit.primitive != NO_HIT) {
+		float fcolor[4];
+
+		scene->Shade <FEATURES & Scene::SHADE_ALL> (ray, hit, fcolor);
+
+		return color_to_pixel(fcolor);
+	}
+
+	return 0;
+}
+
+Ray
+RayTracer::PrimaryRay(int x, int y) const
+{
+	return scene->GetCamera().GetRay(column_coords[x], row_coords[y]);
+}
+
+static inline void
+write_pixel(const PixelLayout &layout, unsigned char *framebuf, int framewidth, int x, int y, unsigned int p)
+{
+	unsigned char *q = &framebuf[framewidth * y * 4 + x * 4];
+	q[layout.red] = p >> 24;
+	q[layout.green] = p >> 16;
+	q[layout.blue] = p >> 8;
+	q[layout.alpha] = 0xff;
+}
+
+void
+RayTracer::SetThreadCount(unsigned int thread_count_arg)
+{
+	thread_count = thread_count_arg;
+}
+
+void
+RayTracer::SetThreadPool(ThreadPool *pool_arg)
+{
+	if(owns_pool)
+		delete pool;
+
+	pool = pool_arg;
+	owns_pool = (pool_arg == NULL);
+}
+
+void
+RayTracer::SetTileSize(int tile_size_arg)
+{
+	tile_size = (tile_size_arg > 0) ? tile_size_arg : 1;
+}
+
+void
+RayTracer::SetPacketSize(int packet_size_arg)
+{
+	if(packet_size_arg >= 16)
+		packet_size = 16;
+	else if(packet_size_arg >= 8)
+		packet_size = 8;
+	else if(packet_size_arg >= 4)
+		packet_size = 4;
+	else
+		packet_size = 1;
+}
+
+void
+RayTracer::SetWavefront(bool wavefront_arg)
+{
+	wavefront = wavefront_arg;
+}
+
+void
+RayTracer::SetAntialiasing(int rate, float threshold)
+{
+	// rates are powers of four: every refinement splits a square in four
+	aa_rate = 1;
+	while(aa_rate * 4 <= rate && aa_rate < MAX_AA_RATE)
+		aa_rate *= 4;
+
+	aa_threshold = threshold;
+}
+
+template <unsigned int FEATURES>
+void
+RayTracer::DrawTile(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1) const
+{
+	if(packet_size > 1) {
+		DrawTilePackets <FEATURES> (framebuf, framewidth, x0, y0, x1, y1);
+		return;
+	}
+
+	PixelMeter meter((FEATURES & Scene::FEATURE_STATS) ? pixel_stats : NULL);
+	for(int y = y0; y < y1; y++) {
+		for(int x = x0; x < x1; x++) {
+			Ray ray = PrimaryRay(x, y);
+			write_pixel(layout, framebuf, framewidth, x, y, TestPixelRay <FEATURES> (x, y, ray));
+			meter.Charge(x, y);
+		}
+	}
+}
+
+// traces the primary rays of pixel block [bx, bx1) x [by, by1) as one
+// packet, storing rays and hits row by row
+void
+RayTracer::TracePacketBlock(int bx, int by, int bx1, int by1, Ray *rays, Hit *hits, PixelMeter &meter) const
+{
+	int count = 0;
+	for(int y = by; y < by1; y++) {
+		for(int x = bx; x < bx1; x++)
+			rays[count++] = PrimaryRay(x, y);
+	}
+
+	RayPacket packet;
+	packet.Init(rays, count);
 
-				Sphere *sphere = new Sphere(1.0f);
-				sphere->SetReflectance(0.2f);
-				sphere->SetOrigin(Vector((float)x, (float)y, (float)z) * 2.5f + Vector(-2.5f, -2.5f, 0.0f));
-				sphere->SetColor((x % 2) ? 1.0f : 0.5f, (y % 2) ? 1.0f : 0.5f, (z % 2) ? 1.0f : 0.5f);
-				objects.insert(objects.end(), sphere);
+	Vector corners[4];
+	corners[0] = PrimaryRay(bx, by).GetDirection();
+	corners[1] = PrimaryRay(bx1 - 1, by).GetDirection();
+	corners[2] = PrimaryRay(bx1 - 1, by1 - 1).GetDirection();
+	corners[3] = PrimaryRay(bx, by1 - 1).GetDirection();
+	packet.BuildFrustum(corners);
+
+	scene->IntersectPacket(packet);
+	meter.ChargeBlock(bx, by, bx1, by1);
+
+	for(int i = 0; i < count; i++) {
+		hits[i].t = packet.t[i];
+		hits[i].primitive = packet.primitive[i];
+	}
+}
+
+template <unsigned int FEATURES>
+void
+RayTracer::DrawTilePackets(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1) const
+{
+	// packets cover 2x2, 4x2 or 4x4 pixel blocks
+	int block_w = (packet_size >= 8) ? 4 : 2;
+	int block_h = packet_size / block_w;
+
+	PixelMeter meter((FEATURES & Scene::FEATURE_STATS) ? pixel_stats : NULL);
+	for(int by = y0; by < y1; by += block_h) {
+		for(int bx = x0; bx < x1; bx += block_w) {
+			int bx1 = (bx + block_w < x1) ? bx + block_w : x1;
+			int by1 = (by + block_h < y1) ? by + block_h : y1;
+
+			Ray rays[MAX_PACKET_SIZE];
+			Hit hits[MAX_PACKET_SIZE];
+			TracePacketBlock(bx, by, bx1, by1, rays, hits, meter);
+
+			// reflections are traced as single rays from here on
+			int i = 0;
+			for(int y = by; y < by1; y++) {
+				for(int x = bx; x < bx1; x++, i++) {
+					RecordHit <FEATURES> (x, y, hits[i].primitive);
+					write_pixel(layout, framebuf, framewidth, x, y, ShadePixel <FEATURES> (rays[i], hits[i]));
+					meter.Charge(x, y);
+				}
 			}
 		}
 	}
 }
 
-RayTracer::~RayTracer()
+// traces the primary rays of the tile, storing rays and hits row by row
+void
+RayTracer::TracePrimary(int x0, int y0, int x1, int y1, Ray *rays, Hit *hits, PixelMeter &meter) const
 {
-	for(unsigned int i = 0; i < objects.size(); i++)
-		delete objects[i];
+	int w = x1 - x0;
+
+	if(packet_size == 1) {
+		for(int y = y0; y < y1; y++) {
+			for(int x = x0; x < x1; x++) {
+				int i = (y - y0) * w + (x - x0);
+				rays[i] = PrimaryRay(x, y);
+				scene->Intersect(rays[i], &hits[i]);
+				meter.Charge(x, y);
+			}
+		}
+		return;
+	}
+
+	int block_w = (packet_size >= 8) ? 4 : 2;
+	int block_h = packet_size / block_w;
+
+	for(int by = y0; by < y1; by += block_h) {
+		for(int bx = x0; bx < x1; bx += block_w) {
+			int bx1 = (bx + block_w < x1) ? bx + block_w : x1;
+			int by1 = (by + block_h < y1) ? by + block_h : y1;
+
+			Ray block_rays[MAX_PACKET_SIZE];
+			Hit block_hits[MAX_PACKET_SIZE];
+			TracePacketBlock(bx, by, bx1, by1, block_rays, block_hits, meter);
+
+			int j = 0;
+			for(int y = by; y < by1; y++) {
+				for(int x = bx; x < bx1; x++, j++) {
+					int i = (y - y0) * w + (x - x0);
+					rays[i] = block_rays[j];
+					hits[i] = block_hits[j];
+				}
+			}
+		}
+	}
 }
 
-unsigned int
-RayTracer::TestPixelRay(int x, int y, const Ray &ray)
+/*
+ * Wavefront shading. Rather than following every pixel's reflections
+ * depth first, a tile is shaded one reflection level at a time: all
+ * reflection rays spawned at a level are queued, sorted so that rays
+ * leaving nearby points in similar directions are traced together, and
+ * then intersected and shaded as a batch. Each path keeps the unclamped
+ * colour and reflectance of every level it reached, stored by level so
+ * that levels no path reaches take no memory, and the pixel is
+ * finished by folding them back up from the deepest level, in the same
+ * order as the recursive Scene::Shade(), so both modes give identical
+ * images.
+ */
+template <unsigned int FEATURES>
+void
+RayTracer::DrawTileWavefront(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+                             WavefrontScratch &scratch) const
 {
-	Object *closest_object = NULL;
-	float closest_t = 9999999.0f;
+	int w = x1 - x0;
+	unsigned int n = (unsigned int)(w * (y1 - y0));
+	// at most Scene::MAX_DEPTH + 2, as the scene clamps its depth
+	int max_depth = scene->GetMaxDepth();
+	unsigned int levels = (max_depth >= 0) ? (unsigned int)max_depth + 2 : 1;
+
+	if(scratch.rays.size() < n) {
+		scratch.rays.resize(n);
+		scratch.hits.resize(n);
+		scratch.depth.resize(n);
+		scratch.queue.reserve(n);
+		scratch.next.reserve(n);
+	}
+	if(scratch.levels.size() < levels)
+		scratch.levels.resize(levels);
+
+	Ray *rays = &scratch.rays[0];
+	Hit *hits = &scratch.hits[0];
+	PixelMeter meter((FEATURES & Scene::FEATURE_STATS) ? pixel_stats : NULL);
+	{
+		TRACE_SCOPE(trace, "primary rays", "render");
+		TRACE_ARG(trace, "rays", (int)n);
+		TracePrimary(x0, y0, x1, y1, rays, hits, meter);
+	}
+
+	// level[l].colors[path * 4] and level[l].reflectances[path] hold
+	// what each path found at level l, and level[l].paths[path] links
+	// them for the throughput cutoff; depth is the number of levels
+	// shaded. Growing one level's buffers leaves the others in place,
+	// so the links stay valid.
+	WavefrontLevel *level_data = &scratch.levels[0];
+	unsigned int *depth = &scratch.depth[0];
+	for(unsigned int i = 0; i < n; i++)
+		depth[i] = 0;
+
+	std::vector <QueuedRay> &queue = scratch.queue;
+	std::vector <QueuedRay> &next = scratch.next;
+	queue.clear();
+
+	WavefrontLevel &first = level_data[0];
+	first.Grow(n);
+
+	meter.Start();
+	for(unsigned int i = 0; i < n; i++) {
+		if(hits[i].primitive == NO_HIT)
+			continue;
+
+		QueuedRay q;
+		if(scene->ShadeSurface <FEATURES & Scene::SHADE_ALL> (rays[i], hits[i], 0, 1.0f, &first.colors[i * 4], &q.ray, &first.reflectances[i])) {
+			Scene::ShadePath here = { &first.colors[i * 4], first.reflectances[i], NULL };
+			first.paths[i] = here;
+			q.throughput = first.reflectances[i];
+			q.path = i;
+			queue.push_back(q);
+		}
+		depth[i] = 1;
+		meter.Charge(x0 + (int)i % w, y0 + (int)i / w);
+	}
+
+	for(int level = 1; !queue.empty(); level++) {
+		TRACE_SCOPE(trace, "bounce", "render");
+		TRACE_ARG(trace, "level", level);
+		TRACE_ARG(trace, "rays", (int)queue.size());
+
+		SortRayQueue(queue);
 
-	for(unsigned int i = 0; i < objects.size(); i++) {
-		float t;
-		if(objects[i]->Intersection(ray, &t)) {
-			if(t < closest_t) {
-				closest_object = objects[i];
-				closest_t = t;
+		// reflections are only spawned up to the maximum depth, so the
+		// level is always below levels
+		WavefrontLevel &current = level_data[level];
+		const WavefrontLevel &above = level_data[level - 1];
+		current.Grow(n);
+
+		next.clear();
+		meter.Start();
+		for(unsigned int i = 0; i < queue.size(); i++) {
+			const QueuedRay &q = queue[i];
+
+			Hit hit;
+			if(scene->Intersect(q.ray, &hit)) {
+				QueuedRay r;
+				unsigned int i4 = q.path * 4;
+				const Scene::ShadePath *parent = &above.paths[q.path];
+				if(scene->ShadeSurface <FEATURES & Scene::SHADE_ALL> (q.ray, hit, level, q.throughput, &current.colors[i4], &r.ray, &current.reflectances[q.path], parent)) {
+					Scene::ShadePath here = { &current.colors[i4], current.reflectances[q.path], parent };
+					current.paths[q.path] = here;
+					r.throughput = q.throughput * current.reflectances[q.path];
+					r.path = q.path;
+					next.push_back(r);
+				}
+				depth[q.path] = level + 1;
 			}
+			meter.Charge(x0 + (int)q.path % w, y0 + (int)q.path / w);
 		}
+		queue.swap(next);
 	}
 
-	if(closest_object) {
-		float fcolor[4];
-		unsigned char bcolor[4];
+	for(unsigned int i = 0; i < n; i++) {
+		unsigned int p = 0;
+
+		if(depth[i] > 0) {
+			unsigned int level = depth[i] - 1;
+			float color[4];
+			for(int j = 0; j < 4; j++)
+				color[j] = level_data[level].colors[i * 4 + j];
+			Scene::ClampColor(color);
+
+			while(level > 0) {
+				level--;
+
+				float local[4];
+				for(int j = 0; j < 4; j++)
+					local[j] = level_data[level].colors[i * 4 + j];
+				Scene::AddReflection(local, color, level_data[level].reflectances[i]);
+				Scene::ClampColor(local);
+				for(int j = 0; j < 4; j++)
+					color[j] = local[j];
+			}
 
-		closest_object->Sample(objects, ray, closest_t, fcolor);
-		color_floats_to_bytes(fcolor, bcolor);
+			p = color_to_pixel(color);
+		}
 
-		return (bcolor[0] << 24) | (bcolor[1] << 16) | (bcolor[2] << 8) | bcolor[3];
+		RecordHit <FEATURES> (x0 + (int)i % w, y0 + (int)i / w, hits[i].primitive);
+		write_pixel(layout, framebuf, framewidth, x0 + (int)i % w, y0 + (int)i / w, p);
 	}
+}
 
-	return 0;
+/*
+ * Adaptive antialiasing. After the base pass, a pixel is refined if its
+ * colour differs from one of its four neighbours by more than the
+ * threshold in any channel, or if a different primitive was hit there.
+ * A refined pixel is split in four quarters, each sampled at its centre;
+ * quarters keep splitting while their samples disagree in the same way,
+ * until the samples per pixel reach the maximum rate. The pixel becomes
+ * the area-weighted mean of its samples.
+ */
+template <unsigned int FEATURES>
+void
+RayTracer::Sample(float sx, float sy, float color[4], unsigned int *primitive) const
+{
+	Ray ray = scene->GetCamera().GetRay(sx, sy);
+
+	Hit hit;
+	if(scene->Intersect(ray, &hit)) {
+		// samples are averaged, so their own bytes don't matter
+		scene->Shade <FEATURES & Scene::SHADE_ALL> (ray, hit, color, 0, 1.0f, &Scene::SAMPLE_PATH);
+	} else {
+		for(int i = 0; i < 4; i++)
+			color[i] = 0.0f;
+	}
+	*primitive = hit.primitive;
+}
+
+bool
+RayTracer::SamplesDiffer(const float a[4], unsigned int a_primitive, const float b[4], unsigned int b_primitive) const
+{
+	if(a_primitive != b_primitive)
+		return true;
+
+	for(int i = 0; i < 3; i++) {
+		float d = (a[i] - b[i]) * 255.0f;
+		if(d > aa_threshold || -d > aa_threshold)
+			return true;
+	}
+
+	return false;
 }
 
+// averages the colour over the screen rectangle at (sx, sy) of size
+// (w, h), sampled at rate samples per unit area at most
+template <unsigned int FEATURES>
 void
-RayTracer::Draw(unsigned char *framebuf, int framewidth, int frameheight)
+RayTracer::SampleRegion(float sx, float sy, float w, float h, int rate, float color[4], unsigned long &rays) const
+{
+	float quarter[4][4];
+	unsigned int primitive[4];
+
+	for(int q = 0; q < 4; q++) {
+		float qx = sx + w * ((q & 1) ? 0.75f : 0.25f);
+		float qy = sy + h * ((q & 2) ? 0.75f : 0.25f);
+		Sample <FEATURES> (qx, qy, quarter[q], &primitive[q]);
+	}
+	rays += 4;
+
+	if(rate > 4) {
+		bool differ = false;
+		for(int q = 1; q < 4 && !differ; q++)
+			differ = SamplesDiffer(quarter[0], primitive[0], quarter[q], primitive[q]);
+
+		if(differ) {
+			for(int q = 0; q < 4; q++) {
+				float qx = sx + ((q & 1) ? w * 0.5f : 0.0f);
+				float qy = sy + ((q & 2) ? h * 0.5f : 0.0f);
+				SampleRegion <FEATURES> (qx, qy, w * 0.5f, h * 0.5f, rate / 4, quarter[q], rays);
+			}
+		}
+	}
+
+	for(int i = 0; i < 4; i++)
+		color[i] = (quarter[0][i] + quarter[1][i] + quarter[2][i] + quarter[3][i]) * 0.25f;
+}
+
+void
+RayTracer::SaveTileBorders(const unsigned char *framebuf, int framewidth)
+{
+	border_rows.resize((size_t)tiles_y * 2 * frame_width * 4);
+	for(int ty = 0; ty < tiles_y; ty++) {
+		int x0, y0, x1, y1;
+		GetTileRect((unsigned int)(ty * tiles_x), x0, y0, x1, y1);
+		for(int k = 0; k < 2; k++) {
+			int y = k ? y1 - 1 : y0;
+			memcpy(&border_rows[(size_t)(ty * 2 + k) * frame_width * 4], framebuf + (size_t)y * framewidth * 4,
+			       (size_t)frame_width * 4);
+		}
+	}
+
+	border_columns.resize((size_t)tiles_x * 2 * frame_height * 4);
+	for(int tx = 0; tx < tiles_x; tx++) {
+		int x0, y0, x1, y1;
+		GetTileRect((unsigned int)tx, x0, y0, x1, y1);
+		for(int k = 0; k < 2; k++) {
+			int x = k ? x1 - 1 : x0;
+			unsigned char *dst = &border_columns[(size_t)(tx * 2 + k) * frame_height * 4];
+			for(int y = 0; y < frame_height; y++, dst += 4)
+				memcpy(dst, framebuf + ((size_t)y * framewidth + x) * 4, 4);
+		}
+	}
+}
+
+// the base pass colour of pixel (x, y), a pixel of the tile
+// [x0, x1) x [y0, y1) or next to it. The tile's own pixels are read
+// before the antialiasing pass writes any of them.
+const unsigned char *
+RayTracer::GetBasePixel(const unsigned char *framebuf, int framewidth, int x, int y,
+                        int x0, int y0, int x1, int y1) const
 {
-	float screen_x_step = (screen_max.vec[0] - screen_min.vec[0]) / (float)framewidth;
-	float screen_y_step = (screen_max.vec[1] - screen_min.vec[1]) / (float)frameheight;
+	if(!base_borders)
+		return &base_frame[((size_t)y * frame_width + x) * 4];
 
-	float fx = screen_min.vec[0];
-	float fy = screen_min.vec[1];
+	// a pixel above or below the tile is the last or first row of a
+	// neighbouring tile, and one beside it the last or first column
+	if(y < y0 || y >= y1)
+		return &border_rows[((size_t)((y / tile_size) * 2 + (y < y0 ? 1 : 0)) * frame_width + x) * 4];
+	if(x < x0 || x >= x1)
+		return &border_columns[((size_t)((x / tile_size) * 2 + (x < x0 ? 1 : 0)) * frame_height + y) * 4];
 
-	for(int y = 0; y < frameheight; y++) {
-		for(int x = 0; x < framewidth; x++) {
-			Vector dir;
-			dir.Clear();
+	return framebuf + ((size_t)y * framewidth + x) * 4;
+}
+
+bool
+RayTracer::IsEdgePixel(const unsigned char *framebuf, int framewidth, int x, int y,
+                       int x0, int y0, int x1, int y1) const
+{
+	static const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	const int channels[3] = { layout.red, layout.green, layout.blue };
+
+	size_t i = (size_t)y * frame_width + x;
+	const unsigned char *p = GetBasePixel(framebuf, framewidth, x, y, x0, y0, x1, y1);
+
+	for(int n = 0; n < 4; n++) {
+		int nx = x + offsets[n][0];
+		int ny = y + offsets[n][1];
+		if(nx < 0 || ny < 0 || nx >= frame_width || ny >= frame_height)
+			continue;
+
+		size_t j = (size_t)ny * frame_width + nx;
+		if(frame_ids[i] != frame_ids[j])
+			return true;
+
+		const unsigned char *q = GetBasePixel(framebuf, framewidth, nx, ny, x0, y0, x1, y1);
+		for(int c = 0; c < 3; c++) {
+			int d = (int)p[channels[c]] - (int)q[channels[c]];
+			if(d > aa_threshold || -d > aa_threshold)
+				return true;
+		}
+	}
+
+	return false;
+}
+
+template <unsigned int FEATURES>
+void
+RayTracer::AntialiasTile(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+                         unsigned long &pixels, unsigned long &rays) const
+{
+	// every edge is found before any pixel of the tile is rewritten
+	std::vector <char> edges((size_t)(x1 - x0) * (y1 - y0));
+	for(int y = y0, i = 0; y < y1; y++) {
+		for(int x = x0; x < x1; x++, i++)
+			edges[i] = IsEdgePixel(framebuf, framewidth, x, y, x0, y0, x1, y1);
+	}
+
+	PixelMeter meter((FEATURES & Scene::FEATURE_STATS) ? pixel_stats : NULL);
+	for(int y = y0, i = 0; y < y1; y++) {
+		for(int x = x0; x < x1; x++, i++) {
+			if(!edges[i])
+				continue;
+
+			float color[4];
+			meter.Start();
+			SampleRegion <FEATURES> (column_coords[x], row_coords[y], screen_x_step, screen_y_step, aa_rate, color, rays);
+			write_pixel(layout, framebuf, framewidth, x, y, color_to_pixel(color));
+			meter.Charge(x, y);
+			pixels++;
+		}
+	}
+}
+
+void
+RayTracer::GetTileRect(unsigned int tile, int &x0, int &y0, int &x1, int &y1) const
+{
+	x0 = (int)(tile % tiles_x) * tile_size;
+	y0 = (int)(tile / tiles_x) * tile_size;
+	x1 = (x0 + tile_size < frame_width) ? x0 + tile_size : frame_width;
+	y1 = (y0 + tile_size < frame_height) ? y0 + tile_size : frame_height;
+}
+
+void
+RayTracer::RunTasks(std::vector <ThreadPool::Task *> &tasks)
+{
+	pool->Run(tasks);
+
+	for(unsigned int i = 0; i < tasks.size(); i++) {
+		const FrameTask *task = (FrameTask *)tasks[i];
+		frame_stats.rays += task->stats.rays;
+		frame_stats.nodes_visited += task->stats.nodes_visited;
+		frame_stats.primitive_tests += task->stats.primitive_tests;
+		frame_stats.aa_pixels += task->aa_pixels;
+		frame_stats.aa_rays += task->aa_rays;
+		frame_stats.shadow_rays += task->stats.shadow_rays;
+		frame_stats.shadow_hits += task->stats.shadow_hits;
+		frame_stats.occluder_cache_hits += task->stats.occluder_cache_hits;
+		delete tasks[i];
+	}
+}
+
+void
+RayTracer::RunTiles(TilePass pass, unsigned char *framebuf, int framewidth, int frameheight,
+                    const std::vector <unsigned int> *tiles, bool record)
+{
+	unsigned int tile_count = tiles ? (unsigned int)tiles->size() : (unsigned int)(tiles_x * tiles_y);
+	TileKernel kernel = GetTileKernel();
+
+	std::vector <ThreadPool::Task *> tasks;
+	for(unsigned int i = 0; i < tile_count; i++) {
+		unsigned int tile = tiles ? (*tiles)[i] : i;
+		int x0, y0, x1, y1;
+		GetTileRect(tile, x0, y0, x1, y1);
+		tasks.push_back(new DrawTileTask(this, kernel, pass, scratch.empty() ? NULL : &scratch[0],
+		                                 framebuf, framewidth, x0, y0, x1, y1,
+		                                 record ? &tile_objects[tile] : NULL));
+	}
+
+	RunTasks(tasks);
+}
+
+// as RunTiles(), for arbitrary rectangles; large ones are split into tiles
+void
+RayTracer::RunRects(TilePass pass, unsigned char *framebuf, int framewidth, const std::vector <TileRect> &rects)
+{
+	TileKernel kernel = GetTileKernel();
+
+	std::vector <ThreadPool::Task *> tasks;
+	for(unsigned int i = 0; i < rects.size(); i++) {
+		const TileRect &r = rects[i];
+		for(int y = r.y0; y < r.y1; y += tile_size) {
+			for(int x = r.x0; x < r.x1; x += tile_size) {
+				int x1 = (x + tile_size < r.x1) ? x + tile_size : r.x1;
+				int y1 = (y + tile_size < r.y1) ? y + tile_size : r.y1;
+				tasks.push_back(new DrawTileTask(this, kernel, pass, scratch.empty() ? NULL : &scratch[0],
+				                                 framebuf, framewidth, x, y, x1, y1, NULL));
+			}
+		}
+	}
+
+	RunTasks(tasks);
+}
+
+void
+RayTracer::GetFrameSettings(FrameSettings &settings, int framewidth, int frameheight) const
+{
+	settings.width = framewidth;
+	settings.height = frameheight;
+	settings.tile_size = tile_size;
+	settings.aa_rate = aa_rate;
+	settings.aa_threshold = aa_threshold;
+	settings.camera = scene->GetCamera();
+	settings.lights = scene->GetLights();
+	settings.ambient = scene->GetAmbient();
+	settings.max_depth = scene->GetMaxDepth();
+	settings.termination = scene->GetTermination();
+	settings.shadows = scene->GetShadows();
+}
+
+static bool
+same_vector(const Vector &a, const Vector &b)
+{
+	return a.vec[0] == b.vec[0] && a.vec[1] == b.vec[1] && a.vec[2] == b.vec[2];
+}
+
+bool
+RayTracer::SameSettings(const FrameSettings &a, const FrameSettings &b)
+{
+	if(a.width != b.width || a.height != b.height || a.tile_size != b.tile_size ||
+	   a.aa_rate != b.aa_rate || a.aa_threshold != b.aa_threshold ||
+	   a.ambient != b.ambient || a.max_depth != b.max_depth || a.termination != b.termination ||
+	   a.shadows != b.shadows)
+		return false;
+
+	if(!same_vector(a.camera.GetPosition(), b.camera.GetPosition()) ||
+	   !same_vector(a.camera.GetForward(), b.camera.GetForward()) ||
+	   !same_vector(a.camera.GetRight(), b.camera.GetRight()) ||
+	   !same_vector(a.camera.GetDown(), b.camera.GetDown()) ||
+	   a.camera.GetHalfWidth() != b.camera.GetHalfWidth() ||
+	   a.camera.GetHalfHeight() != b.camera.GetHalfHeight())
+		return false;
+
+	if(a.lights.size() != b.lights.size())
+		return false;
+	for(unsigned int i = 0; i < a.lights.size(); i++) {
+		if(!same_vector(a.lights[i], b.lights[i]))
+			return false;
+	}
 
-			dir.vec[0] = fx;
-			dir.vec[1] = fy;
-			dir.vec[2] = 2.0f;
+	return true;
+}
 
-			Ray ray;
-			ray.SetOrigin(Vector(0.0f, 0.0f, 0.0f));
-			ray.SetDirection(dir);
+/*
+ * Marks the tiles the box covers on screen, with a pixel to spare for
+ * antialiasing samples and rounding. Given a light, the tiles the box's
+ * shadow may fall on are marked instead: the shadow lies within the
+ * hull of the box's corners and the rays running on from them away from
+ * the light, so its footprint is bounded by the corners and the points
+ * where those rays vanish on screen.
+ */
+void
+RayTracer::MarkFootprint(const Vector &min, const Vector &max, const Vector *light, std::vector <char> &dirty) const
+{
+	const Camera &camera = scene->GetCamera();
+	float sx_min = 0.0f, sx_max = 0.0f, sy_min = 0.0f, sy_max = 0.0f;
 
-			unsigned int p = TestPixelRay(x, y, ray);
+	// a light inside the box shadows everything around it
+	if(light) {
+		bool inside = true;
+		for(int j = 0; j < 3; j++)
+			inside = inside && light->vec[j] >= min.vec[j] && light->vec[j] <= max.vec[j];
+		if(inside) {
+			dirty.assign(dirty.size(), 1);
+			return;
+		}
+	}
 
-			unsigned char r = p >> 24;
-			unsigned char g = p >> 16;
-			unsigned char b = p >> 8;
+	for(int i = 0; i < (light ? 16 : 8); i++) {
+		Vector corner((i & 1) ? max.vec[0] : min.vec[0],
+		              (i & 2) ? max.vec[1] : min.vec[1],
+		              (i & 4) ? max.vec[2] : min.vec[2]);
+		Vector d = (i < 8) ? corner - camera.GetPosition() : corner - *light;
 
-			framebuf[framewidth * y * 4 + x * 4 + 0] = r;
-			framebuf[framewidth * y * 4 + x * 4 + 1] = g;
-			framebuf[framewidth * y * 4 + x * 4 + 2] = b;
-			framebuf[framewidth * y * 4 + x * 4 + 3] = 0xff;
+		// a box reaching behind the camera, or a shadow running
+		// towards or alongside the screen, may cover any part of it
+		float z = dot_product(d.vec, camera.GetForward().vec);
+		if(z <= 0.0f) {
+			dirty.assign(dirty.size(), 1);
+			return;
+		}
+
+		float sx = dot_product(d.vec, camera.GetRight().vec) * Camera::PLANE_DISTANCE / z;
+		float sy = dot_product(d.vec, camera.GetDown().vec) * Camera::PLANE_DISTANCE / z;
+		if(i == 0 || sx < sx_min)
+			sx_min = sx;
+		if(i == 0 || sx > sx_max)
+			sx_max = sx;
+		if(i == 0 || sy < sy_min)
+			sy_min = sy;
+		if(i == 0 || sy > sy_max)
+			sy_max = sy;
+	}
+
+	float px0 = (sx_min + camera.GetHalfWidth()) / screen_x_step - 1.0f;
+	float px1 = (sx_max + camera.GetHalfWidth()) / screen_x_step + 1.0f;
+	float py0 = (sy_min + camera.GetHalfHeight()) / screen_y_step - 1.0f;
+	float py1 = (sy_max + camera.GetHalfHeight()) / screen_y_step + 1.0f;
+	if(px1 < 0.0f || py1 < 0.0f || px0 >= (float)frame_width || py0 >= (float)frame_height)
+		return;
+
+	int tx0 = (px0 > 0.0f) ? (int)px0 / tile_size : 0;
+	int ty0 = (py0 > 0.0f) ? (int)py0 / tile_size : 0;
+	int tx1 = (px1 < (float)frame_width) ? (int)px1 / tile_size : tiles_x - 1;
+	int ty1 = (py1 < (float)frame_height) ? (int)py1 / tile_size : tiles_y - 1;
+
+	for(int ty = ty0; ty <= ty1; ty++) {
+		for(int tx = tx0; tx <= tx1; tx++)
+			dirty[ty * tiles_x + tx] = 1;
+	}
+}
 
-			fx += screen_x_step;
+void
+RayTracer::FindDirtyTiles(const std::vector <unsigned int> &changed, std::vector <unsigned int> &tiles) const
+{
+	tiles.clear();
+	if(changed.empty())
+		return;
+
+	unsigned int tile_count = (unsigned int)(tiles_x * tiles_y);
+	std::vector <char> dirty(tile_count, 0);
+
+	// tiles whose rays hit or were shadowed by a changed object
+	std::vector <char> is_changed(changed.back() + 1, 0);
+	for(unsigned int i = 0; i < changed.size(); i++)
+		is_changed[changed[i]] = 1;
+
+	for(unsigned int t = 0; t < tile_count; t++) {
+		const std::vector <unsigned int> &objects = tile_objects[t];
+		for(unsigned int i = 0; i < objects.size() && objects[i] < is_changed.size(); i++) {
+			if(is_changed[objects[i]]) {
+				dirty[t] = 1;
+				break;
+			}
+		}
+	}
+
+	// tiles a changed object may now be seen in directly, or cast a
+	// shadow on
+	const std::vector <Object *> &objects = scene->GetObjects();
+	const std::vector <Vector> &lights = scene->GetLights();
+	unsigned int features = scene->GetShadeFeatures();
+	for(unsigned int i = 0; i < changed.size(); i++) {
+		Vector min, max;
+		objects[changed[i]]->GetBounds(min, max);
+		MarkFootprint(min, max, NULL, dirty);
+
+		if(features & Scene::FEATURE_SHADOWS) {
+			for(unsigned int j = 0; j < lights.size(); j++)
+				MarkFootprint(min, max, &lights[j], dirty);
+		}
+	}
+
+	// a changed object may now be reflected in any reflective object,
+	// so every tile whose rays reached one is retraced; that covers new
+	// shadows seen in reflections as well
+	if(features & Scene::FEATURE_REFLECTIONS) {
+		const std::vector <Scene::SphereRecord> &records = scene->GetSphereRecords();
+		for(unsigned int t = 0; t < tile_count; t++) {
+			const std::vector <unsigned int> &logged = tile_objects[t];
+			for(unsigned int i = 0; i < logged.size() && !dirty[t]; i++) {
+				unsigned int id = logged[i];
+				float reflectance = (id < objects.size()) ? objects[id]->GetReflectance() :
+				                    records[id - objects.size()].material.reflectance;
+				if(reflectance > 0.0f)
+					dirty[t] = 1;
+			}
 		}
+	}
+
+	for(unsigned int t = 0; t < tile_count; t++) {
+		if(dirty[t])
+			tiles.push_back(t);
+	}
+}
+
+static void
+copy_rect(unsigned char *dst, const unsigned char *src, int framewidth, int x0, int y0, int x1, int y1)
+{
+	for(int y = y0; y < y1; y++) {
+		size_t offset = ((size_t)y * framewidth + x0) * 4;
+		memcpy(dst + offset, src + offset, (size_t)(x1 - x0) * 4);
+	}
+}
+
+void
+RayTracer::BeginFrame(int framewidth, int frameheight, const FrameWindow *window)
+{
+	int virtual_width = window ? window->virtual_width : framewidth;
+	int virtual_height = window ? window->virtual_height : frameheight;
+	int x0 = window ? window->x0 : 0;
+	int y0 = window ? window->y0 : 0;
+
+	const Camera &camera = scene->GetCamera();
+	screen_x_step = (camera.GetHalfWidth() * 2.0f) / (float)virtual_width;
+	screen_y_step = (camera.GetHalfHeight() * 2.0f) / (float)virtual_height;
+
+	// the coordinates are accumulated step by step, exactly as the
+	// original single-threaded scanline loop did, so that every tile
+	// sees the same ray directions regardless of where it starts; a
+	// window steps over the columns and rows before it the same way
+	column_coords.resize(framewidth);
+	float fx = -camera.GetHalfWidth();
+	for(int x = 0; x < x0 + framewidth; x++) {
+		if(x >= x0)
+			column_coords[x - x0] = fx;
+		fx += screen_x_step;
+	}
 
-		fx = screen_min.vec[0];
+	row_coords.resize(frameheight);
+	float fy = -camera.GetHalfHeight();
+	for(int y = 0; y < y0 + frameheight; y++) {
+		if(y >= y0)
+			row_coords[y - y0] = fy;
 		fy += screen_y_step;
 	}
+
+	unsigned int wanted_threads = thread_count ? thread_count : ThreadPool::GetDefaultThreadCount();
+	if(owns_pool && (!pool || pool->GetThreadCount() != wanted_threads)) {
+		delete pool;
+		pool = new ThreadPool(wanted_threads);
+	}
+
+	frame_stats.primary_rays = (unsigned long)framewidth * (unsigned long)frameheight;
+	frame_stats.rays = 0;
+	frame_stats.nodes_visited = 0;
+	frame_stats.primitive_tests = 0;
+	frame_stats.aa_pixels = 0;
+	frame_stats.aa_rays = 0;
+	frame_stats.shadow_rays = 0;
+	frame_stats.shadow_hits = 0;
+	frame_stats.occluder_cache_hits = 0;
+	frame_stats.reused_pixels = 0;
+
+	frame_width = framewidth;
+	frame_height = frameheight;
+	tiles_x = (framewidth + tile_size - 1) / tile_size;
+	tiles_y = (frameheight + tile_size - 1) / tile_size;
+
+	if(wavefront)
+		scratch.resize(pool->GetThreadCount());
+
+	if(pixel_stats)
+		pixel_stats->Reset(framewidth, frameheight);
+}
+
+void
+RayTracer::Render(unsigned char *framebuf, int framewidth, int frameheight, bool incremental,
+                  const FrameWindow *window)
+{
+	TRACE_SCOPE(trace, "frame", "render");
+	TRACE_ARG(trace, "width", framewidth);
+	TRACE_ARG(trace, "height", frameheight);
+
+	double start = timer_seconds();
+
+	// objects edited through their setters are picked up here, whether
+	// or not the frame is incremental
+	std::vector <unsigned int> changed;
+	bool tracked = scene->Update(changed);
+
+	BeginFrame(framewidth, frameheight, window);
+	unsigned int tile_count = (unsigned int)(tiles_x * tiles_y);
+
+	// an incremental frame traces only the tiles that depend on changed
+	// objects, provided nothing else about the frame changed
+	FrameSettings settings;
+	GetFrameSettings(settings, framewidth, frameheight);
+	bool reuse = incremental && tracked && incremental_valid && SameSettings(settings, last_settings);
+
+	std::vector <unsigned int> tiles;
+	if(incremental) {
+		if(reuse) {
+			FindDirtyTiles(changed, tiles);
+		} else {
+			tile_objects.assign(tile_count, std::vector <unsigned int> ());
+			for(unsigned int t = 0; t < tile_count; t++)
+				tiles.push_back(t);
+		}
+
+		unsigned long traced = 0;
+		for(unsigned int i = 0; i < tiles.size(); i++) {
+			int x0, y0, x1, y1;
+			GetTileRect(tiles[i], x0, y0, x1, y1);
+			traced += (unsigned long)(x1 - x0) * (unsigned long)(y1 - y0);
+			tile_objects[tiles[i]].clear();
+		}
+		frame_stats.reused_pixels = frame_stats.primary_rays - traced;
+		frame_stats.primary_rays = traced;
+	}
+	const std::vector <unsigned int> *pass_tiles = incremental ? &tiles : NULL;
+
+	// the antialiasing pass needs every pixel's object id and the base
+	// pass colours, unchanged, around every tile to find edges
+	if(aa_rate > 1) {
+		pixel_ids.resize((size_t)framewidth * frameheight);
+		frame_ids = &pixel_ids[0];
+	} else {
+		frame_ids = NULL;
+	}
+
+	RunTiles(wavefront ? PASS_WAVEFRONT : PASS_RECURSIVE, framebuf, framewidth, frameheight, pass_tiles, incremental);
+
+	// only incremental frames need the whole base pass, to restart
+	// antialiasing from it next time
+	base_borders = !incremental;
+	if(aa_rate > 1 && !incremental) {
+		SaveTileBorders(framebuf, framewidth);
+		RunTiles(PASS_ANTIALIAS, framebuf, framewidth, frameheight);
+	} else if(aa_rate > 1 && !reuse) {
+		base_frame.assign(framebuf, framebuf + (size_t)framewidth * frameheight * 4);
+		RunTiles(PASS_ANTIALIAS, framebuf, framewidth, frameheight, pass_tiles, incremental);
+	} else if(aa_rate > 1) {
+		// edge tests look one pixel across tile borders, so the
+		// neighbours of retraced tiles are antialiased again too,
+		// starting over from their base pass pixels
+		std::vector <char> antialias(tile_count, 0);
+		for(unsigned int i = 0; i < tiles.size(); i++) {
+			int x0, y0, x1, y1;
+			GetTileRect(tiles[i], x0, y0, x1, y1);
+			copy_rect(&base_frame[0], framebuf, framewidth, x0, y0, x1, y1);
+			antialias[tiles[i]] = 1;
+		}
+
+		for(unsigned int i = 0; i < tiles.size(); i++) {
+			int tx = (int)(tiles[i] % tiles_x), ty = (int)(tiles[i] / tiles_x);
+			for(int ny = ty - 1; ny <= ty + 1; ny++) {
+				for(int nx = tx - 1; nx <= tx + 1; nx++) {
+					if(nx < 0 || ny < 0 || nx >= tiles_x || ny >= tiles_y || antialias[ny * tiles_x + nx])
+						continue;
+
+					int x0, y0, x1, y1;
+					GetTileRect(ny * tiles_x + nx, x0, y0, x1, y1);
+					copy_rect(framebuf, &base_frame[0], framewidth, x0, y0, x1, y1);
+					antialias[ny * tiles_x + nx] = 1;
+				}
+			}
+		}
+
+		std::vector <unsigned int> aa_tiles;
+		for(unsigned int t = 0; t < tile_count; t++) {
+			if(antialias[t])
+				aa_tiles.push_back(t);
+		}
+		RunTiles(PASS_ANTIALIAS, framebuf, framewidth, frameheight, &aa_tiles, true);
+	}
+	frame_ids = NULL;
+
+	incremental_valid = incremental;
+	if(incremental)
+		last_settings = settings;
+
+	frame_stats.draw_seconds = timer_seconds() - start;
+}
+
+struct PixelLess {
+	bool operator () (const RayTracer::TileRect &a, const RayTracer::TileRect &b) const
+	{
+		return (a.y0 != b.y0) ? a.y0 < b.y0 : a.x0 < b.x0;
+	}
+};
+
+// the pixels just outside the rectangles that no rectangle covers,
+// merged into runs along each row
+static void
+find_border(const std::vector <RayTracer::TileRect> &rects, int framewidth, int frameheight,
+            std::vector <RayTracer::TileRect> &border)
+{
+	std::vector <RayTracer::TileRect> pixels;
+	for(unsigned int i = 0; i < rects.size(); i++) {
+		const RayTracer::TileRect &r = rects[i];
+		for(int y = r.y0 - 1; y <= r.y1; y++) {
+			bool edge_row = (y == r.y0 - 1 || y == r.y1);
+			for(int x = r.x0 - 1; x <= r.x1; x += (edge_row || x == r.x1) ? 1 : r.x1 - r.x0 + 1) {
+				if(x < 0 || y < 0 || x >= framewidth || y >= frameheight)
+					continue;
+
+				bool covered = false;
+				for(unsigned int j = 0; j < rects.size() && !covered; j++)
+					covered = x >= rects[j].x0 && x < rects[j].x1 && y >= rects[j].y0 && y < rects[j].y1;
+				if(!covered) {
+					RayTracer::TileRect p = { x, y, x + 1, y + 1 };
+					pixels.push_back(p);
+				}
+			}
+		}
+	}
+
+	std::sort(pixels.begin(), pixels.end(), PixelLess());
+
+	border.clear();
+	for(unsigned int i = 0; i < pixels.size(); i++) {
+		if(!border.empty() && border.back().y0 == pixels[i].y0 && border.back().x1 >= pixels[i].x0) {
+			if(pixels[i].x1 > border.back().x1)
+				border.back().x1 = pixels[i].x1;
+		} else {
+			border.push_back(pixels[i]);
+		}
+	}
+}
+
+void
+RayTracer::DrawRects(unsigned char *framebuf, int framewidth, int frameheight, const std::vector <TileRect> &rects)
+{
+	double start = timer_seconds();
+
+	std::vector <unsigned int> changed;
+	scene->Update(changed);
+
+	BeginFrame(framewidth, frameheight);
+	incremental_valid = false;
+
+	unsigned long pixels = 0;
+	for(unsigned int i = 0; i < rects.size(); i++)
+		pixels += (unsigned long)(rects[i].x1 - rects[i].x0) * (unsigned long)(rects[i].y1 - rects[i].y0);
+	frame_stats.primary_rays = pixels;
+
+	TilePass base_pass = wavefront ? PASS_WAVEFRONT : PASS_RECURSIVE;
+	if(aa_rate <= 1) {
+		frame_ids = NULL;
+		RunRects(base_pass, framebuf, framewidth, rects);
+		frame_stats.draw_seconds = timer_seconds() - start;
+		return;
+	}
+
+	pixel_ids.resize((size_t)framewidth * frameheight);
+	frame_ids = &pixel_ids[0];
+	base_borders = false;
+
+	std::vector <TileRect> border;
+	find_border(rects, framewidth, frameheight, border);
+	for(unsigned int i = 0; i < border.size(); i++)
+		frame_stats.primary_rays += border[i].x1 - border[i].x0;
+
+	// the border is traced straight into the base frame, leaving the
+	// caller's pixels outside the rectangles untouched
+	base_frame.resize((size_t)framewidth * frameheight * 4);
+	RunRects(base_pass, framebuf, framewidth, rects);
+	RunRects(base_pass, &base_frame[0], framewidth, border);
+	for(unsigned int i = 0; i < rects.size(); i++)
+		copy_rect(&base_frame[0], framebuf, framewidth, rects[i].x0, rects[i].y0, rects[i].x1, rects[i].y1);
+
+	RunRects(PASS_ANTIALIAS, framebuf, framewidth, rects);
+	frame_ids = NULL;
+
+	frame_stats.draw_seconds = timer_seconds() - start;
+}
+
+/*
+ * Progressive drawing. Level by level, each block's top left pixel has
+ * been traced and its colour fills the block; refining a block of size
+ * 2s traces the other three pixels at multiples of s and fills their
+ * s x s quarters. Blocks are refined in order of the largest colour
+ * difference between their traced pixel and those of their neighbours.
+ * The thread pool gives each worker a contiguous run of tasks, so every
+ * task takes every n-th block instead, keeping each worker on the
+ * highest contrast blocks left.
+ */
+template <unsigned int FEATURES>
+void
+RayTracer::RefineBlocks(const std::vector <RefineBlock> &blocks, unsigned int first, unsigned int stride,
+                        int size, bool keep_corner, unsigned char *framebuf, int framewidth, double deadline,
+                        unsigned int &refined, unsigned long &pixels) const
+{
+	for(unsigned int i = first; i < blocks.size(); i += stride) {
+		if(deadline > 0.0 && timer_seconds() > deadline)
+			return;
+
+		for(int c = keep_corner ? 1 : 0; c < 4; c++) {
+			int x = blocks[i].x + ((c & 1) ? size : 0);
+			int y = blocks[i].y + ((c & 2) ? size : 0);
+			if(x >= frame_width || y >= frame_height)
+				continue;
+
+			unsigned int p = TestPixelRay <FEATURES> (x, y, PrimaryRay(x, y));
+			int x1 = (x + size < frame_width) ? x + size : frame_width;
+			int y1 = (y + size < frame_height) ? y + size : frame_height;
+			for(int fy = y; fy < y1; fy++) {
+				for(int fx = x; fx < x1; fx++)
+					write_pixel(layout, framebuf, framewidth, fx, fy, p);
+			}
+			pixels++;
+		}
+		refined++;
+	}
+}
+
+RayTracer::RefineKernel
+RayTracer::GetRefineKernel() const
+{
+	static const RefineKernel kernels[Scene::SHADE_ALL + 1] = {
+		&RayTracer::RefineBlocks <0>, &RayTracer::RefineBlocks <1>,
+		&RayTracer::RefineBlocks <2>, &RayTracer::RefineBlocks <3>,
+		&RayTracer::RefineBlocks <4>, &RayTracer::RefineBlocks <5>,
+		&RayTracer::RefineBlocks <6>, &RayTracer::RefineBlocks <7>
+	};
+
+	return kernels[specialized ? scene->GetShadeFeatures() : (unsigned int)Scene::SHADE_ALL];
+}
+
+struct ContrastGreater {
+	inline bool operator () (const RayTracer::RefineBlock &a, const RayTracer::RefineBlock &b) const
+	{
+		return a.contrast > b.contrast;
+	}
+};
+
+// lists the blocks of size 2 * size covering the frame, highest
+// contrast first; with no framebuf, in scan order
+void
+RayTracer::FindRefineBlocks(const unsigned char *framebuf, int framewidth, int frameheight, int size,
+                            std::vector <RefineBlock> &blocks) const
+{
+	static const int offsets[4][2] = { { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 } };
+	const int channels[3] = { layout.red, layout.green, layout.blue };
+	int step = size * 2;
+
+	blocks.clear();
+	for(int y = 0; y < frameheight; y += step) {
+		for(int x = 0; x < framewidth; x += step) {
+			RefineBlock b = { x, y, 0 };
+
+			if(framebuf) {
+				const unsigned char *p = &framebuf[((size_t)y * framewidth + x) * 4];
+				for(int n = 0; n < 4; n++) {
+					int nx = x + offsets[n][0] * step;
+					int ny = y + offsets[n][1] * step;
+					if(nx < 0 || ny < 0 || nx >= framewidth || ny >= frameheight)
+						continue;
+
+					const unsigned char *q = &framebuf[((size_t)ny * framewidth + nx) * 4];
+					for(int c = 0; c < 3; c++) {
+						int d = (int)p[channels[c]] - (int)q[channels[c]];
+						if(d < 0)
+							d = -d;
+						if(d > b.contrast)
+							b.contrast = d;
+					}
+				}
+			}
+
+			blocks.push_back(b);
+		}
+	}
+
+	if(framebuf)
+		std::stable_sort(blocks.begin(), blocks.end(), ContrastGreater());
+}
+
+// refines the blocks until the deadline, or 0 for none; returns true if
+// all of them were refined
+bool
+RayTracer::RunRefine(const std::vector <RefineBlock> &blocks, int size, bool keep_corner,
+                     unsigned char *framebuf, int framewidth, double deadline, unsigned int &refined)
+{
+	RefineKernel kernel = GetRefineKernel();
+	unsigned int task_count = pool->GetThreadCount();
+	if(task_count > blocks.size())
+		task_count = (unsigned int)blocks.size();
+
+	std::vector <unsigned int> task_refined(task_count, 0);
+	std::vector <unsigned long> task_pixels(task_count, 0);
+	std::vector <ThreadPool::Task *> tasks;
+	for(unsigned int i = 0; i < task_count; i++) {
+		tasks.push_back(new RefineTask(this, kernel, &blocks, i, task_count, size, keep_corner,
+		                               framebuf, framewidth, deadline, &task_refined[i], &task_pixels[i]));
+	}
+
+	RunTasks(tasks);
+
+	refined = 0;
+	for(unsigned int i = 0; i < task_count; i++) {
+		refined += task_refined[i];
+		frame_stats.primary_rays += task_pixels[i];
+	}
+	if(sink)
+		sink->TileDone(framebuf, framewidth, 0, 0, frame_width, frame_height);
+
+	return refined == blocks.size();
+}
+
+int
+RayTracer::DrawProgressive(unsigned char *framebuf, int framewidth, int frameheight, double seconds, float *partial)
+{
+	TRACE_SCOPE(trace, "progressive frame", "render");
+	TRACE_ARG(trace, "width", framewidth);
+	TRACE_ARG(trace, "height", frameheight);
+
+	double start = timer_seconds();
+
+	std::vector <unsigned int> changed;
+	scene->Update(changed);
+
+	BeginFrame(framewidth, frameheight);
+	incremental_valid = false;
+	frame_ids = NULL;
+	frame_stats.primary_rays = 0;
+
+	// the coarsest level traces all four pixels of blocks twice its size
+	std::vector <RefineBlock> blocks;
+	unsigned int refined;
+	int size = PROGRESSIVE_BLOCK;
+	FindRefineBlocks(NULL, framewidth, frameheight, size, blocks);
+	RunRefine(blocks, size, false, framebuf, framewidth, 0.0, refined);
+
+	float done = 0.0f;
+	while(size > 1) {
+		FindRefineBlocks(framebuf, framewidth, frameheight, size / 2, blocks);
+		if(!RunRefine(blocks, size / 2, true, framebuf, framewidth, start + seconds, refined)) {
+			done = (float)refined / (float)blocks.size();
+			break;
+		}
+		size /= 2;
+	}
+
+	if(partial)
+		*partial = done;
+	frame_stats.draw_seconds = timer_seconds() - start;
+
+	return size;
+}
+
+void
+RayTracer::Draw(unsigned char *framebuf, int framewidth, int frameheight)
+{
+	Render(framebuf, framewidth, frameheight, false);
+}
+
+void
+RayTracer::DrawWindow(unsigned char *framebuf, int width, int height, const FrameWindow &window)
+{
+	if(aa_rate <= 1) {
+		Render(framebuf, width, height, false, &window);
+		return;
+	}
+
+	// the margin is clipped to the virtual frame
+	FrameWindow margin = window;
+	int x1 = window.x0 + width, y1 = window.y0 + height;
+	if(margin.x0 > 0)
+		margin.x0--;
+	if(margin.y0 > 0)
+		margin.y0--;
+	if(x1 < window.virtual_width)
+		x1++;
+	if(y1 < window.virtual_height)
+		y1++;
+
+	int margin_width = x1 - margin.x0;
+	int margin_height = y1 - margin.y0;
+	margin_frame.resize((size_t)margin_width * margin_height * 4);
+	Render(&margin_frame[0], margin_width, margin_height, false, &margin);
+
+	for(int y = 0; y < height; y++) {
+		const unsigned char *src = &margin_frame[(((size_t)(y + window.y0 - margin.y0) * margin_width) +
+		                                          (window.x0 - margin.x0)) * 4];
+		memcpy(framebuf + (size_t)y * width * 4, src, (size_t)width * 4);
+	}
+}
+
+void
+RayTracer::DrawIncremental(unsigned char *framebuf, int framewidth, int frameheight)
+{
+	Render(framebuf, framewidth, frameheight, true);
 }
@@ -27,19 +27,393 @@
 #define __RAYTRACER_H__
 
 #include <vector>
+#include "framesink.h"
 #include "objects.h"
+#include "pixelstats.h"
+#include "scene.h"
+#include "threadpool.h"
 
 class RayTracer {
+	public:
+		struct FrameStats {
+			double draw_seconds;
+			unsigned long primary_rays;
+			unsigned long rays;
+			unsigned long nodes_visited;
+			unsigned long primitive_tests;
+			// pixels refined by antialiasing and the extra primary rays
+			// spent on them; included in rays
+			unsigned long aa_pixels;
+			unsigned long aa_rays;
+			// occlusion queries toward lights, how many were blocked
+			// and how many of those the last-occluder cache answered;
+			// not included in rays, but their work is in nodes_visited
+			// and primitive_tests
+			unsigned long shadow_rays;
+			unsigned long shadow_hits;
+			unsigned long occluder_cache_hits;
+			// pixels DrawIncremental() kept from the previous frame;
+			// primary_rays counts only the pixels traced
+			unsigned long reused_pixels;
+		};
+
+		enum TilePass { PASS_RECURSIVE, PASS_WAVEFRONT, PASS_ANTIALIAS };
+
+		enum { MAX_AA_RATE = 64, DEFAULT_AA_THRESHOLD = 16 };
+
+		// block size of the coarsest level of DrawProgressive()
+		enum { PROGRESSIVE_BLOCK = 8 };
+
+		/*
+		 * The tile kernels are compiled once for every combination of
+		 * the Scene shading features and recording object ids for
+		 * antialiasing; each pass runs the one with just the features
+		 * the frame needs. KERNEL_ALL is the generic kernel.
+		 */
+		enum {
+			FEATURE_OBJECT_IDS = 8,
+			KERNEL_ALL = Scene::SHADE_ALL | FEATURE_OBJECT_IDS,
+			KERNEL_COUNT = KERNEL_ALL + 1
+		};
+
+		// a reflection ray waiting to be traced in wavefront mode
+		struct QueuedRay {
+			Ray ray;
+			float throughput;
+			unsigned int path;
+			unsigned int key;
+		};
+
+		// what the paths of a wavefront tile found at one reflection
+		// level, indexed by path
+		struct WavefrontLevel {
+			std::vector <float> colors;
+			std::vector <float> reflectances;
+			std::vector <Scene::ShadePath> paths;
+
+			inline void Grow(unsigned int n)
+			{
+				if(reflectances.size() < n) {
+					colors.resize(n * 4);
+					reflectances.resize(n);
+					paths.resize(n);
+				}
+			}
+		};
+
+		// per-thread buffers reused by every tile shaded in wavefront
+		// mode; only ever grown, and a level's only once a tile reaches
+		// it
+		struct WavefrontScratch {
+			std::vector <Ray> rays;
+			std::vector <Hit> hits;
+			std::vector <WavefrontLevel> levels;
+			std::vector <unsigned int> depth;
+			std::vector <QueuedRay> queue;
+			std::vector <QueuedRay> next;
+		};
+
+		// pixels [x0, x1) x [y0, y1) of a frame
+		struct TileRect {
+			int x0, y0;
+			int x1, y1;
+		};
+
+		// the part of a larger, virtual frame that a framebuf holds:
+		// its top left pixel is (x0, y0) of the virtual frame
+		struct FrameWindow {
+			int virtual_width;
+			int virtual_height;
+			int x0, y0;
+		};
+
+		// a block of a progressive frame, by its top left pixel, and
+		// how much its colour differs from its neighbours'
+		struct RefineBlock {
+			int x, y;
+			int contrast;
+		};
+
+		// everything besides the objects that a frame's pixels depend on
+		struct FrameSettings {
+			int width;
+			int height;
+			int tile_size;
+			int aa_rate;
+			float aa_threshold;
+			Camera camera;
+			std::vector <Vector> lights;
+			float ambient;
+			int max_depth;
+			Scene::Termination termination;
+			bool shadows;
+		};
+
 	protected:
-		std::vector <Object *> objects;
+		Scene *scene;
+		bool owns_scene;
+		FrameStats frame_stats;
+		FrameSink *sink;
+		PixelStats *pixel_stats;
+		PixelLayout layout;
+
+		ThreadPool *pool;
+		bool owns_pool;
+		unsigned int thread_count;
+		int tile_size;
+		int packet_size;
+		bool wavefront;
+		bool specialized;
+		int aa_rate;
+		float aa_threshold;
+
+		std::vector <WavefrontScratch> scratch;
+
+		// screen plane coordinates of each column and row of the frame
+		std::vector <float> column_coords;
+		std::vector <float> row_coords;
+		float screen_x_step;
+		float screen_y_step;
+
+		// the object hit by each pixel's base ray, recorded while
+		// antialiasing is on, and a copy of the base pass. Object ids
+		// rather than primitive ids, so that pixels kept by an
+		// incremental frame stay comparable after the scene is rebuilt.
+		int frame_width;
+		int frame_height;
+		std::vector <unsigned int> pixel_ids;
+		unsigned int *frame_ids;
+		std::vector <unsigned char> base_frame;
+		// instead of the whole base pass, a frame that keeps nothing
+		// for the next copies only the pixels the antialiasing pass
+		// reads across tile borders: the first and last row of each
+		// row of tiles and column of each column of tiles
+		bool base_borders;
+		std::vector <unsigned char> border_rows;
+		std::vector <unsigned char> border_columns;
+		// a window with its antialiasing margin
+		std::vector <unsigned char> margin_frame;
+
+		// what DrawIncremental() keeps between frames: the settings of
+		// the last frame and, for every tile, the sorted ids of the
+		// objects its rays hit or were shadowed by
+		bool incremental_valid;
+		FrameSettings last_settings;
+		int tiles_x;
+		int tiles_y;
+		std::vector <std::vector <unsigned int> > tile_objects;
+
+		template <unsigned int FEATURES>
+		inline void RecordHit(int x, int y, unsigned int primitive) const
+		{
+			if((FEATURES & FEATURE_OBJECT_IDS) && frame_ids)
+				frame_ids[(size_t)y * frame_width + x] = (primitive == NO_HIT) ? NO_HIT : scene->GetPrimitiveObject(primitive);
+		}
+
+		// runs one tile of a pass; TileKernel points to an instantiation
+		typedef void (RayTracer::*TileKernel)(TilePass pass, unsigned char *framebuf, int framewidth,
+		                                      int x0, int y0, int x1, int y1, WavefrontScratch *scratch,
+		                                      unsigned long &aa_pixels, unsigned long &aa_rays) const;
+		template <unsigned int FEATURES>
+		void RunTileKernel(TilePass pass, unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+		                   WavefrontScratch *scratch, unsigned long &aa_pixels, unsigned long &aa_rays) const;
+		unsigned int GetKernelFeatures() const;
+		TileKernel GetTileKernel() const;
+
+		// traces the new corner pixels of every stride-th block from
+		// first, at the given size, until the deadline (0 for none);
+		// RefineKernel points to an instantiation
+		typedef void (RayTracer::*RefineKernel)(const std::vector <RefineBlock> &blocks, unsigned int first,
+		                                        unsigned int stride, int size, bool keep_corner,
+		                                        unsigned char *framebuf, int framewidth, double deadline,
+		                                        unsigned int &refined, unsigned long &pixels) const;
+		template <unsigned int FEATURES>
+		void RefineBlocks(const std::vector <RefineBlock> &blocks, unsigned int first, unsigned int stride,
+		                  int size, bool keep_corner, unsigned char *framebuf, int framewidth, double deadline,
+		                  unsigned int &refined, unsigned long &pixels) const;
+		RefineKernel GetRefineKernel() const;
+		void FindRefineBlocks(const unsigned char *framebuf, int framewidth, int frameheight, int size,
+		                      std::vector <RefineBlock> &blocks) const;
+		bool RunRefine(const std::vector <RefineBlock> &blocks, int size, bool keep_corner,
+		               unsigned char *framebuf, int framewidth, double deadline, unsigned int &refined);
+
+		Ray PrimaryRay(int x, int y) const;
+		template <unsigned int FEATURES>
+		unsigned int TestPixelRay(int x, int y, const Ray &ray) const;
+		template <unsigned int FEATURES>
+		unsigned int ShadePixel(const Ray &ray, const Hit &hit) const;
+		template <unsigned int FEATURES>
+		void DrawTile(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1) const;
+		template <unsigned int FEATURES>
+		void DrawTilePackets(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1) const;
+		template <unsigned int FEATURES>
+		void DrawTileWavefront(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+		                       WavefrontScratch &scratch) const;
+		void TracePacketBlock(int bx, int by, int bx1, int by1, Ray *rays, Hit *hits, PixelMeter &meter) const;
+		void TracePrimary(int x0, int y0, int x1, int y1, Ray *rays, Hit *hits, PixelMeter &meter) const;
 
-		unsigned int TestPixelRay(int x, int y, const Ray &ray);
+		static void SortRayQueue(std::vector <QueuedRay> &queue);
+
+		template <unsigned int FEATURES>
+		void Sample(float sx, float sy, float color[4], unsigned int *primitive) const;
+		bool SamplesDiffer(const float a[4], unsigned int a_primitive, const float b[4], unsigned int b_primitive) const;
+		template <unsigned int FEATURES>
+		void SampleRegion(float sx, float sy, float w, float h, int rate, float color[4], unsigned long &rays) const;
+		void SaveTileBorders(const unsigned char *framebuf, int framewidth);
+		const unsigned char *GetBasePixel(const unsigned char *framebuf, int framewidth, int x, int y,
+		                                  int x0, int y0, int x1, int y1) const;
+		bool IsEdgePixel(const unsigned char *framebuf, int framewidth, int x, int y,
+		                 int x0, int y0, int x1, int y1) const;
+		template <unsigned int FEATURES>
+		void AntialiasTile(unsigned char *framebuf, int framewidth, int x0, int y0, int x1, int y1,
+		                   unsigned long &pixels, unsigned long &rays) const;
+
+		void GetTileRect(unsigned int tile, int &x0, int &y0, int &x1, int &y1) const;
+		void GetFrameSettings(FrameSettings &settings, int framewidth, int frameheight) const;
+		static bool SameSettings(const FrameSettings &a, const FrameSettings &b);
+		void MarkFootprint(const Vector &min, const Vector &max, const Vector *light, std::vector <char> &dirty) const;
+		void FindDirtyTiles(const std::vector <unsigned int> &changed, std::vector <unsigned int> &tiles) const;
+
+		// with a window, framewidth and frameheight give its size
+		void BeginFrame(int framewidth, int frameheight, const FrameWindow *window = NULL);
+		void RunTasks(std::vector <ThreadPool::Task *> &tasks);
+		void RunRects(TilePass pass, unsigned char *framebuf, int framewidth, const std::vector <TileRect> &rects);
+
+		// runs a pass over the given tiles, or all of them if tiles is
+		// NULL, logging each tile's objects into tile_objects if record
+		// is set
+		void RunTiles(TilePass pass, unsigned char *framebuf, int framewidth, int frameheight,
+		              const std::vector <unsigned int> *tiles = NULL, bool record = false);
+		void Render(unsigned char *framebuf, int framewidth, int frameheight, bool incremental,
+		            const FrameWindow *window = NULL);
+
+		void Init();
+
+		friend class DrawTileTask;
+		friend class RefineTask;
 
 	public:
+		// renders the built-in demo scene
 		RayTracer();
+		// renders the given scene, which the caller keeps ownership of
+		RayTracer(Scene *scene_arg);
 		~RayTracer();
 
+		// 0 uses one thread per online CPU
+		void SetThreadCount(unsigned int thread_count_arg);
+		inline unsigned int GetThreadCount() const { return thread_count; }
+
+		// draws on the given pool instead of one of its own, ignoring
+		// the thread count; NULL goes back to an own pool. The caller
+		// keeps ownership, and raytracers sharing a pool must not draw
+		// at the same time.
+		void SetThreadPool(ThreadPool *pool_arg);
+
+		void SetTileSize(int tile_size_arg);
+		inline int GetTileSize() const { return tile_size; }
+
+		// number of primary rays traced together: 1 traces every ray
+		// on its own, 4, 8 or 16 use packets with frustum culling
+		void SetPacketSize(int packet_size_arg);
+		inline int GetPacketSize() const { return packet_size; }
+
+		// shades reflections breadth first, one level at a time over a
+		// whole tile, instead of recursing per pixel
+		void SetWavefront(bool wavefront_arg);
+		inline bool GetWavefront() const { return wavefront; }
+
+		// after the base pass, supersamples pixels on colour or object
+		// edges with up to rate samples per pixel (4, 16 or 64; 1 turns
+		// antialiasing off). threshold is the largest difference in any
+		// 0-255 colour channel that doesn't count as an edge.
+		void SetAntialiasing(int rate, float threshold = DEFAULT_AA_THRESHOLD);
+		inline int GetAntialiasRate() const { return aa_rate; }
+		inline float GetAntialiasThreshold() const { return aa_threshold; }
+
+		// when off, every pass runs the generic kernel instead of one
+		// specialised for the frame; on by default. For benchmarking.
+		inline void SetSpecializedKernels(bool specialized_arg) { specialized = specialized_arg; }
+		inline bool GetSpecializedKernels() const { return specialized; }
+
+		// where each channel goes in the pixels drawn; RGBA_LAYOUT by
+		// default, which is what images are written in
+		inline void SetPixelLayout(const PixelLayout &layout_arg) { layout = layout_arg; }
+		inline const PixelLayout &GetPixelLayout() const { return layout; }
+
+		// the sink, if any, is handed every tile as it is finished;
+		// the caller keeps ownership
+		inline void SetFrameSink(FrameSink *sink_arg) { sink = sink_arg; }
+		inline FrameSink *GetFrameSink() const { return sink; }
+
+		// while a map is set, every frame drawn resets it to the frame
+		// size and charges each pixel's rays, tests, reflection depth
+		// and time to it; pixels an incremental frame keeps stay at
+		// zero. The caller keeps ownership.
+		inline void SetPixelStats(PixelStats *pixel_stats_arg) { pixel_stats = pixel_stats_arg; }
+		inline PixelStats *GetPixelStats() const { return pixel_stats; }
+
 		void Draw(unsigned char *framebuf, int framewidth, int frameheight);
+
+		/*
+		 * As Draw(), but when called again with the same framebuf and
+		 * unchanged settings, only retraces the tiles that depend on
+		 * objects changed through their setters since the last frame:
+		 * tiles whose rays hit or were shadowed by a changed object,
+		 * tiles its new bounds project onto and, with shadows, tiles
+		 * its new shadow may fall on. With reflections, every tile that
+		 * saw a reflective object is retraced too, since the changed
+		 * object may now show up in it. Objects added between frames
+		 * force a full frame.
+		 */
+		void DrawIncremental(unsigned char *framebuf, int framewidth, int frameheight);
+
+		/*
+		 * Renders only the given rectangles of the frame, as a render
+		 * worker does; they must not overlap. Other pixels are left
+		 * alone; with antialiasing the one pixel border around the
+		 * rectangles is traced too, for the edge tests, but kept
+		 * aside. The result inside the rectangles matches Draw()
+		 * exactly.
+		 */
+		void DrawRects(unsigned char *framebuf, int framewidth, int frameheight, const std::vector <TileRect> &rects);
+
+		/*
+		 * Draws just a width x height window of a larger frame into
+		 * framebuf, which holds only the window, for frames too big
+		 * to keep in memory or for crops. The pixels match those of
+		 * Draw() on the whole frame exactly; with antialiasing a one
+		 * pixel margin around the window is traced too, for the edge
+		 * tests, but kept aside.
+		 */
+		void DrawWindow(unsigned char *framebuf, int width, int height, const FrameWindow &window);
+
+		/*
+		 * Draws the frame coarse to fine, for previews that must be
+		 * ready within a time budget. One ray is traced per
+		 * PROGRESSIVE_BLOCK square block and its colour filled across
+		 * the block; every further level halves the blocks, tracing only
+		 * the three pixels each block gains, and refines the blocks
+		 * that differ most from their neighbours first. No pixel is
+		 * traced twice. Once seconds have passed the frame is returned
+		 * as far as it got; the coarsest level is always finished.
+		 *
+		 * Returns the block size of the finest level finished, 1 for a
+		 * complete frame, which matches Draw() with antialiasing off.
+		 * If partial is given it is set to the share of the next level's
+		 * blocks that were refined. Antialiasing and pixel statistics
+		 * don't apply.
+		 */
+		int DrawProgressive(unsigned char *framebuf, int framewidth, int frameheight, double seconds,
+		                    float *partial = NULL);
+
+		inline const Scene &GetScene() const { return *scene; }
+
+		// statistics from the most recent call to Draw()
+		inline const FrameStats &GetFrameStats() const { return frame_stats; }
+
+	private:
+		RayTracer(const RayTracer &);
+		RayTracer &operator = (const RayTracer &);
 };
 
 #endif /* __RAYTRACER_H__ */
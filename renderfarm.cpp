@@ -0,0 +1,771 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// renderfarm.cpp - Frame rendering spread over worker processes
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include "renderfarm.h"
+#include "scenefile.h"
+#include "timer.h"
+
+const unsigned int PROTOCOL_VERSION = 2;
+
+// tile jobs kept in flight per worker thread, so a worker always has
+// the next batch waiting while its results travel back
+const unsigned int JOBS_PER_THREAD = 2;
+
+const int HELLO_TIMEOUT_MS = 10000;
+
+// payloads are lists of 32-bit integers, described here in order
+enum {
+	MSG_HELLO = 1,  // worker: protocol version, threads
+	MSG_SCENE,      // coordinator: the scene in the text scene format
+	MSG_FRAME,      // coordinator: width, height, tile size, packet size,
+	                // wavefront, antialiasing rate and threshold bits,
+	                // then the camera's position, forward, right and down
+	                // vectors and half width and height as float bits
+	MSG_TILE,       // coordinator: job, x0, y0, x1, y1
+	MSG_PIXELS,     // worker: job, x0, y0, x1, y1, then RGBA rows
+	MSG_STATS,      // worker, before each batch's tiles: rays (high and low
+	                // words), render microseconds
+	MSG_ERROR       // worker: message text; the worker then hangs up
+};
+
+static unsigned int
+float_bits(float f)
+{
+	unsigned int bits;
+	memcpy(&bits, &f, sizeof(bits));
+	return bits;
+}
+
+static float
+bits_float(unsigned int bits)
+{
+	float f;
+	memcpy(&f, &bits, sizeof(f));
+	return f;
+}
+
+void
+put_camera(std::vector <unsigned char> &buffer, const Camera &camera)
+{
+	const Vector *axes[4] = { &camera.GetPosition(), &camera.GetForward(), &camera.GetRight(), &camera.GetDown() };
+	for(int i = 0; i < 4; i++) {
+		for(int j = 0; j < 3; j++)
+			Connection::PutUint32(buffer, float_bits(axes[i]->vec[j]));
+	}
+	Connection::PutUint32(buffer, float_bits(camera.GetHalfWidth()));
+	Connection::PutUint32(buffer, float_bits(camera.GetHalfHeight()));
+}
+
+void
+get_camera(const unsigned char *p, Camera &camera)
+{
+	float f[CAMERA_FLOATS];
+	for(unsigned int i = 0; i < CAMERA_FLOATS; i++)
+		f[i] = bits_float(Connection::GetUint32(p + i * 4));
+
+	camera.Set(Vector(f[0], f[1], f[2]), Vector(f[3], f[4], f[5]), Vector(f[6], f[7], f[8]),
+	           Vector(f[9], f[10], f[11]), f[12], f[13]);
+}
+
+static void
+put_rect(std::vector <unsigned char> &buffer, const RayTracer::TileRect &r)
+{
+	Connection::PutUint32(buffer, (unsigned int)r.x0);
+	Connection::PutUint32(buffer, (unsigned int)r.y0);
+	Connection::PutUint32(buffer, (unsigned int)r.x1);
+	Connection::PutUint32(buffer, (unsigned int)r.y1);
+}
+
+static RayTracer::TileRect
+get_rect(const unsigned char *p)
+{
+	RayTracer::TileRect r;
+	r.x0 = (int)Connection::GetUint32(p);
+	r.y0 = (int)Connection::GetUint32(p + 4);
+	r.x1 = (int)Connection::GetUint32(p + 8);
+	r.y1 = (int)Connection::GetUint32(p + 12);
+	return r;
+}
+
+static unsigned long
+rect_area(const RayTracer::TileRect &r)
+{
+	return (unsigned long)(r.x1 - r.x0) * (unsigned long)(r.y1 - r.y0);
+}
+
+/*
+ * RenderCoordinator class
+ */
+RenderCoordinator::RenderCoordinator(RayTracer *raytracer_arg)
+{
+	raytracer = raytracer_arg;
+	remaining = 0;
+	job_timeout_ms = DEFAULT_JOB_TIMEOUT_MS;
+	scene_saved = false;
+	scene_valid = false;
+	memset(&frame_stats, 0, sizeof(frame_stats));
+}
+
+RenderCoordinator::~RenderCoordinator()
+{
+	for(unsigned int i = 0; i < workers.size(); i++)
+		delete workers[i];
+}
+
+bool
+RenderCoordinator::AddWorker(const char *address, std::string *error)
+{
+	Worker *worker = new Worker;
+	if(!worker->connection.Connect(address, error)) {
+		delete worker;
+		return false;
+	}
+
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	if(!worker->connection.Poll(HELLO_TIMEOUT_MS) || !worker->connection.Receive(type, payload) ||
+	   type != MSG_HELLO || payload.size() < 8) {
+		if(error)
+			*error = "no greeting from worker";
+		delete worker;
+		return false;
+	}
+	if(Connection::GetUint32(&payload[0]) != PROTOCOL_VERSION) {
+		if(error)
+			*error = "worker speaks a different protocol version";
+		delete worker;
+		return false;
+	}
+
+	WorkerStats &stats = worker->stats;
+	stats.address = address;
+	stats.threads = Connection::GetUint32(&payload[4]);
+	if(stats.threads == 0)
+		stats.threads = 1;
+	stats.failed = false;
+	stats.tiles = 0;
+	stats.pixels = 0;
+	stats.rays = 0;
+	stats.render_seconds = 0.0;
+	stats.bytes_sent = 0;
+	stats.bytes_received = 0;
+	worker->scene_sent = false;
+	worker->missed = 0;
+	worker->waiting_since = 0.0;
+	// so a worker that stops partway through a message can't hang Draw()
+	worker->connection.SetReceiveTimeout(job_timeout_ms);
+
+	workers.push_back(worker);
+	return true;
+}
+
+void
+RenderCoordinator::SetJobTimeout(int timeout_ms)
+{
+	job_timeout_ms = timeout_ms;
+	for(unsigned int i = 0; i < workers.size(); i++)
+		workers[i]->connection.SetReceiveTimeout(job_timeout_ms);
+}
+
+static bool
+same_vector(const Vector &a, const Vector &b)
+{
+	return a.vec[0] == b.vec[0] && a.vec[1] == b.vec[1] && a.vec[2] == b.vec[2];
+}
+
+void
+RenderCoordinator::GetSceneState(SceneState &state) const
+{
+	const Scene &scene = raytracer->GetScene();
+
+	state.lights = scene.GetLights();
+	state.ambient = scene.GetAmbient();
+	state.max_depth = scene.GetMaxDepth();
+	state.termination = scene.GetTermination();
+	state.shadows = scene.GetShadows();
+	state.geometries = (unsigned int)scene.GetGeometries().size();
+	state.sphere_records = (unsigned int)scene.GetSphereRecords().size();
+	state.attached_spheres = scene.IsAttached() ? scene.GetSphereStore().GetCount() : 0;
+
+	const std::vector <Object *> &objects = scene.GetObjects();
+	state.bounds.resize(objects.size() * 2);
+	state.materials.resize(objects.size());
+	for(unsigned int i = 0; i < objects.size(); i++) {
+		objects[i]->GetBounds(state.bounds[i * 2], state.bounds[i * 2 + 1]);
+		state.materials[i] = objects[i]->GetMaterial();
+	}
+}
+
+bool
+RenderCoordinator::SameSceneState(const SceneState &a, const SceneState &b)
+{
+	if(a.ambient != b.ambient || a.max_depth != b.max_depth || a.termination != b.termination ||
+	   a.shadows != b.shadows || a.geometries != b.geometries || a.sphere_records != b.sphere_records ||
+	   a.attached_spheres != b.attached_spheres || a.lights.size() != b.lights.size() ||
+	   a.bounds.size() != b.bounds.size())
+		return false;
+
+	for(unsigned int i = 0; i < a.lights.size(); i++) {
+		if(!same_vector(a.lights[i], b.lights[i]))
+			return false;
+	}
+	for(unsigned int i = 0; i < a.bounds.size(); i++) {
+		if(!same_vector(a.bounds[i], b.bounds[i]))
+			return false;
+	}
+	for(unsigned int i = 0; i < a.materials.size(); i++) {
+		const Material &ma = a.materials[i], &mb = b.materials[i];
+		if(ma.reflectance != mb.reflectance || ma.color[0] != mb.color[0] || ma.color[1] != mb.color[1] ||
+		   ma.color[2] != mb.color[2] || ma.color[3] != mb.color[3])
+			return false;
+	}
+
+	return true;
+}
+
+/*
+ * Objects are edited through their setters without the scene being
+ * told, so their bounds and materials are compared, as the scene does
+ * to find what to rebuild; serializing the whole scene every frame
+ * would cost more than many frames take to draw. Returns whether the
+ * workers can be sent the scene.
+ */
+bool
+RenderCoordinator::UpdateScene()
+{
+	SceneState state;
+	GetSceneState(state);
+
+	if(scene_saved && SameSceneState(state, scene_state))
+		return scene_valid;
+
+	scene_state = state;
+	scene_saved = true;
+
+	scene_valid = SerializeScene();
+	bool working = false;
+	for(unsigned int i = 0; i < workers.size(); i++) {
+		workers[i]->scene_sent = false;
+		working = working || !workers[i]->stats.failed;
+	}
+	if(!scene_valid && working)
+		fprintf(stderr, "the scene can't be sent to the workers: it has objects the text scene format can't describe\n");
+
+	return scene_valid;
+}
+
+// fails if the scene can't be described in full
+bool
+RenderCoordinator::SerializeScene()
+{
+	FILE *fp = tmpfile();
+	if(!fp)
+		return false;
+
+	unsigned int skipped;
+	bool ok = save_scene(fp, raytracer->GetScene(), &skipped) && skipped == 0;
+	long size = ftell(fp);
+	if(ok && size > 0) {
+		rewind(fp);
+		scene_text.resize(size);
+		ok = fread(&scene_text[0], 1, size, fp) == (size_t)size;
+	} else {
+		ok = false;
+	}
+	fclose(fp);
+
+	return ok;
+}
+
+bool
+RenderCoordinator::StartFrame(Worker &worker, int framewidth, int frameheight)
+{
+	if(!worker.scene_sent) {
+		if(!scene_valid)
+			return false;
+		if(!worker.connection.Send(MSG_SCENE, scene_text.data(), scene_text.size()))
+			return false;
+		worker.scene_sent = true;
+	}
+
+	std::vector <unsigned char> head;
+	Connection::PutUint32(head, (unsigned int)framewidth);
+	Connection::PutUint32(head, (unsigned int)frameheight);
+	Connection::PutUint32(head, (unsigned int)raytracer->GetTileSize());
+	Connection::PutUint32(head, (unsigned int)raytracer->GetPacketSize());
+	Connection::PutUint32(head, raytracer->GetWavefront() ? 1 : 0);
+	Connection::PutUint32(head, (unsigned int)raytracer->GetAntialiasRate());
+	Connection::PutUint32(head, float_bits(raytracer->GetAntialiasThreshold()));
+	// the view can move between frames without the scene being resent
+	put_camera(head, raytracer->GetScene().GetCamera());
+
+	return worker.connection.Send(MSG_FRAME, &head[0], head.size());
+}
+
+bool
+RenderCoordinator::FillWorker(Worker &worker)
+{
+	// a worker that missed the timeout gets nothing more until it
+	// catches up
+	if(!worker.expired.empty())
+		return true;
+
+	if(worker.jobs.empty())
+		worker.waiting_since = timer_seconds();
+	while(worker.jobs.size() < JOBS_PER_THREAD * worker.stats.threads && !queue.empty()) {
+		unsigned int job = queue.front();
+		queue.pop_front();
+		if(done[job])
+			continue;
+
+		std::vector <unsigned char> head;
+		Connection::PutUint32(head, job);
+		put_rect(head, jobs[job]);
+		if(!worker.connection.Send(MSG_TILE, &head[0], head.size())) {
+			queue.push_front(job);
+			return false;
+		}
+
+		worker.jobs.push_back(job);
+	}
+
+	return true;
+}
+
+bool
+RenderCoordinator::HandleMessage(Worker &worker, unsigned char *framebuf, int framewidth)
+{
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	if(!worker.connection.Receive(type, payload))
+		return false;
+	worker.waiting_since = timer_seconds();
+
+	if(type == MSG_STATS && payload.size() == 12) {
+		worker.stats.rays += ((unsigned long)Connection::GetUint32(&payload[0]) << 16 << 16) |
+		                     Connection::GetUint32(&payload[4]);
+		worker.stats.render_seconds += Connection::GetUint32(&payload[8]) * 1.0e-6;
+		return true;
+	}
+
+	if(type == MSG_ERROR) {
+		fprintf(stderr, "%s: %.*s\n", worker.stats.address.c_str(), (int)payload.size(),
+		        payload.empty() ? "" : (const char *)&payload[0]);
+		return false;
+	}
+
+	if(type != MSG_PIXELS || payload.size() < 20)
+		return false;
+
+	unsigned int job = Connection::GetUint32(&payload[0]);
+	RayTracer::TileRect r = get_rect(&payload[4]);
+	std::vector <unsigned int> *owed = &worker.jobs;
+	std::vector <unsigned int>::iterator it = std::find(owed->begin(), owed->end(), job);
+	if(it == owed->end()) {
+		owed = &worker.expired;
+		it = std::find(owed->begin(), owed->end(), job);
+	}
+	if(it == owed->end() || memcmp(&r, &jobs[job], sizeof(r)) != 0 ||
+	   payload.size() != 20 + rect_area(r) * 4)
+		return false;
+	owed->erase(it);
+	worker.missed = 0;
+
+	if(!done[job]) {
+		// workers send RGBA, which the frame may not be in
+		const PixelLayout &layout = raytracer->GetPixelLayout();
+		bool rgba = memcmp(&layout, &RGBA_LAYOUT, sizeof(layout)) == 0;
+		size_t row = (size_t)(r.x1 - r.x0) * 4;
+		const unsigned char *src = &payload[20];
+		for(int y = r.y0; y < r.y1; y++, src += row) {
+			unsigned char *dst = framebuf + ((size_t)y * framewidth + r.x0) * 4;
+			if(rgba)
+				memcpy(dst, src, row);
+			else
+				convert_pixels(src, dst, (size_t)(r.x1 - r.x0), layout);
+		}
+
+		done[job] = 1;
+		remaining--;
+		worker.stats.tiles++;
+		worker.stats.pixels += rect_area(r);
+	}
+
+	return FillWorker(worker);
+}
+
+void
+RenderCoordinator::ExpireJobs(Worker &worker, double now)
+{
+	if(++worker.missed >= MAX_MISSED_DEADLINES) {
+		DropWorker(worker, "timed out");
+		return;
+	}
+
+	fprintf(stderr, "%s: no reply in %d ms, reissuing %u tiles\n", worker.stats.address.c_str(),
+	        job_timeout_ms, (unsigned int)worker.jobs.size());
+
+	// the worker keeps its connection, and a late reply is still used
+	// if nobody else has finished the tile by then
+	for(unsigned int i = 0; i < worker.jobs.size(); i++) {
+		if(!done[worker.jobs[i]]) {
+			queue.push_front(worker.jobs[i]);
+			frame_stats.reissued_tiles++;
+			frame_stats.expired_tiles++;
+		}
+		worker.expired.push_back(worker.jobs[i]);
+	}
+	worker.jobs.clear();
+	worker.waiting_since = now;
+}
+
+void
+RenderCoordinator::DropWorker(Worker &worker, const char *reason)
+{
+	fprintf(stderr, "%s: worker %s, reissuing %u tiles\n", worker.stats.address.c_str(), reason,
+	        (unsigned int)worker.jobs.size());
+
+	// its tiles go to the front so the frame isn't held up waiting for
+	// them at the end
+	for(unsigned int i = 0; i < worker.jobs.size(); i++) {
+		if(!done[worker.jobs[i]]) {
+			queue.push_front(worker.jobs[i]);
+			frame_stats.reissued_tiles++;
+		}
+	}
+	worker.jobs.clear();
+	// these were reissued when they expired
+	worker.expired.clear();
+
+	worker.stats.failed = true;
+	worker.stats.bytes_sent = worker.connection.GetBytesSent();
+	worker.stats.bytes_received = worker.connection.GetBytesReceived();
+	worker.connection.Close();
+}
+
+void
+RenderCoordinator::Draw(unsigned char *framebuf, int framewidth, int frameheight)
+{
+	double start = timer_seconds();
+
+	memset(&frame_stats, 0, sizeof(frame_stats));
+
+	// one job per tile of the raytracer's tile grid
+	int tile_size = raytracer->GetTileSize();
+	jobs.clear();
+	queue.clear();
+	for(int y = 0; y < frameheight; y += tile_size) {
+		for(int x = 0; x < framewidth; x += tile_size) {
+			RayTracer::TileRect r = { x, y, (x + tile_size < framewidth) ? x + tile_size : framewidth,
+			                          (y + tile_size < frameheight) ? y + tile_size : frameheight };
+			queue.push_back((unsigned int)jobs.size());
+			jobs.push_back(r);
+		}
+	}
+	done.assign(jobs.size(), 0);
+	remaining = (unsigned int)jobs.size();
+	frame_stats.tiles = remaining;
+
+	UpdateScene();
+
+	for(unsigned int i = 0; i < workers.size(); i++) {
+		Worker &worker = *workers[i];
+		if(worker.stats.failed)
+			continue;
+
+		worker.stats.tiles = 0;
+		worker.stats.pixels = 0;
+		worker.stats.rays = 0;
+		worker.stats.render_seconds = 0.0;
+		worker.connection.ResetCounters();
+		if(!StartFrame(worker, framewidth, frameheight) || !FillWorker(worker))
+			DropWorker(worker, scene_valid ? "lost" : "not sent the scene");
+	}
+
+	// once every tile is done, the loop still collects the replies owed
+	// for tiles that were reissued and finished elsewhere, so none turns
+	// up in the next frame; a worker still behind on expired tiles is
+	// dropped rather than waited for
+	std::vector <struct pollfd> fds;
+	std::vector <Worker *> polled;
+	for(;;) {
+		double now = timer_seconds();
+		int timeout = -1;
+		fds.clear();
+		polled.clear();
+		for(unsigned int i = 0; i < workers.size(); i++) {
+			Worker &worker = *workers[i];
+			if(!worker.stats.failed && remaining == 0 && !worker.expired.empty())
+				DropWorker(worker, "timed out");
+			if(worker.stats.failed || (worker.jobs.empty() && worker.expired.empty()))
+				continue;
+
+			double deadline = worker.waiting_since + job_timeout_ms * 1.0e-3;
+			int wait_ms = (deadline > now) ? (int)((deadline - now) * 1000.0) + 1 : 0;
+			if(timeout < 0 || wait_ms < timeout)
+				timeout = wait_ms;
+
+			struct pollfd p;
+			p.fd = worker.connection.GetDescriptor();
+			p.events = POLLIN;
+			p.revents = 0;
+			fds.push_back(p);
+			polled.push_back(&worker);
+		}
+		if(polled.empty())
+			break;
+
+		if(poll(&fds[0], fds.size(), timeout) < 0)
+			continue;
+
+		// a worker only misses its deadline if nothing from it is
+		// waiting, since handling another worker's message can take a
+		// while
+		now = timer_seconds();
+		for(unsigned int i = 0; i < fds.size(); i++) {
+			Worker &worker = *polled[i];
+			if(fds[i].revents) {
+				if(!HandleMessage(worker, framebuf, framewidth))
+					DropWorker(worker, "lost");
+			} else if(now >= worker.waiting_since + job_timeout_ms * 1.0e-3) {
+				ExpireJobs(worker, now);
+			}
+		}
+
+		// reissued tiles go to whichever workers have room
+		for(unsigned int i = 0; i < workers.size() && !queue.empty(); i++) {
+			if(!workers[i]->stats.failed && !FillWorker(*workers[i]))
+				DropWorker(*workers[i], "lost");
+		}
+	}
+
+	if(remaining > 0) {
+		std::vector <RayTracer::TileRect> rects;
+		for(unsigned int i = 0; i < jobs.size(); i++) {
+			if(!done[i])
+				rects.push_back(jobs[i]);
+		}
+		frame_stats.local_tiles = (unsigned int)rects.size();
+		raytracer->DrawRects(framebuf, framewidth, frameheight, rects);
+	}
+
+	for(unsigned int i = 0; i < workers.size(); i++) {
+		WorkerStats &stats = workers[i]->stats;
+		if(!stats.failed) {
+			stats.bytes_sent = workers[i]->connection.GetBytesSent();
+			stats.bytes_received = workers[i]->connection.GetBytesReceived();
+		}
+		frame_stats.bytes_sent += stats.bytes_sent;
+		frame_stats.bytes_received += stats.bytes_received;
+	}
+
+	frame_stats.draw_seconds = timer_seconds() - start;
+}
+
+/*
+ * RenderWorker class
+ */
+RenderWorker::RenderWorker(unsigned int thread_count_arg)
+{
+	thread_count = thread_count_arg;
+}
+
+bool
+RenderWorker::Listen(const char *address, std::string *error)
+{
+	return listener.Listen(address, error);
+}
+
+void
+RenderWorker::Run()
+{
+	for(;;) {
+		std::string error;
+		Connection *connection = listener.Accept(&error);
+		if(!connection) {
+			fprintf(stderr, "accept: %s\n", error.c_str());
+			return;
+		}
+
+		printf("Coordinator connected\n");
+		fflush(stdout);
+		bool ok = Serve(*connection);
+		printf("Coordinator %s: %lu bytes in, %lu bytes out\n", ok ? "done" : "failed",
+		       connection->GetBytesReceived(), connection->GetBytesSent());
+		fflush(stdout);
+		delete connection;
+	}
+}
+
+static bool
+send_error(Connection &connection, const char *message)
+{
+	connection.Send(MSG_ERROR, message, strlen(message));
+	return false;
+}
+
+// renders the jobs received so far as one batch and sends them back
+static bool
+render_batch(Connection &connection, RayTracer &raytracer, std::vector <unsigned char> &framebuf,
+             int width, int height, std::vector <unsigned int> &ids, std::vector <RayTracer::TileRect> &rects)
+{
+	raytracer.DrawRects(&framebuf[0], width, height, rects);
+
+	// the statistics go first, so they have arrived by the time the
+	// coordinator has the last tile of the frame
+	const RayTracer::FrameStats &stats = raytracer.GetFrameStats();
+	std::vector <unsigned char> head;
+	Connection::PutUint32(head, (unsigned int)(stats.rays >> 16 >> 16));
+	Connection::PutUint32(head, (unsigned int)stats.rays);
+	Connection::PutUint32(head, (unsigned int)(stats.draw_seconds * 1.0e6));
+	if(!connection.Send(MSG_STATS, &head[0], head.size()))
+		return false;
+
+	std::vector <unsigned char> pixels;
+	for(unsigned int i = 0; i < rects.size(); i++) {
+		const RayTracer::TileRect &r = rects[i];
+		size_t row = (size_t)(r.x1 - r.x0) * 4;
+
+		pixels.resize(rect_area(r) * 4);
+		for(int y = r.y0; y < r.y1; y++)
+			memcpy(&pixels[(y - r.y0) * row], &framebuf[((size_t)y * width + r.x0) * 4], row);
+
+		head.clear();
+		Connection::PutUint32(head, ids[i]);
+		put_rect(head, r);
+		if(!connection.Send(MSG_PIXELS, &head[0], head.size(), &pixels[0], pixels.size()))
+			return false;
+	}
+
+	ids.clear();
+	rects.clear();
+
+	return true;
+}
+
+bool
+RenderWorker::Serve(Connection &connection)
+{
+	std::vector <unsigned char> hello;
+	Connection::PutUint32(hello, PROTOCOL_VERSION);
+	Connection::PutUint32(hello, thread_count ? thread_count : ThreadPool::GetDefaultThreadCount());
+	if(!connection.Send(MSG_HELLO, &hello[0], hello.size()))
+		return false;
+
+	Scene *scene = NULL;
+	RayTracer *raytracer = NULL;
+	std::vector <unsigned char> framebuf;
+	int width = 0, height = 0;
+	std::vector <unsigned int> ids;
+	std::vector <RayTracer::TileRect> rects;
+
+	bool ok = true;
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	while(ok) {
+		// batch up the jobs that have arrived, and render them once
+		// nothing more is waiting
+		if(!rects.empty() && !connection.Poll(0)) {
+			ok = render_batch(connection, *raytracer, framebuf, width, height, ids, rects);
+			continue;
+		}
+
+		// the coordinator hanging up ends the session normally
+		if(!connection.Receive(type, payload))
+			break;
+
+		if(type == MSG_SCENE) {
+			delete raytracer;
+			delete scene;
+			raytracer = NULL;
+			scene = new Scene;
+
+			FILE *fp = tmpfile();
+			std::string error = "can't buffer the scene";
+			if(!fp || (!payload.empty() && fwrite(&payload[0], 1, payload.size(), fp) != payload.size())) {
+				ok = send_error(connection, error.c_str());
+			} else {
+				rewind(fp);
+				if(!load_scene(fp, *scene, NULL, &error))
+					ok = send_error(connection, error.c_str());
+			}
+			if(fp)
+				fclose(fp);
+
+			if(ok) {
+				scene->Build();
+				raytracer = new RayTracer(scene);
+				raytracer->SetThreadCount(thread_count);
+			}
+		} else if(type == MSG_FRAME) {
+			if(!raytracer || payload.size() != 28 + CAMERA_FLOATS * 4) {
+				ok = send_error(connection, "frame without a scene");
+				continue;
+			}
+
+			width = (int)Connection::GetUint32(&payload[0]);
+			height = (int)Connection::GetUint32(&payload[4]);
+			if(width <= 0 || height <= 0 || (size_t)width * height > (size_t)1 << 30) {
+				ok = send_error(connection, "bad frame size");
+				continue;
+			}
+
+			raytracer->SetTileSize((int)Connection::GetUint32(&payload[8]));
+			raytracer->SetPacketSize((int)Connection::GetUint32(&payload[12]));
+			raytracer->SetWavefront(Connection::GetUint32(&payload[16]) != 0);
+			raytracer->SetAntialiasing((int)Connection::GetUint32(&payload[20]),
+			                           bits_float(Connection::GetUint32(&payload[24])));
+			get_camera(&payload[28], scene->GetCamera());
+			framebuf.resize((size_t)width * height * 4);
+		} else if(type == MSG_TILE) {
+			if(framebuf.empty() || payload.size() != 20) {
+				ok = send_error(connection, "tile without a frame");
+				continue;
+			}
+
+			RayTracer::TileRect r = get_rect(&payload[4]);
+			if(r.x0 < 0 || r.y0 < 0 || r.x1 > width || r.y1 > height || r.x0 >= r.x1 || r.y0 >= r.y1) {
+				ok = send_error(connection, "tile outside the frame");
+				continue;
+			}
+
+			ids.push_back(Connection::GetUint32(&payload[0]));
+			rects.push_back(r);
+		} else {
+			ok = send_error(connection, "unknown message");
+		}
+	}
+
+	delete raytracer;
+	delete scene;
+
+	return ok;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RENDERFARM_H__
+#define __RENDERFARM_H__
+
+#include <deque>
+#include <string>
+#include <vector>
+#include "connection.h"
+#include "raytracer.h"
+
+/*
+ * Frame rendering spread over worker processes. A RenderCoordinator
+ * splits each frame into tile jobs and hands them to its workers as they
+ * return earlier ones, keeping a few in flight per worker thread, then
+ * copies the returned pixels into the caller's framebuffer. The scene is
+ * sent to each worker in the text scene format before its first frame,
+ * and again before the next frame whenever it is edited; the camera and
+ * render settings go with every frame. A scene the text format can't
+ * fully describe isn't sent at all, and the coordinator renders it
+ * itself.
+ *
+ * A worker whose connection fails is dropped and its unfinished tiles
+ * are handed to the others. So are the tiles of a worker that has sent
+ * nothing for the job timeout while it has tiles outstanding, as when it
+ * hangs or its host goes away silently; a late reply is still used if
+ * the tile isn't done by then. A worker is given no new tiles until it
+ * replies again, and is dropped after missing MAX_MISSED_DEADLINES in a
+ * row, or if it still owes tiles at the end of a frame. If no worker is
+ * left, the coordinator renders the remaining tiles itself.
+ */
+class RenderCoordinator {
+	public:
+		struct WorkerStats {
+			std::string address;
+			unsigned int threads;
+			bool failed;
+
+			// for the most recent frame
+			unsigned int tiles;
+			unsigned long pixels;
+			unsigned long rays;
+			double render_seconds;
+			unsigned long bytes_sent;
+			unsigned long bytes_received;
+		};
+
+		struct FrameStats {
+			double draw_seconds;
+			unsigned int tiles;
+			// tiles handed out again after their worker failed or
+			// missed the job timeout, the latter also counted in
+			// expired_tiles, and tiles the coordinator had to render
+			// itself
+			unsigned int reissued_tiles;
+			unsigned int expired_tiles;
+			unsigned int local_tiles;
+			unsigned long bytes_sent;
+			unsigned long bytes_received;
+		};
+
+	protected:
+		struct Worker {
+			Connection connection;
+			WorkerStats stats;
+			bool scene_sent;
+			// ids of the jobs the worker has been sent but not returned
+			std::vector <unsigned int> jobs;
+			// jobs taken back after the worker missed the timeout, and
+			// deadlines missed since it last returned a tile
+			std::vector <unsigned int> expired;
+			unsigned int missed;
+			// since when the worker has owed a reply
+			double waiting_since;
+		};
+
+		RayTracer *raytracer;
+		std::vector <Worker *> workers;
+		FrameStats frame_stats;
+		int job_timeout_ms;
+
+		// what scene_text was made from, to tell when the scene was
+		// edited; the camera goes with every frame, so it isn't kept
+		struct SceneState {
+			std::vector <Vector> lights;
+			float ambient;
+			int max_depth;
+			Scene::Termination termination;
+			bool shadows;
+			unsigned int geometries;
+			unsigned int sphere_records;
+			unsigned int attached_spheres;
+			// every object's bounds, min then max, and material
+			std::vector <Vector> bounds;
+			std::vector <Material> materials;
+		};
+
+		std::string scene_text;
+		SceneState scene_state;
+		// whether scene_state is set, and scene_text describes the
+		// whole scene
+		bool scene_saved;
+		bool scene_valid;
+		std::vector <RayTracer::TileRect> jobs;
+		std::vector <char> done;
+		std::deque <unsigned int> queue;
+		unsigned int remaining;
+
+		void GetSceneState(SceneState &state) const;
+		static bool SameSceneState(const SceneState &a, const SceneState &b);
+		bool UpdateScene();
+		bool SerializeScene();
+		bool StartFrame(Worker &worker, int framewidth, int frameheight);
+		bool FillWorker(Worker &worker);
+		bool HandleMessage(Worker &worker, unsigned char *framebuf, int framewidth);
+		void ExpireJobs(Worker &worker, double now);
+		void DropWorker(Worker &worker, const char *reason);
+
+	public:
+		enum { DEFAULT_JOB_TIMEOUT_MS = 10000, MAX_MISSED_DEADLINES = 3 };
+
+		// renders raytracer's scene with its settings; the raytracer
+		// also renders whatever the workers can't
+		RenderCoordinator(RayTracer *raytracer_arg);
+		~RenderCoordinator();
+
+		bool AddWorker(const char *address, std::string *error);
+		inline unsigned int GetWorkerCount() const { return (unsigned int)workers.size(); }
+		inline const WorkerStats &GetWorkerStats(unsigned int i) const { return workers[i]->stats; }
+
+		// how long a worker with tiles outstanding may go without
+		// sending anything, which includes loading a new scene;
+		// DEFAULT_JOB_TIMEOUT_MS by default
+		void SetJobTimeout(int timeout_ms);
+		inline int GetJobTimeout() const { return job_timeout_ms; }
+
+		void Draw(unsigned char *framebuf, int framewidth, int frameheight);
+
+		// statistics from the most recent call to Draw()
+		inline const FrameStats &GetFrameStats() const { return frame_stats; }
+
+	private:
+		RenderCoordinator(const RenderCoordinator &);
+		RenderCoordinator &operator = (const RenderCoordinator &);
+};
+
+// cameras travel as CAMERA_FLOATS float bit patterns in network byte
+// order: the position, forward, right and down vectors, then the half
+// width and height; the render server uses the same layout
+const unsigned int CAMERA_FLOATS = 14;
+void put_camera(std::vector <unsigned char> &buffer, const Camera &camera);
+void get_camera(const unsigned char *p, Camera &camera);
+
+/*
+ * Serves coordinators, one connection at a time. Tile jobs that arrive
+ * together are rendered as one batch across the worker's threads.
+ */
+class RenderWorker {
+	protected:
+		Connection listener;
+		unsigned int thread_count;
+
+		bool Serve(Connection &connection);
+
+	public:
+		// 0 uses one thread per online CPU
+		RenderWorker(unsigned int thread_count_arg = 0);
+
+		bool Listen(const char *address, std::string *error);
+
+		// serves connections until accepting one fails
+		void Run();
+
+	private:
+		RenderWorker(const RenderWorker &);
+		RenderWorker &operator = (const RenderWorker &);
+};
+
+#endif /* __RENDERFARM_H__ */
@@ -0,0 +1,621 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// renderserver.cpp - Render daemon with a warm scene cache
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include "image.h"
+#include "renderfarm.h"
+#include "renderserver.h"
+#include "scenefile.h"
+#include "scenegen.h"
+#include "timer.h"
+
+// payloads are lists of 32-bit integers, described here in order
+enum {
+	MSG_RENDER = 1, // client: request id, width, height, format,
+	                // antialiasing rate, shadows, budget in microseconds
+	                // (0 for a full frame), camera flag and camera, then
+	                // the scene id
+	MSG_IMAGE,      // server: request id, width, height, format, queued
+	                // and render microseconds, then the image
+	MSG_STATS,      // client: nothing; server: the statistics text
+	MSG_ERROR       // server: request id, message text
+};
+
+const size_t RENDER_HEAD_SIZE = 32 + CAMERA_FLOATS * 4;
+const size_t IMAGE_HEAD_SIZE = 24;
+
+// the largest frame whose RGBA pixels fit in a reply
+const uint64_t MAX_FRAME_PIXELS = (Connection::MAX_MESSAGE_SIZE - IMAGE_HEAD_SIZE) / 4;
+
+static bool
+fail(std::string *error, const std::string &message)
+{
+	if(error)
+		*error = message;
+	return false;
+}
+
+static time_t
+file_mtime(const char *path)
+{
+	struct stat st;
+	return (stat(path, &st) == 0) ? st.st_mtime : 0;
+}
+
+// builds a generated scene from TYPE:COUNT[:SEED]; returns false if the
+// id isn't of that form
+static bool
+generate_from_id(const std::string &id, Scene &scene)
+{
+	size_t colon = id.find(':');
+	if(colon == std::string::npos)
+		return false;
+
+	int type = scene_type_from_name(id.substr(0, colon).c_str());
+	if(type < 0)
+		return false;
+
+	unsigned int count = 0, seed = 1;
+	const char *rest = id.c_str() + colon + 1;
+	char *end;
+	count = (unsigned int)strtoul(rest, &end, 10);
+	if(end == rest || (*end != '\0' && *end != ':'))
+		return false;
+	if(*end == ':') {
+		rest = end + 1;
+		seed = (unsigned int)strtoul(rest, &end, 10);
+		if(end == rest || *end != '\0')
+			return false;
+	}
+
+	generate_scene(scene, (SceneType)type, count, seed);
+	return true;
+}
+
+// the given fraction of the samples, which must be sorted
+static double
+percentile(const std::vector <double> &sorted, double fraction)
+{
+	if(sorted.empty())
+		return 0.0;
+
+	size_t i = (size_t)(fraction * (double)(sorted.size() - 1) + 0.5);
+	return sorted[i];
+}
+
+static void
+put_percentiles(std::string &text, const char *name, std::vector <double> samples)
+{
+	std::sort(samples.begin(), samples.end());
+
+	char line[160];
+	sprintf(line, "%s p50 %.3f p90 %.3f p99 %.3f max %.3f\n", name,
+	        percentile(samples, 0.5) * 1000.0, percentile(samples, 0.9) * 1000.0,
+	        percentile(samples, 0.99) * 1000.0, samples.empty() ? 0.0 : samples.back() * 1000.0);
+	text += line;
+}
+
+static bool
+send_error(Connection &connection, unsigned int id, const std::string &message)
+{
+	std::vector <unsigned char> head;
+	Connection::PutUint32(head, id);
+
+	return connection.Send(MSG_ERROR, &head[0], head.size(), message.data(), message.size());
+}
+
+// at least the size of the frame's image in the given format
+static uint64_t
+image_size_bound(RenderServer::Format format, int width, int height)
+{
+	uint64_t pixels = (uint64_t)width * (uint64_t)height;
+	if(format == RenderServer::FORMAT_PPM)
+		return pixels * 3 + 32;
+	if(format == RenderServer::FORMAT_PNG) {
+		// a filter byte per row, five bytes per stored deflate block,
+		// and the signature and chunks around them
+		uint64_t raw = pixels * 3 + (uint64_t)height;
+		return raw + (raw / 65535 + 1) * 5 + 128;
+	}
+
+	return pixels * 4;
+}
+
+// false for infinities and NaNs
+static bool
+is_finite(float f)
+{
+	return f - f == 0.0f;
+}
+
+static bool
+is_finite(const Vector &v)
+{
+	return is_finite(v.vec[0]) && is_finite(v.vec[1]) && is_finite(v.vec[2]);
+}
+
+// any client can name any scene file, so its settings are checked
+// before it is drawn rather than trusted
+static bool
+check_scene(const Scene &scene, std::string *error)
+{
+	const char *problem = NULL;
+	const Camera &camera = scene.GetCamera();
+	if(scene.GetMaxDepth() < -1 || scene.GetMaxDepth() > Scene::MAX_DEPTH)
+		problem = "reflection depth out of range";
+	else if(!is_finite(scene.GetAmbient()))
+		problem = "bad ambient light";
+	else if(!is_finite(camera.GetPosition()) || !is_finite(camera.GetForward()) || !is_finite(camera.GetRight()) ||
+	        !is_finite(camera.GetDown()) || !is_finite(camera.GetHalfWidth()) || !is_finite(camera.GetHalfHeight()) ||
+	        camera.GetHalfWidth() <= 0.0f || camera.GetHalfHeight() <= 0.0f)
+		problem = "bad camera";
+	for(unsigned int i = 0; !problem && i < scene.GetLights().size(); i++) {
+		if(!is_finite(scene.GetLights()[i]))
+			problem = "bad light position";
+	}
+
+	if(problem && error)
+		*error = problem;
+	return problem == NULL;
+}
+
+/*
+ * RenderServer class
+ */
+RenderServer::Request::Request()
+{
+	scene = "default";
+	width = 640;
+	height = 480;
+	format = FORMAT_RGBA;
+	aa_rate = 1;
+	shadows = SHADOWS_SCENE;
+	budget_seconds = 0.0;
+	set_camera = false;
+}
+
+RenderServer::RenderServer(unsigned int thread_count, unsigned int cache_size_arg)
+{
+	pool = new ThreadPool(thread_count ? thread_count : ThreadPool::GetDefaultThreadCount());
+	cache_size = cache_size_arg ? cache_size_arg : 1;
+	next_client = 0;
+	accept_retry = 0.0;
+	requests = 0;
+	errors = 0;
+	cache_hits = 0;
+	cache_misses = 0;
+}
+
+RenderServer::~RenderServer()
+{
+	while(!clients.empty())
+		DropClient((unsigned int)clients.size() - 1);
+
+	for(std::list <CachedScene *>::iterator i = cache.begin(); i != cache.end(); ++i) {
+		delete (*i)->raytracer;
+		delete (*i)->scene;
+		delete *i;
+	}
+
+	delete pool;
+}
+
+bool
+RenderServer::Listen(const char *address, std::string *error)
+{
+	return listener.Listen(address, error);
+}
+
+// finds the scene in the cache, or loads and builds it, evicting the
+// least recently used scene if the cache is full
+RenderServer::CachedScene *
+RenderServer::GetScene(const std::string &id, std::string *error)
+{
+	for(std::list <CachedScene *>::iterator i = cache.begin(); i != cache.end(); ++i) {
+		CachedScene *cached = *i;
+		if(cached->id != id)
+			continue;
+
+		// a scene file edited since it was loaded is loaded again
+		if(cached->mtime && file_mtime(id.c_str()) != cached->mtime) {
+			delete cached->raytracer;
+			delete cached->scene;
+			delete cached;
+			cache.erase(i);
+			break;
+		}
+
+		cache.erase(i);
+		cache.push_front(cached);
+		cache_hits++;
+		return cached;
+	}
+	cache_misses++;
+
+	Scene *scene = new Scene;
+	time_t mtime = 0;
+	if(id == "default") {
+		generate_scene(*scene, SCENE_DEFAULT, 0, 0);
+	} else if(!generate_from_id(id, *scene)) {
+		mtime = file_mtime(id.c_str());
+		if(!load_scene(id.c_str(), *scene, NULL, error)) {
+			delete scene;
+			return NULL;
+		}
+	}
+	if(!check_scene(*scene, error)) {
+		delete scene;
+		return NULL;
+	}
+	scene->Build();
+
+	CachedScene *cached = new CachedScene;
+	cached->id = id;
+	cached->mtime = mtime;
+	cached->scene = scene;
+	cached->raytracer = new RayTracer(scene);
+	cached->raytracer->SetThreadPool(pool);
+	cached->camera = scene->GetCamera();
+	cached->shadows = scene->GetShadows();
+
+	cache.push_front(cached);
+	while(cache.size() > cache_size) {
+		delete cache.back()->raytracer;
+		delete cache.back()->scene;
+		delete cache.back();
+		cache.pop_back();
+	}
+
+	return cached;
+}
+
+// reads one message from the client; returns false if the client
+// should be dropped, which includes its sending only part of one within
+// RECEIVE_TIMEOUT_MS
+bool
+RenderServer::HandleMessage(Client &client)
+{
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	if(!client.connection->Receive(type, payload))
+		return false;
+
+	if(type == MSG_STATS) {
+		std::string text = GetStatsText();
+		return client.connection->Send(MSG_STATS, text.data(), text.size());
+	}
+
+	if(type != MSG_RENDER) {
+		send_error(*client.connection, 0, "unknown message");
+		return false;
+	}
+
+	unsigned int id = payload.size() >= 4 ? Connection::GetUint32(&payload[0]) : 0;
+	if(payload.size() <= RENDER_HEAD_SIZE) {
+		errors++;
+		return send_error(*client.connection, id, "bad render request");
+	}
+
+	Pending pending;
+	pending.id = id;
+	pending.received = timer_seconds();
+
+	Request &request = pending.request;
+	request.width = (int)Connection::GetUint32(&payload[4]);
+	request.height = (int)Connection::GetUint32(&payload[8]);
+	unsigned int format = Connection::GetUint32(&payload[12]);
+	request.aa_rate = (int)Connection::GetUint32(&payload[16]);
+	request.shadows = (int)Connection::GetUint32(&payload[20]);
+	request.budget_seconds = (double)Connection::GetUint32(&payload[24]) * 1.0e-6;
+	request.set_camera = Connection::GetUint32(&payload[28]) != 0;
+	get_camera(&payload[32], request.camera);
+	request.scene.assign((const char *)&payload[RENDER_HEAD_SIZE], payload.size() - RENDER_HEAD_SIZE);
+
+	// a frame too large to send back is turned down before it is drawn
+	const char *problem = NULL;
+	if(request.width <= 0 || request.height <= 0)
+		problem = "bad frame size";
+	else if(format > FORMAT_PNG)
+		problem = "unknown image format";
+	else if((uint64_t)request.width * (uint64_t)request.height > MAX_FRAME_PIXELS ||
+	        IMAGE_HEAD_SIZE + image_size_bound((Format)format, request.width, request.height) >
+	        (uint64_t)Connection::MAX_MESSAGE_SIZE)
+		problem = "frame too large";
+	else if(request.shadows < SHADOWS_OFF || request.shadows > SHADOWS_SCENE)
+		problem = "bad shadow setting";
+	if(problem) {
+		errors++;
+		return send_error(*client.connection, id, problem);
+	}
+	request.format = (Format)format;
+
+	client.queue.push_back(pending);
+	return true;
+}
+
+// renders the client's oldest request on the whole pool and sends the
+// reply; returns false if the client should be dropped
+bool
+RenderServer::Serve(Client &client)
+{
+	Pending pending = client.queue.front();
+	client.queue.pop_front();
+	const Request &request = pending.request;
+
+	double start = timer_seconds();
+	std::string error;
+	CachedScene *cached = GetScene(request.scene, &error);
+	if(!cached) {
+		errors++;
+		return send_error(*client.connection, pending.id, request.scene + ": " + error);
+	}
+
+	Scene &scene = *cached->scene;
+	scene.GetCamera() = request.set_camera ? request.camera : cached->camera;
+	scene.SetShadows(request.shadows == SHADOWS_SCENE ? cached->shadows : request.shadows == SHADOWS_ON);
+
+	RayTracer &raytracer = *cached->raytracer;
+	raytracer.SetAntialiasing(request.aa_rate);
+
+	// the tile size doesn't change the image
+	int tile_size = TILE_SIZE;
+	size_t min_tiles = (size_t)pool->GetThreadCount() * TILES_PER_THREAD;
+	while(tile_size > MIN_TILE_SIZE) {
+		size_t tiles_x = (size_t)((request.width + tile_size - 1) / tile_size);
+		size_t tiles_y = (size_t)((request.height + tile_size - 1) / tile_size);
+		if(tiles_x * tiles_y >= min_tiles)
+			break;
+		tile_size /= 2;
+	}
+	raytracer.SetTileSize(tile_size);
+
+	std::vector <unsigned char> framebuf((size_t)request.width * request.height * 4);
+	if(request.budget_seconds > 0.0)
+		raytracer.DrawProgressive(&framebuf[0], request.width, request.height, request.budget_seconds);
+	else
+		raytracer.Draw(&framebuf[0], request.width, request.height);
+
+	std::vector <unsigned char> encoded;
+	if(request.format == FORMAT_PPM)
+		encode_ppm(&framebuf[0], request.width, request.height, encoded);
+	else if(request.format == FORMAT_PNG)
+		encode_png(&framebuf[0], request.width, request.height, encoded);
+	const std::vector <unsigned char> &image = (request.format == FORMAT_RGBA) ? framebuf : encoded;
+
+	double render = timer_seconds() - start;
+	double wait = start - pending.received;
+
+	std::vector <unsigned char> head;
+	Connection::PutUint32(head, pending.id);
+	Connection::PutUint32(head, (unsigned int)request.width);
+	Connection::PutUint32(head, (unsigned int)request.height);
+	Connection::PutUint32(head, (unsigned int)request.format);
+	Connection::PutUint32(head, (unsigned int)(wait * 1.0e6));
+	Connection::PutUint32(head, (unsigned int)(render * 1.0e6));
+	if(!client.connection->Send(MSG_IMAGE, &head[0], head.size(), &image[0], image.size()))
+		return false;
+
+	RecordRequest(timer_seconds() - pending.received, wait, render);
+	return true;
+}
+
+void
+RenderServer::DropClient(unsigned int index)
+{
+	delete clients[index]->connection;
+	delete clients[index];
+	clients.erase(clients.begin() + index);
+
+	if(next_client > index)
+		next_client--;
+}
+
+void
+RenderServer::RecordRequest(double latency, double wait, double render)
+{
+	size_t slot = requests % LATENCY_SAMPLES;
+	if(latencies.size() < LATENCY_SAMPLES) {
+		latencies.push_back(latency);
+		waits.push_back(wait);
+		renders.push_back(render);
+	} else {
+		latencies[slot] = latency;
+		waits[slot] = wait;
+		renders[slot] = render;
+	}
+	requests++;
+}
+
+std::string
+RenderServer::GetStatsText() const
+{
+	unsigned long queued = 0;
+	for(unsigned int i = 0; i < clients.size(); i++)
+		queued += clients[i]->queue.size();
+
+	char line[160];
+	std::string text;
+	sprintf(line, "requests %lu\nerrors %lu\nclients %u\nqueued %lu\n", requests, errors,
+	        (unsigned int)clients.size(), queued);
+	text += line;
+	sprintf(line, "scenes %u of %u\ncache_hits %lu\ncache_misses %lu\n", (unsigned int)cache.size(),
+	        cache_size, cache_hits, cache_misses);
+	text += line;
+
+	// over the most recent requests, in milliseconds
+	put_percentiles(text, "latency_ms", latencies);
+	put_percentiles(text, "queued_ms", waits);
+	put_percentiles(text, "render_ms", renders);
+
+	return text;
+}
+
+/*
+ * The server reads whatever has arrived from every client before each
+ * frame, then serves the next client in turn that has a request
+ * waiting. Latency is timed from when a request was read, so time it
+ * spent in the socket while a frame was drawing isn't counted.
+ */
+void
+RenderServer::Run()
+{
+	std::vector <struct pollfd> fds;
+
+	for(;;) {
+		bool waiting = false;
+		for(unsigned int i = 0; i < clients.size() && !waiting; i++)
+			waiting = !clients[i]->queue.empty();
+
+		int timeout = waiting ? 0 : -1;
+		double retry = accept_retry - timer_seconds();
+		if(retry > 0.0 && !waiting)
+			timeout = (int)(retry * 1000.0) + 1;
+
+		fds.clear();
+		struct pollfd p;
+		p.fd = listener.GetDescriptor();
+		p.events = (retry > 0.0) ? 0 : POLLIN;
+		p.revents = 0;
+		fds.push_back(p);
+		p.events = POLLIN;
+		for(unsigned int i = 0; i < clients.size(); i++) {
+			p.fd = clients[i]->connection->GetDescriptor();
+			fds.push_back(p);
+		}
+
+		// with requests waiting, only pick up what has already arrived
+		if(poll(&fds[0], fds.size(), timeout) < 0)
+			continue;
+
+		// dropping clients shifts the ones after, so go backwards
+		for(unsigned int i = (unsigned int)clients.size(); i > 0; i--) {
+			if(fds[i].revents && !HandleMessage(*clients[i - 1]))
+				DropClient(i - 1);
+		}
+
+		if(fds[0].revents & POLLIN) {
+			std::string error;
+			Connection *connection = listener.Accept(&error);
+			if(connection) {
+				connection->SetSendTimeout(SEND_TIMEOUT_MS);
+				connection->SetReceiveTimeout(RECEIVE_TIMEOUT_MS);
+				Client *client = new Client;
+				client->connection = connection;
+				clients.push_back(client);
+			} else {
+				// the clients already connected can still be served
+				fprintf(stderr, "accept: %s\n", error.c_str());
+				accept_retry = timer_seconds() + ACCEPT_RETRY_MS * 1.0e-3;
+			}
+		}
+
+		for(unsigned int n = 0; n < clients.size(); n++) {
+			unsigned int i = (next_client + n) % (unsigned int)clients.size();
+			if(!clients[i]->queue.empty()) {
+				next_client = i + 1;
+				if(!Serve(*clients[i]))
+					DropClient(i);
+				break;
+			}
+		}
+	}
+}
+
+/*
+ * RenderClient class
+ */
+RenderClient::RenderClient()
+{
+	next_id = 1;
+}
+
+bool
+RenderClient::Connect(const char *address, std::string *error)
+{
+	return connection.Connect(address, error);
+}
+
+bool
+RenderClient::Render(const RenderServer::Request &request, std::vector <unsigned char> &image,
+                     RenderServer::Reply *reply, std::string *error)
+{
+	unsigned int id = next_id++;
+
+	std::vector <unsigned char> head;
+	Connection::PutUint32(head, id);
+	Connection::PutUint32(head, (unsigned int)request.width);
+	Connection::PutUint32(head, (unsigned int)request.height);
+	Connection::PutUint32(head, (unsigned int)request.format);
+	Connection::PutUint32(head, (unsigned int)request.aa_rate);
+	Connection::PutUint32(head, (unsigned int)request.shadows);
+	Connection::PutUint32(head, (unsigned int)(request.budget_seconds * 1.0e6));
+	Connection::PutUint32(head, request.set_camera ? 1 : 0);
+	put_camera(head, request.camera);
+	if(!connection.Send(MSG_RENDER, &head[0], head.size(), request.scene.data(), request.scene.size()))
+		return fail(error, "lost the connection to the server");
+
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	if(!connection.Receive(type, payload))
+		return fail(error, "lost the connection to the server");
+
+	if(type == MSG_ERROR && payload.size() >= 4)
+		return fail(error, std::string((const char *)&payload[4], payload.size() - 4));
+	if(type != MSG_IMAGE || payload.size() < IMAGE_HEAD_SIZE || Connection::GetUint32(&payload[0]) != id)
+		return fail(error, "unexpected reply from the server");
+
+	if(reply) {
+		reply->width = (int)Connection::GetUint32(&payload[4]);
+		reply->height = (int)Connection::GetUint32(&payload[8]);
+		reply->format = (RenderServer::Format)Connection::GetUint32(&payload[12]);
+		reply->queued_seconds = (double)Connection::GetUint32(&payload[16]) * 1.0e-6;
+		reply->render_seconds = (double)Connection::GetUint32(&payload[20]) * 1.0e-6;
+	}
+	image.assign(payload.begin() + IMAGE_HEAD_SIZE, payload.end());
+
+	return true;
+}
+
+bool
+RenderClient::GetStats(std::string &text, std::string *error)
+{
+	unsigned int type;
+	std::vector <unsigned char> payload;
+	if(!connection.Send(MSG_STATS, NULL, 0) || !connection.Receive(type, payload))
+		return fail(error, "lost the connection to the server");
+	if(type != MSG_STATS)
+		return fail(error, "unexpected reply from the server");
+
+	text.assign(payload.begin(), payload.end());
+	return true;
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __RENDERSERVER_H__
+#define __RENDERSERVER_H__
+
+#include <deque>
+#include <list>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include "connection.h"
+#include "raytracer.h"
+
+/*
+ * Long-running render daemon, so that small renders don't pay for
+ * process startup and scene building. Clients connect, usually over a
+ * Unix domain socket, and send render requests naming a scene; the
+ * replies carry raw RGBA pixels or an encoded PPM or PNG image.
+ *
+ * A scene id is "default" for the built-in scene, TYPE:COUNT[:SEED] for
+ * a generated one (see scenegen.h), or else the path of a text scene
+ * file, which is loaded again if it has changed. The most recently used
+ * scenes are kept built, each with a raytracer; all of them draw on one
+ * shared thread pool, a frame at a time. Waiting requests are served
+ * round robin, one per client in turn, so a client sending many can't
+ * hold up the others.
+ *
+ * Frames are drawn one after another rather than side by side on
+ * purpose: each is split into tiles over every thread of the pool, with
+ * smaller tiles for smaller frames, so even a small one keeps it busy;
+ * and requests for the same scene share its camera, settings and
+ * raytracer state, so they couldn't draw at once without a copy of each
+ * per request.
+ */
+class RenderServer {
+	public:
+		enum Format { FORMAT_RGBA, FORMAT_PPM, FORMAT_PNG };
+
+		enum { DEFAULT_CACHE_SCENES = 8, LATENCY_SAMPLES = 4096 };
+
+		// a client that takes none of a reply for this long is dropped,
+		// rather than holding up everyone else
+		enum { SEND_TIMEOUT_MS = 10000 };
+		// nor one that stops partway through a message, which the
+		// server reads in one go once it starts arriving
+		enum { RECEIVE_TIMEOUT_MS = 1000 };
+		// after failing to accept a client, as when out of file
+		// descriptors, the server stops accepting for this long
+		enum { ACCEPT_RETRY_MS = 100 };
+
+		// a frame is split into tiles of TILE_SIZE, or smaller ones
+		// down to MIN_TILE_SIZE if that leaves fewer than
+		// TILES_PER_THREAD for each thread of the pool
+		enum { TILE_SIZE = 32, MIN_TILE_SIZE = 8, TILES_PER_THREAD = 4 };
+
+		// shadows: SHADOWS_SCENE keeps the scene's own setting
+		enum { SHADOWS_OFF, SHADOWS_ON, SHADOWS_SCENE };
+
+		struct Request {
+			std::string scene;
+			int width;
+			int height;
+			Format format;
+			int aa_rate;
+			int shadows;
+			// time budget for a coarse-to-fine frame; 0 draws it all
+			double budget_seconds;
+			// the scene's own camera is used unless set
+			bool set_camera;
+			Camera camera;
+
+			Request();
+		};
+
+		// timings of a served request, in seconds
+		struct Reply {
+			int width;
+			int height;
+			Format format;
+			double queued_seconds;
+			double render_seconds;
+		};
+
+	protected:
+		struct CachedScene {
+			std::string id;
+			// modification time of a scene file, 0 otherwise
+			time_t mtime;
+			Scene *scene;
+			RayTracer *raytracer;
+			// as loaded, since requests change them
+			Camera camera;
+			bool shadows;
+		};
+
+		struct Pending {
+			unsigned int id;
+			Request request;
+			double received;
+		};
+
+		struct Client {
+			Connection *connection;
+			std::deque <Pending> queue;
+		};
+
+		Connection listener;
+		ThreadPool *pool;
+		unsigned int cache_size;
+		// most recently used first
+		std::list <CachedScene *> cache;
+		std::vector <Client *> clients;
+		// where the round robin over clients resumes
+		unsigned int next_client;
+		// when to try accepting again after a failure
+		double accept_retry;
+
+		unsigned long requests;
+		unsigned long errors;
+		unsigned long cache_hits;
+		unsigned long cache_misses;
+		// the most recent latencies, queue waits and render times, in
+		// rings of LATENCY_SAMPLES
+		std::vector <double> latencies;
+		std::vector <double> waits;
+		std::vector <double> renders;
+
+		CachedScene *GetScene(const std::string &id, std::string *error);
+		bool HandleMessage(Client &client);
+		bool Serve(Client &client);
+		void DropClient(unsigned int index);
+		void RecordRequest(double latency, double wait, double render);
+		std::string GetStatsText() const;
+
+	public:
+		// 0 uses one thread per online CPU
+		RenderServer(unsigned int thread_count = 0, unsigned int cache_size_arg = DEFAULT_CACHE_SCENES);
+		~RenderServer();
+
+		bool Listen(const char *address, std::string *error);
+
+		// serves clients; never returns
+		void Run();
+
+	private:
+		RenderServer(const RenderServer &);
+		RenderServer &operator = (const RenderServer &);
+};
+
+/*
+ * Talks to a RenderServer; one request at a time.
+ */
+class RenderClient {
+	protected:
+		Connection connection;
+		unsigned int next_id;
+
+	public:
+		RenderClient();
+
+		bool Connect(const char *address, std::string *error);
+
+		// fills image with the pixels or encoded file of the frame
+		bool Render(const RenderServer::Request &request, std::vector <unsigned char> &image,
+		            RenderServer::Reply *reply, std::string *error);
+
+		// the server's counters and latency percentiles, as lines of
+		// "name value ..."
+		bool GetStats(std::string &text, std::string *error);
+
+	private:
+		RenderClient(const RenderClient &);
+		RenderClient &operator = (const RenderClient &);
+};
+
+#endif /* __RENDERSERVER_H__ */
@@ -1,5 +1,5 @@
 /*
- * Copyright (C) 2003-2004 Josh A. Beam
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
  * All rights reserved.
  *
  * Redistribution and use in source and binary forms, with or without
@@ -23,18 +23,19 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-// math.cpp - Useful math functions and classes
+// scalarmath.cpp - Reference scalar vector math
 
-#include "my_math.h"
+#include <cmath>
+#include "scalarmath.h"
 
 float
-dot_product(const float v1[3], const float v2[3])
+scalar_dot_product(const float v1[3], const float v2[3])
 {
 	return (v1[0]*v2[0] + v1[1]*v2[1] + v1[2]*v2[2]);
 }
 
 void
-cross_product(const float v1[3], const float v2[3], float out[3])
+scalar_cross_product(const float v1[3], const float v2[3], float out[3])
 {
 	out[0] = v1[1] * v2[2] - v1[2] * v2[1];
 	out[1] = v1[2] * v2[0] - v1[0] * v2[2];
@@ -42,19 +43,19 @@ cross_product(const float v1[3], const float v2[3], float out[3])
 }
 
 void
-normalize(float v[3])
+scalar_normalize(float v[3])
 {
 	float f;
 
-	f = 1.0f / sqrtf(dot_product(v, v));
+	f = 1.0f / sqrtf(scalar_dot_product(v, v));
 	v[0] *= f;
 	v[1] *= f;
 	v[2] *= f;
 }
 
-// inline because this will normally just be called by Vector::Scale()
-inline void
-scale_vec(float v[3], float f)
+// inline because this will normally just be called by ScalarVector::Scale()
+static inline void
+scalar_scale_vec(float v[3], float f)
 {
 	v[0] *= f;
 	v[1] *= f;
@@ -62,10 +63,10 @@ scale_vec(float v[3], float f)
 }
 
 /*
- * Vector class
+ * ScalarVector class
  */
 void
-Vector::Clear()
+ScalarVector::Clear()
 {
 	vec[0] = 0.0f;
 	vec[1] = 0.0f;
@@ -73,7 +74,7 @@ Vector::Clear()
 }
 
 void
-Vector::Set(const float v[3])
+ScalarVector::Set(const float v[3])
 {
 	vec[0] = v[0];
 	vec[1] = v[1];
@@ -81,19 +82,19 @@ Vector::Set(const float v[3])
 }
 
 void
-Vector::Scale(float f)
+ScalarVector::Scale(float f)
 {
-	scale_vec(vec, f);
+	scalar_scale_vec(vec, f);
 }
 
 void
-Vector::Normalize()
+ScalarVector::Normalize()
 {
-	normalize(vec);
+	scalar_normalize(vec);
 }
 
 void
-Vector::Add(const Vector *v)
+ScalarVector::Add(const ScalarVector *v)
 {
 	vec[0] += v->vec[0];
 	vec[1] += v->vec[1];
@@ -101,17 +102,17 @@ Vector::Add(const Vector *v)
 }
 
 void
-Vector::Subtract(const Vector *v)
+ScalarVector::Subtract(const ScalarVector *v)
 {
 	vec[0] -= v->vec[0];
 	vec[1] -= v->vec[1];
 	vec[2] -= v->vec[2];
 }
 
-Vector
-Vector::operator + (float f) const
+ScalarVector
+ScalarVector::operator + (float f) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.vec[0] += f;
@@ -121,10 +122,10 @@ Vector::operator + (float f) const
 	return tmp;
 }
 
-Vector
-Vector::operator + (Vector v) const
+ScalarVector
+ScalarVector::operator + (ScalarVector v) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.Add(&v);
@@ -132,10 +133,10 @@ Vector::operator + (Vector v) const
 	return tmp;
 }
 
-Vector
-Vector::operator - (float f) const
+ScalarVector
+ScalarVector::operator - (float f) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.vec[0] -= f;
@@ -145,10 +146,10 @@ Vector::operator - (float f) const
 	return tmp;
 }
 
-Vector
-Vector::operator - (Vector v) const
+ScalarVector
+ScalarVector::operator - (ScalarVector v) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.Subtract(&v);
@@ -156,10 +157,10 @@ Vector::operator - (Vector v) const
 	return tmp;
 }
 
-Vector
-Vector::operator * (float f) const
+ScalarVector
+ScalarVector::operator * (float f) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.Scale(f);
@@ -167,10 +168,10 @@ Vector::operator * (float f) const
 	return tmp;
 }
 
-Vector
-Vector::operator * (Vector v) const
+ScalarVector
+ScalarVector::operator * (ScalarVector v) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.vec[0] *= v.vec[0];
@@ -180,10 +181,10 @@ Vector::operator * (Vector v) const
 	return tmp;
 }
 
-Vector
-Vector::operator / (float f) const
+ScalarVector
+ScalarVector::operator / (float f) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.vec[0] /= f;
@@ -193,10 +194,10 @@ Vector::operator / (float f) const
 	return tmp;
 }
 
-Vector
-Vector::operator / (Vector v) const
+ScalarVector
+ScalarVector::operator / (ScalarVector v) const
 {
-	Vector tmp;
+	ScalarVector tmp;
 
 	tmp.Set(vec);
 	tmp.vec[0] /= v.vec[0];
@@ -206,8 +207,8 @@ Vector::operator / (Vector v) const
 	return tmp;
 }
 
-Vector
-Vector::operator += (float f)
+ScalarVector
+ScalarVector::operator += (float f)
 {
 	vec[0] += f;
 	vec[1] += f;
@@ -216,16 +217,16 @@ Vector::operator += (float f)
 	return *this;
 }
 
-Vector
-Vector::operator += (Vector v)
+ScalarVector
+ScalarVector::operator += (ScalarVector v)
 {
 	Add(&v);
 
 	return *this;
 }
 
-Vector
-Vector::operator -= (float f)
+ScalarVector
+ScalarVector::operator -= (float f)
 {
 	vec[0] -= f;
 	vec[1] -= f;
@@ -234,24 +235,24 @@ Vector::operator -= (float f)
 	return *this;
 }
 
-Vector
-Vector::operator -= (Vector v)
+ScalarVector
+ScalarVector::operator -= (ScalarVector v)
 {
 	Subtract(&v);
 
 	return *this;
 }
 
-Vector
-Vector::operator *= (float f)
+ScalarVector
+ScalarVector::operator *= (float f)
 {
 	Scale(f);
 
 	return *this;
 }
 
-Vector
-Vector::operator *= (Vector v)
+ScalarVector
+ScalarVector::operator *= (ScalarVector v)
 {
 	vec[0] *= v.vec[0];
 	vec[1] *= v.vec[1];
@@ -260,8 +261,8 @@ Vector::operator *= (Vector v)
 	return *this;
 }
 
-Vector
-Vector::operator /= (float f)
+ScalarVector
+ScalarVector::operator /= (float f)
 {
 	vec[0] /= f;
 	vec[1] /= f;
@@ -270,8 +271,8 @@ Vector::operator /= (float f)
 	return *this;
 }
 
-Vector
-Vector::operator /= (Vector v)
+ScalarVector
+ScalarVector::operator /= (ScalarVector v)
 {
 	vec[0] /= v.vec[0];
 	vec[1] /= v.vec[1];
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCALARMATH_H__
+#define __SCALARMATH_H__
+
+/*
+ * The vector math as it was before Vector moved to a float4 layout:
+ * three floats and out-of-line operators, with the same arithmetic per
+ * component. Kept as the reference the Vector tests compare against and
+ * as the baseline of the kernel microbenchmarks; the renderer itself
+ * doesn't use it.
+ */
+class ScalarVector {
+	public:
+		float vec[3];
+
+		ScalarVector() { }
+		ScalarVector(float f1, float f2, float f3) { vec[0] = f1; vec[1] = f2; vec[2] = f3; }
+		void Clear();
+		void Set(const float v[3]);
+		void Scale(float f);
+		void Normalize();
+		void Add(const ScalarVector *v);
+		void Subtract(const ScalarVector *v);
+
+		ScalarVector operator + (float f) const;
+		ScalarVector operator + (ScalarVector v) const;
+		ScalarVector operator - (float f) const;
+		ScalarVector operator - (ScalarVector v) const;
+		ScalarVector operator * (float f) const;
+		ScalarVector operator * (ScalarVector v) const;
+		ScalarVector operator / (float f) const;
+		ScalarVector operator / (ScalarVector v) const;
+		ScalarVector operator += (float f);
+		ScalarVector operator += (ScalarVector v);
+		ScalarVector operator -= (float f);
+		ScalarVector operator -= (ScalarVector v);
+		ScalarVector operator *= (float f);
+		ScalarVector operator *= (ScalarVector v);
+		ScalarVector operator /= (float f);
+		ScalarVector operator /= (ScalarVector v);
+};
+
+float scalar_dot_product(const float v1[3], const float v2[3]);
+void scalar_cross_product(const float v1[3], const float v2[3], float out[3]);
+void scalar_normalize(float v[3]);
+
+#endif /* __SCALARMATH_H__ */
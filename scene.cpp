@@ -0,0 +1,784 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// scene.cpp - Scene object list, acceleration structures and shading
+
+#include <cstring>
+#include "scene.h"
+#include "mappedfile.h"
+#include "trace.h"
+
+#define SQUARE(x) ((x)*(x))
+
+const int DEFAULT_MAX_DEPTH = 8;
+
+// a reflection weighted below this can change an 8-bit channel by less
+// than one step, so it is worth checking whether it can change the pixel
+const float MIN_THROUGHPUT = 1.0f / 255.0f;
+
+// with TERMINATE_ROULETTE, paths off materials at least this reflective
+// play roulette once their throughput drops below ROULETTE_START, and
+// go on at that throughput if they survive
+const float ROULETTE_REFLECTANCE = 0.5f;
+const float ROULETTE_START = 0.5f;
+const float DEFAULT_AMBIENT = 0.2f;
+
+const Vector default_light_pos(-2.0f, -10.0f, 12.0f);
+
+// how far shadow rays start off a surface that can shadow itself, per
+// unit of the point's largest coordinate
+const float SHADOW_BIAS = 1.0e-4f;
+
+// lights beyond this share last-occluder slots
+const unsigned int OCCLUDER_CACHE_SIZE = 8;
+
+// the last blocker each light's shadow rays found on this thread, plus
+// one so that zero means none. Ids aren't tied to a scene, so an entry
+// may be stale; it's only ever a first guess.
+static __thread unsigned int last_occluder[OCCLUDER_CACHE_SIZE];
+
+static __thread std::vector <unsigned int> *hit_log;
+
+static __thread int shade_depth;
+
+static inline void
+log_hit(unsigned int primitive)
+{
+	// neighbouring rays mostly hit the same primitive
+	if(hit_log->empty() || hit_log->back() != primitive)
+		hit_log->push_back(primitive);
+}
+
+// leaf callbacks handed to BVH::Traverse()/TraverseAny()/TraversePacket()
+struct ObjectLeaf {
+	const std::vector <const Object *> *objects;
+	const Ray *ray;
+	unsigned int id_base;
+	unsigned int closest;
+
+	inline void operator () (unsigned int first, unsigned int n, float &closest_t)
+	{
+		for(unsigned int i = first; i < first + n; i++) {
+			float t;
+			if((*objects)[i]->Intersection(*ray, &t) && t < closest_t) {
+				closest_t = t;
+				closest = id_base + i;
+			}
+		}
+	}
+};
+
+struct ObjectOcclusionLeaf {
+	const std::vector <const Object *> *objects;
+	const Ray *ray;
+	unsigned int id_base;
+	unsigned int ignore;
+	unsigned int occluder;
+
+	inline bool operator () (unsigned int first, unsigned int n, float max_t)
+	{
+		for(unsigned int i = first; i < first + n; i++) {
+			float t;
+			if(id_base + i != ignore && (*objects)[i]->Intersection(*ray, &t) && t < max_t) {
+				occluder = id_base + i;
+				return true;
+			}
+		}
+
+		return false;
+	}
+};
+
+struct ObjectPacketLeaf {
+	const std::vector <const Object *> *objects;
+	unsigned int id_base;
+
+	inline void operator () (unsigned int first, unsigned int n, RayPacket &packet)
+	{
+		for(unsigned int i = first; i < first + n; i++)
+			(*objects)[i]->IntersectPacket(packet, id_base + i);
+	}
+};
+
+/*
+ * Scene class
+ */
+Scene::Scene()
+{
+	built = false;
+	storage = NULL;
+
+	lights.push_back(default_light_pos);
+	default_light = true;
+	ambient = DEFAULT_AMBIENT;
+	max_depth = DEFAULT_MAX_DEPTH;
+	termination = TERMINATE_DEPTH;
+	shadows = false;
+	reflective = false;
+}
+
+Scene::~Scene()
+{
+	for(unsigned int i = 0; i < objects.size(); i++)
+		delete objects[i];
+	for(unsigned int i = 0; i < geometries.size(); i++)
+		delete geometries[i];
+
+	// the sphere store may point into the mapping, so it goes first
+	spheres.Clear();
+	delete storage;
+}
+
+void
+Scene::AddObject(Object *object)
+{
+	objects.push_back(object);
+	built = false;
+}
+
+void
+Scene::AddGeometry(Object *geometry)
+{
+	geometries.push_back(geometry);
+}
+
+void
+Scene::AddSphere(const Vector &center, float radius, const Material &material)
+{
+	SphereRecord record;
+	record.center = center;
+	record.radius = radius;
+	record.material = material;
+
+	sphere_records.push_back(record);
+	built = false;
+}
+
+void
+Scene::ReserveSpheres(unsigned int count)
+{
+	sphere_records.reserve(sphere_records.size() + count);
+}
+
+void
+Scene::AddLight(const Vector &position)
+{
+	if(default_light) {
+		lights.clear();
+		default_light = false;
+	}
+
+	lights.push_back(position);
+}
+
+void
+Scene::ClearLights()
+{
+	lights.clear();
+	default_light = false;
+}
+
+void
+Scene::Build()
+{
+	TRACE_SCOPE(trace, "scene build", "scene");
+	TRACE_ARG(trace, "objects", (int)objects.size());
+
+	// an attached scene is already built
+	if(storage) {
+		built = true;
+		return;
+	}
+
+	spheres.Clear();
+	generic.clear();
+	object_states.resize(objects.size());
+
+	// object id of every sphere, in the order they're added
+	std::vector <unsigned int> sphere_objects;
+
+	std::vector <BVH::BuildPrimitive> build_prims;
+	for(unsigned int i = 0; i < objects.size(); i++) {
+		ObjectState &state = object_states[i];
+		objects[i]->GetBounds(state.min, state.max);
+		state.material = objects[i]->GetMaterial();
+
+		const Sphere *sphere = dynamic_cast <const Sphere *> (objects[i]);
+		if(sphere) {
+			spheres.Add(sphere->GetOrigin(), sphere->GetRadius(), sphere->GetMaterial());
+			sphere_objects.push_back(i);
+		} else {
+			build_prims.push_back(BVH::BuildPrimitive());
+			BVH::MakeBuildPrimitive(build_prims.back(), state.min, state.max, i);
+		}
+	}
+
+	for(unsigned int i = 0; i < sphere_records.size(); i++) {
+		spheres.Add(sphere_records[i].center, sphere_records[i].radius, sphere_records[i].material);
+		sphere_objects.push_back((unsigned int)objects.size() + i);
+	}
+
+	std::vector <unsigned int> order;
+	spheres.Build(&order);
+
+	generic_bvh.Build(build_prims);
+	for(unsigned int i = 0; i < build_prims.size(); i++)
+		generic.push_back(objects[build_prims[i].index]);
+
+	primitive_objects.resize(spheres.GetCount() + build_prims.size());
+	for(unsigned int i = 0; i < spheres.GetCount(); i++)
+		primitive_objects[i] = sphere_objects[order[i]];
+	for(unsigned int i = 0; i < build_prims.size(); i++)
+		primitive_objects[spheres.GetCount() + i] = build_prims[i].index;
+
+	FindReflective();
+	built = true;
+}
+
+void
+Scene::FindReflective()
+{
+	reflective = false;
+	for(unsigned int i = 0; i < spheres.GetMaterialCount() && !reflective; i++)
+		reflective = spheres.GetArrays().materials[i].reflectance > 0.0f;
+	for(unsigned int i = 0; i < generic.size() && !reflective; i++)
+		reflective = generic[i]->GetReflectance() > 0.0f;
+}
+
+void
+Scene::SetMaxDepth(int max_depth_arg)
+{
+	if(max_depth_arg < -1)
+		max_depth = -1;
+	else if(max_depth_arg > MAX_DEPTH)
+		max_depth = MAX_DEPTH;
+	else
+		max_depth = max_depth_arg;
+}
+
+unsigned int
+Scene::GetShadeFeatures() const
+{
+	unsigned int features = 0;
+	if(reflective && max_depth >= 0)
+		features |= FEATURE_REFLECTIONS;
+	if(shadows && !lights.empty())
+		features |= FEATURE_SHADOWS;
+
+	return features;
+}
+
+void
+Scene::AttachSpheres(const SphereStore::Arrays &arrays, const BVH::Node *nodes, unsigned int node_count,
+                     const BVH::BuildStats &stats, MappedFile *storage_arg)
+{
+	for(unsigned int i = 0; i < objects.size(); i++)
+		delete objects[i];
+	objects.clear();
+	for(unsigned int i = 0; i < geometries.size(); i++)
+		delete geometries[i];
+	geometries.clear();
+	sphere_records.clear();
+	generic.clear();
+	generic_bvh.Clear();
+	object_states.clear();
+	primitive_objects.clear();
+
+	spheres.Attach(arrays, nodes, node_count, stats);
+	delete storage;
+	storage = storage_arg;
+
+	FindReflective();
+	built = true;
+}
+
+bool
+Scene::GetChangedObjects(std::vector <unsigned int> &changed) const
+{
+	changed.clear();
+	if(objects.size() != object_states.size())
+		return false;
+
+	for(unsigned int i = 0; i < objects.size(); i++) {
+		const ObjectState &state = object_states[i];
+		const Material &material = objects[i]->GetMaterial();
+		Vector min, max;
+		objects[i]->GetBounds(min, max);
+
+		bool same = material.reflectance == state.material.reflectance;
+		for(int j = 0; j < 4; j++)
+			same = same && material.color[j] == state.material.color[j];
+		for(int j = 0; j < 3; j++)
+			same = same && min.vec[j] == state.min.vec[j] && max.vec[j] == state.max.vec[j];
+
+		if(!same)
+			changed.push_back(i);
+	}
+
+	return true;
+}
+
+bool
+Scene::Update(std::vector <unsigned int> &changed)
+{
+	bool tracked = built && GetChangedObjects(changed);
+	if(!tracked || !changed.empty())
+		Build();
+
+	return tracked;
+}
+
+void
+Scene::SetThreadHitLog(std::vector <unsigned int> *log)
+{
+	hit_log = log;
+}
+
+unsigned int
+Scene::TakeThreadDepth()
+{
+	unsigned int depth = (unsigned int)shade_depth;
+	shade_depth = 0;
+
+	return depth;
+}
+
+BVH::BuildStats
+Scene::GetBuildStats() const
+{
+	BVH::BuildStats stats = spheres.GetBVH().GetBuildStats();
+	const BVH::BuildStats &g = generic_bvh.GetBuildStats();
+
+	stats.build_seconds += g.build_seconds;
+	stats.primitive_count += g.primitive_count;
+	stats.node_count += g.node_count;
+	stats.leaf_count += g.leaf_count;
+	if(g.max_depth > stats.max_depth)
+		stats.max_depth = g.max_depth;
+	if(g.max_leaf_size > stats.max_leaf_size)
+		stats.max_leaf_size = g.max_leaf_size;
+	stats.sah_cost += g.sah_cost;
+
+	return stats;
+}
+
+bool
+Scene::Intersect(const Ray &ray, Hit *hit) const
+{
+	BVH::GetThreadStats().rays++;
+
+	float closest_t = 9999999.0f;
+	unsigned int closest = NO_HIT;
+
+	spheres.Intersect(ray, closest_t, closest);
+
+	if(!generic.empty()) {
+		ObjectLeaf leaf;
+		leaf.objects = &generic;
+		leaf.ray = &ray;
+		leaf.id_base = spheres.GetCount();
+		leaf.closest = closest;
+		generic_bvh.Traverse(ray, closest_t, leaf);
+		closest = leaf.closest;
+	}
+
+	hit->t = closest_t;
+	hit->primitive = closest;
+	if(hit_log && closest != NO_HIT)
+		log_hit(closest);
+
+	return closest != NO_HIT;
+}
+
+void
+Scene::IntersectPacket(RayPacket &packet) const
+{
+	BVH::GetThreadStats().rays += packet.size;
+
+	spheres.IntersectPacket(packet);
+
+	if(!generic.empty()) {
+		ObjectPacketLeaf leaf;
+		leaf.objects = &generic;
+		leaf.id_base = spheres.GetCount();
+		generic_bvh.TraversePacket(packet, leaf);
+	}
+
+	if(hit_log) {
+		for(int i = 0; i < packet.size; i++) {
+			if(packet.primitive[i] != NO_HIT)
+				log_hit(packet.primitive[i]);
+		}
+	}
+}
+
+bool
+Scene::OccludedBy(unsigned int primitive, const Ray &ray, float max_t) const
+{
+	BVH::GetThreadStats().primitive_tests++;
+
+	if(primitive < spheres.GetCount())
+		return spheres.OccludedRange(ray, primitive, 1, max_t, NO_HIT) != NO_HIT;
+
+	primitive -= spheres.GetCount();
+	if(primitive >= generic.size())
+		return false;
+
+	float t;
+	return generic[primitive]->Intersection(ray, &t) && t < max_t;
+}
+
+bool
+Scene::IsConvex(unsigned int primitive) const
+{
+	if(primitive < spheres.GetCount())
+		return true;
+
+	primitive -= spheres.GetCount();
+	return primitive < generic.size() && generic[primitive]->IsConvex();
+}
+
+bool
+Scene::Occluded(const Ray &ray, float max_t, unsigned int light, unsigned int ignore) const
+{
+	BVH::TraversalStats &stats = BVH::GetThreadStats();
+	stats.shadow_rays++;
+
+	// neighbouring shadow rays are usually stopped by the same object
+	unsigned int &cached = last_occluder[light % OCCLUDER_CACHE_SIZE];
+	if(cached != 0 && cached - 1 != ignore && OccludedBy(cached - 1, ray, max_t)) {
+		stats.shadow_hits++;
+		stats.occluder_cache_hits++;
+		if(hit_log)
+			log_hit(cached - 1);
+		return true;
+	}
+
+	unsigned int occluder = spheres.Occluded(ray, max_t, ignore);
+
+	if(occluder == NO_HIT && !generic.empty()) {
+		ObjectOcclusionLeaf leaf;
+		leaf.objects = &generic;
+		leaf.ray = &ray;
+		leaf.id_base = spheres.GetCount();
+		leaf.ignore = ignore;
+		leaf.occluder = NO_HIT;
+		generic_bvh.TraverseAny(ray, max_t, leaf);
+		occluder = leaf.occluder;
+	}
+
+	if(occluder == NO_HIT)
+		return false;
+
+	stats.shadow_hits++;
+	cached = occluder + 1;
+	if(hit_log)
+		log_hit(occluder);
+	return true;
+}
+
+void
+Scene::GetSurface(unsigned int primitive, const Vector &p, Vector &normal, const Material *&material) const
+{
+	if(primitive < spheres.GetCount()) {
+		normal = p - spheres.GetCenter(primitive);
+		normal.Normalize();
+		material = &spheres.GetMaterial(primitive);
+	} else {
+		const Object *object = generic[primitive - spheres.GetCount()];
+		normal = object->NormalAtSurfacePoint(p);
+		material = &object->GetMaterial();
+	}
+}
+
+static const char *termination_names[] = { "depth", "throughput", "roulette" };
+
+bool
+Scene::ParseTermination(const char *name, Termination &termination)
+{
+	for(int i = 0; i < (int)(sizeof(termination_names) / sizeof(termination_names[0])); i++) {
+		if(strcmp(name, termination_names[i]) == 0) {
+			termination = (Termination)i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char *
+Scene::GetTerminationName(Termination termination)
+{
+	return termination_names[termination];
+}
+
+// a number in [0, 1) that depends only on the ray, so that roulette
+// picks the same paths in every shading mode and on every machine
+static float
+roulette_number(const Ray &ray, int level)
+{
+	unsigned int h = 2166136261u ^ (unsigned int)level;
+	const float *v[2] = { ray.GetOrigin().vec, ray.GetDirection().vec };
+	for(int i = 0; i < 2; i++) {
+		for(int j = 0; j < 3; j++) {
+			unsigned int bits;
+			memcpy(&bits, &v[i][j], sizeof(bits));
+			h = (h ^ bits) * 16777619u;
+		}
+	}
+	h ^= h >> 15;
+	h *= 0x2c1b3c6du;
+	h ^= h >> 12;
+
+	return (float)(h >> 8) / 16777216.0f;
+}
+
+const Scene::ShadePath Scene::SAMPLE_PATH = { NULL, 0.0f, NULL };
+
+// whether the pixel comes out the same whatever a reflection off a point
+// shaded to color adds: the reflected colour is clamped to [0, 1], so
+// the point ends up between color and color + reflectance, and each
+// level above only adds and clamps, so folding both ends up the path
+// bounds the pixel
+static bool
+reflection_is_invisible(const float color[4], float reflectance, const Scene::ShadePath *path)
+{
+	float lo[3], hi[3];
+	for(int i = 0; i < 3; i++) {
+		lo[i] = color[i];
+		hi[i] = color[i] + reflectance;
+	}
+
+	for(;;) {
+		for(int i = 0; i < 3; i++) {
+			if(lo[i] > 1.0f)
+				lo[i] = 1.0f;
+			if(hi[i] > 1.0f)
+				hi[i] = 1.0f;
+		}
+		if(path == NULL)
+			break;
+		if(path->color == NULL)
+			return false;
+		for(int i = 0; i < 3; i++) {
+			lo[i] = path->color[i] + lo[i] * path->reflectance;
+			hi[i] = path->color[i] + hi[i] * path->reflectance;
+		}
+		path = path->parent;
+	}
+
+	// as RayTracer converts the pixel
+	for(int i = 0; i < 3; i++) {
+		if((unsigned char)(lo[i] * 255.0f) != (unsigned char)(hi[i] * 255.0f))
+			return false;
+	}
+
+	return true;
+}
+
+template <unsigned int FEATURES>
+bool
+Scene::ShadeSurface(const Ray &ray, const Hit &hit, int level, float throughput, float color_arg[4],
+                    Ray *reflection, float *reflectance_arg, const ShadePath *path) const
+{
+#ifndef NO_PIXEL_STATS
+	if((FEATURES & FEATURE_STATS) && level > shade_depth)
+		shade_depth = level;
+#endif
+
+	// calculate point on object
+	Vector p = ray.GetOrigin() + ray.GetDirection() * hit.t;
+
+	// calculate normal of point on object
+	Vector normal;
+	const Material *material;
+	GetSurface(hit.primitive, p, normal, material);
+	const float *color = material->color;
+	float reflectance = material->reflectance;
+
+	for(int i = 0; i < 4; i++)
+		color_arg[i] = 0.0f;
+
+	// a convex surface is never its own blocker: a sphere only hides
+	// its far side, which the diffuse term already darkens. Any other
+	// surface is tested like the rest of the scene, with shadow rays
+	// starting a little way off it on the side facing the light so they
+	// can't hit the point they leave; the offset grows with the point's
+	// distance from the origin, as float precision shrinks.
+	bool convex = true;
+	float bias = 0.0f;
+	if((FEATURES & FEATURE_SHADOWS) && shadows && !IsConvex(hit.primitive)) {
+		convex = false;
+		for(int i = 0; i < 3; i++) {
+			float a = fabsf(p.vec[i]);
+			if(a > bias)
+				bias = a;
+		}
+		bias = SHADOW_BIAS * (1.0f + bias);
+	}
+
+	for(unsigned int j = 0; j < lights.size(); j++) {
+		// calculate light to point vector
+		Vector l = lights[j] - p;
+		float distance = sqrtf(dot_product(l.vec, l.vec));
+		l.Normalize();
+
+		// a point in shadow only gets the ambient term
+		bool lit = true;
+		if((FEATURES & FEATURE_SHADOWS) && shadows) {
+			Ray shadow;
+			if(convex)
+				shadow.SetOrigin(p);
+			else
+				shadow.SetOrigin(p + normal * ((dot_product(normal.vec, l.vec) < 0.0f) ? -bias : bias));
+			shadow.SetDirection(l);
+			lit = !Occluded(shadow, distance, j, convex ? hit.primitive : NO_HIT);
+		}
+
+		// calculate diffuse lighting
+		float diffuse = ambient;
+		float specular = 0.0f;
+		if(lit) {
+			diffuse = dot_product(normal.vec, l.vec);
+			diffuse += 1.0f;
+			diffuse /= 2.0f;
+			if(diffuse < ambient)
+				diffuse = ambient;
+
+			// calculate specular lighting
+			Vector sv = l - normal * dot_product(l.vec, normal.vec) * 2.0f;
+			float dot = dot_product(sv.vec, ray.GetDirection().vec);
+			if(dot > 0.0f)
+				specular = SQUARE(SQUARE(SQUARE(dot)));
+		}
+
+		// add to color array
+		for(int i = 0; i < 4; i++)
+			color_arg[i] += (color[i] * diffuse * (1.0f - reflectance)) + specular;
+	}
+
+	if(!(FEATURES & FEATURE_REFLECTIONS) || level > max_depth || reflectance <= 0.0f)
+		return false;
+
+	float weight = reflectance;
+	if(termination != TERMINATE_DEPTH) {
+		// reflections only add light, which a saturated colour can't take
+		if(color_arg[0] >= 1.0f && color_arg[1] >= 1.0f && color_arg[2] >= 1.0f)
+			return false;
+
+		float next = throughput * reflectance;
+		if(termination == TERMINATE_ROULETTE && reflectance >= ROULETTE_REFLECTANCE) {
+			if(next < ROULETTE_START) {
+				float survival = next / ROULETTE_START;
+				if(roulette_number(ray, level) >= survival)
+					return false;
+				weight = reflectance / survival;
+			}
+		} else if(next < MIN_THROUGHPUT && reflection_is_invisible(color_arg, reflectance, path)) {
+			return false;
+		}
+	}
+
+	// create reflection vector
+	Vector rv = ray.GetDirection() - normal * dot_product(ray.GetDirection().vec, normal.vec) * 2.0f;
+
+	// create ray from intersection point in direction of reflection vector
+	reflection->SetOrigin(p);
+	reflection->SetDirection(rv);
+	*reflectance_arg = weight;
+
+	return true;
+}
+
+void
+Scene::AddReflection(float color_arg[4], const float reflected[4], float reflectance)
+{
+	color_arg[0] += reflected[0] * reflectance;
+	color_arg[1] += reflected[1] * reflectance;
+	color_arg[2] += reflected[2] * reflectance;
+	color_arg[3] += reflected[3] * reflectance;
+}
+
+void
+Scene::ClampColor(float color_arg[4])
+{
+	for(int i = 0; i < 4; i++) {
+		if(color_arg[i] > 1.0f)
+			color_arg[i] = 1.0f;
+	}
+}
+
+template <unsigned int FEATURES>
+void
+Scene::Shade(const Ray &ray, const Hit &hit, float color_arg[4], int level, float throughput,
+             const ShadePath *path) const
+{
+	Ray r;
+	float reflectance;
+
+	// ShadeSurface() never asks for a reflection without the feature,
+	// but testing it here drops the branch from the kernel
+	bool reflect = ShadeSurface <FEATURES> (ray, hit, level, throughput, color_arg, &r, &reflectance, path);
+	if((FEATURES & FEATURE_REFLECTIONS) && reflect) {
+		Hit rhit;
+		if(Intersect(r, &rhit)) {
+			ShadePath here = { color_arg, reflectance, path };
+			float fcolor[4];
+			Shade <FEATURES> (r, rhit, fcolor, level+1, throughput * reflectance, &here);
+			AddReflection(color_arg, fcolor, reflectance);
+		}
+	}
+
+	ClampColor(color_arg);
+}
+
+// every combination, for RayTracer to pick from
+#define INSTANTIATE_SHADING(F) \
+	template bool Scene::ShadeSurface <F> (const Ray &, const Hit &, int, float, float *, Ray *, float *, \
+	                                       const ShadePath *) const; \
+	template void Scene::Shade <F> (const Ray &, const Hit &, float *, int, float, const ShadePath *) const;
+
+INSTANTIATE_SHADING(0)
+INSTANTIATE_SHADING(1)
+INSTANTIATE_SHADING(2)
+INSTANTIATE_SHADING(3)
+INSTANTIATE_SHADING(4)
+INSTANTIATE_SHADING(5)
+INSTANTIATE_SHADING(6)
+INSTANTIATE_SHADING(7)
+
+bool
+Scene::ShadeSurface(const Ray &ray, const Hit &hit, int level, float throughput, float color_arg[4],
+                    Ray *reflection, float *reflectance_arg, const ShadePath *path) const
+{
+	return ShadeSurface <SHADE_ALL> (ray, hit, level, throughput, color_arg, reflection, reflectance_arg, path);
+}
+
+void
+Scene::Shade(const Ray &ray, const Hit &hit, float color_arg[4], int level, float throughput,
+             const ShadePath *path) const
+{
+	Shade <SHADE_ALL> (ray, hit, color_arg, level, throughput, path);
+}
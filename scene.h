@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCENE_H__
+#define __SCENE_H__
+
+#include <vector>
+#include "objects.h"
+#include "bvh.h"
+#include "camera.h"
+#include "spherestore.h"
+
+class MappedFile;
+
+/*
+ * Owns the objects being rendered and compiles them for tracing: spheres
+ * go into a SphereStore, anything else is kept as an Object behind its own
+ * BVH. Build() must be called after the object list changes and before
+ * rendering.
+ *
+ * Hits are reported as primitive ids: ids below the sphere count index
+ * the sphere store, the rest index the other objects.
+ */
+class Scene {
+	public:
+		/*
+		 * How reflection paths end. TERMINATE_DEPTH follows every
+		 * reflection down to the maximum depth. TERMINATE_THROUGHPUT
+		 * also stops a path once the rest of it can't change the 8-bit
+		 * pixel: its reflectance product is below one step and the
+		 * pixel's colour so far has that much headroom before the
+		 * next step, or the colour is already saturated. It draws the
+		 * same image as TERMINATE_DEPTH. Antialiasing samples are
+		 * averaged, so only saturation ends theirs early.
+		 * TERMINATE_ROULETTE does the same for dull materials, but
+		 * ends paths off shinier ones by Russian roulette, weighting
+		 * the survivors up so the expected colour stays the same.
+		 * The maximum depth applies in every case.
+		 */
+		enum Termination { TERMINATE_DEPTH, TERMINATE_THROUGHPUT, TERMINATE_ROULETTE };
+
+		/*
+		 * Optional work the shading kernels are compiled with. A kernel
+		 * built without a feature leaves its code out; one built with
+		 * it still checks the scene's settings, so SHADE_ALL is the
+		 * generic kernel that suits any scene.
+		 */
+		enum {
+			FEATURE_REFLECTIONS = 1,
+			FEATURE_SHADOWS = 2,
+			FEATURE_STATS = 4,
+			SHADE_ALL = 7
+		};
+
+		/*
+		 * A level of the path a reflection ray took from the camera:
+		 * the unclamped colour shaded there, the weight the reflection
+		 * is added with, and the level before. A camera ray has no
+		 * path if its colour is the pixel's, or SAMPLE_PATH if it is
+		 * averaged with others.
+		 */
+		struct ShadePath {
+			const float *color;
+			float reflectance;
+			const ShadePath *parent;
+		};
+		static const ShadePath SAMPLE_PATH;
+
+		// a sphere added without a front-end Object
+		struct SphereRecord {
+			Vector center;
+			float radius;
+			Material material;
+		};
+
+	protected:
+		std::vector <Object *> objects;
+		std::vector <SphereRecord> sphere_records;
+		std::vector <Object *> geometries;
+		bool built;
+
+		Camera camera;
+		std::vector <Vector> lights;
+		float ambient;
+		int max_depth;
+		Termination termination;
+		bool shadows;
+		bool reflective;
+
+		SphereStore spheres;
+		std::vector <const Object *> generic;
+		BVH generic_bvh;
+
+		// backs the sphere store of a scene loaded from a cache
+		MappedFile *storage;
+
+		// object state as of the last Build(), to find edits made since
+		struct ObjectState {
+			Vector min;
+			Vector max;
+			Material material;
+		};
+		std::vector <ObjectState> object_states;
+
+		// the object id of every primitive; empty for attached scenes,
+		// whose primitives are their own ids
+		std::vector <unsigned int> primitive_objects;
+
+		void GetSurface(unsigned int primitive, const Vector &p, Vector &normal, const Material *&material) const;
+		void FindReflective();
+		bool OccludedBy(unsigned int primitive, const Ray &ray, float max_t) const;
+		bool IsConvex(unsigned int primitive) const;
+
+	public:
+		Scene();
+		~Scene();
+
+		// the scene takes ownership of the object
+		void AddObject(Object *object);
+		inline const std::vector <Object *> &GetObjects() const { return objects; }
+
+		// geometry for instances to share; the scene takes ownership,
+		// but draws it only where instances place it
+		void AddGeometry(Object *geometry);
+		inline const std::vector <Object *> &GetGeometries() const { return geometries; }
+
+		// adds a sphere straight to the sphere store, without creating
+		// an Object; used by loaders for very large scenes
+		void AddSphere(const Vector &center, float radius, const Material &material);
+
+		// reserves room for the given number of AddSphere() calls
+		void ReserveSpheres(unsigned int count);
+		inline const std::vector <SphereRecord> &GetSphereRecords() const { return sphere_records; }
+
+		inline Camera &GetCamera() { return camera; }
+		inline const Camera &GetCamera() const { return camera; }
+
+		// the first AddLight() replaces the default light
+		void AddLight(const Vector &position);
+		void ClearLights();
+		inline const std::vector <Vector> &GetLights() const { return lights; }
+
+		inline void SetAmbient(float ambient_arg) { ambient = ambient_arg; }
+		inline float GetAmbient() const { return ambient; }
+
+		// deepest reflection level that still spawns a reflection ray,
+		// from -1 for none up to MAX_DEPTH; reflections recurse, so
+		// deeper ones could overflow a render thread's stack
+		enum { MAX_DEPTH = 64 };
+		void SetMaxDepth(int max_depth_arg);
+		inline int GetMaxDepth() const { return max_depth; }
+
+		// TERMINATE_DEPTH by default
+		inline void SetTermination(Termination termination_arg) { termination = termination_arg; }
+		inline Termination GetTermination() const { return termination; }
+
+		// "depth", "throughput" or "roulette"; returns false otherwise
+		static bool ParseTermination(const char *name, Termination &termination);
+		static const char *GetTerminationName(Termination termination);
+
+		// whether lights are tested for visibility; off by default
+		inline void SetShadows(bool shadows_arg) { shadows = shadows_arg; }
+		inline bool GetShadows() const { return shadows; }
+
+		// the features shading this scene needs, as of the last Build()
+		unsigned int GetShadeFeatures() const;
+
+		void Build();
+		inline bool IsBuilt() const { return built; }
+
+		// makes the scene a prebuilt sphere store whose arrays and
+		// nodes live in storage, which the scene takes ownership of.
+		// Objects and spheres added before are dropped; the scene is
+		// built and must not be given further objects.
+		void AttachSpheres(const SphereStore::Arrays &arrays, const BVH::Node *nodes, unsigned int node_count,
+		                   const BVH::BuildStats &stats, MappedFile *storage_arg);
+		inline bool IsAttached() const { return storage != NULL; }
+
+		inline const SphereStore &GetSphereStore() const { return spheres; }
+		inline unsigned int GetPrimitiveCount() const { return spheres.GetCount() + (unsigned int)generic.size(); }
+
+		/*
+		 * Object ids are stable across Build(), unlike primitive ids:
+		 * an object's index in GetObjects(), or for spheres added with
+		 * AddSphere(), the object count plus the sphere's index in
+		 * GetSphereRecords().
+		 */
+		inline unsigned int GetPrimitiveObject(unsigned int primitive) const
+		{
+			return primitive_objects.empty() ? primitive : primitive_objects[primitive];
+		}
+
+		// lists, in ascending order, the objects moved, resized or
+		// recoloured through their setters since the last Build().
+		// Returns false if objects were added since, which this can't
+		// account for.
+		bool GetChangedObjects(std::vector <unsigned int> &changed) const;
+
+		// builds the scene if it isn't built, or rebuilds it if
+		// objects were edited since; returns what GetChangedObjects()
+		// found before, the changed objects in changed
+		bool Update(std::vector <unsigned int> &changed);
+		BVH::BuildStats GetBuildStats() const;
+
+		// finds the closest hit along the ray; returns false on a miss
+		bool Intersect(const Ray &ray, Hit *hit) const;
+		void IntersectPacket(RayPacket &packet) const;
+
+		/*
+		 * Any-hit query: returns true if something other than the
+		 * primitive ignore, which may be NO_HIT, lies along the ray
+		 * before max_t. Each thread
+		 * remembers the last blocker found for every light and tests it
+		 * before walking the hierarchy.
+		 */
+		bool Occluded(const Ray &ray, float max_t, unsigned int light, unsigned int ignore) const;
+
+		// while a log is set, the primitives hit by Intersect() and
+		// IntersectPacket() and the blockers found by Occluded() on the
+		// calling thread are appended to it; NULL stops logging
+		static void SetThreadHitLog(std::vector <unsigned int> *log);
+
+		// the deepest reflection level shaded on the calling thread
+		// since the last call, for per-pixel statistics
+		static unsigned int TakeThreadDepth();
+
+		// computes the colour seen along the ray at the given hit,
+		// following reflections; throughput is the share of the pixel
+		// the colour makes up, and path the levels above
+		void Shade(const Ray &ray, const Hit &hit, float color_arg[4], int level = 0, float throughput = 1.0f,
+		           const ShadePath *path = NULL) const;
+		template <unsigned int FEATURES>
+		void Shade(const Ray &ray, const Hit &hit, float color_arg[4], int level = 0, float throughput = 1.0f,
+		           const ShadePath *path = NULL) const;
+
+		/*
+		 * The steps of Shade() for callers that trace reflections
+		 * themselves. ShadeSurface() computes the unclamped direct
+		 * lighting at a hit found at the given reflection level, with
+		 * the given throughput, and returns true if a reflection ray
+		 * should be traced; the colour is then finished with
+		 * AddReflection() for the reflected colour, if the reflection
+		 * hit anything, and ClampColor(). The reflection's throughput
+		 * is this one times *reflectance_arg, and its path this level
+		 * on top of path.
+		 */
+		bool ShadeSurface(const Ray &ray, const Hit &hit, int level, float throughput, float color_arg[4],
+		                  Ray *reflection, float *reflectance_arg, const ShadePath *path = NULL) const;
+		template <unsigned int FEATURES>
+		bool ShadeSurface(const Ray &ray, const Hit &hit, int level, float throughput, float color_arg[4],
+		                  Ray *reflection, float *reflectance_arg, const ShadePath *path = NULL) const;
+		static void AddReflection(float color_arg[4], const float reflected[4], float reflectance);
+		static void ClampColor(float color_arg[4]);
+
+	private:
+		bool default_light;
+
+		Scene(const Scene &);
+		Scene &operator = (const Scene &);
+};
+
+#endif /* __SCENE_H__ */
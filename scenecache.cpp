@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// scenecache.cpp - Memory mapped compiled scene cache
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+#include <sys/stat.h>
+#include "scenecache.h"
+#include "mappedfile.h"
+#include "timer.h"
+#include "trace.h"
+
+const char CACHE_MAGIC[8] = { 'R', 'T', 'S', 'C', 'E', 'N', 'E', '\n' };
+const uint32_t CACHE_VERSION = 4;
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+const uint32_t SECTION_ALIGN = 64;
+const uint32_t MAX_LIGHTS = 64;
+
+enum {
+	SECTION_CENTER_X,
+	SECTION_CENTER_Y,
+	SECTION_CENTER_Z,
+	SECTION_RADIUS2,
+	SECTION_MATERIAL_INDEX,
+	SECTION_MATERIALS,
+	SECTION_NODES,
+	SECTION_COUNT
+};
+
+struct CacheSection {
+	uint64_t offset;
+	uint64_t size;
+};
+
+// everything is fixed size so the header can be read straight out of
+// the mapping; the cache is only ever read back on the same kind of
+// host that wrote it
+struct CacheHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t header_size;
+	uint32_t node_size;
+	uint32_t material_size;
+	uint32_t simd_width;
+	uint64_t file_size;
+
+	uint32_t has_source;
+	uint32_t source_mtime_nsec;
+	uint64_t source_size;
+	int64_t source_mtime;
+
+	float camera_position[3];
+	float camera_forward[3];
+	float camera_right[3];
+	float camera_down[3];
+	float camera_half_width;
+	float camera_half_height;
+	float lights[MAX_LIGHTS][3];
+	uint32_t light_count;
+	float ambient;
+	int32_t max_depth;
+	uint32_t termination;
+	uint32_t shadows;
+
+	uint32_t sphere_count;
+	uint32_t material_count;
+	uint32_t node_count;
+	uint32_t leaf_count;
+	uint32_t bvh_depth;
+	uint32_t max_leaf_size;
+	float sah_cost;
+
+	CacheSection sections[SECTION_COUNT];
+
+	uint32_t checksum;
+};
+
+static uint32_t
+header_checksum(const CacheHeader &header)
+{
+	// FNV-1a over everything before the checksum
+	const unsigned char *p = (const unsigned char *)&header;
+	uint32_t h = 2166136261u;
+
+	for(size_t i = 0; i < offsetof(CacheHeader, checksum); i++)
+		h = (h ^ p[i]) * 16777619u;
+
+	return h;
+}
+
+static bool
+fail(std::string *error, const char *message)
+{
+	if(error)
+		*error = message;
+
+	return false;
+}
+
+// the size and modification time of the source; the nanoseconds catch
+// an edit made in the same second as the cache, where the system keeps
+// them
+static bool
+source_stamp(const char *source, uint64_t *size, int64_t *mtime, uint32_t *mtime_nsec)
+{
+	struct stat st;
+	if(stat(source, &st) != 0)
+		return false;
+
+	*size = (uint64_t)st.st_size;
+	*mtime = (int64_t)st.st_mtime;
+#if defined(__APPLE__)
+	*mtime_nsec = (uint32_t)st.st_mtimespec.tv_nsec;
+#elif defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+	*mtime_nsec = (uint32_t)st.st_mtim.tv_nsec;
+#else
+	*mtime_nsec = 0;
+#endif
+
+	return true;
+}
+
+static void
+copy_vector(float dst[3], const Vector &v)
+{
+	for(int i = 0; i < 3; i++)
+		dst[i] = v.vec[i];
+}
+
+static bool
+write_section(FILE *fp, CacheSection &section, const void *data, size_t size)
+{
+	static const char zeros[SECTION_ALIGN] = { 0 };
+
+	long pos = ftell(fp);
+	if(pos < 0)
+		return false;
+
+	size_t pad = (SECTION_ALIGN - (size_t)pos % SECTION_ALIGN) % SECTION_ALIGN;
+	if(pad > 0 && fwrite(zeros, 1, pad, fp) != pad)
+		return false;
+
+	section.offset = (uint64_t)pos + pad;
+	section.size = size;
+
+	return size == 0 || fwrite(data, 1, size, fp) == size;
+}
+
+bool
+save_scene_cache(const char *filename, const Scene &scene, const char *source, std::string *error)
+{
+	TRACE_SCOPE(trace, "scene cache save", "scene");
+
+	const SphereStore &spheres = scene.GetSphereStore();
+	const SphereStore::Arrays &arrays = spheres.GetArrays();
+	const BVH &bvh = spheres.GetBVH();
+
+	if(!scene.IsBuilt())
+		return fail(error, "scene is not built");
+	if(scene.GetPrimitiveCount() != spheres.GetCount())
+		return fail(error, "only scenes made of spheres can be cached");
+	if(scene.GetLights().size() > MAX_LIGHTS)
+		return fail(error, "too many lights");
+
+	CacheHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+	header.version = CACHE_VERSION;
+	header.byte_order = BYTE_ORDER_MARK;
+	header.header_size = sizeof(CacheHeader);
+	header.node_size = sizeof(BVH::Node);
+	header.material_size = sizeof(Material);
+	header.simd_width = SphereStore::SIMD_WIDTH;
+
+	if(source) {
+		if(!source_stamp(source, &header.source_size, &header.source_mtime, &header.source_mtime_nsec))
+			return fail(error, strerror(errno));
+		header.has_source = 1;
+	}
+
+	const Camera &camera = scene.GetCamera();
+	copy_vector(header.camera_position, camera.GetPosition());
+	copy_vector(header.camera_forward, camera.GetForward());
+	copy_vector(header.camera_right, camera.GetRight());
+	copy_vector(header.camera_down, camera.GetDown());
+	header.camera_half_width = camera.GetHalfWidth();
+	header.camera_half_height = camera.GetHalfHeight();
+
+	const std::vector <Vector> &lights = scene.GetLights();
+	for(unsigned int i = 0; i < lights.size(); i++)
+		copy_vector(header.lights[i], lights[i]);
+	header.light_count = (uint32_t)lights.size();
+	header.ambient = scene.GetAmbient();
+	header.max_depth = scene.GetMaxDepth();
+	header.termination = scene.GetTermination();
+	header.shadows = scene.GetShadows();
+
+	const BVH::BuildStats &bstats = bvh.GetBuildStats();
+	header.sphere_count = arrays.count;
+	header.material_count = arrays.material_count;
+	header.node_count = bvh.GetNodeCount();
+	header.leaf_count = bstats.leaf_count;
+	header.bvh_depth = bstats.max_depth;
+	header.max_leaf_size = bstats.max_leaf_size;
+	header.sah_cost = bstats.sah_cost;
+
+	FILE *fp = fopen(filename, "wb");
+	if(!fp)
+		return fail(error, strerror(errno));
+
+	// the header is written twice: first as a placeholder, then again
+	// once the section offsets are known
+	size_t padded = (size_t)arrays.count + SphereStore::SIMD_WIDTH;
+	bool ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+	ok = ok && write_section(fp, header.sections[SECTION_CENTER_X], arrays.center_x, padded * sizeof(float));
+	ok = ok && write_section(fp, header.sections[SECTION_CENTER_Y], arrays.center_y, padded * sizeof(float));
+	ok = ok && write_section(fp, header.sections[SECTION_CENTER_Z], arrays.center_z, padded * sizeof(float));
+	ok = ok && write_section(fp, header.sections[SECTION_RADIUS2], arrays.radius2, padded * sizeof(float));
+	ok = ok && write_section(fp, header.sections[SECTION_MATERIAL_INDEX], arrays.material_index,
+	                         padded * sizeof(unsigned int));
+	ok = ok && write_section(fp, header.sections[SECTION_MATERIALS], arrays.materials,
+	                         arrays.material_count * sizeof(Material));
+	ok = ok && write_section(fp, header.sections[SECTION_NODES], bvh.GetNodes(),
+	                         bvh.GetNodeCount() * sizeof(BVH::Node));
+
+	if(ok) {
+		long end = ftell(fp);
+		header.file_size = (uint64_t)end;
+		header.checksum = header_checksum(header);
+		ok = end > 0 && fseek(fp, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, fp) == 1;
+	}
+
+	if(fclose(fp) != 0)
+		ok = false;
+	if(!ok) {
+		remove(filename);
+		return fail(error, "write failed");
+	}
+
+	return true;
+}
+
+static bool
+check_section(const CacheHeader &header, int index, uint64_t size)
+{
+	const CacheSection &section = header.sections[index];
+
+	return section.size == size &&
+	       section.offset % SECTION_ALIGN == 0 &&
+	       section.offset >= sizeof(CacheHeader) &&
+	       section.offset <= header.file_size &&
+	       section.size <= header.file_size - section.offset;
+}
+
+static bool
+check_header(const CacheHeader &header, size_t file_size, const char *source, std::string *error)
+{
+	if(memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic)) != 0)
+		return fail(error, "not a scene cache");
+	if(header.version != CACHE_VERSION)
+		return fail(error, "stale cache: different format version");
+	if(header.byte_order != BYTE_ORDER_MARK || header.header_size != sizeof(CacheHeader) ||
+	   header.node_size != sizeof(BVH::Node) || header.material_size != sizeof(Material) ||
+	   header.simd_width != (uint32_t)SphereStore::SIMD_WIDTH)
+		return fail(error, "cache was written by an incompatible build");
+	if(header.checksum != header_checksum(header))
+		return fail(error, "corrupt cache header");
+	if(header.file_size != file_size)
+		return fail(error, "truncated cache");
+
+	uint64_t padded = (uint64_t)header.sphere_count + SphereStore::SIMD_WIDTH;
+	if(!check_section(header, SECTION_CENTER_X, padded * sizeof(float)) ||
+	   !check_section(header, SECTION_CENTER_Y, padded * sizeof(float)) ||
+	   !check_section(header, SECTION_CENTER_Z, padded * sizeof(float)) ||
+	   !check_section(header, SECTION_RADIUS2, padded * sizeof(float)) ||
+	   !check_section(header, SECTION_MATERIAL_INDEX, padded * sizeof(unsigned int)) ||
+	   !check_section(header, SECTION_MATERIALS, (uint64_t)header.material_count * sizeof(Material)) ||
+	   !check_section(header, SECTION_NODES, (uint64_t)header.node_count * sizeof(BVH::Node)) ||
+	   header.light_count > MAX_LIGHTS || header.termination > Scene::TERMINATE_ROULETTE)
+		return fail(error, "corrupt cache layout");
+
+	if(source) {
+		uint64_t size;
+		int64_t mtime;
+		uint32_t mtime_nsec;
+		if(!source_stamp(source, &size, &mtime, &mtime_nsec))
+			return fail(error, strerror(errno));
+		if(!header.has_source || header.source_size != size || header.source_mtime != mtime ||
+		   header.source_mtime_nsec != mtime_nsec)
+			return fail(error, "stale cache: the scene file has changed");
+	}
+
+	return true;
+}
+
+// a subtree still to check: its first node, the end of the nodes it
+// must fill, and how many interior nodes lie above it
+struct NodeRange {
+	uint32_t node;
+	uint32_t end;
+	uint32_t depth;
+};
+
+/*
+ * The header checksum doesn't cover the sections, so before anything is
+ * traced the hierarchy and material indices are checked against the
+ * counts: every subtree must fill exactly the nodes between it and the
+ * next in depth-first order, no deeper than the traversal stacks, and
+ * every leaf must cover spheres that exist. Anything else would read
+ * outside the mapping.
+ */
+static bool
+check_sections(const CacheHeader &header, const char *base, std::string *error)
+{
+	const unsigned int *material_index =
+		(const unsigned int *)(base + header.sections[SECTION_MATERIAL_INDEX].offset);
+	for(uint32_t i = 0; i < header.sphere_count; i++) {
+		if(material_index[i] >= header.material_count)
+			return fail(error, "corrupt cache: bad material index");
+	}
+
+	if(header.node_count == 0) {
+		if(header.sphere_count != 0)
+			return fail(error, "corrupt cache: missing hierarchy");
+		return true;
+	}
+
+	std::vector <NodeRange> pending;
+	NodeRange root = { 0, header.node_count, 0 };
+	pending.push_back(root);
+
+	const BVH::Node *nodes = (const BVH::Node *)(base + header.sections[SECTION_NODES].offset);
+	while(!pending.empty()) {
+		NodeRange r = pending.back();
+		pending.pop_back();
+
+		const BVH::Node &node = nodes[r.node];
+		if(node.count > 0) {
+			if(r.end != r.node + 1 || node.offset > header.sphere_count ||
+			   node.count > header.sphere_count - node.offset)
+				return fail(error, "corrupt cache: bad hierarchy leaf");
+			continue;
+		}
+
+		// the left child follows the node, the right one starts at
+		// offset, and both need at least one node
+		if(node.axis > 2 || r.depth >= (uint32_t)BVH::STACK_SIZE ||
+		   node.offset <= r.node + 1 || node.offset >= r.end)
+			return fail(error, "corrupt cache: bad hierarchy node");
+
+		NodeRange left = { r.node + 1, node.offset, r.depth + 1 };
+		NodeRange right = { node.offset, r.end, r.depth + 1 };
+		pending.push_back(right);
+		pending.push_back(left);
+	}
+
+	return true;
+}
+
+bool
+load_scene_cache(const char *filename, Scene &scene, const char *source,
+                 SceneCacheStats *stats, std::string *error)
+{
+	TRACE_SCOPE(trace, "scene cache load", "scene");
+
+	double start = timer_seconds();
+
+	MappedFile *file = new MappedFile;
+	if(!file->Open(filename, error)) {
+		delete file;
+		return false;
+	}
+
+	const char *base = (const char *)file->GetData();
+	if(file->GetSize() < sizeof(CacheHeader)) {
+		delete file;
+		return fail(error, "not a scene cache");
+	}
+
+	const CacheHeader &header = *(const CacheHeader *)base;
+	if(!check_header(header, file->GetSize(), source, error) || !check_sections(header, base, error)) {
+		delete file;
+		return false;
+	}
+
+	Camera &camera = scene.GetCamera();
+	camera.Set(Vector(header.camera_position[0], header.camera_position[1], header.camera_position[2]),
+	           Vector(header.camera_forward[0], header.camera_forward[1], header.camera_forward[2]),
+	           Vector(header.camera_right[0], header.camera_right[1], header.camera_right[2]),
+	           Vector(header.camera_down[0], header.camera_down[1], header.camera_down[2]),
+	           header.camera_half_width, header.camera_half_height);
+	scene.ClearLights();
+	for(unsigned int i = 0; i < header.light_count; i++)
+		scene.AddLight(Vector(header.lights[i][0], header.lights[i][1], header.lights[i][2]));
+	scene.SetAmbient(header.ambient);
+	scene.SetMaxDepth(header.max_depth);
+	scene.SetTermination((Scene::Termination)header.termination);
+	scene.SetShadows(header.shadows != 0);
+
+	SphereStore::Arrays arrays;
+	arrays.center_x = (const float *)(base + header.sections[SECTION_CENTER_X].offset);
+	arrays.center_y = (const float *)(base + header.sections[SECTION_CENTER_Y].offset);
+	arrays.center_z = (const float *)(base + header.sections[SECTION_CENTER_Z].offset);
+	arrays.radius2 = (const float *)(base + header.sections[SECTION_RADIUS2].offset);
+	arrays.material_index = (const unsigned int *)(base + header.sections[SECTION_MATERIAL_INDEX].offset);
+	arrays.count = header.sphere_count;
+	arrays.materials = (const Material *)(base + header.sections[SECTION_MATERIALS].offset);
+	arrays.material_count = header.material_count;
+
+	BVH::BuildStats bstats;
+	bstats.build_seconds = 0.0;
+	bstats.primitive_count = header.sphere_count;
+	bstats.node_count = header.node_count;
+	bstats.leaf_count = header.leaf_count;
+	bstats.max_depth = header.bvh_depth;
+	bstats.max_leaf_size = header.max_leaf_size;
+	bstats.sah_cost = header.sah_cost;
+
+	const BVH::Node *nodes = (const BVH::Node *)(base + header.sections[SECTION_NODES].offset);
+	scene.AttachSpheres(arrays, nodes, header.node_count, bstats, file);
+
+	if(stats) {
+		stats->bytes = (unsigned long)header.file_size;
+		stats->spheres = header.sphere_count;
+		stats->nodes = header.node_count;
+		stats->load_seconds = timer_seconds() - start;
+	}
+
+	return true;
+}
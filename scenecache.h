@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCENECACHE_H__
+#define __SCENECACHE_H__
+
+#include <string>
+#include "scene.h"
+
+/*
+ * Compiled scene cache. A cache file holds a built sphere scene exactly
+ * as it sits in memory: the leaf ordered sphere arrays, the material
+ * table and the flattened BVH, plus the camera, lights and shading
+ * settings. Loading maps the file and attaches the scene to it in place,
+ * so nothing is parsed, copied or rebuilt.
+ *
+ * Caches record the format version, the host's byte order and struct
+ * layout, and optionally the size and modification time of the scene
+ * file they were compiled from; a cache that doesn't match is rejected
+ * as stale. The hierarchy and material indices are checked on loading,
+ * so a corrupt cache is rejected too rather than traced out of bounds.
+ * Only scenes made of spheres can be cached.
+ */
+struct SceneCacheStats {
+	unsigned long bytes;
+	unsigned int spheres;
+	unsigned int nodes;
+	double load_seconds;
+};
+
+// writes a built scene; source is the scene file it came from, or NULL
+bool save_scene_cache(const char *filename, const Scene &scene, const char *source, std::string *error);
+
+// replaces the contents of scene with the cache; when source is given,
+// the cache must have been compiled from that file as it is now
+bool load_scene_cache(const char *filename, Scene &scene, const char *source,
+                      SceneCacheStats *stats, std::string *error);
+
+#endif /* __SCENECACHE_H__ */
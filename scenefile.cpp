@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// scenefile.cpp - Text scene format loader and writer
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <map>
+#include <vector>
+#include "objfile.h"
+#include "scenefile.h"
+#include "textparse.h"
+#include "timer.h"
+#include "trace.h"
+
+const unsigned int MAX_TOKENS = 16;
+const unsigned int MAX_NAME = 32;
+const unsigned int NO_MATERIAL = 0xffffffff;
+
+typedef std::map <std::string, Object *> GeometryNames;
+
+struct NamedMaterial {
+	char name[MAX_NAME];
+	Material material;
+};
+
+/*
+ * SceneParser class
+ */
+class SceneParser : public LineParser {
+	protected:
+		Scene &scene;
+		unsigned int objects;
+		unsigned long triangles;
+
+		// materials are found through an open addressing hash table
+		// of indices into materials
+		std::vector <NamedMaterial> materials;
+		std::vector <unsigned int> material_table;
+		unsigned int last_material;
+
+		GeometryNames geometries;
+
+		virtual bool ParseLine(char *line);
+		bool Statement(char *tokens[], unsigned int count);
+		unsigned int FindMaterial(const char *name) const;
+		unsigned int LookupMaterial(const char *name);
+		Mesh *LoadMesh(const char *filename);
+		void AddMaterial(const NamedMaterial &m);
+		void InsertMaterial(unsigned int index);
+
+	public:
+		SceneParser(Scene &scene_arg, std::string *error_arg)
+			: LineParser(error_arg), scene(scene_arg)
+		{
+			objects = 0;
+			triangles = 0;
+			last_material = 0;
+			material_table.resize(64, NO_MATERIAL);
+		}
+
+		inline unsigned int GetObjects() const { return objects; }
+		inline unsigned long GetTriangles() const { return triangles; }
+};
+
+static unsigned int
+hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
+
+	while(*name)
+		h = (h ^ (unsigned char)*name++) * 16777619u;
+
+	return h;
+}
+
+unsigned int
+SceneParser::FindMaterial(const char *name) const
+{
+	unsigned int mask = (unsigned int)material_table.size() - 1;
+
+	for(unsigned int i = hash_name(name) & mask; ; i = (i + 1) & mask) {
+		unsigned int index = material_table[i];
+		if(index == NO_MATERIAL || strcmp(materials[index].name, name) == 0)
+			return index;
+	}
+}
+
+void
+SceneParser::InsertMaterial(unsigned int index)
+{
+	unsigned int mask = (unsigned int)material_table.size() - 1;
+	unsigned int i = hash_name(materials[index].name) & mask;
+
+	while(material_table[i] != NO_MATERIAL)
+		i = (i + 1) & mask;
+	material_table[i] = index;
+}
+
+// redefining a name replaces it for the spheres that follow
+void
+SceneParser::AddMaterial(const NamedMaterial &m)
+{
+	unsigned int index = FindMaterial(m.name);
+	if(index != NO_MATERIAL) {
+		materials[index] = m;
+		last_material = index;
+		return;
+	}
+
+	materials.push_back(m);
+	last_material = (unsigned int)materials.size() - 1;
+
+	// keep the table at most half full
+	if(materials.size() * 2 > material_table.size()) {
+		material_table.assign(material_table.size() * 2, NO_MATERIAL);
+		for(unsigned int i = 0; i < materials.size(); i++)
+			InsertMaterial(i);
+	} else {
+		InsertMaterial(last_material);
+	}
+}
+
+// consecutive objects usually share a material, so the last one found is
+// checked first; returns NO_MATERIAL if the name is undefined
+unsigned int
+SceneParser::LookupMaterial(const char *name)
+{
+	if(last_material >= materials.size() || strcmp(materials[last_material].name, name) != 0) {
+		unsigned int index = FindMaterial(name);
+		if(index == NO_MATERIAL)
+			return NO_MATERIAL;
+		last_material = index;
+	}
+
+	return last_material;
+}
+
+// returns NULL after setting the error if the file can't be loaded
+Mesh *
+SceneParser::LoadMesh(const char *filename)
+{
+	Mesh *mesh = new Mesh;
+	std::string mesh_error;
+	if(!load_obj(filename, *mesh, NULL, &mesh_error)) {
+		delete mesh;
+		mesh_error = std::string(filename) + ": " + mesh_error;
+		Fail(mesh_error.c_str());
+		return NULL;
+	}
+	mesh->SetSource(filename);
+	triangles += mesh->GetTriangleCount();
+
+	return mesh;
+}
+
+bool
+SceneParser::Statement(char *tokens[], unsigned int count)
+{
+	const char *keyword = tokens[0];
+	float f[12];
+
+	if(strcmp(keyword, "sphere") == 0) {
+		if(count != 6 || !parse_floats(tokens + 1, 4, f))
+			return Fail("expected: sphere X Y Z RADIUS MATERIAL");
+
+		unsigned int m = LookupMaterial(tokens[5]);
+		if(m == NO_MATERIAL)
+			return Fail("undefined material");
+
+		scene.AddSphere(Vector(f[0], f[1], f[2]), f[3], materials[m].material);
+		objects++;
+	} else if(strcmp(keyword, "instance") == 0) {
+		if((count != 6 && count != 15) || !parse_floats(tokens + 3, count - 3, f))
+			return Fail("expected: instance GEOMETRY MATERIAL X Y Z [M00 M01 M02 M10 M11 M12 M20 M21 M22]");
+
+		GeometryNames::iterator it = geometries.find(tokens[1]);
+		if(it == geometries.end())
+			return Fail("undefined geometry");
+		unsigned int m = LookupMaterial(tokens[2]);
+		if(m == NO_MATERIAL)
+			return Fail("undefined material");
+
+		Instance *instance = new Instance(it->second);
+		if(count == 15 && !instance->SetLinear(f + 3)) {
+			delete instance;
+			return Fail("instance transform is singular");
+		}
+		instance->SetOrigin(Vector(f[0], f[1], f[2]));
+		instance->SetColor(materials[m].material.color);
+		instance->SetReflectance(materials[m].material.reflectance);
+
+		scene.AddObject(instance);
+		objects++;
+	} else if(strcmp(keyword, "geometry") == 0) {
+		if(count != 4 || (strcmp(tokens[2], "sphere") != 0 && strcmp(tokens[2], "mesh") != 0))
+			return Fail("expected: geometry NAME sphere RADIUS, or geometry NAME mesh FILE");
+		if(geometries.find(tokens[1]) != geometries.end())
+			return Fail("geometry already defined");
+
+		Object *geometry;
+		if(strcmp(tokens[2], "sphere") == 0) {
+			if(!parse_float(tokens[3], &f[0]))
+				return Fail("expected: geometry NAME sphere RADIUS");
+			geometry = new Sphere(f[0]);
+		} else {
+			geometry = LoadMesh(tokens[3]);
+			if(!geometry)
+				return false;
+		}
+
+		scene.AddGeometry(geometry);
+		geometries[tokens[1]] = geometry;
+	} else if(strcmp(keyword, "mesh") == 0) {
+		if((count != 3 && count != 6) || (count == 6 && !parse_floats(tokens + 3, 3, f)))
+			return Fail("expected: mesh FILE MATERIAL [X Y Z]");
+
+		unsigned int m = LookupMaterial(tokens[2]);
+		if(m == NO_MATERIAL)
+			return Fail("undefined material");
+
+		Mesh *mesh = LoadMesh(tokens[1]);
+		if(!mesh)
+			return false;
+		mesh->SetColor(materials[m].material.color);
+		mesh->SetReflectance(materials[m].material.reflectance);
+		if(count == 6)
+			mesh->SetOrigin(Vector(f[0], f[1], f[2]));
+
+		scene.AddObject(mesh);
+		objects++;
+	} else if(strcmp(keyword, "material") == 0) {
+		if((count != 5 && count != 6) || !parse_floats(tokens + 2, count - 2, f))
+			return Fail("expected: material NAME R G B [REFLECTANCE]");
+		if(strlen(tokens[1]) >= MAX_NAME)
+			return Fail("material name too long");
+
+		NamedMaterial m;
+		strcpy(m.name, tokens[1]);
+		m.material.color[0] = f[0];
+		m.material.color[1] = f[1];
+		m.material.color[2] = f[2];
+		m.material.color[3] = 1.0f;
+		m.material.reflectance = (count == 6) ? f[3] : 0.0f;
+		AddMaterial(m);
+	} else if(strcmp(keyword, "light") == 0) {
+		if(count != 4 || !parse_floats(tokens + 1, 3, f))
+			return Fail("expected: light X Y Z");
+
+		scene.AddLight(Vector(f[0], f[1], f[2]));
+	} else if(strcmp(keyword, "camera") == 0) {
+		if((count != 11 && count != 12) || !parse_floats(tokens + 1, count - 1, f))
+			return Fail("expected: camera PX PY PZ TX TY TZ UX UY UZ FOV [ASPECT]");
+
+		// the screen size is derived in double precision so that files
+		// written by save_scene() reproduce it exactly
+		double fov, aspect = 4.0 / 3.0;
+		parse_double(tokens[10], &fov);
+		if(count == 12)
+			parse_double(tokens[11], &aspect);
+		if(fov <= 0.0 || fov >= 180.0 || aspect <= 0.0)
+			return Fail("camera field of view must be between 0 and 180 degrees");
+
+		Camera &camera = scene.GetCamera();
+		camera.LookAt(Vector(f[0], f[1], f[2]), Vector(f[3], f[4], f[5]), Vector(f[6], f[7], f[8]));
+		camera.SetFov(fov, aspect);
+	} else if(strcmp(keyword, "ambient") == 0) {
+		if(count != 2 || !parse_floats(tokens + 1, 1, f))
+			return Fail("expected: ambient A");
+
+		scene.SetAmbient(f[0]);
+	} else if(strcmp(keyword, "max_depth") == 0) {
+		int depth;
+		if(count != 2 || !parse_int(tokens[1], &depth))
+			return Fail("expected: max_depth N");
+
+		// deeper levels are cut off at the scene's limit
+		if(depth > Scene::MAX_DEPTH)
+			depth = Scene::MAX_DEPTH;
+		scene.SetMaxDepth(depth);
+	} else if(strcmp(keyword, "termination") == 0) {
+		Scene::Termination termination;
+		if(count != 2 || !Scene::ParseTermination(tokens[1], termination))
+			return Fail("expected: termination depth|throughput|roulette");
+
+		scene.SetTermination(termination);
+	} else if(strcmp(keyword, "shadows") == 0) {
+		if(count != 2 || (strcmp(tokens[1], "on") != 0 && strcmp(tokens[1], "off") != 0))
+			return Fail("expected: shadows on|off");
+
+		scene.SetShadows(strcmp(tokens[1], "on") == 0);
+	} else {
+		return Fail("unknown statement");
+	}
+
+	return true;
+}
+
+bool
+SceneParser::ParseLine(char *line)
+{
+	char *tokens[MAX_TOKENS];
+	unsigned int count;
+	if(!Tokenize(line, tokens, MAX_TOKENS, count))
+		return false;
+
+	return (count == 0) ? true : Statement(tokens, count);
+}
+
+bool
+load_scene(FILE *fp, Scene &scene, SceneLoadStats *stats_arg, std::string *error)
+{
+	SceneLoadStats local_stats;
+	SceneLoadStats &stats = stats_arg ? *stats_arg : local_stats;
+
+	double start = timer_seconds();
+
+	SceneParser parser(scene, error);
+	bool ok = parser.Load(fp);
+
+	stats.bytes = parser.GetBytes();
+	stats.lines = parser.GetLines();
+	stats.objects = parser.GetObjects();
+	stats.triangles = parser.GetTriangles();
+	stats.parse_seconds = timer_seconds() - start;
+
+	return ok;
+}
+
+bool
+load_scene(const char *filename, Scene &scene, SceneLoadStats *stats, std::string *error)
+{
+	TRACE_SCOPE(trace, "scene load", "scene");
+
+	FILE *fp = fopen(filename, "rb");
+	if(!fp) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	bool ok = load_scene(fp, scene, stats, error);
+	fclose(fp);
+
+	return ok;
+}
+
+/*
+ * Writing
+ */
+struct MaterialLess {
+	bool operator () (const Material &a, const Material &b) const
+	{
+		return memcmp(&a, &b, sizeof(Material)) < 0;
+	}
+};
+
+typedef std::map <Material, unsigned int, MaterialLess> MaterialNames;
+
+static unsigned int
+write_material(FILE *fp, MaterialNames &names, const Material &m)
+{
+	MaterialNames::iterator it = names.find(m);
+	if(it != names.end())
+		return it->second;
+
+	unsigned int index = (unsigned int)names.size();
+	names[m] = index;
+	fprintf(fp, "material m%u %.9g %.9g %.9g %.9g\n", index,
+	        m.color[0], m.color[1], m.color[2], m.reflectance);
+
+	return index;
+}
+
+bool
+save_scene(FILE *fp, const Scene &scene, unsigned int *skipped)
+{
+	unsigned int left_out = 0;
+
+	const Camera &camera = scene.GetCamera();
+	Vector pos = camera.GetPosition();
+	Vector target = pos + camera.GetForward();
+	Vector up = Vector(0.0f, 0.0f, 0.0f) - camera.GetDown();
+	double fov = atan((double)camera.GetHalfWidth() / Camera::PLANE_DISTANCE) * 360.0 / M_PI;
+
+	fprintf(fp, "# raytracer scene\n");
+	fprintf(fp, "camera %.9g %.9g %.9g  %.9g %.9g %.9g  %.9g %.9g %.9g  %.17g %.17g\n",
+	        pos.vec[0], pos.vec[1], pos.vec[2], target.vec[0], target.vec[1], target.vec[2],
+	        up.vec[0], up.vec[1], up.vec[2], fov, (double)camera.GetHalfWidth() / camera.GetHalfHeight());
+
+	const std::vector <Vector> &lights = scene.GetLights();
+	for(unsigned int i = 0; i < lights.size(); i++)
+		fprintf(fp, "light %.9g %.9g %.9g\n", lights[i].vec[0], lights[i].vec[1], lights[i].vec[2]);
+	fprintf(fp, "ambient %.9g\n", scene.GetAmbient());
+	fprintf(fp, "max_depth %d\n", scene.GetMaxDepth());
+	fprintf(fp, "termination %s\n", Scene::GetTerminationName(scene.GetTermination()));
+	fprintf(fp, "shadows %s\n", scene.GetShadows() ? "on" : "off");
+
+	// only spheres, meshes loaded from files and instances of those can
+	// be described; other objects are left out, and so is a geometry
+	// that can't be, but only its instances are counted
+	std::map <const Object *, unsigned int> geometry_names;
+	const std::vector <Object *> &geometries = scene.GetGeometries();
+	for(unsigned int i = 0; i < geometries.size(); i++) {
+		const Sphere *sphere = dynamic_cast<const Sphere *>(geometries[i]);
+		const Mesh *mesh = dynamic_cast<const Mesh *>(geometries[i]);
+		if(sphere)
+			fprintf(fp, "geometry g%u sphere %.9g\n", i, sphere->GetRadius());
+		else if(mesh && !mesh->GetSource().empty())
+			fprintf(fp, "geometry g%u mesh %s\n", i, mesh->GetSource().c_str());
+		else
+			continue;
+		geometry_names[geometries[i]] = i;
+	}
+
+	MaterialNames materials;
+	const std::vector <Object *> &objects = scene.GetObjects();
+	for(unsigned int i = 0; i < objects.size(); i++) {
+		const Instance *instance = dynamic_cast<const Instance *>(objects[i]);
+		if(instance) {
+			std::map <const Object *, unsigned int>::iterator it = geometry_names.find(instance->GetGeometry());
+			if(it == geometry_names.end()) {
+				left_out++;
+				continue;
+			}
+
+			unsigned int m = write_material(fp, materials, instance->GetMaterial());
+			const Vector &o = instance->GetOrigin();
+			const float *l = instance->GetLinear();
+			fprintf(fp, "instance g%u m%u %.9g %.9g %.9g  %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g %.9g\n",
+			        it->second, m, o.vec[0], o.vec[1], o.vec[2],
+			        l[0], l[1], l[2], l[3], l[4], l[5], l[6], l[7], l[8]);
+			continue;
+		}
+
+		const Mesh *mesh = dynamic_cast<const Mesh *>(objects[i]);
+		if(mesh && !mesh->GetSource().empty()) {
+			unsigned int m = write_material(fp, materials, mesh->GetMaterial());
+			const Vector &o = mesh->GetOrigin();
+			fprintf(fp, "mesh %s m%u %.9g %.9g %.9g\n", mesh->GetSource().c_str(), m, o.vec[0], o.vec[1], o.vec[2]);
+			continue;
+		}
+
+		const Sphere *sphere = dynamic_cast<const Sphere *>(objects[i]);
+		if(!sphere) {
+			left_out++;
+			continue;
+		}
+
+		unsigned int m = write_material(fp, materials, sphere->GetMaterial());
+		const Vector &c = sphere->GetOrigin();
+		fprintf(fp, "sphere %.9g %.9g %.9g %.9g m%u\n", c.vec[0], c.vec[1], c.vec[2], sphere->GetRadius(), m);
+	}
+
+	const std::vector <Scene::SphereRecord> &records = scene.GetSphereRecords();
+	for(unsigned int i = 0; i < records.size(); i++) {
+		unsigned int m = write_material(fp, materials, records[i].material);
+		const Vector &c = records[i].center;
+		fprintf(fp, "sphere %.9g %.9g %.9g %.9g m%u\n", c.vec[0], c.vec[1], c.vec[2], records[i].radius, m);
+	}
+
+	// a scene attached to a cache only has its compiled sphere store
+	if(scene.IsAttached()) {
+		const SphereStore &store = scene.GetSphereStore();
+		for(unsigned int i = 0; i < store.GetCount(); i++) {
+			unsigned int m = write_material(fp, materials, store.GetMaterial(i));
+			Vector c = store.GetCenter(i);
+			fprintf(fp, "sphere %.9g %.9g %.9g %.9g m%u\n", c.vec[0], c.vec[1], c.vec[2],
+			        sqrtf(store.GetRadius2(i)), m);
+		}
+	}
+
+	if(skipped)
+		*skipped = left_out;
+
+	return fflush(fp) == 0 && !ferror(fp);
+}
+
+bool
+save_scene(const char *filename, const Scene &scene, unsigned int *skipped)
+{
+	FILE *fp = fopen(filename, "w");
+	if(!fp)
+		return false;
+
+	bool ok = save_scene(fp, scene, skipped);
+	if(fclose(fp) != 0)
+		ok = false;
+
+	return ok;
+}
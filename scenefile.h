@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCENEFILE_H__
+#define __SCENEFILE_H__
+
+#include <cstdio>
+#include <string>
+#include "scene.h"
+
+/*
+ * Text scene format. One statement per line, '#' starts a comment:
+ *
+ *   camera PX PY PZ  TX TY TZ  UX UY UZ  FOV [ASPECT]
+ *   light X Y Z
+ *   ambient A
+ *   max_depth N
+ *   termination depth|throughput|roulette
+ *   shadows on|off
+ *   material NAME R G B [REFLECTANCE]
+ *   sphere X Y Z RADIUS MATERIAL
+ *   mesh FILE MATERIAL [X Y Z]
+ *   geometry NAME sphere RADIUS
+ *   geometry NAME mesh FILE
+ *   instance GEOMETRY MATERIAL X Y Z [M00 M01 M02 M10 M11 M12 M20 M21 M22]
+ *
+ * The camera sits at P looking at T with U pointing up in the frame;
+ * FOV is the horizontal field of view in degrees and ASPECT defaults
+ * to 4:3. Materials must be defined before the objects that use them.
+ * A mesh is loaded from a Wavefront OBJ file, relative to the current
+ * directory, and placed with its origin at X Y Z.
+ *
+ * max_depth is at most Scene::MAX_DEPTH; deeper settings are cut to it.
+ *
+ * A geometry is defined once and drawn only through instances, which
+ * place it with their origin at X Y Z under the row major linear
+ * transform M, the identity if left out, in their own material.
+ */
+struct SceneLoadStats {
+	unsigned long bytes;
+	unsigned int lines;
+	unsigned int objects;
+	unsigned long triangles;
+	double parse_seconds;
+};
+
+// adds the file's contents to scene; on failure error describes the
+// problem and the scene may be partially filled
+bool load_scene(const char *filename, Scene &scene, SceneLoadStats *stats, std::string *error);
+
+// writes the scene; objects the format can't describe, such as meshes
+// not loaded from a file, are left out, and counted in skipped if given
+bool save_scene(const char *filename, const Scene &scene, unsigned int *skipped = NULL);
+
+// as above, for a stream that is already open; save_scene() doesn't
+// close it
+bool load_scene(FILE *fp, Scene &scene, SceneLoadStats *stats, std::string *error);
+bool save_scene(FILE *fp, const Scene &scene, unsigned int *skipped = NULL);
+
+#endif /* __SCENEFILE_H__ */
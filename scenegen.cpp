@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// scenegen.cpp - Procedural scene generation
+
+#include <cmath>
+#include <cstring>
+#include "mesh.h"
+#include "scenegen.h"
+
+// view volume the generated scenes are placed in; the camera sees
+// x in [-2z, 2z] and y in [-1.5z, 1.5z] at depth z
+const float VOLUME_MIN_Z = 6.0f;
+const float VOLUME_DEPTH = 14.0f;
+const float VIEW_SLOPE = 1.8f;
+
+static const char *scene_type_names[] = { "default", "grid", "cloud", "reflective", "instances" };
+
+/*
+ * Small xorshift generator; rand() differs between C libraries, which
+ * would make scenes differ between machines.
+ */
+class Random {
+	protected:
+		unsigned int state;
+
+	public:
+		Random(unsigned int seed) { state = seed ? seed : 0x9e3779b9u; }
+
+		inline unsigned int Next()
+		{
+			state ^= state << 13;
+			state ^= state >> 17;
+			state ^= state << 5;
+			return state;
+		}
+
+		// uniform in [min, max)
+		inline float Range(float min, float max)
+		{
+			return min + (max - min) * (float)(Next() >> 8) * (1.0f / 16777216.0f);
+		}
+};
+
+static void
+add_sphere(Scene &scene, const Vector &origin, float radius, float r, float g, float b, float reflectance)
+{
+	Sphere *sphere = new Sphere(radius);
+	sphere->SetOrigin(origin);
+	sphere->SetColor(r, g, b);
+	sphere->SetReflectance(reflectance);
+	scene.AddObject(sphere);
+}
+
+static void
+generate_default(Scene &scene)
+{
+	const int spheresPerDimension = 3;
+
+	for(int x = 0; x < spheresPerDimension; ++x) {
+		for(int y = 0; y < spheresPerDimension; ++y) {
+			for(int z = 0; z < spheresPerDimension; ++z) {
+				if(((x+y+z) % 3) == 0)
+					continue;
+
+				add_sphere(scene, Vector((float)x, (float)y, (float)z) * 2.5f + Vector(-2.5f, -2.5f, 0.0f), 1.0f,
+				           (x % 2) ? 1.0f : 0.5f, (y % 2) ? 1.0f : 0.5f, (z % 2) ? 1.0f : 0.5f, 0.2f);
+			}
+		}
+	}
+}
+
+static void
+generate_grid(Scene &scene, unsigned int count, Random &random)
+{
+	int n = (int)ceil(pow((double)count, 1.0 / 3.0));
+	if(n < 1)
+		n = 1;
+
+	// fit the grid into the view frustum at its near plane
+	float size = VOLUME_MIN_Z * VIEW_SLOPE * 2.0f;
+	float spacing = size / (float)n;
+	float radius = spacing * 0.35f;
+	unsigned int added = 0;
+
+	for(int z = 0; z < n && added < count; z++) {
+		for(int y = 0; y < n && added < count; y++) {
+			for(int x = 0; x < n && added < count; x++) {
+				Vector origin(((float)x + 0.5f) * spacing - size * 0.5f,
+				              (((float)y + 0.5f) * spacing - size * 0.5f) * 0.75f,
+				              VOLUME_MIN_Z + ((float)z + 0.5f) * spacing);
+				add_sphere(scene, origin, radius, random.Range(0.3f, 1.0f), random.Range(0.3f, 1.0f),
+				           random.Range(0.3f, 1.0f), 0.2f);
+				added++;
+			}
+		}
+	}
+}
+
+static void
+generate_cloud(Scene &scene, unsigned int count, Random &random)
+{
+	// keep the fraction of the volume covered roughly constant
+	float mid_z = VOLUME_MIN_Z + VOLUME_DEPTH * 0.5f;
+	float volume = (2.0f * VIEW_SLOPE * mid_z) * (1.5f * VIEW_SLOPE * mid_z) * VOLUME_DEPTH;
+	float mean_radius = 0.3f * (float)pow((double)(volume / (float)count), 1.0 / 3.0);
+
+	for(unsigned int i = 0; i < count; i++) {
+		float z = random.Range(VOLUME_MIN_Z, VOLUME_MIN_Z + VOLUME_DEPTH);
+		float half_width = z * VIEW_SLOPE;
+		Vector origin(random.Range(-half_width, half_width), random.Range(-half_width, half_width) * 0.75f, z);
+		add_sphere(scene, origin, mean_radius * random.Range(0.5f, 1.5f), random.Range(0.2f, 1.0f),
+		           random.Range(0.2f, 1.0f), random.Range(0.2f, 1.0f), random.Range(0.0f, 0.3f));
+	}
+}
+
+static void
+generate_reflective(Scene &scene, unsigned int count, Random &random)
+{
+	// a dense ball of mirrors in the middle of the view, so most rays
+	// bounce many times
+	float cluster_radius = 7.0f;
+	float mean_radius = 0.6f * cluster_radius * (float)pow(1.0 / (double)count, 1.0 / 3.0);
+	Vector center(0.0f, 0.0f, VOLUME_MIN_Z + cluster_radius);
+
+	for(unsigned int i = 0; i < count; i++) {
+		Vector offset;
+		do {
+			offset = Vector(random.Range(-1.0f, 1.0f), random.Range(-1.0f, 1.0f), random.Range(-1.0f, 1.0f));
+		} while(dot_product(offset.vec, offset.vec) > 1.0f);
+
+		add_sphere(scene, center + offset * cluster_radius, mean_radius * random.Range(0.7f, 1.3f),
+		           random.Range(0.5f, 1.0f), random.Range(0.5f, 1.0f), random.Range(0.5f, 1.0f),
+		           random.Range(0.6f, 0.9f));
+	}
+}
+
+// a torus of unit outer radius around the y axis
+static Mesh *
+make_torus(unsigned int rings, unsigned int sides)
+{
+	const float minor = 0.3f, major = 1.0f - minor;
+	Mesh *mesh = new Mesh;
+	mesh->Reserve(rings * sides, rings * sides * 2);
+
+	for(unsigned int i = 0; i < rings; i++) {
+		float a = 2.0f * (float)M_PI * (float)i / (float)rings;
+		for(unsigned int j = 0; j < sides; j++) {
+			float b = 2.0f * (float)M_PI * (float)j / (float)sides;
+			float d = major + minor * cosf(b);
+			mesh->AddVertex(Vector(d * cosf(a), minor * sinf(b), d * sinf(a)));
+		}
+	}
+
+	for(unsigned int i = 0; i < rings; i++) {
+		unsigned int next = (i + 1) % rings;
+		for(unsigned int j = 0; j < sides; j++) {
+			unsigned int k = (j + 1) % sides;
+			mesh->AddTriangle(i * sides + j, i * sides + k, next * sides + k);
+			mesh->AddTriangle(i * sides + j, next * sides + k, next * sides + j);
+		}
+	}
+
+	mesh->Build();
+
+	return mesh;
+}
+
+static void
+generate_instances(Scene &scene, unsigned int count, Random &random)
+{
+	// one shared torus, placed like the spheres of the cloud scene
+	Mesh *torus = make_torus(32, 16);
+	scene.AddGeometry(torus);
+
+	float mid_z = VOLUME_MIN_Z + VOLUME_DEPTH * 0.5f;
+	float volume = (2.0f * VIEW_SLOPE * mid_z) * (1.5f * VIEW_SLOPE * mid_z) * VOLUME_DEPTH;
+	float mean_size = 0.3f * (float)pow((double)(volume / (float)count), 1.0 / 3.0);
+
+	for(unsigned int i = 0; i < count; i++) {
+		float z = random.Range(VOLUME_MIN_Z, VOLUME_MIN_Z + VOLUME_DEPTH);
+		float half_width = z * VIEW_SLOPE;
+		Vector origin(random.Range(-half_width, half_width), random.Range(-half_width, half_width) * 0.75f, z);
+
+		// a random rotation, from a random axis and angle, and scale
+		Vector axis;
+		do {
+			axis = Vector(random.Range(-1.0f, 1.0f), random.Range(-1.0f, 1.0f), random.Range(-1.0f, 1.0f));
+		} while(dot_product(axis.vec, axis.vec) > 1.0f || dot_product(axis.vec, axis.vec) < 0.01f);
+		axis.Normalize();
+		float angle = random.Range(0.0f, 2.0f * (float)M_PI);
+		float scale = mean_size * random.Range(0.5f, 1.5f);
+
+		float c = cosf(angle), s = sinf(angle), t = 1.0f - c;
+		float x = axis.vec[0], y = axis.vec[1], w = axis.vec[2];
+		float m[9] = {
+			(t * x * x + c) * scale, (t * x * y - s * w) * scale, (t * x * w + s * y) * scale,
+			(t * x * y + s * w) * scale, (t * y * y + c) * scale, (t * y * w - s * x) * scale,
+			(t * x * w - s * y) * scale, (t * y * w + s * x) * scale, (t * w * w + c) * scale
+		};
+
+		Instance *instance = new Instance(torus);
+		instance->SetLinear(m);
+		instance->SetOrigin(origin);
+		instance->SetColor(random.Range(0.2f, 1.0f), random.Range(0.2f, 1.0f), random.Range(0.2f, 1.0f));
+		instance->SetReflectance(random.Range(0.0f, 0.3f));
+		scene.AddObject(instance);
+	}
+}
+
+void
+generate_scene(Scene &scene, SceneType type, unsigned int count, unsigned int seed)
+{
+	Random random(seed);
+
+	switch(type) {
+		default:
+		case SCENE_DEFAULT:
+			generate_default(scene);
+			break;
+		case SCENE_GRID:
+			generate_grid(scene, count, random);
+			break;
+		case SCENE_CLOUD:
+			generate_cloud(scene, count, random);
+			break;
+		case SCENE_REFLECTIVE:
+			generate_reflective(scene, count, random);
+			break;
+		case SCENE_INSTANCES:
+			generate_instances(scene, count, random);
+			break;
+	}
+}
+
+int
+scene_type_from_name(const char *name)
+{
+	for(int i = 0; i < (int)(sizeof(scene_type_names) / sizeof(scene_type_names[0])); i++) {
+		if(strcmp(name, scene_type_names[i]) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+const char *
+scene_type_name(SceneType type)
+{
+	return scene_type_names[type];
+}
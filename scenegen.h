@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SCENEGEN_H__
+#define __SCENEGEN_H__
+
+#include "scene.h"
+
+enum SceneType {
+	SCENE_DEFAULT,    // the original 3x3x3 grid of 18 spheres
+	SCENE_GRID,       // regular grid of spheres
+	SCENE_CLOUD,      // uniformly scattered spheres of varying size
+	SCENE_REFLECTIVE, // tight cluster of highly reflective spheres
+	SCENE_INSTANCES   // scattered instances of one shared torus mesh
+};
+
+/*
+ * Procedural scene generation. The same type, count and seed always give
+ * the same scene on every platform, so benchmark results are comparable
+ * from build to build. Everything is placed inside the fixed camera's
+ * view volume.
+ */
+void generate_scene(Scene &scene, SceneType type, unsigned int count, unsigned int seed);
+
+// returns the type for a name such as "grid", or -1 if unknown
+int scene_type_from_name(const char *name);
+const char *scene_type_name(SceneType type);
+
+#endif /* __SCENEGEN_H__ */
@@ -0,0 +1,600 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// spherestore.cpp - Structure-of-arrays sphere store and SIMD kernels
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+#include <cmath>
+#include "spherestore.h"
+
+#define SQUARE(x) ((x)*(x))
+
+// leaf callbacks handed to BVH::Traverse()/TraverseAny()/TraversePacket()
+struct SphereLeaf {
+	const SphereStore *store;
+	const Ray *ray;
+	unsigned int closest;
+
+	inline void operator () (unsigned int first, unsigned int n, float &closest_t)
+	{
+		store->IntersectRange(*ray, first, n, closest_t, closest);
+	}
+};
+
+struct SphereOcclusionLeaf {
+	const SphereStore *store;
+	const Ray *ray;
+	unsigned int ignore;
+	unsigned int occluder;
+
+	inline bool operator () (unsigned int first, unsigned int n, float max_t)
+	{
+		occluder = store->OccludedRange(*ray, first, n, max_t, ignore);
+		return occluder != NO_HIT;
+	}
+};
+
+struct SpherePacketLeaf {
+	const SphereStore *store;
+
+	inline void operator () (unsigned int first, unsigned int n, RayPacket &packet)
+	{
+		store->IntersectRangePacket(packet, first, n);
+	}
+};
+
+/*
+ * SphereStore class
+ */
+SphereStore::SphereStore()
+{
+	Clear();
+}
+
+bool
+SphereStore::MaterialLess::operator () (const Material &a, const Material &b) const
+{
+	for(int i = 0; i < 4; i++) {
+		if(a.color[i] != b.color[i])
+			return a.color[i] < b.color[i];
+	}
+
+	return a.reflectance < b.reflectance;
+}
+
+void
+SphereStore::Clear()
+{
+	center_x.clear();
+	center_y.clear();
+	center_z.clear();
+	radius2.clear();
+	material_index.clear();
+	count = 0;
+
+	materials.clear();
+	material_lookup.clear();
+	bvh.Clear();
+
+	SetArrays();
+}
+
+void
+SphereStore::Add(const Vector &center, float radius, const Material &material)
+{
+	// drop the padding left by a previous Build()
+	center_x.resize(count);
+	center_y.resize(count);
+	center_z.resize(count);
+	radius2.resize(count);
+	material_index.resize(count);
+
+	std::map <Material, unsigned int, MaterialLess>::iterator it = material_lookup.find(material);
+	unsigned int m;
+	if(it == material_lookup.end()) {
+		m = (unsigned int)materials.size();
+		materials.push_back(material);
+		material_lookup[material] = m;
+	} else {
+		m = it->second;
+	}
+
+	center_x.push_back(center.vec[0]);
+	center_y.push_back(center.vec[1]);
+	center_z.push_back(center.vec[2]);
+	radius2.push_back(SQUARE(radius));
+	material_index.push_back(m);
+	count++;
+}
+
+void
+SphereStore::Pad()
+{
+	center_x.resize(count + SIMD_WIDTH, 0.0f);
+	center_y.resize(count + SIMD_WIDTH, 0.0f);
+	center_z.resize(count + SIMD_WIDTH, 0.0f);
+	radius2.resize(count + SIMD_WIDTH, 0.0f);
+	material_index.resize(count + SIMD_WIDTH, 0);
+}
+
+void
+SphereStore::Build(std::vector <unsigned int> *order)
+{
+	std::vector <BVH::BuildPrimitive> build_prims(count);
+	for(unsigned int i = 0; i < count; i++) {
+		float r = sqrtf(radius2[i]);
+		Vector c(center_x[i], center_y[i], center_z[i]);
+		BVH::MakeBuildPrimitive(build_prims[i], c - r, c + r, i);
+	}
+
+	bvh.Build(build_prims, GetKernelWidth());
+
+	// put the sphere data in leaf order
+	std::vector <float> x(count), y(count), z(count), r2(count);
+	std::vector <unsigned int> m(count);
+	for(unsigned int i = 0; i < count; i++) {
+		unsigned int src = build_prims[i].index;
+		x[i] = center_x[src];
+		y[i] = center_y[src];
+		z[i] = center_z[src];
+		r2[i] = radius2[src];
+		m[i] = material_index[src];
+	}
+	center_x.swap(x);
+	center_y.swap(y);
+	center_z.swap(z);
+	radius2.swap(r2);
+	material_index.swap(m);
+
+	if(order) {
+		order->resize(count);
+		for(unsigned int i = 0; i < count; i++)
+			(*order)[i] = build_prims[i].index;
+	}
+
+	Pad();
+	SetArrays();
+}
+
+void
+SphereStore::SetArrays()
+{
+	arrays.center_x = center_x.empty() ? NULL : &center_x[0];
+	arrays.center_y = center_y.empty() ? NULL : &center_y[0];
+	arrays.center_z = center_z.empty() ? NULL : &center_z[0];
+	arrays.radius2 = radius2.empty() ? NULL : &radius2[0];
+	arrays.material_index = material_index.empty() ? NULL : &material_index[0];
+	arrays.count = count;
+	arrays.materials = materials.empty() ? NULL : &materials[0];
+	arrays.material_count = (unsigned int)materials.size();
+}
+
+void
+SphereStore::Attach(const Arrays &arrays_arg, const BVH::Node *nodes, unsigned int node_count,
+                    const BVH::BuildStats &stats)
+{
+	Clear();
+
+	arrays = arrays_arg;
+	count = arrays.count;
+	bvh.Attach(nodes, node_count, stats);
+}
+
+unsigned int
+SphereStore::GetKernelWidth()
+{
+#if defined(__AVX__)
+	return 8;
+#elif defined(__SSE__)
+	return 4;
+#else
+	return 1;
+#endif
+}
+
+void
+SphereStore::Intersect(const Ray &ray, float &closest_t, unsigned int &closest) const
+{
+	SphereLeaf leaf;
+	leaf.store = this;
+	leaf.ray = &ray;
+	leaf.closest = closest;
+
+	bvh.Traverse(ray, closest_t, leaf);
+	closest = leaf.closest;
+}
+
+unsigned int
+SphereStore::Occluded(const Ray &ray, float max_t, unsigned int ignore) const
+{
+	SphereOcclusionLeaf leaf;
+	leaf.store = this;
+	leaf.ray = &ray;
+	leaf.ignore = ignore;
+	leaf.occluder = NO_HIT;
+
+	bvh.TraverseAny(ray, max_t, leaf);
+	return leaf.occluder;
+}
+
+void
+SphereStore::IntersectPacket(RayPacket &packet) const
+{
+	SpherePacketLeaf leaf;
+	leaf.store = this;
+
+	bvh.TraversePacket(packet, leaf);
+}
+
+/*
+ * The kernels below repeat the arithmetic of Sphere::Intersection() in
+ * the same order, so a sphere in the store and the same sphere as an
+ * Object produce bit-identical hits.
+ */
+void
+SphereStore::IntersectRange(const Ray &ray, unsigned int first, unsigned int n,
+                            float &closest_t, unsigned int &closest) const
+{
+	const float *ro = ray.GetOrigin().vec;
+	const float *rd = ray.GetDirection().vec;
+	float a = SQUARE(rd[0]) + SQUARE(rd[1]) + SQUARE(rd[2]);
+
+#if defined(__AVX__)
+	__m256 ro0 = _mm256_set1_ps(ro[0]), ro1 = _mm256_set1_ps(ro[1]), ro2 = _mm256_set1_ps(ro[2]);
+	__m256 rd0 = _mm256_set1_ps(rd[0]), rd1 = _mm256_set1_ps(rd[1]), rd2 = _mm256_set1_ps(rd[2]);
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 four_a = _mm256_set1_ps(4.0f * a);
+	__m256 two_a = _mm256_set1_ps(2.0f * a);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 sign = _mm256_set1_ps(-0.0f);
+
+	for(unsigned int i = first; i < first + n; i += 8) {
+		__m256 tmp0 = _mm256_sub_ps(ro0, _mm256_loadu_ps(&arrays.center_x[i]));
+		__m256 tmp1 = _mm256_sub_ps(ro1, _mm256_loadu_ps(&arrays.center_y[i]));
+		__m256 tmp2 = _mm256_sub_ps(ro2, _mm256_loadu_ps(&arrays.center_z[i]));
+
+		__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rd0, tmp0), _mm256_mul_ps(rd1, tmp1)), _mm256_mul_ps(rd2, tmp2));
+		b = _mm256_mul_ps(b, two);
+		__m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tmp0, tmp0), _mm256_mul_ps(tmp1, tmp1)), _mm256_mul_ps(tmp2, tmp2));
+		c = _mm256_sub_ps(c, _mm256_loadu_ps(&arrays.radius2[i]));
+
+		__m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(four_a, c));
+		__m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+		if(_mm256_movemask_ps(valid) == 0)
+			continue;
+
+		__m256 sq = _mm256_sqrt_ps(disc);
+		__m256 nb = _mm256_xor_ps(b, sign);
+		__m256 t1 = _mm256_div_ps(_mm256_add_ps(nb, sq), two_a);
+		__m256 t2 = _mm256_div_ps(_mm256_sub_ps(nb, sq), two_a);
+		__m256 t = _mm256_min_ps(t1, t2);
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+
+		int mask = _mm256_movemask_ps(valid);
+		if(first + n - i < 8)
+			mask &= (1 << (first + n - i)) - 1;
+		if(mask == 0)
+			continue;
+
+		float ts[8];
+		_mm256_storeu_ps(ts, t);
+		for(int j = 0; j < 8; j++) {
+			if((mask & (1 << j)) && ts[j] < closest_t) {
+				closest_t = ts[j];
+				closest = i + j;
+			}
+		}
+	}
+#elif defined(__SSE__)
+	__m128 ro0 = _mm_set1_ps(ro[0]), ro1 = _mm_set1_ps(ro[1]), ro2 = _mm_set1_ps(ro[2]);
+	__m128 rd0 = _mm_set1_ps(rd[0]), rd1 = _mm_set1_ps(rd[1]), rd2 = _mm_set1_ps(rd[2]);
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 four_a = _mm_set1_ps(4.0f * a);
+	__m128 two_a = _mm_set1_ps(2.0f * a);
+	__m128 zero = _mm_setzero_ps();
+	__m128 sign = _mm_set1_ps(-0.0f);
+
+	for(unsigned int i = first; i < first + n; i += 4) {
+		__m128 tmp0 = _mm_sub_ps(ro0, _mm_loadu_ps(&arrays.center_x[i]));
+		__m128 tmp1 = _mm_sub_ps(ro1, _mm_loadu_ps(&arrays.center_y[i]));
+		__m128 tmp2 = _mm_sub_ps(ro2, _mm_loadu_ps(&arrays.center_z[i]));
+
+		__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rd0, tmp0), _mm_mul_ps(rd1, tmp1)), _mm_mul_ps(rd2, tmp2));
+		b = _mm_mul_ps(b, two);
+		__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp0, tmp0), _mm_mul_ps(tmp1, tmp1)), _mm_mul_ps(tmp2, tmp2));
+		c = _mm_sub_ps(c, _mm_loadu_ps(&arrays.radius2[i]));
+
+		__m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(four_a, c));
+		__m128 valid = _mm_cmpge_ps(disc, zero);
+		if(_mm_movemask_ps(valid) == 0)
+			continue;
+
+		__m128 sq = _mm_sqrt_ps(disc);
+		__m128 nb = _mm_xor_ps(b, sign);
+		__m128 t1 = _mm_div_ps(_mm_add_ps(nb, sq), two_a);
+		__m128 t2 = _mm_div_ps(_mm_sub_ps(nb, sq), two_a);
+		__m128 t = _mm_min_ps(t1, t2);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+
+		int mask = _mm_movemask_ps(valid);
+		if(first + n - i < 4)
+			mask &= (1 << (first + n - i)) - 1;
+		if(mask == 0)
+			continue;
+
+		float ts[4];
+		_mm_storeu_ps(ts, t);
+		for(int j = 0; j < 4; j++) {
+			if((mask & (1 << j)) && ts[j] < closest_t) {
+				closest_t = ts[j];
+				closest = i + j;
+			}
+		}
+	}
+#else
+	for(unsigned int i = first; i < first + n; i++) {
+		float tmp[3] = { ro[0] - arrays.center_x[i], ro[1] - arrays.center_y[i], ro[2] - arrays.center_z[i] };
+		float b = dot_product(rd, tmp) * 2.0f;
+		float c = SQUARE(tmp[0]) + SQUARE(tmp[1]) + SQUARE(tmp[2]) - arrays.radius2[i];
+		float disc = SQUARE(b) - (4.0f*a*c);
+		if(disc < 0.0f)
+			continue;
+
+		float t1 = (-b + sqrtf(disc)) / (2.0f*a);
+		float t2 = (-b - sqrtf(disc)) / (2.0f*a);
+		float t = (t1 < t2) ? t1 : t2;
+		if(t >= 0.0f && t < closest_t) {
+			closest_t = t;
+			closest = i;
+		}
+	}
+#endif
+}
+
+/*
+ * Any-hit version of IntersectRange(): the spheres are tested the same
+ * way, but the first one hit before max_t is returned without looking
+ * for a closer one.
+ */
+unsigned int
+SphereStore::OccludedRange(const Ray &ray, unsigned int first, unsigned int n,
+                           float max_t, unsigned int ignore) const
+{
+	const float *ro = ray.GetOrigin().vec;
+	const float *rd = ray.GetDirection().vec;
+	float a = SQUARE(rd[0]) + SQUARE(rd[1]) + SQUARE(rd[2]);
+
+#if defined(__AVX__)
+	__m256 ro0 = _mm256_set1_ps(ro[0]), ro1 = _mm256_set1_ps(ro[1]), ro2 = _mm256_set1_ps(ro[2]);
+	__m256 rd0 = _mm256_set1_ps(rd[0]), rd1 = _mm256_set1_ps(rd[1]), rd2 = _mm256_set1_ps(rd[2]);
+	__m256 two = _mm256_set1_ps(2.0f);
+	__m256 four_a = _mm256_set1_ps(4.0f * a);
+	__m256 two_a = _mm256_set1_ps(2.0f * a);
+	__m256 zero = _mm256_setzero_ps();
+	__m256 sign = _mm256_set1_ps(-0.0f);
+	__m256 limit = _mm256_set1_ps(max_t);
+
+	for(unsigned int i = first; i < first + n; i += 8) {
+		__m256 tmp0 = _mm256_sub_ps(ro0, _mm256_loadu_ps(&arrays.center_x[i]));
+		__m256 tmp1 = _mm256_sub_ps(ro1, _mm256_loadu_ps(&arrays.center_y[i]));
+		__m256 tmp2 = _mm256_sub_ps(ro2, _mm256_loadu_ps(&arrays.center_z[i]));
+
+		__m256 b = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(rd0, tmp0), _mm256_mul_ps(rd1, tmp1)), _mm256_mul_ps(rd2, tmp2));
+		b = _mm256_mul_ps(b, two);
+		__m256 c = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(tmp0, tmp0), _mm256_mul_ps(tmp1, tmp1)), _mm256_mul_ps(tmp2, tmp2));
+		c = _mm256_sub_ps(c, _mm256_loadu_ps(&arrays.radius2[i]));
+
+		__m256 disc = _mm256_sub_ps(_mm256_mul_ps(b, b), _mm256_mul_ps(four_a, c));
+		__m256 valid = _mm256_cmp_ps(disc, zero, _CMP_GE_OQ);
+		if(_mm256_movemask_ps(valid) == 0)
+			continue;
+
+		__m256 sq = _mm256_sqrt_ps(disc);
+		__m256 nb = _mm256_xor_ps(b, sign);
+		__m256 t1 = _mm256_div_ps(_mm256_add_ps(nb, sq), two_a);
+		__m256 t2 = _mm256_div_ps(_mm256_sub_ps(nb, sq), two_a);
+		__m256 t = _mm256_min_ps(t1, t2);
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+		valid = _mm256_and_ps(valid, _mm256_cmp_ps(t, limit, _CMP_LT_OQ));
+
+		int mask = _mm256_movemask_ps(valid);
+		if(first + n - i < 8)
+			mask &= (1 << (first + n - i)) - 1;
+		if(ignore - i < 8)
+			mask &= ~(1 << (ignore - i));
+		if(mask == 0)
+			continue;
+
+		for(int j = 0; j < 8; j++) {
+			if(mask & (1 << j))
+				return i + j;
+		}
+	}
+#elif defined(__SSE__)
+	__m128 ro0 = _mm_set1_ps(ro[0]), ro1 = _mm_set1_ps(ro[1]), ro2 = _mm_set1_ps(ro[2]);
+	__m128 rd0 = _mm_set1_ps(rd[0]), rd1 = _mm_set1_ps(rd[1]), rd2 = _mm_set1_ps(rd[2]);
+	__m128 two = _mm_set1_ps(2.0f);
+	__m128 four_a = _mm_set1_ps(4.0f * a);
+	__m128 two_a = _mm_set1_ps(2.0f * a);
+	__m128 zero = _mm_setzero_ps();
+	__m128 sign = _mm_set1_ps(-0.0f);
+	__m128 limit = _mm_set1_ps(max_t);
+
+	for(unsigned int i = first; i < first + n; i += 4) {
+		__m128 tmp0 = _mm_sub_ps(ro0, _mm_loadu_ps(&arrays.center_x[i]));
+		__m128 tmp1 = _mm_sub_ps(ro1, _mm_loadu_ps(&arrays.center_y[i]));
+		__m128 tmp2 = _mm_sub_ps(ro2, _mm_loadu_ps(&arrays.center_z[i]));
+
+		__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rd0, tmp0), _mm_mul_ps(rd1, tmp1)), _mm_mul_ps(rd2, tmp2));
+		b = _mm_mul_ps(b, two);
+		__m128 c = _mm_add_ps(_mm_add_ps(_mm_mul_ps(tmp0, tmp0), _mm_mul_ps(tmp1, tmp1)), _mm_mul_ps(tmp2, tmp2));
+		c = _mm_sub_ps(c, _mm_loadu_ps(&arrays.radius2[i]));
+
+		__m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(four_a, c));
+		__m128 valid = _mm_cmpge_ps(disc, zero);
+		if(_mm_movemask_ps(valid) == 0)
+			continue;
+
+		__m128 sq = _mm_sqrt_ps(disc);
+		__m128 nb = _mm_xor_ps(b, sign);
+		__m128 t1 = _mm_div_ps(_mm_add_ps(nb, sq), two_a);
+		__m128 t2 = _mm_div_ps(_mm_sub_ps(nb, sq), two_a);
+		__m128 t = _mm_min_ps(t1, t2);
+		valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+		valid = _mm_and_ps(valid, _mm_cmplt_ps(t, limit));
+
+		int mask = _mm_movemask_ps(valid);
+		if(first + n - i < 4)
+			mask &= (1 << (first + n - i)) - 1;
+		if(ignore - i < 4)
+			mask &= ~(1 << (ignore - i));
+		if(mask == 0)
+			continue;
+
+		for(int j = 0; j < 4; j++) {
+			if(mask & (1 << j))
+				return i + j;
+		}
+	}
+#else
+	for(unsigned int i = first; i < first + n; i++) {
+		if(i == ignore)
+			continue;
+
+		float tmp[3] = { ro[0] - arrays.center_x[i], ro[1] - arrays.center_y[i], ro[2] - arrays.center_z[i] };
+		float b = dot_product(rd, tmp) * 2.0f;
+		float c = SQUARE(tmp[0]) + SQUARE(tmp[1]) + SQUARE(tmp[2]) - arrays.radius2[i];
+		float disc = SQUARE(b) - (4.0f*a*c);
+		if(disc < 0.0f)
+			continue;
+
+		float t1 = (-b + sqrtf(disc)) / (2.0f*a);
+		float t2 = (-b - sqrtf(disc)) / (2.0f*a);
+		float t = (t1 < t2) ? t1 : t2;
+		if(t >= 0.0f && t < max_t)
+			return i;
+	}
+#endif
+
+	return NO_HIT;
+}
+
+void
+SphereStore::IntersectRangePacket(RayPacket &packet, unsigned int first, unsigned int n) const
+{
+	const float *ro = packet.origin;
+
+	for(unsigned int s = first; s < first + n; s++) {
+		Vector center(arrays.center_x[s], arrays.center_y[s], arrays.center_z[s]);
+		if(packet.SphereOutsideFrustum(center, sqrtf(arrays.radius2[s])))
+			continue;
+
+		float tmp[3], c;
+		tmp[0] = ro[0] - arrays.center_x[s];
+		tmp[1] = ro[1] - arrays.center_y[s];
+		tmp[2] = ro[2] - arrays.center_z[s];
+		c = SQUARE(tmp[0]) + SQUARE(tmp[1]) + SQUARE(tmp[2]) - arrays.radius2[s];
+
+#ifdef __SSE__
+		__m128 vtmp0 = _mm_set1_ps(tmp[0]);
+		__m128 vtmp1 = _mm_set1_ps(tmp[1]);
+		__m128 vtmp2 = _mm_set1_ps(tmp[2]);
+		__m128 vc = _mm_set1_ps(c);
+		__m128 zero = _mm_setzero_ps();
+		__m128 sign = _mm_set1_ps(-0.0f);
+
+		for(int i = 0; i < packet.size; i += 4) {
+			__m128 rd0 = _mm_loadu_ps(&packet.dir[0][i]);
+			__m128 rd1 = _mm_loadu_ps(&packet.dir[1][i]);
+			__m128 rd2 = _mm_loadu_ps(&packet.dir[2][i]);
+
+			__m128 a = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rd0, rd0), _mm_mul_ps(rd1, rd1)), _mm_mul_ps(rd2, rd2));
+			__m128 b = _mm_add_ps(_mm_add_ps(_mm_mul_ps(rd0, vtmp0), _mm_mul_ps(rd1, vtmp1)), _mm_mul_ps(rd2, vtmp2));
+			b = _mm_mul_ps(b, _mm_set1_ps(2.0f));
+
+			__m128 disc = _mm_sub_ps(_mm_mul_ps(b, b), _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(4.0f), a), vc));
+			__m128 valid = _mm_cmpge_ps(disc, zero);
+			if(_mm_movemask_ps(valid) == 0)
+				continue;
+
+			__m128 sq = _mm_sqrt_ps(disc);
+			__m128 nb = _mm_xor_ps(b, sign);
+			__m128 a2 = _mm_mul_ps(_mm_set1_ps(2.0f), a);
+			__m128 t1 = _mm_div_ps(_mm_add_ps(nb, sq), a2);
+			__m128 t2 = _mm_div_ps(_mm_sub_ps(nb, sq), a2);
+			__m128 t = _mm_min_ps(t1, t2);
+
+			__m128 closest = _mm_loadu_ps(&packet.t[i]);
+			valid = _mm_and_ps(valid, _mm_cmpge_ps(t, zero));
+			valid = _mm_and_ps(valid, _mm_cmplt_ps(t, closest));
+
+			int mask = _mm_movemask_ps(valid);
+			if(mask == 0)
+				continue;
+
+			_mm_storeu_ps(&packet.t[i], _mm_or_ps(_mm_and_ps(valid, t), _mm_andnot_ps(valid, closest)));
+			for(int j = 0; j < 4; j++) {
+				if(mask & (1 << j))
+					packet.primitive[i + j] = s;
+			}
+		}
+#else
+		for(int i = 0; i < packet.size; i++) {
+			float rd[3] = { packet.dir[0][i], packet.dir[1][i], packet.dir[2][i] };
+			float a = SQUARE(rd[0]) + SQUARE(rd[1]) + SQUARE(rd[2]);
+			float b = dot_product(rd, tmp) * 2.0f;
+			float disc = SQUARE(b) - (4.0f*a*c);
+			if(disc < 0.0f)
+				continue;
+
+			float t1 = (-b + sqrtf(disc)) / (2.0f*a);
+			float t2 = (-b - sqrtf(disc)) / (2.0f*a);
+			float t = (t1 < t2) ? t1 : t2;
+			if(t >= 0.0f && t < packet.t[i]) {
+				packet.t[i] = t;
+				packet.primitive[i] = s;
+			}
+		}
+#endif
+	}
+}
+
+unsigned long
+SphereStore::GetMemoryUsage() const
+{
+	unsigned long bytes = 0;
+
+	// attached arrays live in the cache mapping and count as nothing
+	bytes += center_x.capacity() * sizeof(float) * 4;
+	bytes += material_index.capacity() * sizeof(unsigned int);
+	bytes += materials.capacity() * sizeof(Material);
+	bytes += bvh.GetMemoryUsage();
+
+	return bytes;
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __SPHERESTORE_H__
+#define __SPHERESTORE_H__
+
+#include <map>
+#include <vector>
+#include "objects.h"
+#include "bvh.h"
+
+/*
+ * Compact structure-of-arrays store for spheres. Centres, squared radii
+ * and material indices live in separate arrays, ordered so that each BVH
+ * leaf covers a contiguous range, and materials are shared through a
+ * table. Leaves are tested with a SIMD kernel that checks one ray against
+ * eight (AVX) or four (SSE) spheres per instruction.
+ *
+ * Spheres are identified by their index in leaf order, which is only
+ * known after Build().
+ *
+ * Queries read the arrays through pointers, so a store can also be
+ * attached to prebuilt arrays held elsewhere, such as a memory mapped
+ * scene cache, and used without copying them.
+ */
+class SphereStore {
+	public:
+		// the arrays as laid out after Build(): in leaf order, each
+		// padded with SIMD_WIDTH zeroed entries past count
+		struct Arrays {
+			const float *center_x;
+			const float *center_y;
+			const float *center_z;
+			const float *radius2;
+			const unsigned int *material_index;
+			unsigned int count;
+			const Material *materials;
+			unsigned int material_count;
+		};
+
+	protected:
+		// what queries read: the vectors below or attached storage
+		Arrays arrays;
+
+		// storage for spheres added with Add()
+		std::vector <float> center_x;
+		std::vector <float> center_y;
+		std::vector <float> center_z;
+		std::vector <float> radius2;
+		std::vector <unsigned int> material_index;
+		unsigned int count;
+
+		std::vector <Material> materials;
+		BVH bvh;
+
+		struct MaterialLess {
+			bool operator () (const Material &a, const Material &b) const;
+		};
+		std::map <Material, unsigned int, MaterialLess> material_lookup;
+
+		void Pad();
+		void SetArrays();
+
+	public:
+		// the arrays are padded so that kernels may always load a full
+		// SIMD register from the start of a leaf
+		enum { SIMD_WIDTH = 8 };
+
+		// spheres tested per instruction by IntersectRange()
+		static unsigned int GetKernelWidth();
+
+		SphereStore();
+
+		void Clear();
+		void Add(const Vector &center, float radius, const Material &material);
+		// if order is given, (*order)[i] is set to the Add() index of
+		// the sphere that ends up at index i
+		void Build(std::vector <unsigned int> *order = NULL);
+
+		// uses prebuilt arrays and hierarchy in place; the caller keeps
+		// them alive for as long as the store is used
+		void Attach(const Arrays &arrays_arg, const BVH::Node *nodes, unsigned int node_count,
+		            const BVH::BuildStats &stats);
+		inline const Arrays &GetArrays() const { return arrays; }
+
+		inline unsigned int GetCount() const { return count; }
+		inline const BVH &GetBVH() const { return bvh; }
+
+		inline Vector GetCenter(unsigned int i) const { return Vector(arrays.center_x[i], arrays.center_y[i], arrays.center_z[i]); }
+		inline float GetRadius2(unsigned int i) const { return arrays.radius2[i]; }
+		inline const Material &GetMaterial(unsigned int i) const { return arrays.materials[arrays.material_index[i]]; }
+		inline unsigned int GetMaterialCount() const { return arrays.material_count; }
+
+		// lowers closest_t and sets closest to the sphere index if the
+		// ray hits a sphere closer than closest_t
+		void Intersect(const Ray &ray, float &closest_t, unsigned int &closest) const;
+		void IntersectPacket(RayPacket &packet) const;
+
+		// returns the index of a sphere, other than ignore, that the ray
+		// hits before max_t, or NO_HIT if there is none
+		unsigned int Occluded(const Ray &ray, float max_t, unsigned int ignore) const;
+
+		// tests spheres [first, first + n) against the ray
+		void IntersectRange(const Ray &ray, unsigned int first, unsigned int n,
+		                    float &closest_t, unsigned int &closest) const;
+		void IntersectRangePacket(RayPacket &packet, unsigned int first, unsigned int n) const;
+		unsigned int OccludedRange(const Ray &ray, unsigned int first, unsigned int n,
+		                           float max_t, unsigned int ignore) const;
+
+		// bytes used by sphere data, materials and hierarchy
+		unsigned long GetMemoryUsage() const;
+
+	private:
+		SphereStore(const SphereStore &);
+		SphereStore &operator = (const SphereStore &);
+};
+
+#endif /* __SPHERESTORE_H__ */
@@ -0,0 +1,214 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// textparse.cpp - Helpers shared by the text file loaders
+
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include "textparse.h"
+
+const size_t READ_CHUNK = 256 * 1024;
+
+static const double POWERS_OF_TEN[16] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+	1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+};
+
+// decimal floats of the form [-]digits[.digits] are by far the common
+// case and are handled here; anything else (exponents, inf, hex) goes
+// through strtod
+bool
+parse_double(const char *s, double *d)
+{
+	const char *p = s;
+	bool negative = false;
+
+	if(*p == '-' || *p == '+')
+		negative = (*p++ == '-');
+
+	// with at most 15 digits the mantissa is an exact integer in a
+	// double, so one division by an exact power of ten gives the
+	// correctly rounded result
+	double mantissa = 0.0;
+	int digits = 0, fraction_digits = 0;
+	while(*p >= '0' && *p <= '9') {
+		mantissa = mantissa * 10.0 + (double)(*p++ - '0');
+		digits++;
+	}
+	if(*p == '.') {
+		p++;
+		while(*p >= '0' && *p <= '9') {
+			mantissa = mantissa * 10.0 + (double)(*p++ - '0');
+			digits++;
+			fraction_digits++;
+		}
+	}
+
+	if(*p == '\0' && digits > 0 && digits <= 15) {
+		double value = mantissa / POWERS_OF_TEN[fraction_digits];
+		*d = negative ? -value : value;
+		return true;
+	}
+
+	char *end;
+	*d = strtod(s, &end);
+
+	return end != s && *end == '\0';
+}
+
+bool
+parse_float(const char *s, float *f)
+{
+	double d;
+	if(!parse_double(s, &d))
+		return false;
+	*f = (float)d;
+
+	return true;
+}
+
+bool
+parse_floats(char *tokens[], unsigned int count, float *f)
+{
+	for(unsigned int i = 0; i < count; i++) {
+		if(!parse_float(tokens[i], &f[i]))
+			return false;
+	}
+
+	return true;
+}
+
+// a decimal integer in the range of int
+bool
+parse_int(const char *s, int *i)
+{
+	char *end;
+	errno = 0;
+	long value = strtol(s, &end, 10);
+	if(end == s || *end != '\0' || errno == ERANGE || value < INT_MIN || value > INT_MAX)
+		return false;
+	*i = (int)value;
+
+	return true;
+}
+
+/*
+ * LineParser class
+ */
+bool
+LineParser::Fail(const char *message)
+{
+	if(error) {
+		char buf[64];
+		sprintf(buf, "line %u: ", lines);
+		*error = buf;
+		*error += message;
+	}
+
+	return false;
+}
+
+bool
+LineParser::Tokenize(char *line, char *tokens[], unsigned int max_tokens, unsigned int &count)
+{
+	char *p = line;
+
+	count = 0;
+	for(;;) {
+		while(*p != '\0' && is_space(*p))
+			p++;
+		if(*p == '\0' || *p == '#')
+			break;
+		if(count == max_tokens)
+			return Fail("too many fields");
+
+		tokens[count++] = p;
+		while(!is_space(*p) && *p != '#')
+			p++;
+		if(*p == '#') {
+			*p = '\0';
+			break;
+		}
+		if(*p != '\0')
+			*p++ = '\0';
+	}
+
+	return true;
+}
+
+// reads the file in fixed size chunks; a line cut off at the end of a
+// chunk is moved to the front of the buffer and completed by the next
+// read, so lines may be at most READ_CHUNK bytes long
+bool
+LineParser::Load(FILE *fp)
+{
+	std::vector <char> buffer(READ_CHUNK + 1);
+	size_t filled = 0;
+	bool eof = false;
+
+	while(!eof) {
+		size_t n = fread(&buffer[filled], 1, READ_CHUNK - filled, fp);
+		bytes += n;
+		filled += n;
+		if(filled < READ_CHUNK) {
+			if(ferror(fp))
+				return Fail("read error");
+			eof = true;
+		}
+
+		char *start = &buffer[0];
+		char *end = start + filled;
+		for(;;) {
+			char *newline = (char *)memchr(start, '\n', end - start);
+			if(!newline)
+				break;
+
+			*newline = '\0';
+			lines++;
+			if(!ParseLine(start))
+				return false;
+			start = newline + 1;
+		}
+
+		filled = end - start;
+		if(eof) {
+			if(filled > 0) {
+				start[filled] = '\0';
+				lines++;
+				if(!ParseLine(start))
+					return false;
+			}
+		} else {
+			if(filled == READ_CHUNK)
+				return Fail("line too long");
+			memmove(&buffer[0], start, filled);
+		}
+	}
+
+	return true;
+}
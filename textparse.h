@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TEXTPARSE_H__
+#define __TEXTPARSE_H__
+
+#include <cstdio>
+#include <string>
+
+// number parsing shared by the text loaders; the whole string must be
+// consumed
+bool parse_double(const char *s, double *d);
+bool parse_float(const char *s, float *f);
+bool parse_floats(char *tokens[], unsigned int count, float *f);
+bool parse_int(const char *s, int *i);
+
+// any control character counts as whitespace, '\0' included
+static inline bool
+is_space(char c)
+{
+	return (unsigned char)c <= ' ';
+}
+
+/*
+ * Base for line oriented text loaders. Load() streams the file in fixed
+ * size chunks and hands every line, without its newline, to ParseLine(),
+ * which may modify it in place.
+ */
+class LineParser {
+	protected:
+		std::string *error;
+		unsigned long bytes;
+		unsigned int lines;
+
+		// sets the error, prefixed with the current line number, and
+		// returns false
+		bool Fail(const char *message);
+
+		// splits the line into whitespace separated tokens in place,
+		// stopping at a '#' comment
+		bool Tokenize(char *line, char *tokens[], unsigned int max_tokens, unsigned int &count);
+
+		virtual bool ParseLine(char *line) = 0;
+
+	public:
+		LineParser(std::string *error_arg) { error = error_arg; bytes = 0; lines = 0; }
+		virtual ~LineParser() { }
+
+		bool Load(FILE *fp);
+
+		inline unsigned long GetBytes() const { return bytes; }
+		inline unsigned int GetLines() const { return lines; }
+};
+
+#endif /* __TEXTPARSE_H__ */
@@ -0,0 +1,220 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// threadpool.cpp - Work-stealing thread pool
+
+#include <cstdio>
+#include <unistd.h>
+#include "threadpool.h"
+#include "trace.h"
+
+/*
+ * ThreadPool class
+ */
+ThreadPool::ThreadPool(unsigned int num_threads)
+{
+	if(num_threads == 0)
+		num_threads = GetDefaultThreadCount();
+
+	pthread_mutex_init(&lock, NULL);
+	pthread_cond_init(&work_cond, NULL);
+	pthread_cond_init(&done_cond, NULL);
+	generation = 0;
+	pending = 0;
+	quit = false;
+
+	for(unsigned int i = 0; i < num_threads; i++) {
+		Worker *worker = new Worker;
+		worker->pool = this;
+		worker->index = i;
+		pthread_mutex_init(&worker->lock, NULL);
+		workers.push_back(worker);
+	}
+
+	// worker 0 is whichever thread calls Run(), so it gets no thread of its own
+	for(unsigned int i = 1; i < workers.size(); i++)
+		pthread_create(&workers[i]->thread, NULL, WorkerMain, workers[i]);
+}
+
+ThreadPool::~ThreadPool()
+{
+	pthread_mutex_lock(&lock);
+	quit = true;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	for(unsigned int i = 1; i < workers.size(); i++)
+		pthread_join(workers[i]->thread, NULL);
+
+	for(unsigned int i = 0; i < workers.size(); i++) {
+		pthread_mutex_destroy(&workers[i]->lock);
+		delete workers[i];
+	}
+
+	pthread_cond_destroy(&done_cond);
+	pthread_cond_destroy(&work_cond);
+	pthread_mutex_destroy(&lock);
+}
+
+unsigned int
+ThreadPool::GetDefaultThreadCount()
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return (n > 0) ? (unsigned int)n : 1;
+}
+
+void
+ThreadPool::Run(const std::vector <Task *> &tasks)
+{
+	if(tasks.empty())
+		return;
+
+	if(workers.size() == 1) {
+		for(unsigned int i = 0; i < tasks.size(); i++)
+			tasks[i]->Run(0);
+		return;
+	}
+
+	// pending has to be set before any task becomes visible to a worker
+	pthread_mutex_lock(&lock);
+	pending = (unsigned int)tasks.size();
+	pthread_mutex_unlock(&lock);
+
+	// give each worker a contiguous run of tasks so neighbouring tiles
+	// tend to stay on the same core; stealing evens out the rest
+	unsigned int num_workers = (unsigned int)workers.size();
+	for(unsigned int w = 0; w < num_workers; w++) {
+		unsigned int first = (unsigned int)(((size_t)tasks.size() * w) / num_workers);
+		unsigned int last = (unsigned int)(((size_t)tasks.size() * (w + 1)) / num_workers);
+
+		pthread_mutex_lock(&workers[w]->lock);
+		// the owner pops from the back, so push in reverse to run in order
+		for(unsigned int i = last; i > first; i--)
+			workers[w]->tasks.push_back(tasks[i - 1]);
+		pthread_mutex_unlock(&workers[w]->lock);
+	}
+
+	pthread_mutex_lock(&lock);
+	generation++;
+	pthread_cond_broadcast(&work_cond);
+	pthread_mutex_unlock(&lock);
+
+	ProcessTasks(0);
+
+	// the time the caller spends here is time other workers are still
+	// busy after it ran out of tasks to steal
+	TRACE_SCOPE(trace, "wait for workers", "pool");
+	pthread_mutex_lock(&lock);
+	while(pending > 0)
+		pthread_cond_wait(&done_cond, &lock);
+	pthread_mutex_unlock(&lock);
+}
+
+ThreadPool::Task *
+ThreadPool::PopTask(unsigned int index)
+{
+	Worker *worker = workers[index];
+	Task *task = NULL;
+
+	pthread_mutex_lock(&worker->lock);
+	if(!worker->tasks.empty()) {
+		task = worker->tasks.back();
+		worker->tasks.pop_back();
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	return task;
+}
+
+ThreadPool::Task *
+ThreadPool::StealTask(unsigned int index)
+{
+	unsigned int num_workers = (unsigned int)workers.size();
+
+	for(unsigned int i = 1; i < num_workers; i++) {
+		Worker *victim = workers[(index + i) % num_workers];
+		Task *task = NULL;
+
+		pthread_mutex_lock(&victim->lock);
+		if(!victim->tasks.empty()) {
+			task = victim->tasks.front();
+			victim->tasks.pop_front();
+		}
+		pthread_mutex_unlock(&victim->lock);
+
+		if(task)
+			return task;
+	}
+
+	return NULL;
+}
+
+void
+ThreadPool::ProcessTasks(unsigned int index)
+{
+	for(;;) {
+		Task *task = PopTask(index);
+		if(!task)
+			task = StealTask(index);
+		if(!task)
+			break;
+
+		task->Run(index);
+
+		pthread_mutex_lock(&lock);
+		if(--pending == 0)
+			pthread_cond_broadcast(&done_cond);
+		pthread_mutex_unlock(&lock);
+	}
+}
+
+void *
+ThreadPool::WorkerMain(void *arg)
+{
+	Worker *worker = (Worker *)arg;
+	ThreadPool *pool = worker->pool;
+	unsigned int seen = 0;
+
+	char name[32];
+	sprintf(name, "worker %u", worker->index);
+	Trace::SetThreadName(name);
+
+	for(;;) {
+		pthread_mutex_lock(&pool->lock);
+		while(!pool->quit && pool->generation == seen)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		seen = pool->generation;
+		bool quit = pool->quit;
+		pthread_mutex_unlock(&pool->lock);
+
+		if(quit)
+			break;
+
+		pool->ProcessTasks(worker->index);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <deque>
+#include <vector>
+#include <pthread.h>
+
+/*
+ * Persistent pool of worker threads. Each worker owns a deque of tasks;
+ * a worker pops from the back of its own deque and, once that is empty,
+ * steals from the front of the others, so expensive tasks don't leave
+ * the remaining workers idle. The thread calling Run() acts as worker 0.
+ */
+class ThreadPool {
+	public:
+		class Task {
+			public:
+				virtual ~Task() { }
+				virtual void Run(unsigned int thread_index) = 0;
+		};
+
+		ThreadPool(unsigned int num_threads = 0);
+		~ThreadPool();
+
+		// runs all of the given tasks and returns once they have finished
+		void Run(const std::vector <Task *> &tasks);
+
+		inline unsigned int GetThreadCount() const { return (unsigned int)workers.size(); }
+
+		static unsigned int GetDefaultThreadCount();
+
+	protected:
+		struct Worker {
+			ThreadPool *pool;
+			unsigned int index;
+			pthread_t thread;
+			pthread_mutex_t lock;
+			std::deque <Task *> tasks;
+		};
+
+		std::vector <Worker *> workers;
+
+		pthread_mutex_t lock;
+		pthread_cond_t work_cond;
+		pthread_cond_t done_cond;
+		unsigned int generation;
+		unsigned int pending;
+		bool quit;
+
+		Task *PopTask(unsigned int index);
+		Task *StealTask(unsigned int index);
+		void ProcessTasks(unsigned int index);
+
+		static void *WorkerMain(void *arg);
+
+	private:
+		ThreadPool(const ThreadPool &);
+		ThreadPool &operator = (const ThreadPool &);
+};
+
+#endif /* __THREADPOOL_H__ */
@@ -0,0 +1,226 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// trace.cpp - Per-thread timeline tracing
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <pthread.h>
+#include "trace.h"
+
+#define THREAD_NAME_LENGTH 32
+
+bool Trace::enabled = false;
+
+// the events one thread has recorded; only that thread writes to it
+struct ThreadBuffer {
+	unsigned int id;
+	char name[THREAD_NAME_LENGTH];
+	std::vector <Trace::Event> events;
+	// events recorded since Start(); the ring holds the last ones
+	unsigned long count;
+};
+
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static std::vector <ThreadBuffer *> buffers;
+static unsigned int ring_size = Trace::DEFAULT_THREAD_EVENTS;
+static double origin;
+
+static __thread ThreadBuffer *thread_buffer;
+static __thread char thread_name[THREAD_NAME_LENGTH];
+
+static void
+copy_name(char *dest, const char *name)
+{
+	size_t len = strlen(name);
+	if(len >= THREAD_NAME_LENGTH)
+		len = THREAD_NAME_LENGTH - 1;
+
+	memcpy(dest, name, len);
+	dest[len] = '\0';
+}
+
+// buffers are kept for the life of the process, since threads that
+// have finished may still have events to write
+static ThreadBuffer *
+register_thread()
+{
+	ThreadBuffer *buffer = new ThreadBuffer;
+
+	pthread_mutex_lock(&buffers_lock);
+	buffer->id = (unsigned int)buffers.size();
+	if(thread_name[0])
+		copy_name(buffer->name, thread_name);
+	else
+		sprintf(buffer->name, "thread %u", buffer->id);
+	buffer->events.resize(ring_size);
+	buffer->count = 0;
+	buffers.push_back(buffer);
+	pthread_mutex_unlock(&buffers_lock);
+
+	return buffer;
+}
+
+// writes the string as a JSON string literal
+static void
+put_json_string(FILE *fp, const char *s)
+{
+	fputc('"', fp);
+	for(; *s; s++) {
+		if(*s == '"' || *s == '\\')
+			fputc('\\', fp);
+		if((unsigned char)*s >= 0x20)
+			fputc(*s, fp);
+	}
+	fputc('"', fp);
+}
+
+/*
+ * Trace class
+ */
+void
+Trace::Start(unsigned int thread_events)
+{
+	unsigned int size = 1;
+	while(size < thread_events && size < 0x80000000u)
+		size <<= 1;
+
+	pthread_mutex_lock(&buffers_lock);
+	ring_size = size;
+	for(unsigned int i = 0; i < buffers.size(); i++) {
+		buffers[i]->events.resize(ring_size);
+		buffers[i]->count = 0;
+	}
+	pthread_mutex_unlock(&buffers_lock);
+
+	origin = timer_seconds();
+	enabled = true;
+}
+
+void
+Trace::Stop()
+{
+	enabled = false;
+}
+
+void
+Trace::SetThreadName(const char *name)
+{
+	copy_name(thread_name, name);
+	if(thread_buffer)
+		copy_name(thread_buffer->name, name);
+}
+
+unsigned long
+Trace::GetDroppedEvents()
+{
+	unsigned long dropped = 0;
+
+	pthread_mutex_lock(&buffers_lock);
+	for(unsigned int i = 0; i < buffers.size(); i++) {
+		if(buffers[i]->count > buffers[i]->events.size())
+			dropped += buffers[i]->count - buffers[i]->events.size();
+	}
+	pthread_mutex_unlock(&buffers_lock);
+
+	return dropped;
+}
+
+void
+Trace::Record(const Event &event)
+{
+	ThreadBuffer *buffer = thread_buffer;
+	if(!buffer)
+		buffer = thread_buffer = register_thread();
+
+	// the ring size is a power of two
+	buffer->events[buffer->count & (buffer->events.size() - 1)] = event;
+	buffer->count++;
+}
+
+bool
+Trace::Write(const char *filename, std::string *error)
+{
+	FILE *fp = fopen(filename, "w");
+	if(!fp) {
+		if(error)
+			*error = strerror(errno);
+		return false;
+	}
+
+	pthread_mutex_lock(&buffers_lock);
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"raytracer\"}}");
+
+	for(unsigned int i = 0; i < buffers.size(); i++) {
+		const ThreadBuffer *buffer = buffers[i];
+
+		fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", buffer->id);
+		put_json_string(fp, buffer->name);
+		fprintf(fp, "}}");
+		fprintf(fp, ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"sort_index\":%u}}",
+		        buffer->id, buffer->id);
+
+		// oldest first, so that each thread's events are in order
+		unsigned long size = (unsigned long)buffer->events.size();
+		unsigned long first = (buffer->count > size) ? buffer->count - size : 0;
+		for(unsigned long j = first; j < buffer->count; j++) {
+			const Event &event = buffer->events[j & (size - 1)];
+
+			fprintf(fp, ",\n{\"name\":");
+			put_json_string(fp, event.name);
+			fprintf(fp, ",\"cat\":");
+			put_json_string(fp, event.category);
+			fprintf(fp, ",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f", buffer->id,
+			        (event.start - origin) * 1.0e6, (event.end - event.start) * 1.0e6);
+			if(event.arg_names[0]) {
+				fprintf(fp, ",\"args\":{");
+				for(int k = 0; k < MAX_ARGS && event.arg_names[k]; k++) {
+					if(k > 0)
+						fputc(',', fp);
+					put_json_string(fp, event.arg_names[k]);
+					fprintf(fp, ":%d", event.args[k]);
+				}
+				fputc('}', fp);
+			}
+			fputc('}', fp);
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+
+	pthread_mutex_unlock(&buffers_lock);
+
+	bool ok = !ferror(fp);
+	if(fclose(fp) != 0)
+		ok = false;
+	if(!ok && error)
+		*error = "error writing the trace";
+
+	return ok;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <string>
+#include "timer.h"
+
+// building with -DNO_TRACE compiles the trace points out entirely;
+// otherwise a trace point costs one test of a flag while not tracing
+#ifdef NO_TRACE
+#define TRACE_ENABLED 0
+#define TRACE_SCOPE(scope, name, category)
+#define TRACE_ARG(scope, arg_name, value)
+#else
+#define TRACE_ENABLED 1
+#define TRACE_SCOPE(scope, name, category) Trace::Scope scope(name, category)
+#define TRACE_ARG(scope, arg_name, value) scope.SetArg(arg_name, value)
+#endif
+
+/*
+ * Timeline of what each thread was doing, written in the Chrome trace
+ * event format for chrome://tracing or Perfetto. Events are spans of
+ * time recorded by Scope objects while tracing is on. Every thread
+ * records into a ring buffer of its own, without locking; once a ring
+ * is full, its oldest events are overwritten.
+ *
+ * Start(), Stop() and Write() must only be called while no traced work
+ * is running on other threads, such as between frames. Event names,
+ * categories and argument names must be string literals, or otherwise
+ * outlive the trace.
+ */
+class Trace {
+	public:
+		enum { DEFAULT_THREAD_EVENTS = 1 << 16, MAX_ARGS = 2 };
+
+		struct Event {
+			const char *name;
+			const char *category;
+			double start;
+			double end;
+			const char *arg_names[MAX_ARGS];
+			int args[MAX_ARGS];
+		};
+
+		// records the time from its construction to its destruction
+		// as an event, if tracing was on when it was constructed
+		class Scope {
+			protected:
+				Event event;
+				bool active;
+
+			public:
+				inline Scope(const char *name, const char *category)
+				{
+					active = enabled;
+					if(active) {
+						event.name = name;
+						event.category = category;
+						event.arg_names[0] = event.arg_names[1] = NULL;
+						event.start = timer_seconds();
+					}
+				}
+
+				inline ~Scope()
+				{
+					if(active) {
+						event.end = timer_seconds();
+						Record(event);
+					}
+				}
+
+				// arguments past MAX_ARGS are ignored
+				inline void SetArg(const char *arg_name, int value)
+				{
+					if(!active)
+						return;
+					for(int i = 0; i < MAX_ARGS; i++) {
+						if(!event.arg_names[i]) {
+							event.arg_names[i] = arg_name;
+							event.args[i] = value;
+							break;
+						}
+					}
+				}
+		};
+
+		// clears the events recorded so far and starts recording, with
+		// a ring of thread_events (rounded up to a power of two) for
+		// each thread
+		static void Start(unsigned int thread_events = DEFAULT_THREAD_EVENTS);
+		static void Stop();
+		static inline bool IsEnabled() { return enabled; }
+
+		// names the calling thread in the trace; the name is copied
+		static void SetThreadName(const char *name);
+
+		// the events lost to full rings since Start()
+		static unsigned long GetDroppedEvents();
+
+		static bool Write(const char *filename, std::string *error);
+
+	protected:
+		static bool enabled;
+
+		static void Record(const Event &event);
+};
+
+#endif /* __TRACE_H__ */
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// viewer.cpp - Helpers for the interactive window
+
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include "viewer.h"
+
+// keeps the view from flipping over at the poles
+static const float MAX_PITCH = 1.55f;
+
+static const double MIN_FOV = 10.0;
+static const double MAX_FOV = 150.0;
+
+/*
+ * CameraControl class
+ */
+CameraControl::CameraControl(const Camera &camera)
+{
+	position = camera.GetPosition();
+	up = camera.GetDown() * -1.0f;
+	level_right = camera.GetRight();
+	level_forward.Clear();
+	cross_product(up.vec, level_right.vec, level_forward.vec);
+	level_forward.Normalize();
+
+	const Vector &forward = camera.GetForward();
+	float f_up = dot_product(forward.vec, up.vec);
+	if(f_up > 1.0f)
+		f_up = 1.0f;
+	else if(f_up < -1.0f)
+		f_up = -1.0f;
+
+	yaw = 0.0f;
+	pitch = asinf(f_up);
+	fov = camera.GetFov();
+	aspect = camera.GetAspect();
+}
+
+Vector
+CameraControl::GetForward() const
+{
+	Vector level = level_forward * cosf(yaw) + level_right * sinf(yaw);
+
+	return level * cosf(pitch) + up * sinf(pitch);
+}
+
+void
+CameraControl::Move(float ahead, float across, float rise)
+{
+	Vector forward = GetForward();
+	Vector right = level_right * cosf(yaw) - level_forward * sinf(yaw);
+
+	position += forward * ahead + right * across + up * rise;
+}
+
+void
+CameraControl::Turn(float yaw_delta, float pitch_delta)
+{
+	yaw = fmodf(yaw + yaw_delta, 2.0f * (float)M_PI);
+	pitch += pitch_delta;
+	if(pitch > MAX_PITCH)
+		pitch = MAX_PITCH;
+	else if(pitch < -MAX_PITCH)
+		pitch = -MAX_PITCH;
+}
+
+void
+CameraControl::Zoom(double factor)
+{
+	fov *= factor;
+	if(fov < MIN_FOV)
+		fov = MIN_FOV;
+	else if(fov > MAX_FOV)
+		fov = MAX_FOV;
+}
+
+void
+CameraControl::Apply(Camera &camera) const
+{
+	camera.LookAt(position, position + GetForward(), up);
+	camera.SetFov(fov, aspect);
+}
+
+/*
+ * ResolutionScaler class
+ */
+ResolutionScaler::ResolutionScaler(int full_width_arg, int full_height_arg, double target_seconds_arg,
+                                   float min_scale_arg)
+{
+	full_width = full_width_arg;
+	full_height = full_height_arg;
+	target_seconds = target_seconds_arg;
+	min_scale = min_scale_arg;
+	scale = 1.0f;
+	pixel_seconds = 0.0;
+}
+
+void
+ResolutionScaler::FrameDone(double seconds, int width, int height)
+{
+	double pixels = (double)width * height;
+	if(pixels <= 0.0)
+		return;
+
+	// smoothed, so that one slow frame doesn't halve the next
+	double cost = seconds / pixels;
+	pixel_seconds = (pixel_seconds > 0.0) ? 0.5 * (pixel_seconds + cost) : cost;
+	if(pixel_seconds <= 0.0) {
+		scale = 1.0f;
+		return;
+	}
+
+	double fit = sqrt(target_seconds / pixel_seconds / ((double)full_width * full_height));
+	float steps = floorf((float)fit * SCALE_STEPS);
+	scale = steps / SCALE_STEPS;
+	if(scale < min_scale)
+		scale = min_scale;
+	else if(scale > 1.0f)
+		scale = 1.0f;
+}
+
+void
+ResolutionScaler::GetFrameSize(int &width, int &height) const
+{
+	width = (int)(full_width * scale + 0.5f);
+	height = (int)(full_height * scale + 0.5f);
+	if(width < 1)
+		width = 1;
+	if(height < 1)
+		height = 1;
+}
+
+void
+upscale_frame(const unsigned char *src, int srcwidth, int srcheight,
+              unsigned char *dst, int dstwidth, int dstheight)
+{
+	// source coordinates of each destination pixel centre in 16.16
+	// fixed point, clamped to the outer pixel centres
+	const int ONE = 1 << 16;
+	int x_step = (int)((double)srcwidth * ONE / dstwidth);
+	int y_step = (int)((double)srcheight * ONE / dstheight);
+	int x_max = (srcwidth - 1) << 16;
+	int y_max = (srcheight - 1) << 16;
+
+	for(int y = 0; y < dstheight; y++) {
+		int sy = y_step / 2 + y * y_step - ONE / 2;
+		sy = (sy < 0) ? 0 : (sy > y_max) ? y_max : sy;
+		int y0 = sy >> 16;
+		int y1 = (y0 + 1 < srcheight) ? y0 + 1 : y0;
+		int fy = (sy & (ONE - 1)) >> 8;
+
+		const unsigned char *row0 = src + (size_t)y0 * srcwidth * 4;
+		const unsigned char *row1 = src + (size_t)y1 * srcwidth * 4;
+		unsigned char *out = dst + (size_t)y * dstwidth * 4;
+		for(int x = 0; x < dstwidth; x++, out += 4) {
+			int sx = x_step / 2 + x * x_step - ONE / 2;
+			sx = (sx < 0) ? 0 : (sx > x_max) ? x_max : sx;
+			int x0 = sx >> 16;
+			int x1 = (x0 + 1 < srcwidth) ? x0 + 1 : x0;
+			int fx = (sx & (ONE - 1)) >> 8;
+
+			for(int c = 0; c < 4; c++) {
+				int top = row0[x0 * 4 + c] * (256 - fx) + row0[x1 * 4 + c] * fx;
+				int bottom = row1[x0 * 4 + c] * (256 - fx) + row1[x1 * 4 + c] * fx;
+				out[c] = (unsigned char)((top * (256 - fy) + bottom * fy + (1 << 15)) >> 16);
+			}
+		}
+	}
+}
+
+// 3x5 glyphs, one row per entry from the top, the high bit leftmost
+struct Glyph {
+	char c;
+	unsigned char rows[5];
+};
+
+static const Glyph font[] = {
+	{ '0', { 7, 5, 5, 5, 7 } },
+	{ '1', { 2, 6, 2, 2, 7 } },
+	{ '2', { 7, 1, 7, 4, 7 } },
+	{ '3', { 7, 1, 7, 1, 7 } },
+	{ '4', { 5, 5, 7, 1, 1 } },
+	{ '5', { 7, 4, 7, 1, 7 } },
+	{ '6', { 7, 4, 7, 5, 7 } },
+	{ '7', { 7, 1, 1, 1, 1 } },
+	{ '8', { 7, 5, 7, 5, 7 } },
+	{ '9', { 7, 5, 7, 1, 7 } },
+	{ '.', { 0, 0, 0, 0, 2 } },
+	{ '%', { 5, 1, 2, 4, 5 } },
+	{ ':', { 0, 2, 0, 2, 0 } },
+	{ '/', { 1, 1, 2, 4, 4 } },
+	{ 'F', { 7, 4, 6, 4, 4 } },
+	{ 'M', { 5, 7, 7, 5, 5 } },
+	{ 'P', { 6, 5, 6, 4, 4 } },
+	{ 'S', { 3, 4, 2, 1, 6 } },
+	{ 'X', { 5, 5, 2, 5, 5 } }
+};
+
+static const unsigned char *
+find_glyph(char c)
+{
+	c = (char)toupper((unsigned char)c);
+	for(unsigned int i = 0; i < sizeof(font) / sizeof(font[0]); i++) {
+		if(font[i].c == c)
+			return font[i].rows;
+	}
+
+	return NULL;
+}
+
+// fills every byte of the pixels, alpha included, with level
+static void
+fill_rect(unsigned char *framebuf, int framewidth, int frameheight, int x0, int y0, int x1, int y1,
+          unsigned char level)
+{
+	x0 = (x0 < 0) ? 0 : x0;
+	y0 = (y0 < 0) ? 0 : y0;
+	x1 = (x1 > framewidth) ? framewidth : x1;
+	y1 = (y1 > frameheight) ? frameheight : y1;
+	if(x1 <= x0)
+		return;
+
+	for(int y = y0; y < y1; y++)
+		memset(framebuf + ((size_t)y * framewidth + x0) * 4, level, (size_t)(x1 - x0) * 4);
+}
+
+void
+get_text_size(const char *text, int size, int &width, int &height)
+{
+	// each glyph takes 3 columns and a column of spacing, and the box
+	// a border of one column
+	width = ((int)strlen(text) * 4 + 1) * size;
+	height = 7 * size;
+}
+
+void
+draw_text(unsigned char *framebuf, int framewidth, int frameheight, int x, int y, const char *text, int size)
+{
+	int length = (int)strlen(text);
+	int width, height;
+	get_text_size(text, size, width, height);
+	fill_rect(framebuf, framewidth, frameheight, x, y, x + width, y + height, 0);
+
+	for(int i = 0; i < length; i++) {
+		const unsigned char *rows = find_glyph(text[i]);
+		if(!rows)
+			continue;
+
+		int gx = x + (i * 4 + 1) * size;
+		for(int row = 0; row < 5; row++) {
+			for(int col = 0; col < 3; col++) {
+				if(rows[row] & (4 >> col)) {
+					int px = gx + col * size;
+					int py = y + (row + 1) * size;
+					fill_rect(framebuf, framewidth, frameheight, px, py, px + size, py + size, 255);
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,110 @@
+/*
+ * Copyright (C) 2003-2004, 2012 Josh A. Beam
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *   1. Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *   2. Redistributions in binary form must reproduce the above copyright
+ *      notice, this list of conditions and the following disclaimer in the
+ *      documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR
+ * OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef __VIEWER_H__
+#define __VIEWER_H__
+
+#include "camera.h"
+
+/*
+ * First person controls for a camera. Turning is kept as yaw and pitch
+ * about the camera's up direction at the time the control was created,
+ * so repeated small turns don't drift or roll the view.
+ */
+class CameraControl {
+	protected:
+		Vector position;
+		Vector up;
+		// the starting view direction levelled against up, and the
+		// starting right vector
+		Vector level_forward;
+		Vector level_right;
+		float yaw;
+		float pitch;
+		double fov;
+		double aspect;
+
+	public:
+		CameraControl(const Camera &camera);
+
+		// moves along the view direction, to the right and along up
+		void Move(float ahead, float across, float rise);
+
+		// angles in radians; positive yaw turns right, positive pitch
+		// looks up. Pitch stops short of straight up or down.
+		void Turn(float yaw_delta, float pitch_delta);
+
+		// scales the field of view, narrowing it for factors below one
+		void Zoom(double factor);
+
+		Vector GetForward() const;
+		void Apply(Camera &camera) const;
+};
+
+/*
+ * Picks the size of interactive frames so that they take about the
+ * target time: the cost per pixel of each finished frame is tracked,
+ * and the next frame is scaled down from the full size by just enough
+ * to fit. Scales go in steps of 1/SCALE_STEPS so the size doesn't jitter
+ * from frame to frame.
+ */
+class ResolutionScaler {
+	protected:
+		int full_width;
+		int full_height;
+		double target_seconds;
+		float min_scale;
+		float scale;
+		double pixel_seconds;
+
+	public:
+		enum { SCALE_STEPS = 16 };
+
+		ResolutionScaler(int full_width_arg, int full_height_arg, double target_seconds_arg,
+		                 float min_scale_arg = 0.25f);
+
+		// records the time taken to draw a frame of the given size
+		void FrameDone(double seconds, int width, int height);
+
+		// the fraction of the full width and height to draw at next
+		inline float GetScale() const { return scale; }
+		void GetFrameSize(int &width, int &height) const;
+};
+
+// resizes a frame of 32-bit pixels, in any channel layout, with
+// bilinear filtering
+void upscale_frame(const unsigned char *src, int srcwidth, int srcheight,
+                   unsigned char *dst, int dstwidth, int dstheight);
+
+// draws text with its top left corner at (x, y) in a small block font,
+// magnified size times, over a dark box. Covers digits, spaces and
+// . % : / F M P S X; other characters are left blank. Only greys are
+// used, so the frame may be in any channel layout.
+void draw_text(unsigned char *framebuf, int framewidth, int frameheight, int x, int y, const char *text, int size);
+
+// the size of the box draw_text() covers
+void get_text_size(const char *text, int size, int &width, int &height);
+
+#endif /* __VIEWER_H__ */